@@ -0,0 +1,443 @@
+#include "BackgroundLibrary.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#include "BitmapFile.h"
+#include "WindowsHelper.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+namespace
+{
+    size_t GetCacheHeaderSize()
+    {
+        return (sizeof(BackgroundCacheHeader) + cBackgroundCacheAlignment - 1) / cBackgroundCacheAlignment * cBackgroundCacheAlignment;
+    }
+
+    bool HasExtension(const std::string& name, const char* pszExtensions)
+    {
+        const char* pszBegin = pszExtensions;
+        while (*pszBegin)
+        {
+            const char* pszEnd = strchr(pszBegin, ';');
+            const size_t nLength = pszEnd ? size_t(pszEnd - pszBegin) : strlen(pszBegin);
+
+            if (nLength > 0 && name.size() > nLength)
+            {
+                const char* pszSuffix = name.c_str() + name.size() - nLength;
+                bool bMatch = true;
+                for (size_t i = 0; i < nLength && bMatch; ++i)
+                {
+                    bMatch = tolower(static_cast<unsigned char>(pszSuffix[i])) == tolower(static_cast<unsigned char>(pszBegin[i]));
+                }
+
+                if (bMatch)
+                {
+                    return true;
+                }
+            }
+
+            pszBegin += nLength;
+            if (*pszBegin == ';')
+            {
+                ++pszBegin;
+            }
+        }
+
+        return false;
+    }
+
+    HRESULT ListDirectory(const char* pszDirectory, std::vector<std::string>* pNames)
+    {
+#ifdef _WIN32
+        WIN32_FIND_DATAA findData;
+        HANDLE hFind = FindFirstFileA((std::string(pszDirectory) + "\\*").c_str(), &findData);
+        if (hFind == INVALID_HANDLE_VALUE)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        do
+        {
+            if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+            {
+                pNames->push_back(findData.cFileName);
+            }
+        } while (FindNextFileA(hFind, &findData));
+
+        FindClose(hFind);
+#else
+        DIR* pDirectory = opendir(pszDirectory);
+        if (!pDirectory)
+        {
+            return E_ACCESSDENIED;
+        }
+
+        while (dirent* pEntry = readdir(pDirectory))
+        {
+            if (pEntry->d_name[0] != '.')
+            {
+                pNames->push_back(pEntry->d_name);
+            }
+        }
+
+        closedir(pDirectory);
+#endif
+        return S_OK;
+    }
+
+    HRESULT GetSourceInfo(const char* pszPath, uint64_t* pSize, int64_t* pTime)
+    {
+#ifdef _WIN32
+        struct _stat64 info;
+        if (_stat64(pszPath, &info) != 0)
+#else
+        struct stat info;
+        if (stat(pszPath, &info) != 0)
+#endif
+        {
+            return E_FAIL;
+        }
+
+        *pSize = static_cast<uint64_t>(info.st_size);
+        *pTime = static_cast<int64_t>(info.st_mtime);
+        return S_OK;
+    }
+
+    // Reads a byte of every page so the frame thread never takes a page fault
+    // on a background it switches to
+    void PrefaultPages(const BYTE* pData, size_t nSize)
+    {
+        const size_t cPageSize = 4096;
+        volatile BYTE nSink = 0;
+        for (size_t i = 0; i < nSize; i += cPageSize)
+        {
+            nSink = nSink + pData[i];
+        }
+    }
+}
+
+BackgroundLibrary::BackgroundLibrary() :
+    m_nWidth(0),
+    m_nHeight(0),
+    m_nSelected(0),
+    m_bStop(false),
+    m_stats(),
+    m_pSelectedPixels(nullptr)
+{
+}
+
+BackgroundLibrary::~BackgroundLibrary()
+{
+    Close();
+}
+
+HRESULT BackgroundLibrary::Open(
+    const char* pszDirectory,
+    int nWidth,
+    int nHeight,
+    const char* pszExtensions,
+    const BackgroundDecoder& decoder)
+{
+    V_CHECK_HR(pszDirectory && pszExtensions && nWidth > 0 && nHeight > 0);
+
+    Close();
+
+    std::vector<std::string> names;
+    V_RET(ListDirectory(pszDirectory, &names));
+
+    names.erase(
+        std::remove_if(names.begin(), names.end(), [pszExtensions](const std::string& name) { return !HasExtension(name, pszExtensions); }),
+        names.end());
+    if (names.empty())
+    {
+        return E_FAIL;
+    }
+
+    std::sort(names.begin(), names.end());
+
+    for (const std::string& name : names)
+    {
+        std::unique_ptr<Entry> pEntry = std::make_unique<Entry>();
+        pEntry->name = name;
+        pEntry->path = std::string(pszDirectory) + "/" + name;
+        pEntry->cachePath = GetCachePath(pEntry->path, nWidth, nHeight);
+        pEntry->state = EntryState_Pending;
+        pEntry->hr = S_OK;
+        pEntry->pPixels = nullptr;
+        m_entries.push_back(std::move(pEntry));
+    }
+
+    m_nWidth = nWidth;
+    m_nHeight = nHeight;
+    m_decoder = decoder ? decoder : BackgroundDecoder(LoadBackgroundImage);
+    m_nSelected = 0;
+    m_bStop = false;
+    m_stats = LoadStats();
+    m_thread = std::thread(&BackgroundLibrary::LoaderMain, this);
+
+    return S_OK;
+}
+
+void BackgroundLibrary::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_bStop = true;
+    }
+    m_wake.notify_one();
+
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+
+    m_pSelectedPixels.store(nullptr, std::memory_order_release);
+    m_entries.clear();
+}
+
+void BackgroundLibrary::Select(int nIndex)
+{
+    if (nIndex < 0 || nIndex >= GetCount())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_nSelected = nIndex;
+
+        const Entry& entry = *m_entries[nIndex];
+        if (entry.state == EntryState_Ready)
+        {
+            m_pSelectedPixels.store(entry.pPixels, std::memory_order_release);
+        }
+    }
+
+    // a pending background jumps the queue
+    m_wake.notify_one();
+}
+
+int BackgroundLibrary::GetSelectedIndex() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_nSelected;
+}
+
+HRESULT BackgroundLibrary::WaitForBackground(int nIndex, const RGBQUAD** ppPixels)
+{
+    V_CHECK_HR(ppPixels && nIndex >= 0 && nIndex < GetCount());
+
+    std::unique_lock<std::mutex> lock(m_lock);
+    const Entry& entry = *m_entries[nIndex];
+    m_loaded.wait(lock, [this, &entry] { return entry.state == EntryState_Ready || entry.state == EntryState_Failed || m_bStop; });
+
+    if (entry.state != EntryState_Ready)
+    {
+        return FAILED(entry.hr) ? entry.hr : E_FAIL;
+    }
+
+    *ppPixels = entry.pPixels;
+    return S_OK;
+}
+
+BackgroundLibrary::LoadStats BackgroundLibrary::GetLoadStats() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stats;
+}
+
+std::string BackgroundLibrary::GetCachePath(const std::string& imagePath, int nWidth, int nHeight)
+{
+    char szSuffix[64];
+    snprintf(szSuffix, sizeof(szSuffix), ".%dx%d.bgcache", nWidth, nHeight);
+    return imagePath + szSuffix;
+}
+
+void BackgroundLibrary::LoaderMain()
+{
+    for (;;)
+    {
+        Entry* pEntry = nullptr;
+        int nIndex = -1;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            for (;;)
+            {
+                if (m_bStop)
+                {
+                    return;
+                }
+
+                // the selected background first, then the rest in order
+                if (m_entries[m_nSelected]->state == EntryState_Pending)
+                {
+                    nIndex = m_nSelected;
+                }
+                else
+                {
+                    for (int i = 0; i < GetCount() && nIndex < 0; ++i)
+                    {
+                        if (m_entries[i]->state == EntryState_Pending)
+                        {
+                            nIndex = i;
+                        }
+                    }
+                }
+
+                if (nIndex >= 0)
+                {
+                    break;
+                }
+
+                m_wake.wait(lock);
+            }
+
+            pEntry = m_entries[nIndex].get();
+            pEntry->state = EntryState_Loading;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        bool bCold = false;
+        const HRESULT hr = LoadEntry(pEntry, &bCold);
+        const double fMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            pEntry->hr = hr;
+            if (SUCCEEDED(hr))
+            {
+                pEntry->state = EntryState_Ready;
+                if (bCold)
+                {
+                    ++m_stats.nColdLoads;
+                    m_stats.fColdMilliseconds += fMilliseconds;
+                }
+                else
+                {
+                    ++m_stats.nWarmLoads;
+                    m_stats.fWarmMilliseconds += fMilliseconds;
+                }
+
+                if (nIndex == m_nSelected)
+                {
+                    m_pSelectedPixels.store(pEntry->pPixels, std::memory_order_release);
+                }
+            }
+            else
+            {
+                pEntry->state = EntryState_Failed;
+                ++m_stats.nFailed;
+            }
+        }
+        m_loaded.notify_all();
+    }
+}
+
+HRESULT BackgroundLibrary::LoadEntry(Entry* pEntry, bool* pbCold)
+{
+    uint64_t nSourceSize = 0;
+    int64_t nSourceTime = 0;
+    V_RET(GetSourceInfo(pEntry->path.c_str(), &nSourceSize, &nSourceTime));
+
+    *pbCold = false;
+    if (SUCCEEDED(MapCache(pEntry, nSourceSize, nSourceTime)))
+    {
+        return S_OK;
+    }
+
+    *pbCold = true;
+    pEntry->pDecoded = std::make_unique<RGBQUAD[]>(size_t(m_nWidth) * m_nHeight);
+    V_RET(m_decoder(pEntry->path.c_str(), m_nWidth, m_nHeight, pEntry->pDecoded.get()));
+
+    // when the cache cannot be written, e.g. a read only directory, the
+    // decoded pixels stay on the heap and the next run decodes again
+    if (SUCCEEDED(WriteCache(*pEntry, nSourceSize, nSourceTime)) &&
+        SUCCEEDED(MapCache(pEntry, nSourceSize, nSourceTime)))
+    {
+        pEntry->pDecoded.reset();
+        return S_OK;
+    }
+
+    pEntry->pPixels = pEntry->pDecoded.get();
+    return S_OK;
+}
+
+HRESULT BackgroundLibrary::MapCache(Entry* pEntry, uint64_t nSourceSize, int64_t nSourceTime)
+{
+    MappedFile& cache = pEntry->cache;
+    V_RET(cache.Open(pEntry->cachePath.c_str()));
+
+    const size_t nHeaderSize = GetCacheHeaderSize();
+    const uint64_t nPixelBytes = uint64_t(m_nWidth) * m_nHeight * sizeof(RGBQUAD);
+    if (cache.GetSize() != nHeaderSize + nPixelBytes)
+    {
+        cache.Close();
+        return E_FAIL;
+    }
+
+    BackgroundCacheHeader header;
+    memcpy(&header, cache.GetData(), sizeof(header));
+    if (header.nMagic != cBackgroundCacheMagic || header.nVersion != cBackgroundCacheVersion ||
+        header.nWidth != m_nWidth || header.nHeight != m_nHeight ||
+        header.nSourceSize != nSourceSize || header.nSourceTime != nSourceTime)
+    {
+        cache.Close();
+        return E_FAIL;
+    }
+
+    PrefaultPages(cache.GetData() + nHeaderSize, static_cast<size_t>(nPixelBytes));
+
+    pEntry->pPixels = reinterpret_cast<const RGBQUAD*>(cache.GetData() + nHeaderSize);
+    return S_OK;
+}
+
+HRESULT BackgroundLibrary::WriteCache(const Entry& entry, uint64_t nSourceSize, int64_t nSourceTime)
+{
+    std::vector<BYTE> headerBytes(GetCacheHeaderSize(), 0);
+    BackgroundCacheHeader header = {};
+    header.nMagic = cBackgroundCacheMagic;
+    header.nVersion = cBackgroundCacheVersion;
+    header.nWidth = m_nWidth;
+    header.nHeight = m_nHeight;
+    header.nSourceSize = nSourceSize;
+    header.nSourceTime = nSourceTime;
+    memcpy(headerBytes.data(), &header, sizeof(header));
+
+    // written next to the cache and renamed over it, so another run never
+    // maps a half written file
+    const std::string tempPath = entry.cachePath + ".tmp";
+    FILE* pFile = fopen(tempPath.c_str(), "wb");
+    if (!pFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    const size_t nPixelBytes = size_t(m_nWidth) * m_nHeight * sizeof(RGBQUAD);
+    bool bWritten = fwrite(headerBytes.data(), 1, headerBytes.size(), pFile) == headerBytes.size();
+    bWritten = bWritten && fwrite(entry.pDecoded.get(), 1, nPixelBytes, pFile) == nPixelBytes;
+    const bool bClosed = fclose(pFile) == 0;
+
+    if (!bWritten || !bClosed)
+    {
+        remove(tempPath.c_str());
+        return E_FAIL;
+    }
+
+#ifdef _WIN32
+    // rename does not replace an existing file here
+    remove(entry.cachePath.c_str());
+#endif
+    if (rename(tempPath.c_str(), entry.cachePath.c_str()) != 0)
+    {
+        remove(tempPath.c_str());
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
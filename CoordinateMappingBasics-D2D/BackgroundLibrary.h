@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "KinectTypes.h"
+#include "MappedFile.h"
+
+// Backgrounds taken from the images in a directory. Each image is decoded and
+// scaled once into a raw cache file next to it, which later runs map without
+// decoding anything:
+//
+//   BackgroundCacheHeader (padded to cBackgroundCacheAlignment)
+//   nWidth * nHeight BGRA pixels, top down
+//
+// The header remembers the size and modification time of the image, so an
+// edited image is cached again.
+
+const UINT cBackgroundCacheMagic = 0x48434742;      // 'BGCH'
+const UINT cBackgroundCacheVersion = 1;
+const UINT cBackgroundCacheAlignment = 64;
+
+struct BackgroundCacheHeader
+{
+    UINT nMagic;
+    UINT nVersion;
+    int nWidth;
+    int nHeight;
+    uint64_t nSourceSize;
+    int64_t nSourceTime;
+};
+
+// Decodes the image at pszPath scaled to nWidth x nHeight, like LoadBackgroundImage
+typedef std::function<HRESULT(const char* pszPath, int nWidth, int nHeight, RGBQUAD* pPixels)> BackgroundDecoder;
+
+// A loader thread brings every background into memory, the selected one
+// first, so switching between frames never waits for a decode or a disk read.
+// The frame thread only reads GetSelectedPixels.
+class BackgroundLibrary
+{
+public:
+    struct LoadStats
+    {
+        // backgrounds decoded into a new cache file, and mapped from an existing one
+        int nColdLoads;
+        int nWarmLoads;
+        double fColdMilliseconds;
+        double fWarmMilliseconds;
+        int nFailed;
+    };
+
+    BackgroundLibrary();
+    // stops the loader and unmaps every background
+    ~BackgroundLibrary();
+
+    BackgroundLibrary(const BackgroundLibrary&) = delete;
+    BackgroundLibrary& operator=(const BackgroundLibrary&) = delete;
+
+    // Lists the images in pszDirectory whose extension is in pszExtensions
+    // (";" separated, e.g. ".bmp;.png") and starts loading them at nWidth x
+    // nHeight. Fails when there are none.
+    HRESULT Open(
+        const char* pszDirectory,
+        int nWidth,
+        int nHeight,
+        const char* pszExtensions = ".bmp",
+        const BackgroundDecoder& decoder = BackgroundDecoder());
+
+    void Close();
+
+    int GetCount() const { return static_cast<int>(m_entries.size()); }
+    int GetWidth() const { return m_nWidth; }
+    int GetHeight() const { return m_nHeight; }
+
+    // file name of background nIndex, without the directory
+    const std::string& GetName(int nIndex) const { return m_entries[nIndex]->name; }
+
+    // Shows background nIndex as soon as it is loaded, until then the
+    // previous selection stays
+    void Select(int nIndex);
+    int GetSelectedIndex() const;
+
+    // pixels of the last selected background that is loaded, null before the
+    // first one is; they stay valid until Close
+    const RGBQUAD* GetSelectedPixels() const { return m_pSelectedPixels.load(std::memory_order_acquire); }
+
+    // Blocks until background nIndex is loaded or has failed
+    HRESULT WaitForBackground(int nIndex, const RGBQUAD** ppPixels);
+
+    LoadStats GetLoadStats() const;
+
+    // where the pixels of the image at imagePath are cached at nWidth x nHeight
+    static std::string GetCachePath(const std::string& imagePath, int nWidth, int nHeight);
+
+private:
+    enum EntryState
+    {
+        EntryState_Pending = 0,
+        EntryState_Loading,
+        EntryState_Ready,
+        EntryState_Failed,
+    };
+
+    struct Entry
+    {
+        std::string name;
+        std::string path;
+        std::string cachePath;
+        EntryState state;
+        HRESULT hr;
+        MappedFile cache;
+        // only when the cache could not be written
+        std::unique_ptr<RGBQUAD[]> pDecoded;
+        const RGBQUAD* pPixels;
+    };
+
+    int m_nWidth;
+    int m_nHeight;
+    BackgroundDecoder m_decoder;
+    std::vector<std::unique_ptr<Entry>> m_entries;
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_loaded;
+    int m_nSelected;
+    bool m_bStop;
+    std::thread m_thread;
+    LoadStats m_stats;
+
+    std::atomic<const RGBQUAD*> m_pSelectedPixels;
+
+    void LoaderMain();
+
+    // maps the entry's cache file, decoding the image into it first when it
+    // is missing or stale; *pbCold says which happened
+    HRESULT LoadEntry(Entry* pEntry, bool* pbCold);
+    HRESULT MapCache(Entry* pEntry, uint64_t nSourceSize, int64_t nSourceTime);
+    HRESULT WriteCache(const Entry& entry, uint64_t nSourceSize, int64_t nSourceTime);
+};
@@ -0,0 +1,478 @@
+// Composites recorded captures offline, as fast as the machine allows, and
+// optionally saves every composited frame as an image sequence.
+//
+//   CoordinateMappingBatch -calibration file [-background file.bmp]
+//                          [-output directory] [-format bmp|qoi|png]
+//                          [-threads N] [-roi] [-depthres WxH] [-lowmem]
+//                          [-depthkey NEAR-FAR] [-matte none|feather|clean]
+//                          [-list file] capture...
+//
+// The frames of all captures form one queue, taken in order by a lane per
+// pool thread. Each lane owns a mapper, a compositor and an output buffer, so
+// a lane runs a whole frame (map, composite, encode, write) without sharing
+// anything, and a short capture never leaves threads idle while a longer one
+// still has frames. Images are named <output>/<capture name>-<frame>.<ext>.
+//
+// Reports the wall time and frames per second of every capture, measured from
+// its first frame starting to its last one finishing, and of the whole batch,
+// then the process's peak resident memory (-lowmem composites full frames in
+// row blocks to lower it).
+//
+// -depthkey takes the players from the depth range NEAR-FAR (mm) instead of
+// the captured body index frames. Lanes take frames out of order, so there
+// is no background model to learn as the app does. -matte composites the
+// players with soft edges refined from their mask.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BitmapFile.h"
+#include "CaptureFile.h"
+#include "FrameCompositor.h"
+#include "ImageEncoder.h"
+#include "SoftwareCoordinateMapper.h"
+#include "ThreadPool.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    struct BatchOptions
+    {
+        std::string calibrationPath;
+        std::string backgroundPath;
+        std::string outputDirectory;
+        ImageFormat format;
+        int nThreadCount;
+        CompositeMode compositeMode;
+        int nOutputWidth;
+        int nOutputHeight;
+        bool bLowMemory;
+        bool bDepthKey;
+        int nDepthKeyNear;
+        int nDepthKeyFar;
+        MatteRefinement matteRefinement;
+        std::vector<std::string> capturePaths;
+    };
+
+    struct CaptureJob
+    {
+        std::string path;
+        // file name without directory and extension, names the images
+        std::string name;
+        CaptureReader reader;
+        ColorFormat colorFormat;
+
+        // queue position of the first frame
+        uint64_t nFirstFrame;
+
+        // nanoseconds since the batch started
+        std::atomic<int64_t> nStartTime;
+        std::atomic<int64_t> nEndTime;
+        std::atomic<UINT> nFailedFrames;
+    };
+
+    // Everything one thread needs to run a frame on its own
+    struct Lane
+    {
+        SoftwareCoordinateMapper mapper;
+        // no workers, the compositor runs on the lane's thread
+        ThreadPool threadPool;
+        FrameCompositor compositor;
+        std::unique_ptr<RGBQUAD[]> pOutput;
+        std::vector<BYTE> encoded;
+
+        Lane() : threadPool(1) {}
+    };
+
+    bool ReadCaptureList(const char* pszPath, std::vector<std::string>* pPaths)
+    {
+        FILE* pFile = fopen(pszPath, "r");
+        if (!pFile)
+        {
+            return false;
+        }
+
+        // one path per line, blank lines and # comments skipped
+        char szLine[4096];
+        while (fgets(szLine, sizeof(szLine), pFile))
+        {
+            size_t nLength = strcspn(szLine, "\r\n");
+            szLine[nLength] = '\0';
+
+            if (nLength > 0 && szLine[0] != '#')
+            {
+                pPaths->push_back(szLine);
+            }
+        }
+
+        fclose(pFile);
+        return true;
+    }
+
+    bool ParseCommandLine(int argc, char** argv, BatchOptions* pOptions)
+    {
+        pOptions->format = ImageFormat_Bmp;
+        pOptions->nThreadCount = 0;
+        pOptions->compositeMode = CompositeMode_Full;
+        pOptions->nOutputWidth = 0;
+        pOptions->nOutputHeight = 0;
+        pOptions->bLowMemory = false;
+        pOptions->bDepthKey = false;
+        pOptions->nDepthKeyNear = 0;
+        pOptions->nDepthKeyFar = 0;
+        pOptions->matteRefinement = MatteRefinement_None;
+
+        bool bValid = true;
+        for (int i = 1; i < argc && bValid; ++i)
+        {
+            const bool bHasValue = (i + 1 < argc);
+
+            if (strcmp(argv[i], "-calibration") == 0 && bHasValue)
+            {
+                pOptions->calibrationPath = argv[++i];
+            }
+            else if (strcmp(argv[i], "-background") == 0 && bHasValue)
+            {
+                pOptions->backgroundPath = argv[++i];
+            }
+            else if (strcmp(argv[i], "-output") == 0 && bHasValue)
+            {
+                pOptions->outputDirectory = argv[++i];
+            }
+            else if (strcmp(argv[i], "-format") == 0 && bHasValue)
+            {
+                bValid = ParseImageFormat(argv[++i], &pOptions->format);
+            }
+            else if (strcmp(argv[i], "-threads") == 0 && bHasValue)
+            {
+                pOptions->nThreadCount = std::max(0, atoi(argv[++i]));
+            }
+            else if (strcmp(argv[i], "-roi") == 0)
+            {
+                pOptions->compositeMode = CompositeMode_PlayerRegions;
+            }
+            else if (strcmp(argv[i], "-depthres") == 0 && bHasValue)
+            {
+                pOptions->compositeMode = CompositeMode_DepthResolution;
+                bValid = sscanf(argv[++i], "%dx%d", &pOptions->nOutputWidth, &pOptions->nOutputHeight) == 2 &&
+                    pOptions->nOutputWidth > 0 && pOptions->nOutputHeight > 0;
+            }
+            else if (strcmp(argv[i], "-lowmem") == 0)
+            {
+                pOptions->bLowMemory = true;
+            }
+            else if (strcmp(argv[i], "-depthkey") == 0 && bHasValue)
+            {
+                pOptions->bDepthKey = true;
+                bValid = sscanf(argv[++i], "%d-%d", &pOptions->nDepthKeyNear, &pOptions->nDepthKeyFar) == 2 &&
+                    pOptions->nDepthKeyNear > 0 && pOptions->nDepthKeyNear <= pOptions->nDepthKeyFar && pOptions->nDepthKeyFar <= 0xffff;
+            }
+            else if (strcmp(argv[i], "-matte") == 0 && bHasValue)
+            {
+                bValid = ParseMatteRefinement(argv[++i], &pOptions->matteRefinement);
+            }
+            else if (strcmp(argv[i], "-list") == 0 && bHasValue)
+            {
+                bValid = ReadCaptureList(argv[++i], &pOptions->capturePaths);
+            }
+            else if (argv[i][0] != '-')
+            {
+                pOptions->capturePaths.push_back(argv[i]);
+            }
+            else
+            {
+                bValid = false;
+            }
+        }
+
+        if (!bValid || pOptions->calibrationPath.empty() || pOptions->capturePaths.empty())
+        {
+            fprintf(stderr,
+                "usage: %s -calibration file [-background file.bmp] [-output directory] [-format bmp|qoi|png]\n"
+                "       [-threads N] [-roi] [-depthres WxH] [-lowmem] [-depthkey NEAR-FAR] [-matte none|feather|clean]\n"
+                "       [-list file] capture...\n",
+                argv[0]);
+            return false;
+        }
+
+        return true;
+    }
+
+    std::string GetCaptureName(const std::string& path)
+    {
+        const size_t nSlash = path.find_last_of("/\\");
+        std::string name = (nSlash == std::string::npos) ? path : path.substr(nSlash + 1);
+
+        const size_t nDot = name.find_last_of('.');
+        if (nDot != std::string::npos && nDot > 0)
+        {
+            name.resize(nDot);
+        }
+
+        return name;
+    }
+
+    HRESULT WriteImageFile(const char* pszPath, const std::vector<BYTE>& data)
+    {
+        FILE* pFile = fopen(pszPath, "wb");
+        if (!pFile)
+        {
+            return E_ACCESSDENIED;
+        }
+
+        const bool bWritten = fwrite(data.data(), 1, data.size(), pFile) == data.size();
+        const bool bClosed = fclose(pFile) == 0;
+
+        return (bWritten && bClosed) ? S_OK : E_FAIL;
+    }
+
+    // most memory the process ever had resident, 0 where we cannot tell
+    uint64_t GetPeakResidentBytes()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters = {};
+        return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+        rusage usage = {};
+        return (getrusage(RUSAGE_SELF, &usage) == 0) ? uint64_t(usage.ru_maxrss) * 1024 : 0;
+#endif
+    }
+
+    void AtomicMin(std::atomic<int64_t>* pValue, int64_t nValue)
+    {
+        int64_t nCurrent = pValue->load();
+        while (nValue < nCurrent && !pValue->compare_exchange_weak(nCurrent, nValue))
+        {
+        }
+    }
+
+    void AtomicMax(std::atomic<int64_t>* pValue, int64_t nValue)
+    {
+        int64_t nCurrent = pValue->load();
+        while (nValue > nCurrent && !pValue->compare_exchange_weak(nCurrent, nValue))
+        {
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BatchOptions options;
+    if (!ParseCommandLine(argc, argv, &options))
+    {
+        return 1;
+    }
+
+    SensorCalibration calibration;
+    if (FAILED(LoadSensorCalibration(options.calibrationPath.c_str(), &calibration)))
+    {
+        fprintf(stderr, "cannot load calibration %s\n", options.calibrationPath.c_str());
+        return 1;
+    }
+
+    // Every capture must share the first one's geometry, the lanes are sized once
+    std::vector<std::unique_ptr<CaptureJob>> jobs;
+    uint64_t nTotalFrames = 0;
+
+    for (const std::string& path : options.capturePaths)
+    {
+        std::unique_ptr<CaptureJob> pJob = std::make_unique<CaptureJob>();
+        pJob->path = path;
+        pJob->name = GetCaptureName(path);
+
+        if (FAILED(pJob->reader.Open(path.c_str())))
+        {
+            fprintf(stderr, "cannot open capture %s\n", path.c_str());
+            return 1;
+        }
+
+        const CaptureFileHeader& header = pJob->reader.GetHeader();
+        if (header.nColorFormat != CaptureColorFormat_Bgra && header.nColorFormat != CaptureColorFormat_Yuy2)
+        {
+            fprintf(stderr, "unknown color format in %s\n", path.c_str());
+            return 1;
+        }
+
+        if (!jobs.empty())
+        {
+            const CaptureFileHeader& first = jobs[0]->reader.GetHeader();
+            if (header.nDepthWidth != first.nDepthWidth || header.nDepthHeight != first.nDepthHeight ||
+                header.nColorWidth != first.nColorWidth || header.nColorHeight != first.nColorHeight)
+            {
+                fprintf(stderr, "%s does not match the frame sizes of %s\n", path.c_str(), jobs[0]->path.c_str());
+                return 1;
+            }
+        }
+
+        pJob->colorFormat = (header.nColorFormat == CaptureColorFormat_Yuy2) ? ColorFormat_Yuy2 : ColorFormat_Bgra;
+        pJob->nFirstFrame = nTotalFrames;
+        pJob->nStartTime = INT64_MAX;
+        pJob->nEndTime = 0;
+        pJob->nFailedFrames = 0;
+
+        nTotalFrames += header.nFrameCount;
+        jobs.push_back(std::move(pJob));
+    }
+
+    const CaptureFileHeader& geometry = jobs[0]->reader.GetHeader();
+    const int nOutputWidth = options.nOutputWidth ? options.nOutputWidth : geometry.nColorWidth;
+    const int nOutputHeight = options.nOutputHeight ? options.nOutputHeight : geometry.nColorHeight;
+    const size_t nOutputPixels = size_t(nOutputWidth) * nOutputHeight;
+
+    // green like the app when no background is given or it cannot be loaded
+    std::unique_ptr<RGBQUAD[]> pBackground(new RGBQUAD[nOutputPixels]);
+    if (options.backgroundPath.empty() ||
+        FAILED(LoadBackgroundImage(options.backgroundPath.c_str(), nOutputWidth, nOutputHeight, pBackground.get())))
+    {
+        if (!options.backgroundPath.empty())
+        {
+            fprintf(stderr, "cannot load background %s, using green\n", options.backgroundPath.c_str());
+        }
+
+        const RGBQUAD green = {0, 255, 0, 0};
+        std::fill(pBackground.get(), pBackground.get() + nOutputPixels, green);
+    }
+
+    ThreadPool threadPool(options.nThreadCount);
+    const int nLaneCount = threadPool.GetThreadCount();
+
+    std::vector<std::unique_ptr<Lane>> lanes;
+    for (int i = 0; i < nLaneCount; ++i)
+    {
+        // the calibration may be of another mode of the same sensor, it is
+        // scaled to the captures' frame sizes
+        std::unique_ptr<Lane> pLane = std::make_unique<Lane>();
+        if (FAILED(pLane->mapper.Initialize(calibration)) ||
+            FAILED(pLane->mapper.SetFrameGeometry(geometry.nDepthWidth, geometry.nDepthHeight, geometry.nColorWidth, geometry.nColorHeight)) ||
+            FAILED(pLane->compositor.Initialize(&pLane->mapper, &pLane->threadPool,
+                geometry.nDepthWidth, geometry.nDepthHeight, geometry.nColorWidth, geometry.nColorHeight)) ||
+            FAILED(pLane->compositor.SetOutputSize(nOutputWidth, nOutputHeight)))
+        {
+            fprintf(stderr, "calibration does not fit the captures\n");
+            return 1;
+        }
+
+        pLane->compositor.SetCompositeMode(options.compositeMode);
+        pLane->compositor.SetLowMemory(options.bLowMemory);
+        pLane->compositor.SetMatteRefinement(options.matteRefinement);
+        if (options.bDepthKey)
+        {
+            pLane->compositor.SetSegmentationMode(SegmentationMode_DepthRange);
+            pLane->compositor.GetDepthKeyer().SetDepthRange(
+                static_cast<UINT16>(options.nDepthKeyNear),
+                static_cast<UINT16>(options.nDepthKeyFar));
+        }
+        pLane->pOutput.reset(new RGBQUAD[nOutputPixels]);
+        lanes.push_back(std::move(pLane));
+    }
+
+    printf("%llu frames from %d captures on %d threads\n",
+        static_cast<unsigned long long>(nTotalFrames),
+        static_cast<int>(jobs.size()),
+        nLaneCount);
+
+    const auto batchStart = std::chrono::steady_clock::now();
+    const auto getTime = [&batchStart]()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - batchStart).count();
+    };
+
+    std::atomic<uint64_t> nNextFrame(0);
+    threadPool.ParallelFor(nLaneCount, [&](int nLane)
+    {
+        Lane& lane = *lanes[nLane];
+
+        for (;;)
+        {
+            const uint64_t nFrame = nNextFrame++;
+            if (nFrame >= nTotalFrames)
+            {
+                break;
+            }
+
+            // the last capture starting at or before nFrame
+            auto jobIt = std::upper_bound(jobs.begin(), jobs.end(), nFrame,
+                [](uint64_t nValue, const std::unique_ptr<CaptureJob>& pJob) { return nValue < pJob->nFirstFrame; });
+            CaptureJob& job = **(jobIt - 1);
+            const UINT nCaptureFrame = static_cast<UINT>(nFrame - job.nFirstFrame);
+
+            AtomicMin(&job.nStartTime, getTime());
+
+            CaptureFrame frame;
+            HRESULT hr = job.reader.GetFrame(nCaptureFrame, &frame);
+            if (SUCCEEDED(hr))
+            {
+                hr = lane.compositor.ProcessFrame(
+                    frame.pDepthBuffer,
+                    frame.pColorBuffer,
+                    job.colorFormat,
+                    frame.pBodyIndexBuffer,
+                    pBackground.get(),
+                    lane.pOutput.get());
+            }
+
+            if (SUCCEEDED(hr) && !options.outputDirectory.empty())
+            {
+                char szPath[4096];
+                snprintf(szPath, sizeof(szPath), "%s/%s-%06u%s",
+                    options.outputDirectory.c_str(), job.name.c_str(), nCaptureFrame, GetImageFormatExtension(options.format));
+
+                hr = EncodeImage(options.format, lane.pOutput.get(), nOutputWidth, nOutputHeight, nullptr, &lane.encoded);
+                if (SUCCEEDED(hr))
+                {
+                    hr = WriteImageFile(szPath, lane.encoded);
+                }
+            }
+
+            if (FAILED(hr))
+            {
+                ++job.nFailedFrames;
+            }
+
+            AtomicMax(&job.nEndTime, getTime());
+        }
+    });
+
+    const double fBatchSeconds = getTime() / 1e9;
+
+    UINT nFailedFrames = 0;
+    printf("%-32s %8s %10s %10s\n", "capture", "frames", "wall s", "fps");
+    for (const std::unique_ptr<CaptureJob>& pJob : jobs)
+    {
+        const UINT nFrames = pJob->reader.GetFrameCount();
+        const double fSeconds = nFrames ? (pJob->nEndTime - pJob->nStartTime) / 1e9 : 0.0;
+
+        printf("%-32s %8u %10.3f %10.1f\n",
+            pJob->name.c_str(),
+            nFrames,
+            fSeconds,
+            fSeconds > 0 ? nFrames / fSeconds : 0.0);
+
+        if (pJob->nFailedFrames)
+        {
+            printf("    %u frames failed\n", pJob->nFailedFrames.load());
+            nFailedFrames += pJob->nFailedFrames;
+        }
+    }
+
+    printf("%-32s %8llu %10.3f %10.1f\n",
+        "total",
+        static_cast<unsigned long long>(nTotalFrames),
+        fBatchSeconds,
+        fBatchSeconds > 0 ? nTotalFrames / fBatchSeconds : 0.0);
+
+    printf("peak resident %.1f MB\n", GetPeakResidentBytes() / 1e6);
+
+    return nFailedFrames ? 1 : 0;
+}
@@ -0,0 +1,2330 @@
+// Times the frame processing stages on synthetic or recorded frames and
+// writes the results as JSON, so regressions show up between builds.
+//
+//   CoordinateMappingBenchmark [-frames N] [-capture file] [-calibration file]
+//                              [-background file.bmp] [-json file]
+//
+// Every stage reports the median frame time as ns per color pixel, GB/s of
+// estimated memory traffic and frames per second.
+//
+// The frame stage runs with a FrameProfiler attached, switched on for half
+// of every group of frames of one input, to price the profiler's overhead
+// with a confidence interval. The screenshot stages time what saving an image costs
+// the frame thread, written in place or handed to the ScreenshotWriter, and
+// the encode stages compare the file formats on the composited frame.
+//
+// The roi stages run whole frames on synthetic player masks of growing size,
+// mapping and compositing every pixel, only the player regions, and only the
+// player regions into a persistent output.
+//
+// The depthres stage composites players at depth resolution and upscales
+// them over the background at each output size, against the full color mode.
+//
+// The library stages load a directory of backgrounds into a BackgroundLibrary,
+// cold (decoded, scaled and cached) and warm (mapped from the cache), per image.
+//
+// The yuy2 stages feed the sensor's native color format, converting the whole
+// frame before compositing against converting only the player pixels inside
+// the kernel, and report how far the conversion is from exact BT.601.
+//
+// The depthmap stages keep the color to depth mapping as points and as an
+// index map, check that every kernel composites both alike and time the
+// whole frame with each.
+//
+// The geometry stages check that every kernel composites a mapped frame from
+// points and from indices to the same pixels in either color format through
+// the kernels compiled for the Kinect depth size and through the generic ones
+// taking it at run time. Only the scalar kernels have the size compiled in;
+// they are timed on one thread, fixed and generic frames alternating in
+// groups, with the mean difference and its 95% confidence interval.
+//
+// The mapcache stages map a still and a walking player with a little sensor
+// noise in full every frame and through the MappingCache, reporting the share
+// of the mapping reused and the composited pixels that differ from mapping
+// in full.
+//
+// The pool stages allocate the app's frame buffers for 1080p the way they
+// used to be (zeroed new[]) and from FrameBufferPools on small and on huge
+// pages, then copy in and composite frames through them. They report the
+// startup and first frame cost with the page faults behind it, how much of
+// the pool huge pages actually back, and on Linux the data TLB misses per
+// frame where the kernel exposes the counter.
+//
+// The lowmem stages composite whole frames, BGRA and YUY2, with the full
+// frame mapping and in row blocks, check that both produce the same pixels
+// and report for each the most frame buffer memory it had in the shared pool
+// at once, what it keeps there between frames and the bytes it moves per
+// frame.
+//
+// The resolution stages composite the synthetic source's frames at each
+// depth and color size up to 1024x1024 and 3840x2160 through one compositor
+// that follows the geometry, report what switching costs and how the time
+// per pixel scales, then pace the source at 30 fps through a FramePipeline
+// and count the frames that kept up.
+//
+// The depthkey stages time the DepthKeyer's mask kernel on one thread with
+// every kernel, keying on a depth range alone and against a learned
+// background, check it against the scalar kernel and the body index frame it
+// replaces, then composite whole frames keyed from depth against taken from
+// the body index frame.
+//
+// The matte stages refine a noisy player mask at each MatteRefinement level
+// on one thread, check that every kernel blends a matte as the scalar one
+// does and that a matte of only 0 and 255 composites as the hard edged
+// kernels, then time whole frames at each level against hard edges.
+//
+// The video stages decode a Y4M background frame scaled to the color frame,
+// then composite at a paced 30 fps over the frames a VideoBackground decodes
+// ahead, counting the frames that found none ready.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include "BackgroundLibrary.h"
+#include "BitmapFile.h"
+#include "CaptureFile.h"
+#include "CompositeKernel.h"
+#include "FrameBufferPool.h"
+#include "FrameCompositor.h"
+#include "FramePipeline.h"
+#include "FrameProfiler.h"
+#include "ImageEncoder.h"
+#include "InstantReplayRing.h"
+#include "MappedFile.h"
+#include "MatteRefiner.h"
+#include "SoftwareCoordinateMapper.h"
+#include "ScreenshotWriter.h"
+#include "ThreadPool.h"
+#include "TimerFrameSource.h"
+#include "VideoBackground.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+namespace
+{
+    const int cDepthWidth = 512;
+    const int cDepthHeight = 424;
+    const int cColorWidth = 1920;
+    const int cColorHeight = 1080;
+    const int cColorPixels = cColorWidth * cColorHeight;
+    const int cDepthPixels = cDepthWidth * cDepthHeight;
+
+    const int cDefaultFrameCount = 50;
+    const int cWarmupFrames = 3;
+
+    // most frames a capture contributes, they are cycled through
+    const UINT cMaxCaptureFrames = 16;
+
+    // synthetic background, scaled up to the color frame like the app's image
+    const int cBackgroundWidth = 1280;
+    const int cBackgroundHeight = 720;
+
+    const int cThreadCounts[] = {1, 2, 4, 8, 16};
+
+    // scopes timed back to back to price a single ProfileScope
+    const int cProfileScopeCount = 1000000;
+
+    // fewest groups of profiled and unprofiled frames the profiler's
+    // overhead is measured over, whatever -frames asks for
+    const int cMinProfilerOverheadGroups = 100;
+
+    // and of fixed and generic geometry frames
+    const int cMinGeometryGroups = 30;
+
+    // screenshots land in the working directory and are removed afterwards
+    const char cScreenshotPath[] = "benchmark-screenshot.bmp";
+
+    // the library stages write this many copies of the background into a
+    // directory of the working directory, removed afterwards
+    const char cLibraryDirectory[] = "benchmark-backgrounds";
+    const int cLibraryBackgrounds = 4;
+
+    // the video stages loop a Y4M of this many background sized frames,
+    // written to the working directory and removed afterwards
+    const char cVideoPath[] = "benchmark-video.y4m";
+    const int cVideoFrames = 8;
+    const int cVideoFrameRate = 30;
+
+    // one second of instant replay
+    const int cInstantReplayFrames = 30;
+
+    // share of the depth frame covered by players in the synthetic roi masks
+    const double cPlayerCoverages[] = {0.0, 0.05, 0.15, 0.3, 0.6, 1.0};
+
+    // the tiles stage: a player on this share of the depth frame, moving this
+    // many depth pixels per frame, into as many output buffers as the pipeline rotates
+    const double cTilePlayerCoverage = 0.15;
+    const int cTilePlayerStep = 2;
+    const int cTileOutputBuffers = 3;
+
+    // the mapcache stage: depth noise (mm) added to the tiles stage's player,
+    // within the cache's tolerance
+    const int cMapCacheNoise = 3;
+
+    // the pool stage's copy of the app's buffers: output surfaces and frame
+    // slots as FramePipeline rotates them
+    const int cPoolOutputSurfaces = 3;
+    const int cPoolFrameSlots = 4;
+
+    // output sizes of the depthres stage
+    const int cDepthResolutionSizes[][2] = {{512, 424}, {960, 540}, {1280, 720}, {1024, 848}, {1920, 1080}};
+
+    // depth and color sizes of the resolution stage: the Kinect, then modes of
+    // newer time of flight sensors up to 1 MP depth and 4K color; and the
+    // rate the synthetic source paces them at
+    const int cResolutionGeometries[][4] =
+    {
+        {512, 424, 1920, 1080},
+        {640, 576, 2560, 1440},
+        {512, 424, 3840, 2160},
+        {1024, 1024, 3840, 2160},
+    };
+    const int cResolutionFrameRate = 30;
+
+    struct BenchmarkOptions
+    {
+        int nFrameCount;
+        std::string capturePath;
+        std::string calibrationPath;
+        std::string backgroundPath;
+        std::string jsonPath;
+    };
+
+    struct FrameInput
+    {
+        const UINT16* pDepthBuffer;
+        const RGBQUAD* pColorBuffer;
+        const BYTE* pBodyIndexBuffer;
+    };
+
+    struct StageResult
+    {
+        std::string stage;
+        std::string variant;
+        int nThreads;
+        double fMedianMilliseconds;
+        double fNanosecondsPerPixel;
+        double fGigabytesPerSecond;
+        double fFramesPerSecond;
+    };
+
+    struct EncoderResult
+    {
+        std::string format;
+        int nThreads;
+        double fMedianMilliseconds;
+        // megabytes of 24bpp image encoded per second
+        double fMegabytesPerSecond;
+        size_t nBytes;
+        // BMP file size over this file's size
+        double fRatioToBitmap;
+    };
+
+    struct ProfilerOverhead
+    {
+        // cost of one enabled ProfileScope
+        double fScopeNanoseconds;
+        // scopes per frame times their cost, against the unprofiled frame time
+        double fEstimatedPercent;
+        // mean of the profiled against the unprofiled frames of each group
+        double fMeasuredPercent;
+        // half the 95% confidence interval of that mean
+        double fNoisePercent;
+    };
+
+    double GetMedian(std::vector<double> values)
+    {
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        return values[values.size() / 2];
+    }
+
+    // The frame buffers the app allocates at startup: the background, the
+    // pipeline's output surfaces and frame slots and the compositor's map
+    struct AppFrameBuffers
+    {
+        RGBQUAD* pBackground;
+        RGBQUAD* pOutputs[cPoolOutputSurfaces];
+        RGBQUAD* pColors[cPoolFrameSlots];
+        UINT16* pDepths[cPoolFrameSlots];
+        BYTE* pBodyIndices[cPoolFrameSlots];
+        UINT* pDepthIndices;
+    };
+
+    template <typename Allocate>
+    void AllocateAppFrameBuffers(Allocate allocate, AppFrameBuffers* pBuffers)
+    {
+        pBuffers->pBackground = static_cast<RGBQUAD*>(allocate(cColorPixels * sizeof(RGBQUAD)));
+        for (RGBQUAD*& pOutput : pBuffers->pOutputs)
+        {
+            pOutput = static_cast<RGBQUAD*>(allocate(cColorPixels * sizeof(RGBQUAD)));
+        }
+
+        for (int i = 0; i < cPoolFrameSlots; ++i)
+        {
+            pBuffers->pColors[i] = static_cast<RGBQUAD*>(allocate(cColorPixels * sizeof(RGBQUAD)));
+            pBuffers->pDepths[i] = static_cast<UINT16*>(allocate(cDepthPixels * sizeof(UINT16)));
+            pBuffers->pBodyIndices[i] = static_cast<BYTE*>(allocate(cDepthPixels * sizeof(BYTE)));
+        }
+
+        pBuffers->pDepthIndices = static_cast<UINT*>(allocate(cColorPixels * sizeof(UINT)));
+    }
+
+    // Page faults the process has taken so far, -1 where we cannot tell
+    int64_t GetPageFaultCount()
+    {
+#ifdef _WIN32
+        return -1;
+#else
+        rusage usage = {};
+        return (getrusage(RUSAGE_SELF, &usage) == 0) ? int64_t(usage.ru_minflt) + usage.ru_majflt : -1;
+#endif
+    }
+
+    // Counts the calling thread's data TLB load misses in user mode, on Linux
+    // when the kernel exposes the hardware counter (virtual machines often
+    // do not); everywhere else IsAvailable is false.
+    class TlbMissCounter
+    {
+    public:
+        TlbMissCounter() : m_nFile(-1)
+        {
+#ifdef __linux__
+            perf_event_attr attributes;
+            memset(&attributes, 0, sizeof(attributes));
+            attributes.type = PERF_TYPE_HW_CACHE;
+            attributes.size = sizeof(attributes);
+            attributes.config = PERF_COUNT_HW_CACHE_DTLB |
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attributes.disabled = 1;
+            attributes.exclude_kernel = 1;
+            attributes.exclude_hv = 1;
+            m_nFile = static_cast<int>(syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0));
+#endif
+        }
+
+        ~TlbMissCounter()
+        {
+#ifdef __linux__
+            if (m_nFile >= 0)
+            {
+                close(m_nFile);
+            }
+#endif
+        }
+
+        TlbMissCounter(const TlbMissCounter&) = delete;
+        TlbMissCounter& operator=(const TlbMissCounter&) = delete;
+
+        bool IsAvailable() const { return m_nFile >= 0; }
+
+        void Start()
+        {
+#ifdef __linux__
+            if (m_nFile >= 0)
+            {
+                ioctl(m_nFile, PERF_EVENT_IOC_RESET, 0);
+                ioctl(m_nFile, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        // misses since Start
+        uint64_t Stop()
+        {
+            uint64_t nMisses = 0;
+#ifdef __linux__
+            if (m_nFile >= 0)
+            {
+                ioctl(m_nFile, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(m_nFile, &nMisses, sizeof(nMisses)) != sizeof(nMisses))
+                {
+                    nMisses = 0;
+                }
+            }
+#endif
+            return nMisses;
+        }
+
+    private:
+        int m_nFile;
+    };
+
+    // Typical Kinect v2 factory calibration, used when no file is given
+    SensorCalibration GetDefaultCalibration()
+    {
+        SensorCalibration calibration;
+        memset(&calibration, 0, sizeof(calibration));
+
+        calibration.depth.nWidth = cDepthWidth;
+        calibration.depth.nHeight = cDepthHeight;
+        calibration.depth.fFocalLengthX = 365.5f;
+        calibration.depth.fFocalLengthY = 365.5f;
+        calibration.depth.fPrincipalPointX = 257.0f;
+        calibration.depth.fPrincipalPointY = 207.0f;
+        calibration.depth.fRadialK2 = 0.09f;
+        calibration.depth.fRadialK4 = -0.27f;
+        calibration.depth.fRadialK6 = 0.09f;
+
+        calibration.color.nWidth = cColorWidth;
+        calibration.color.nHeight = cColorHeight;
+        calibration.color.fFocalLengthX = 1081.4f;
+        calibration.color.fFocalLengthY = 1081.4f;
+        calibration.color.fPrincipalPointX = 959.5f;
+        calibration.color.fPrincipalPointY = 539.5f;
+
+        calibration.rotation[0] = 1.0f;
+        calibration.rotation[4] = 1.0f;
+        calibration.rotation[8] = 1.0f;
+        calibration.translation[0] = -0.052f;
+
+        return calibration;
+    }
+
+    bool ParseCommandLine(int argc, char** argv, BenchmarkOptions* pOptions)
+    {
+        pOptions->nFrameCount = cDefaultFrameCount;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const bool bHasValue = (i + 1 < argc);
+
+            if (strcmp(argv[i], "-frames") == 0 && bHasValue)
+            {
+                pOptions->nFrameCount = std::max(1, atoi(argv[++i]));
+            }
+            else if (strcmp(argv[i], "-capture") == 0 && bHasValue)
+            {
+                pOptions->capturePath = argv[++i];
+            }
+            else if (strcmp(argv[i], "-calibration") == 0 && bHasValue)
+            {
+                pOptions->calibrationPath = argv[++i];
+            }
+            else if (strcmp(argv[i], "-background") == 0 && bHasValue)
+            {
+                pOptions->backgroundPath = argv[++i];
+            }
+            else if (strcmp(argv[i], "-json") == 0 && bHasValue)
+            {
+                pOptions->jsonPath = argv[++i];
+            }
+            else
+            {
+                fprintf(stderr,
+                    "usage: %s [-frames N] [-capture file] [-calibration file] [-background file.bmp] [-json file]\n",
+                    argv[0]);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Runs warmup frames, then nFrameCount timed frames, and returns the median
+    // in seconds. prepareFrame runs untimed before every frame.
+    template <typename Prepare, typename Frame>
+    double TimeFrames(int nFrameCount, Prepare prepareFrame, Frame runFrame)
+    {
+        for (int i = 0; i < cWarmupFrames; ++i)
+        {
+            prepareFrame(i);
+            runFrame(i);
+        }
+
+        std::vector<double> times(nFrameCount);
+        for (int i = 0; i < nFrameCount; ++i)
+        {
+            prepareFrame(i);
+
+            const auto start = std::chrono::steady_clock::now();
+            runFrame(i);
+            times[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        std::nth_element(times.begin(), times.begin() + nFrameCount / 2, times.end());
+        return times[nFrameCount / 2];
+    }
+
+    template <typename Frame>
+    double TimeFrames(int nFrameCount, Frame runFrame)
+    {
+        return TimeFrames(nFrameCount, [](int) {}, runFrame);
+    }
+
+    StageResult MakeResult(
+        const char* pszStage,
+        const std::string& variant,
+        int nThreads,
+        double fSeconds,
+        double fPixels,
+        double fBytes)
+    {
+        StageResult result;
+        result.stage = pszStage;
+        result.variant = variant;
+        result.nThreads = nThreads;
+        result.fMedianMilliseconds = fSeconds * 1e3;
+        result.fNanosecondsPerPixel = fSeconds * 1e9 / fPixels;
+        result.fGigabytesPerSecond = fBytes / fSeconds / 1e9;
+        result.fFramesPerSecond = 1.0 / fSeconds;
+
+        printf("%-12s %-10s %3d threads  %8.3f ms  %7.3f ns/px  %7.2f GB/s  %8.1f fps\n",
+            result.stage.c_str(),
+            result.variant.c_str(),
+            result.nThreads,
+            result.fMedianMilliseconds,
+            result.fNanosecondsPerPixel,
+            result.fGigabytesPerSecond,
+            result.fFramesPerSecond);
+
+        return result;
+    }
+
+    // Estimated bytes moved per frame by each stage. The mapper clears its
+    // output and z-buffer per color pixel, then reads depth and the ray table
+    // (12 bytes) per depth pixel while splatting. The compositor keeps an
+    // index map unless told otherwise, nMapEntryBytes per color pixel.
+    double GetMappingBytes(size_t nMapEntryBytes = sizeof(UINT))
+    {
+        return double(cColorPixels) * (nMapEntryBytes + sizeof(UINT16)) +
+            double(cDepthPixels) * (sizeof(UINT16) + 3 * sizeof(float));
+    }
+
+    // The composite reads the mapping, color, background and body index and writes the output
+    double GetCompositeBytes(size_t nMapEntryBytes = sizeof(UINT))
+    {
+        return double(cColorPixels) * (nMapEntryBytes + 3 * sizeof(RGBQUAD) + sizeof(BYTE));
+    }
+
+    // Both of the above for frames of any size, with an index map
+    double GetFrameBytes(double fColorPixels, double fDepthPixels)
+    {
+        return fColorPixels * (2 * sizeof(UINT) + sizeof(UINT16) + 3 * sizeof(RGBQUAD) + sizeof(BYTE)) +
+            fDepthPixels * (sizeof(UINT16) + 3 * sizeof(float));
+    }
+
+    // Depth resolution frames map every depth pixel to color (8 byte points),
+    // gather a color pixel per depth pixel, then upscale that over the
+    // background into nOutputPixels
+    double GetDepthResolutionBytes(double fOutputPixels)
+    {
+        return double(cDepthPixels) * (2 * sizeof(UINT16) + sizeof(ColorSpacePoint) + 3 * sizeof(float)) +
+            double(cDepthPixels) * (sizeof(ColorSpacePoint) + sizeof(BYTE) + 3 * sizeof(RGBQUAD)) +
+            fOutputPixels * 2 * sizeof(RGBQUAD);
+    }
+
+    // Player region frames scan the body index and map the share
+    // fRegionCoverage of the color frame
+    double GetRegionMappingBytes(double fRegionCoverage)
+    {
+        return double(cDepthPixels) + fRegionCoverage * cColorPixels * (sizeof(UINT) + sizeof(UINT16)) +
+            double(cDepthPixels) * (sizeof(UINT16) + 3 * sizeof(float));
+    }
+
+    // then composite the regions and copy the rest of the background, or
+    // restore about as much as they composite when the output persists
+    double GetPlayerRegionBytes(double fRegionCoverage, bool bPersistent)
+    {
+        const double fCopiedPixels = bPersistent ? fRegionCoverage * cColorPixels : (1.0 - fRegionCoverage) * cColorPixels;
+
+        return GetRegionMappingBytes(fRegionCoverage) + fRegionCoverage * GetCompositeBytes() +
+            fCopiedPixels * 2 * sizeof(RGBQUAD);
+    }
+
+    // Dirty tile frames hash the mapping, body index and color of the regions,
+    // then composite the share fRedrawn of the frame
+    double GetDirtyTileBytes(double fRegionCoverage, double fRedrawn)
+    {
+        return GetRegionMappingBytes(fRegionCoverage) +
+            fRegionCoverage * cColorPixels * (sizeof(UINT) + sizeof(RGBQUAD) + sizeof(BYTE)) +
+            fRedrawn * GetCompositeBytes();
+    }
+
+    // What converting a YUY2 frame to BGRA moves on top of compositing it
+    // the mapping's projections and row block bins go through memory, the
+    // block's index map and z-buffer stay in cache
+    double GetRowBlockBytes(size_t nColorBytesPerPixel)
+    {
+        return double(cColorPixels) * (nColorBytesPerPixel + 2 * sizeof(RGBQUAD)) +
+            double(cDepthPixels) * (sizeof(UINT16) + 2 * 3 * sizeof(float) + 2 * sizeof(UINT) + sizeof(BYTE));
+    }
+
+    double GetYuy2ConversionBytes()
+    {
+        return double(cColorPixels) * (2 + sizeof(RGBQUAD));
+    }
+
+    inline BYTE ClampToByte(int n)
+    {
+        return static_cast<BYTE>(n < 0 ? 0 : (n > 255 ? 255 : n));
+    }
+
+    // BGRA to studio range BT.601 YUY2, each pair sharing its averaged chroma,
+    // so the yuy2 stages composite the same picture as the others
+    void EncodeYuy2(const RGBQUAD* pPixels, int nPixelCount, BYTE* pYuy2)
+    {
+        for (int i = 0; i + 1 < nPixelCount; i += 2)
+        {
+            int nU = 0;
+            int nV = 0;
+            for (int j = 0; j < 2; ++j)
+            {
+                const int r = pPixels[i + j].rgbRed;
+                const int g = pPixels[i + j].rgbGreen;
+                const int b = pPixels[i + j].rgbBlue;
+
+                pYuy2[(i + j) * 2] = ClampToByte(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                nU += ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+                nV += ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+            }
+
+            pYuy2[i * 2 + 1] = ClampToByte((nU + 1) / 2);
+            pYuy2[i * 2 + 3] = ClampToByte((nV + 1) / 2);
+        }
+    }
+
+    // Moving gradients in 4:2:0, cVideoFrames of them
+    bool WriteVideo(const char* pszPath, int nWidth, int nHeight)
+    {
+        FILE* pFile = fopen(pszPath, "wb");
+        if (!pFile)
+        {
+            return false;
+        }
+
+        fprintf(pFile, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", nWidth, nHeight, cVideoFrameRate);
+
+        std::vector<BYTE> plane(size_t(nWidth) * nHeight);
+        for (int nFrame = 0; nFrame < cVideoFrames; ++nFrame)
+        {
+            fprintf(pFile, "FRAME\n");
+
+            for (int y = 0; y < nHeight; ++y)
+            {
+                for (int x = 0; x < nWidth; ++x)
+                {
+                    plane[size_t(y) * nWidth + x] = static_cast<BYTE>(16 + (x + y + nFrame * 8) % 220);
+                }
+            }
+            fwrite(plane.data(), 1, plane.size(), pFile);
+
+            const size_t nChromaSize = size_t(nWidth / 2) * ((nHeight + 1) / 2);
+            for (int nChroma = 0; nChroma < 2; ++nChroma)
+            {
+                for (size_t i = 0; i < nChromaSize; ++i)
+                {
+                    plane[i] = static_cast<BYTE>(64 + (i / (nWidth / 2) + nChroma * 64 + nFrame * 4) % 128);
+                }
+                fwrite(plane.data(), 1, nChromaSize, pFile);
+            }
+        }
+
+        return fclose(pFile) == 0;
+    }
+
+    // Largest difference of ConvertYuy2Pixel from the exact studio range
+    // BT.601 conversion, rounded, over every Y, U and V
+    int GetYuy2MaxDeviation()
+    {
+        int nMaxDeviation = 0;
+        BYTE pair[4];
+
+        for (int y = 0; y < 256; ++y)
+        {
+            for (int u = 0; u < 256; ++u)
+            {
+                for (int v = 0; v < 256; ++v)
+                {
+                    pair[0] = pair[2] = static_cast<BYTE>(y);
+                    pair[1] = static_cast<BYTE>(u);
+                    pair[3] = static_cast<BYTE>(v);
+                    const RGBQUAD pixel = ConvertYuy2Pixel(pair, 0);
+
+                    const double fLuma = 255.0 / 219.0 * (y - 16);
+                    const double fRed = fLuma + 255.0 / 224.0 * 1.402 * (v - 128);
+                    const double fGreen = fLuma - 255.0 / 224.0 * (1.772 * 0.114 / 0.587 * (u - 128) + 1.402 * 0.299 / 0.587 * (v - 128));
+                    const double fBlue = fLuma + 255.0 / 224.0 * 1.772 * (u - 128);
+
+                    nMaxDeviation = std::max(nMaxDeviation, abs(ClampToByte(static_cast<int>(floor(fRed + 0.5))) - pixel.rgbRed));
+                    nMaxDeviation = std::max(nMaxDeviation, abs(ClampToByte(static_cast<int>(floor(fGreen + 0.5))) - pixel.rgbGreen));
+                    nMaxDeviation = std::max(nMaxDeviation, abs(ClampToByte(static_cast<int>(floor(fBlue + 0.5))) - pixel.rgbBlue));
+                }
+            }
+        }
+
+        return nMaxDeviation;
+    }
+
+    // An upright ellipse of players in front of the depth ramp of the
+    // synthetic source, the whole frame at full coverage, nOffsetX depth
+    // pixels right of the center. Returns the share of depth pixels that
+    // ended up as players.
+    double MakePlayerMask(double fCoverage, int nOffsetX, UINT16* pDepth, BYTE* pBodyIndex)
+    {
+        // the ellipse area is pi/4 of its bounding box
+        const double fScale = sqrt(4.0 * fCoverage / 3.14159265358979);
+        const double fRadiusX = 0.5 * cDepthWidth * fScale;
+        const double fRadiusY = 0.5 * cDepthHeight * fScale;
+
+        int nPlayerPixels = 0;
+        for (int y = 0; y < cDepthHeight; ++y)
+        {
+            for (int x = 0; x < cDepthWidth; ++x)
+            {
+                const double dx = (x - 0.5 * cDepthWidth - nOffsetX) / std::max(fRadiusX, 1e-6);
+                const double dy = (y - 0.5 * cDepthHeight) / std::max(fRadiusY, 1e-6);
+                const bool bPlayer = fCoverage >= 1.0 || (fCoverage > 0.0 && dx * dx + dy * dy <= 1.0);
+
+                const int i = y * cDepthWidth + x;
+                pDepth[i] = bPlayer ? 1500 : static_cast<UINT16>(2000 + (2000 * x) / cDepthWidth);
+                pBodyIndex[i] = bPlayer ? 0 : 0xff;
+                nPlayerPixels += bPlayer ? 1 : 0;
+            }
+        }
+
+        return double(nPlayerPixels) / cDepthPixels;
+    }
+
+    void WriteJson(
+        const char* pszPath,
+        const BenchmarkOptions& options,
+        const std::vector<StageResult>& results,
+        const std::vector<EncoderResult>& encoders,
+        const ProfilerOverhead& overhead)
+    {
+        FILE* pFile = fopen(pszPath, "w");
+        if (!pFile)
+        {
+            fprintf(stderr, "cannot write %s\n", pszPath);
+            return;
+        }
+
+        fprintf(pFile, "{\n");
+        fprintf(pFile, "  \"input\": \"%s\",\n", options.capturePath.empty() ? "synthetic" : "capture");
+        fprintf(pFile, "  \"frames\": %d,\n", options.nFrameCount);
+        fprintf(pFile, "  \"color_size\": [%d, %d],\n", cColorWidth, cColorHeight);
+        fprintf(pFile, "  \"depth_size\": [%d, %d],\n", cDepthWidth, cDepthHeight);
+        fprintf(pFile, "  \"hardware_threads\": %u,\n", std::thread::hardware_concurrency());
+        fprintf(pFile, "  \"best_kernel\": \"%s\",\n", GetCompositeKernelName(GetBestCompositeKernel()));
+        fprintf(pFile, "  \"profiler\": {\"scope_ns\": %.2f, \"estimated_overhead_percent\": %.4f, \"measured_overhead_percent\": %.3f, \"noise_percent\": %.3f},\n",
+            overhead.fScopeNanoseconds, overhead.fEstimatedPercent, overhead.fMeasuredPercent, overhead.fNoisePercent);
+        fprintf(pFile, "  \"results\": [\n");
+
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const StageResult& result = results[i];
+            fprintf(pFile,
+                "    {\"stage\": \"%s\", \"variant\": \"%s\", \"threads\": %d, \"median_ms\": %.4f, "
+                "\"ns_per_pixel\": %.4f, \"gb_per_s\": %.3f, \"fps\": %.2f}%s\n",
+                result.stage.c_str(),
+                result.variant.c_str(),
+                result.nThreads,
+                result.fMedianMilliseconds,
+                result.fNanosecondsPerPixel,
+                result.fGigabytesPerSecond,
+                result.fFramesPerSecond,
+                (i + 1 < results.size()) ? "," : "");
+        }
+
+        fprintf(pFile, "  ],\n");
+        fprintf(pFile, "  \"encoders\": [\n");
+
+        for (size_t i = 0; i < encoders.size(); ++i)
+        {
+            const EncoderResult& encoder = encoders[i];
+            fprintf(pFile,
+                "    {\"format\": \"%s\", \"threads\": %d, \"median_ms\": %.4f, \"mb_per_s\": %.1f, "
+                "\"bytes\": %llu, \"ratio_to_bmp\": %.3f}%s\n",
+                encoder.format.c_str(),
+                encoder.nThreads,
+                encoder.fMedianMilliseconds,
+                encoder.fMegabytesPerSecond,
+                static_cast<unsigned long long>(encoder.nBytes),
+                encoder.fRatioToBitmap,
+                (i + 1 < encoders.size()) ? "," : "");
+        }
+
+        fprintf(pFile, "  ]\n}\n");
+        fclose(pFile);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    if (!ParseCommandLine(argc, argv, &options))
+    {
+        return 1;
+    }
+
+    SensorCalibration calibration = GetDefaultCalibration();
+    if (!options.calibrationPath.empty() && FAILED(LoadSensorCalibration(options.calibrationPath.c_str(), &calibration)))
+    {
+        fprintf(stderr, "cannot load calibration %s\n", options.calibrationPath.c_str());
+        return 1;
+    }
+
+    SoftwareCoordinateMapper mapper;
+    if (FAILED(mapper.Initialize(calibration)))
+    {
+        fprintf(stderr, "invalid calibration\n");
+        return 1;
+    }
+
+    // Input frames, either from a capture or a single synthetic frame
+    std::vector<FrameInput> frames;
+    CaptureReader reader;
+    TimerFrameSource syntheticSource;
+
+    if (!options.capturePath.empty())
+    {
+        if (FAILED(reader.Open(options.capturePath.c_str())))
+        {
+            fprintf(stderr, "cannot open capture %s\n", options.capturePath.c_str());
+            return 1;
+        }
+
+        const CaptureFileHeader& header = reader.GetHeader();
+        if (header.nColorFormat != CaptureColorFormat_Bgra ||
+            header.nDepthWidth != cDepthWidth || header.nDepthHeight != cDepthHeight ||
+            header.nColorWidth != cColorWidth || header.nColorHeight != cColorHeight)
+        {
+            fprintf(stderr, "capture must hold %dx%d depth and %dx%d BGRA color\n", cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            return 1;
+        }
+
+        for (UINT i = 0; i < std::min(reader.GetFrameCount(), cMaxCaptureFrames); ++i)
+        {
+            CaptureFrame frame;
+            if (SUCCEEDED(reader.GetFrame(i, &frame)))
+            {
+                FrameInput input = {frame.pDepthBuffer, reinterpret_cast<const RGBQUAD*>(frame.pColorBuffer), frame.pBodyIndexBuffer};
+                frames.push_back(input);
+            }
+        }
+    }
+    else
+    {
+        PipelineFrame frame;
+        syntheticSource.Initialize(cDepthWidth, cDepthHeight, cColorWidth, cColorHeight, std::chrono::microseconds(1));
+        syntheticSource.WaitForFrame(std::chrono::milliseconds(1));
+        if (SUCCEEDED(syntheticSource.AcquireFrame(&frame)))
+        {
+            FrameInput input = {frame.pDepthBuffer, reinterpret_cast<const RGBQUAD*>(frame.pColorBuffer), frame.pBodyIndexBuffer};
+            frames.push_back(input);
+        }
+    }
+
+    if (frames.empty())
+    {
+        fprintf(stderr, "no input frames\n");
+        return 1;
+    }
+
+    // Background image file, encoded in memory unless one is given
+    std::vector<BYTE> backgroundFile;
+    if (!options.backgroundPath.empty())
+    {
+        MappedFile file;
+        if (FAILED(file.Open(options.backgroundPath.c_str())))
+        {
+            fprintf(stderr, "cannot open background %s\n", options.backgroundPath.c_str());
+            return 1;
+        }
+
+        backgroundFile.assign(file.GetData(), file.GetData() + file.GetSize());
+    }
+    else
+    {
+        std::vector<RGBQUAD> pixels(cBackgroundWidth * cBackgroundHeight);
+        for (size_t i = 0; i < pixels.size(); ++i)
+        {
+            pixels[i].rgbBlue = static_cast<BYTE>(i);
+            pixels[i].rgbGreen = static_cast<BYTE>(i / cBackgroundWidth);
+            pixels[i].rgbRed = 64;
+            pixels[i].rgbReserved = 0xff;
+        }
+
+        backgroundFile.resize(GetBitmapFileSize(cBackgroundWidth, cBackgroundHeight));
+        EncodeBitmap(pixels.data(), cBackgroundWidth, cBackgroundHeight, backgroundFile.data(), backgroundFile.size());
+    }
+
+    std::unique_ptr<RGBQUAD[]> pBackground(new RGBQUAD[cColorPixels]);
+    std::unique_ptr<RGBQUAD[]> pOutput(new RGBQUAD[cColorPixels]);
+
+    const int nFrameCount = options.nFrameCount;
+    const size_t nInputCount = frames.size();
+    std::vector<StageResult> results;
+
+    printf("%d frames from %s, best kernel %s\n",
+        nFrameCount,
+        options.capturePath.empty() ? "synthetic input" : options.capturePath.c_str(),
+        GetCompositeKernelName(GetBestCompositeKernel()));
+
+    // Background: decode the file and scale it to the color frame
+    {
+        std::vector<RGBQUAD> decoded;
+        int nWidth = 0;
+        int nHeight = 0;
+
+        double fSeconds = TimeFrames(nFrameCount, [&](int)
+        {
+            DecodeBitmap(backgroundFile.data(), backgroundFile.size(), &decoded, &nWidth, &nHeight);
+            ScaleImage(decoded.data(), nWidth, nHeight, pBackground.get(), cColorWidth, cColorHeight);
+        });
+
+        // file read, decoded pixels written then read by the scaler, output written
+        const double fBytes = double(backgroundFile.size()) + 2.0 * decoded.size() * sizeof(RGBQUAD) +
+            double(cColorPixels) * sizeof(RGBQUAD);
+        results.push_back(MakeResult("background", "bmp", 1, fSeconds, cColorPixels, fBytes));
+    }
+
+    // Background library: a cold start decodes, scales and writes the cache of
+    // every image, a warm start maps the caches. Times are per background.
+    {
+#ifdef _WIN32
+        _mkdir(cLibraryDirectory);
+#else
+        mkdir(cLibraryDirectory, 0755);
+#endif
+
+        std::vector<std::string> imagePaths;
+        for (int i = 0; i < cLibraryBackgrounds; ++i)
+        {
+            char szPath[64];
+            snprintf(szPath, sizeof(szPath), "%s/background-%d.bmp", cLibraryDirectory, i);
+            imagePaths.push_back(szPath);
+
+            FILE* pFile = fopen(szPath, "wb");
+            if (pFile)
+            {
+                fwrite(backgroundFile.data(), 1, backgroundFile.size(), pFile);
+                fclose(pFile);
+            }
+        }
+
+        const auto removeCaches = [&]()
+        {
+            for (const std::string& path : imagePaths)
+            {
+                remove(BackgroundLibrary::GetCachePath(path, cColorWidth, cColorHeight).c_str());
+            }
+        };
+
+        const auto loadLibrary = [&]()
+        {
+            BackgroundLibrary library;
+            library.Open(cLibraryDirectory, cColorWidth, cColorHeight);
+            for (int i = 0; i < library.GetCount(); ++i)
+            {
+                const RGBQUAD* pPixels = nullptr;
+                library.WaitForBackground(i, &pPixels);
+            }
+        };
+
+        const double fFrameBytes = double(cColorPixels) * sizeof(RGBQUAD);
+
+        double fSeconds = TimeFrames(nFrameCount, [&](int) { removeCaches(); }, [&](int) { loadLibrary(); }) / cLibraryBackgrounds;
+
+        // the bmp stage plus the cache written
+        results.push_back(MakeResult("library", "cold", 1, fSeconds, cColorPixels,
+            double(backgroundFile.size()) + 2.0 * cBackgroundWidth * cBackgroundHeight * sizeof(RGBQUAD) + 2.0 * fFrameBytes));
+
+        fSeconds = TimeFrames(nFrameCount, [&](int) { loadLibrary(); }) / cLibraryBackgrounds;
+
+        // the mapped cache is faulted in, from the page cache
+        results.push_back(MakeResult("library", "warm", 1, fSeconds, cColorPixels, fFrameBytes));
+
+        removeCaches();
+        for (const std::string& path : imagePaths)
+        {
+            remove(path.c_str());
+        }
+#ifdef _WIN32
+        _rmdir(cLibraryDirectory);
+#else
+        rmdir(cLibraryDirectory);
+#endif
+    }
+
+    // Mapping: color to depth space with the software mapper
+    {
+        ThreadPool threadPool(1);
+        FrameCompositor compositor;
+        compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+
+        double fSeconds = TimeFrames(nFrameCount, [&](int i)
+        {
+            compositor.MapFrame(frames[i % nInputCount].pDepthBuffer);
+        });
+
+        results.push_back(MakeResult("map", "software", 1, fSeconds, cColorPixels, GetMappingBytes()));
+    }
+
+    // Composite: every kernel on one thread, then the best kernel across thread counts (scaling)
+    {
+        ThreadPool threadPool(1);
+        FrameCompositor compositor;
+        compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+        compositor.MapFrame(frames[0].pDepthBuffer);
+
+        const CompositeKernelType kernels[] = {CompositeKernel_Scalar, CompositeKernel_Sse41, CompositeKernel_Avx2};
+        for (CompositeKernelType kernel : kernels)
+        {
+            if (!IsCompositeKernelSupported(kernel))
+            {
+                continue;
+            }
+
+            compositor.SetCompositeKernel(kernel);
+
+            double fSeconds = TimeFrames(nFrameCount, [&](int i)
+            {
+                const FrameInput& input = frames[i % nInputCount];
+                compositor.Composite(input.pColorBuffer, input.pBodyIndexBuffer, pBackground.get(), pOutput.get());
+            });
+
+            results.push_back(MakeResult("composite", GetCompositeKernelName(kernel), 1, fSeconds, cColorPixels, GetCompositeBytes()));
+        }
+    }
+
+    // Depth map formats: the same frames mapped to points and to indices, every
+    // kernel and color format composited from both and compared, then both
+    // timed on the whole frame
+    {
+        ThreadPool threadPool;
+        std::unique_ptr<UINT16[]> pDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pBodyIndex(new BYTE[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pYuy2(new BYTE[cColorPixels * 2]);
+        std::unique_ptr<RGBQUAD[]> pPointsOutput(new RGBQUAD[cColorPixels]);
+        std::unique_ptr<RGBQUAD[]> pIndicesOutput(new RGBQUAD[cColorPixels]);
+        const RGBQUAD* pColor = frames[0].pColorBuffer;
+
+        MakePlayerMask(cTilePlayerCoverage, 0, pDepth.get(), pBodyIndex.get());
+        EncodeYuy2(pColor, cColorPixels, pYuy2.get());
+
+        FrameCompositor compositors[2];
+        const DepthMapFormat formats[] = {DepthMapFormat_Points, DepthMapFormat_Indices};
+        for (int i = 0; i < 2; ++i)
+        {
+            compositors[i].Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            compositors[i].SetDepthMapFormat(formats[i]);
+        }
+
+        const CompositeKernelType kernels[] = {CompositeKernel_Scalar, CompositeKernel_Sse41, CompositeKernel_Avx2};
+        const CompositeMode modes[] = {CompositeMode_Full, CompositeMode_PlayerRegions, CompositeMode_DirtyTiles};
+        int nCompared = 0;
+        int nMismatched = 0;
+
+        for (CompositeKernelType kernel : kernels)
+        {
+            if (!IsCompositeKernelSupported(kernel))
+            {
+                continue;
+            }
+
+            for (CompositeMode mode : modes)
+            {
+                for (int nYuy2 = 0; nYuy2 < 2; ++nYuy2)
+                {
+                    RGBQUAD* outputs[] = {pPointsOutput.get(), pIndicesOutput.get()};
+                    for (int i = 0; i < 2; ++i)
+                    {
+                        compositors[i].SetCompositeKernel(kernel);
+                        compositors[i].SetCompositeMode(mode);
+                        compositors[i].InvalidateBackground();
+
+                        if (nYuy2)
+                        {
+                            compositors[i].ProcessFrame(pDepth.get(), pYuy2.get(), ColorFormat_Yuy2, pBodyIndex.get(), pBackground.get(), outputs[i]);
+                        }
+                        else
+                        {
+                            compositors[i].ProcessFrame(pDepth.get(), pColor, pBodyIndex.get(), pBackground.get(), outputs[i]);
+                        }
+                    }
+
+                    ++nCompared;
+                    if (memcmp(pPointsOutput.get(), pIndicesOutput.get(), cColorPixels * sizeof(RGBQUAD)) != 0)
+                    {
+                        ++nMismatched;
+                    }
+                }
+            }
+        }
+
+        const char* variants[] = {"points", "indices"};
+        const size_t entryBytes[] = {sizeof(DepthSpacePoint), sizeof(UINT)};
+        for (int i = 0; i < 2; ++i)
+        {
+            compositors[i].SetCompositeKernel(GetBestCompositeKernel());
+            compositors[i].SetCompositeMode(CompositeMode_Full);
+
+            double fSeconds = TimeFrames(nFrameCount, [&](int)
+            {
+                compositors[i].ProcessFrame(pDepth.get(), pColor, pBodyIndex.get(), pBackground.get(), pPointsOutput.get());
+            });
+
+            results.push_back(MakeResult("depthmap", variants[i], threadPool.GetThreadCount(), fSeconds, cColorPixels,
+                GetMappingBytes(entryBytes[i]) + GetCompositeBytes(entryBytes[i])));
+        }
+
+        printf("             %d of %d kernel, mode and color format runs identical, map %.1f MB as points and %.1f MB as indices\n",
+            nCompared - nMismatched, nCompared,
+            double(cColorPixels) * sizeof(DepthSpacePoint) / 1e6, double(cColorPixels) * sizeof(UINT) / 1e6);
+    }
+
+    // Depth geometry: the kernels with the depth size compiled in against the
+    // generic ones, per kernel, depth map and color format
+    {
+        ThreadPool threadPool(1);
+        std::unique_ptr<UINT16[]> pDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pBodyIndex(new BYTE[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pYuy2(new BYTE[cColorPixels * 2]);
+        std::unique_ptr<RGBQUAD[]> pFixedOutput(new RGBQUAD[cColorPixels]);
+        std::unique_ptr<RGBQUAD[]> pGenericOutput(new RGBQUAD[cColorPixels]);
+        const RGBQUAD* pColor = frames[0].pColorBuffer;
+
+        MakePlayerMask(cTilePlayerCoverage, 0, pDepth.get(), pBodyIndex.get());
+        EncodeYuy2(pColor, cColorPixels, pYuy2.get());
+
+        const DepthMapFormat formats[] = {DepthMapFormat_Points, DepthMapFormat_Indices};
+        const char* formatNames[] = {"points", "indices"};
+        const size_t entryBytes[] = {sizeof(DepthSpacePoint), sizeof(UINT)};
+        const CompositeKernelType kernels[] = {CompositeKernel_Scalar, CompositeKernel_Sse41, CompositeKernel_Avx2};
+        const int nGroups = std::max(nFrameCount, cMinGeometryGroups);
+        int nCompared = 0;
+        int nMismatched = 0;
+
+        for (int nFormat = 0; nFormat < 2; ++nFormat)
+        {
+            FrameCompositor compositor;
+            compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            compositor.SetDepthMapFormat(formats[nFormat]);
+            compositor.MapFrame(pDepth.get());
+
+            for (CompositeKernelType kernel : kernels)
+            {
+                if (!IsCompositeKernelSupported(kernel))
+                {
+                    continue;
+                }
+
+                compositor.SetCompositeKernel(kernel);
+
+                for (int nYuy2 = 0; nYuy2 < 2; ++nYuy2)
+                {
+                    const BYTE* pColorBuffer = nYuy2 ? pYuy2.get() : reinterpret_cast<const BYTE*>(pColor);
+                    const ColorFormat colorFormat = nYuy2 ? ColorFormat_Yuy2 : ColorFormat_Bgra;
+
+                    compositor.SetCompositeGeometry(CompositeGeometry_Fixed);
+                    compositor.Composite(pColorBuffer, colorFormat, pBodyIndex.get(), pBackground.get(), pFixedOutput.get());
+                    compositor.SetCompositeGeometry(CompositeGeometry_Generic);
+                    compositor.Composite(pColorBuffer, colorFormat, pBodyIndex.get(), pBackground.get(), pGenericOutput.get());
+
+                    ++nCompared;
+                    if (memcmp(pFixedOutput.get(), pGenericOutput.get(), cColorPixels * sizeof(RGBQUAD)) != 0)
+                    {
+                        ++nMismatched;
+                    }
+
+                    if (kernel != CompositeKernel_Scalar)
+                    {
+                        continue;
+                    }
+
+                    // generic, fixed, fixed and generic again in every group,
+                    // after a frame to warm up, so drift in clock speed falls
+                    // on both alike; back to back blocks of each differed by
+                    // more than the difference between them
+                    std::vector<double> times[2];
+                    std::vector<double> differences;
+                    for (int nGroup = 0; nGroup < nGroups; ++nGroup)
+                    {
+                        compositor.Composite(pColorBuffer, colorFormat, pBodyIndex.get(), pBackground.get(), pFixedOutput.get());
+
+                        double groupTimes[2] = {0, 0};
+                        for (int nPhase = 0; nPhase < 4; ++nPhase)
+                        {
+                            const bool bFixed = (nPhase == 1 || nPhase == 2);
+                            compositor.SetCompositeGeometry(bFixed ? CompositeGeometry_Fixed : CompositeGeometry_Generic);
+
+                            const auto start = std::chrono::steady_clock::now();
+                            compositor.Composite(pColorBuffer, colorFormat, pBodyIndex.get(), pBackground.get(), pFixedOutput.get());
+                            const double fFrameSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                            times[bFixed].push_back(fFrameSeconds);
+                            groupTimes[bFixed] += fFrameSeconds / 2;
+                        }
+
+                        differences.push_back(groupTimes[1] - groupTimes[0]);
+                    }
+
+                    const std::string variant = std::string("scalar-") + formatNames[nFormat] + (nYuy2 ? "-yuy2" : "-bgra");
+                    const double fGenericSeconds = GetMedian(times[0]);
+                    results.push_back(MakeResult("geometry", variant + "-fixed", 1,
+                        GetMedian(times[1]), cColorPixels, GetCompositeBytes(entryBytes[nFormat])));
+                    results.push_back(MakeResult("geometry", variant + "-generic", 1,
+                        fGenericSeconds, cColorPixels, GetCompositeBytes(entryBytes[nFormat])));
+
+                    double fMeanDifference = 0;
+                    for (double fDifference : differences)
+                    {
+                        fMeanDifference += fDifference / nGroups;
+                    }
+
+                    double fVariance = 0;
+                    for (double fDifference : differences)
+                    {
+                        fVariance += (fDifference - fMeanDifference) * (fDifference - fMeanDifference) / (nGroups - 1);
+                    }
+
+                    printf("             scalar fixed against generic %+.2f%% +- %.2f%% over %d groups\n",
+                        fMeanDifference / fGenericSeconds * 100.0, 1.96 * sqrt(fVariance / nGroups) / fGenericSeconds * 100.0, nGroups);
+                }
+            }
+        }
+
+        printf("             %d of %d kernel, depth map and color format runs identical between fixed and generic\n",
+            nCompared - nMismatched, nCompared);
+    }
+
+    for (int nThreads : cThreadCounts)
+    {
+        ThreadPool threadPool(nThreads);
+        FrameCompositor compositor;
+        compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+        compositor.MapFrame(frames[0].pDepthBuffer);
+
+        double fSeconds = TimeFrames(nFrameCount, [&](int i)
+        {
+            const FrameInput& input = frames[i % nInputCount];
+            compositor.Composite(input.pColorBuffer, input.pBodyIndexBuffer, pBackground.get(), pOutput.get());
+        });
+
+        results.push_back(MakeResult("scaling", GetCompositeKernelName(compositor.GetCompositeKernel()), nThreads, fSeconds, cColorPixels, GetCompositeBytes()));
+    }
+
+    // Whole frame: map and composite, the work of the app's processing thread,
+    // then the same with the profiler timing both stages
+    ProfilerOverhead overhead;
+    {
+        ThreadPool threadPool;
+        FrameCompositor compositor;
+        compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+
+        auto runFrame = [&](int i)
+        {
+            const FrameInput& input = frames[i % nInputCount];
+            compositor.ProcessFrame(input.pDepthBuffer, input.pColorBuffer, input.pBodyIndexBuffer, pBackground.get(), pOutput.get());
+        };
+
+        // Each input runs once untimed, then unprofiled, profiled, profiled
+        // and unprofiled again, so every group compares frames of the same
+        // content and cache state, and drift in clock speed over a group
+        // falls on both halves alike. Back to back runs of all unprofiled
+        // then all profiled frames differed by a few percent either way.
+        FrameProfiler profiler;
+        compositor.SetProfiler(&profiler);
+
+        const int nOverheadGroups = std::max(nFrameCount, cMinProfilerOverheadGroups);
+        std::vector<double> unprofiledTimes;
+        std::vector<double> profiledTimes;
+        std::vector<double> differences;
+        for (int nGroup = 0; nGroup < nOverheadGroups; ++nGroup)
+        {
+            profiler.SetEnabled(false);
+            runFrame(nGroup);
+
+            double groupTimes[2] = {0, 0};
+            for (int nPhase = 0; nPhase < 4; ++nPhase)
+            {
+                const bool bProfiled = (nPhase == 1 || nPhase == 2);
+                profiler.SetEnabled(bProfiled);
+
+                const auto start = std::chrono::steady_clock::now();
+                runFrame(nGroup);
+                const double fFrameSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                (bProfiled ? profiledTimes : unprofiledTimes).push_back(fFrameSeconds);
+                groupTimes[bProfiled] += fFrameSeconds / 2;
+            }
+
+            differences.push_back(groupTimes[1] - groupTimes[0]);
+        }
+
+        profiler.SetEnabled(true);
+
+        const double fSeconds = GetMedian(unprofiledTimes);
+        const double fProfiledSeconds = GetMedian(profiledTimes);
+
+        results.push_back(MakeResult("frame", GetCompositeKernelName(compositor.GetCompositeKernel()), threadPool.GetThreadCount(),
+            fSeconds, cColorPixels, GetMappingBytes() + GetCompositeBytes()));
+        results.push_back(MakeResult("frame", "profiled", threadPool.GetThreadCount(),
+            fProfiledSeconds, cColorPixels, GetMappingBytes() + GetCompositeBytes()));
+
+        double fMeanDifference = 0;
+        for (double fDifference : differences)
+        {
+            fMeanDifference += fDifference / nOverheadGroups;
+        }
+
+        double fVariance = 0;
+        for (double fDifference : differences)
+        {
+            fVariance += (fDifference - fMeanDifference) * (fDifference - fMeanDifference) / (nOverheadGroups - 1);
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < cProfileScopeCount; ++i)
+        {
+            ProfileScope scope(&profiler, ProfileStage_Draw);
+        }
+        const double fScopeSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        // map and composite are the two scopes on a processed frame
+        const ProfileStats mapStats = profiler.GetStageStats(ProfileStage_Map);
+        const ProfileStats compositeStats = profiler.GetStageStats(ProfileStage_Composite);
+
+        overhead.fScopeNanoseconds = fScopeSeconds * 1e9 / cProfileScopeCount;
+        overhead.fEstimatedPercent = 2.0 * overhead.fScopeNanoseconds / (fSeconds * 1e9) * 100.0;
+        overhead.fMeasuredPercent = fMeanDifference / fSeconds * 100.0;
+        overhead.fNoisePercent = 1.96 * sqrt(fVariance / nOverheadGroups) / fSeconds * 100.0;
+
+        printf("profiler     %.1f ns per scope, %.4f%% of a frame estimated, %+.2f%% +- %.2f%% measured over %d groups\n",
+            overhead.fScopeNanoseconds, overhead.fEstimatedPercent, overhead.fMeasuredPercent, overhead.fNoisePercent, nOverheadGroups);
+        printf("             map p50 %.3f p99 %.3f ms, composite p50 %.3f p99 %.3f ms\n",
+            mapStats.nP50 / 1e6, mapStats.nP99 / 1e6, compositeStats.nP50 / 1e6, compositeStats.nP99 / 1e6);
+    }
+
+    // Player regions: whole frames against player coverage, every color pixel
+    // against the player boxes with the rest copied, or restored only where
+    // the previous frame's players were
+    {
+        ThreadPool threadPool;
+        std::unique_ptr<UINT16[]> pDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pBodyIndex(new BYTE[cDepthPixels]);
+        std::unique_ptr<RGBQUAD[]> pRegionOutput(new RGBQUAD[cColorPixels]);
+        const RGBQUAD* pColor = frames[0].pColorBuffer;
+
+        for (double fCoverage : cPlayerCoverages)
+        {
+            const double fPlayerShare = MakePlayerMask(fCoverage, 0, pDepth.get(), pBodyIndex.get());
+
+            const CompositeMode modes[] = {CompositeMode_Full, CompositeMode_PlayerRegions, CompositeMode_PlayerRegions};
+            const char* variants[] = {"full", "roi", "persist"};
+            double fRegionCoverage = 0.0;
+
+            for (int nMode = 0; nMode < 3; ++nMode)
+            {
+                const bool bPersistent = (nMode == 2);
+
+                FrameCompositor compositor;
+                compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+                compositor.SetCompositeMode(modes[nMode]);
+                compositor.SetBackgroundPersistent(bPersistent);
+
+                double fSeconds = TimeFrames(nFrameCount, [&](int)
+                {
+                    compositor.ProcessFrame(pDepth.get(), pColor, pBodyIndex.get(), pBackground.get(), pRegionOutput.get());
+                });
+
+                if (modes[nMode] == CompositeMode_PlayerRegions)
+                {
+                    fRegionCoverage = compositor.GetPlayerCoverage();
+                }
+
+                const double fBytes = (modes[nMode] == CompositeMode_Full) ?
+                    GetMappingBytes() + GetCompositeBytes() :
+                    GetPlayerRegionBytes(fRegionCoverage, bPersistent);
+
+                char szVariant[32];
+                snprintf(szVariant, sizeof(szVariant), "%s-%d%%", variants[nMode], static_cast<int>(fPlayerShare * 100.0 + 0.5));
+                results.push_back(MakeResult("roi", szVariant, threadPool.GetThreadCount(), fSeconds, cColorPixels, fBytes));
+            }
+
+            printf("             players on %.1f%% of depth, regions on %.1f%% of color\n",
+                fPlayerShare * 100.0, fRegionCoverage * 100.0);
+        }
+    }
+
+    // Dirty tiles: the same frame over and over, then a player walking across
+    // the frame, both against the player region mode, into rotating outputs
+    {
+        ThreadPool threadPool;
+        std::unique_ptr<UINT16[]> pDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pBodyIndex(new BYTE[cDepthPixels]);
+        std::unique_ptr<RGBQUAD[]> pTileOutputs[cTileOutputBuffers];
+        for (std::unique_ptr<RGBQUAD[]>& pTileOutput : pTileOutputs)
+        {
+            pTileOutput.reset(new RGBQUAD[cColorPixels]);
+        }
+
+        const RGBQUAD* pColor = frames[0].pColorBuffer;
+        const char* variants[] = {"still", "moving"};
+
+        for (int nMotion = 0; nMotion < 2; ++nMotion)
+        {
+            const CompositeMode modes[] = {CompositeMode_PlayerRegions, CompositeMode_DirtyTiles};
+            for (CompositeMode mode : modes)
+            {
+                FrameCompositor compositor;
+                compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+                compositor.SetCompositeMode(mode);
+                compositor.SetBackgroundPersistent(true);
+
+                // what a presenter showing every frame would upload, counted untimed
+                int64_t nUploadedFrame = 0;
+                double fUploadedPixels = 0.0;
+                std::vector<PixelRect> changedRects;
+
+                double fSeconds = TimeFrames(nFrameCount,
+                    [&](int i)
+                    {
+                        if (i >= cTileOutputBuffers)
+                        {
+                            compositor.GetDirtyTiles().GetChangedRects(pTileOutputs[(i - 1) % cTileOutputBuffers].get(),
+                                nUploadedFrame, &changedRects, &nUploadedFrame);
+                            for (const PixelRect& rect : changedRects)
+                            {
+                                fUploadedPixels += rect.GetArea();
+                            }
+                        }
+
+                        // walks back and forth so the player never leaves the frame
+                        const int nPeriod = cDepthWidth / cTilePlayerStep;
+                        const int nPhase = (nMotion ? i : 0) % (2 * nPeriod);
+                        const int nOffset = cTilePlayerStep * (nPhase < nPeriod ? nPhase : 2 * nPeriod - nPhase) - cDepthWidth / 2;
+                        MakePlayerMask(cTilePlayerCoverage, nOffset / 2, pDepth.get(), pBodyIndex.get());
+                    },
+                    [&](int i)
+                    {
+                        compositor.ProcessFrame(pDepth.get(), pColor, pBodyIndex.get(), pBackground.get(),
+                            pTileOutputs[i % cTileOutputBuffers].get());
+                    });
+
+                // every buffer is filled completely the first time it is seen
+                const DirtyTileTracker& tiles = compositor.GetDirtyTiles();
+                const double fRegionCoverage = compositor.GetPlayerCoverage();
+                const double fRedrawn = double(tiles.GetRedrawnTileCount() - uint64_t(cTileOutputBuffers) * tiles.GetTileCount()) /
+                    (double(tiles.GetFrameCount() - cTileOutputBuffers) * tiles.GetTileCount());
+
+                const double fBytes = (mode == CompositeMode_DirtyTiles) ?
+                    GetDirtyTileBytes(fRegionCoverage, fRedrawn) :
+                    GetPlayerRegionBytes(fRegionCoverage, true);
+
+                const std::string variant = std::string(mode == CompositeMode_DirtyTiles ? "tiles-" : "roi-") + variants[nMotion];
+                results.push_back(MakeResult("tiles", variant, threadPool.GetThreadCount(), fSeconds, cColorPixels, fBytes));
+
+                if (mode == CompositeMode_DirtyTiles)
+                {
+                    // uploads start from an empty bitmap on the first frame of each TimeFrames pass
+                    const double fUploaded = fUploadedPixels / (double(cWarmupFrames + nFrameCount - cTileOutputBuffers) * cColorPixels);
+                    printf("             %.1f%% of %d tiles redrawn and %.1f%% of the frame uploaded per frame, regions on %.1f%% of color\n",
+                        fRedrawn * 100.0, tiles.GetTileCount(), fUploaded * 100.0, fRegionCoverage * 100.0);
+                }
+            }
+        }
+    }
+
+    // Mapping cache: the tiles stage's player, still and walking, with sensor
+    // noise, mapped in full and through the cache; the cached output is then
+    // compared against the full map frame by frame, untimed
+    {
+        ThreadPool threadPool;
+        std::unique_ptr<UINT16[]> pDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pBodyIndex(new BYTE[cDepthPixels]);
+        std::unique_ptr<RGBQUAD[]> pFullOutput(new RGBQUAD[cColorPixels]);
+        std::unique_ptr<RGBQUAD[]> pCachedOutput(new RGBQUAD[cColorPixels]);
+        const RGBQUAD* pColor = frames[0].pColorBuffer;
+        const char* variants[] = {"still", "moving"};
+
+        auto makeFrame = [&](int nMotion, int i)
+        {
+            const int nPeriod = cDepthWidth / cTilePlayerStep;
+            const int nPhase = (nMotion ? i : 0) % (2 * nPeriod);
+            const int nOffset = cTilePlayerStep * (nPhase < nPeriod ? nPhase : 2 * nPeriod - nPhase) - cDepthWidth / 2;
+            MakePlayerMask(cTilePlayerCoverage, nOffset / 2, pDepth.get(), pBodyIndex.get());
+
+            // a cheap hash per pixel and frame, different every frame
+            for (int j = 0; j < cDepthPixels; ++j)
+            {
+                const uint32_t nHash = (uint32_t(j) * 2654435761u) ^ (uint32_t(i) * 40503u);
+                pDepth[j] = static_cast<UINT16>(pDepth[j] + int((nHash >> 16) % (2 * cMapCacheNoise + 1)) - cMapCacheNoise);
+            }
+        };
+
+        for (int nMotion = 0; nMotion < 2; ++nMotion)
+        {
+            for (int nCached = 0; nCached < 2; ++nCached)
+            {
+                FrameCompositor compositor;
+                compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+                compositor.SetMappingCacheEnabled(nCached != 0);
+
+                double fSeconds = TimeFrames(nFrameCount,
+                    [&](int i) { makeFrame(nMotion, i); },
+                    [&](int)
+                    {
+                        compositor.ProcessFrame(pDepth.get(), pColor, pBodyIndex.get(), pBackground.get(), pCachedOutput.get());
+                    });
+
+                // the cache reads the tiles and writes back what it remapped
+                const MappingCacheStats stats = compositor.GetMappingCache().GetStats();
+                const double fHitRate = compositor.GetMappingCache().GetHitRate();
+                const double fCacheBytes = nCached ?
+                    GetMappingBytes() * (1.0 - fHitRate) + 2.0 * cDepthPixels * sizeof(UINT16) + GetCompositeBytes() :
+                    GetMappingBytes() + GetCompositeBytes();
+
+                const std::string variant = std::string(nCached ? "cached-" : "full-") + variants[nMotion];
+                results.push_back(MakeResult("mapcache", variant, threadPool.GetThreadCount(), fSeconds, cColorPixels, fCacheBytes));
+
+                if (nCached)
+                {
+                    printf("             %.1f%% of the mapping reused, %llu of %llu frames mapped in full, %.2f ms saved per frame\n",
+                        fHitRate * 100.0,
+                        static_cast<unsigned long long>(stats.nFullMaps),
+                        static_cast<unsigned long long>(stats.nFrames),
+                        stats.nFrames ? stats.fSavedMilliseconds / stats.nFrames : 0.0);
+                }
+            }
+
+            // both side by side on the same frames
+            FrameCompositor fullCompositor;
+            FrameCompositor cachedCompositor;
+            fullCompositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            cachedCompositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            cachedCompositor.SetMappingCacheEnabled(true);
+
+            uint64_t nDiffering = 0;
+            for (int i = 0; i < nFrameCount; ++i)
+            {
+                makeFrame(nMotion, i);
+                fullCompositor.ProcessFrame(pDepth.get(), pColor, pBodyIndex.get(), pBackground.get(), pFullOutput.get());
+                cachedCompositor.ProcessFrame(pDepth.get(), pColor, pBodyIndex.get(), pBackground.get(), pCachedOutput.get());
+
+                for (int j = 0; j < cColorPixels; ++j)
+                {
+                    nDiffering += (memcmp(&pFullOutput[j], &pCachedOutput[j], sizeof(RGBQUAD)) != 0) ? 1 : 0;
+                }
+            }
+
+            printf("             %s: %.3f%% of the composited pixels differ from mapping in full\n",
+                variants[nMotion], 100.0 * double(nDiffering) / (double(nFrameCount) * cColorPixels));
+        }
+    }
+
+    // Frame buffers: the app's startup allocations zeroed on the heap and
+    // from fresh pools, then frames copied in as the acquisition thread does
+    // and composited, the first one with the page faults it takes
+    {
+        const RGBQUAD* pColor = frames[0].pColorBuffer;
+        const CompositeKernelType kernel = GetBestCompositeKernel();
+        TlbMissCounter tlbMisses;
+
+        const char* variants[] = {"heap", "pool-4k", "pool-huge"};
+        for (int nVariant = 0; nVariant < 3; ++nVariant)
+        {
+            std::vector<std::unique_ptr<BYTE[]>> heapBuffers;
+            FrameBufferPool pool(nVariant == 2);
+            std::vector<FrameBuffer<BYTE>> poolBuffers;
+            poolBuffers.reserve(2 + cPoolOutputSurfaces + 3 * cPoolFrameSlots);
+
+            AppFrameBuffers buffers;
+            size_t nAllocatedBytes = 0;
+            const int64_t nStartFaults = GetPageFaultCount();
+            const auto start = std::chrono::steady_clock::now();
+
+            if (nVariant == 0)
+            {
+                // make_unique<T[]> value-initializes
+                AllocateAppFrameBuffers([&](size_t nBytes)
+                {
+                    heapBuffers.push_back(std::unique_ptr<BYTE[]>(new BYTE[nBytes]()));
+                    nAllocatedBytes += nBytes;
+                    return static_cast<void*>(heapBuffers.back().get());
+                }, &buffers);
+            }
+            else
+            {
+                AllocateAppFrameBuffers([&](size_t nBytes)
+                {
+                    poolBuffers.emplace_back();
+                    poolBuffers.back().Allocate(nBytes, &pool);
+                    nAllocatedBytes += nBytes;
+                    return static_cast<void*>(poolBuffers.back().get());
+                }, &buffers);
+            }
+
+            const auto allocated = std::chrono::steady_clock::now();
+            const int64_t nAllocatedFaults = GetPageFaultCount();
+
+            // the first frame writes every buffer once: the background, the
+            // map and each slot and surface in turn
+            memcpy(buffers.pBackground, pBackground.get(), cColorPixels * sizeof(RGBQUAD));
+            const PixelRect frame = {0, 0, cColorWidth, cColorHeight};
+            mapper.MapColorRegionsToDepthIndices(cDepthPixels, frames[0].pDepthBuffer, cColorPixels, buffers.pDepthIndices, &frame, 1);
+
+            auto runFrame = [&](int i)
+            {
+                const int nSlot = i % cPoolFrameSlots;
+                memcpy(buffers.pColors[nSlot], pColor, cColorPixels * sizeof(RGBQUAD));
+                memcpy(buffers.pDepths[nSlot], frames[0].pDepthBuffer, cDepthPixels * sizeof(UINT16));
+                memcpy(buffers.pBodyIndices[nSlot], frames[0].pBodyIndexBuffer, cDepthPixels * sizeof(BYTE));
+
+                CompositeFrame(kernel, buffers.pDepthIndices, buffers.pBodyIndices[nSlot], cDepthWidth, cDepthHeight,
+                    buffers.pColors[nSlot], buffers.pBackground, buffers.pOutputs[i % cPoolOutputSurfaces], 0, cColorPixels);
+            };
+
+            for (int i = 0; i < std::max(cPoolFrameSlots, cPoolOutputSurfaces); ++i)
+            {
+                runFrame(i);
+            }
+
+            const auto firstFrames = std::chrono::steady_clock::now();
+            const int64_t nFirstFrameFaults = GetPageFaultCount();
+
+            uint64_t nTlbMisses = 0;
+            double fSeconds = TimeFrames(nFrameCount, [&](int i)
+            {
+                tlbMisses.Start();
+                runFrame(i);
+                nTlbMisses += tlbMisses.Stop();
+            });
+
+            // copied in, then the color, map, background and output passes of the kernel
+            const double fBytes = 2.0 * (cColorPixels * sizeof(RGBQUAD) + cDepthPixels * (sizeof(UINT16) + sizeof(BYTE))) +
+                double(cColorPixels) * (3 * sizeof(RGBQUAD) + sizeof(UINT)) + cDepthPixels;
+            results.push_back(MakeResult("pool", variants[nVariant], 1, fSeconds, cColorPixels, fBytes));
+
+            const FrameBufferPoolStats stats = pool.GetStats();
+            printf("             %.1f MB allocated in %.2f ms with %lld page faults, first frames %.2f ms with %lld",
+                nAllocatedBytes / 1e6,
+                std::chrono::duration<double, std::milli>(allocated - start).count(),
+                static_cast<long long>(nAllocatedFaults - nStartFaults),
+                std::chrono::duration<double, std::milli>(firstFrames - allocated).count(),
+                static_cast<long long>(nFirstFrameFaults - nAllocatedFaults));
+            if (nVariant != 0)
+            {
+                printf(", %.1f MB of %.1f MB reserved backed by huge pages", stats.nHugePageBytes / 1e6, stats.nArenaBytes / 1e6);
+            }
+            if (tlbMisses.IsAvailable())
+            {
+                printf(", %.0f dTLB misses per frame", double(nTlbMisses) / (cWarmupFrames + nFrameCount));
+            }
+            printf("\n");
+        }
+
+        const FrameBufferPoolStats shared = FrameBufferPool::GetShared().GetStats();
+        printf("             shared pool so far: %.1f MB peak, %llu buffers carved and %llu recycled%s\n",
+            shared.nHighWaterBytes / 1e6,
+            static_cast<unsigned long long>(shared.nCarved),
+            static_cast<unsigned long long>(shared.nRecycled),
+            tlbMisses.IsAvailable() ? "" : ", no dTLB counter");
+    }
+
+    // Depth resolution: the tiles stage's player composited per depth pixel
+    // and upscaled to each output size, against full color compositing
+    {
+        ThreadPool threadPool;
+        std::unique_ptr<UINT16[]> pDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pBodyIndex(new BYTE[cDepthPixels]);
+        const RGBQUAD* pColor = frames[0].pColorBuffer;
+        MakePlayerMask(cTilePlayerCoverage, 0, pDepth.get(), pBodyIndex.get());
+
+        {
+            std::unique_ptr<RGBQUAD[]> pOutput(new RGBQUAD[cColorPixels]);
+
+            FrameCompositor compositor;
+            compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+
+            double fSeconds = TimeFrames(nFrameCount, [&](int)
+            {
+                compositor.ProcessFrame(pDepth.get(), pColor, pBodyIndex.get(), pBackground.get(), pOutput.get());
+            });
+
+            results.push_back(MakeResult("depthres", "full", threadPool.GetThreadCount(), fSeconds, cColorPixels,
+                GetMappingBytes() + GetCompositeBytes()));
+        }
+
+        for (const int* pSize : cDepthResolutionSizes)
+        {
+            const int nOutputWidth = pSize[0];
+            const int nOutputHeight = pSize[1];
+            const int nOutputPixels = nOutputWidth * nOutputHeight;
+
+            std::unique_ptr<RGBQUAD[]> pScaledBackground(new RGBQUAD[nOutputPixels]);
+            std::unique_ptr<RGBQUAD[]> pOutput(new RGBQUAD[nOutputPixels]);
+            ScaleImage(pBackground.get(), cColorWidth, cColorHeight, pScaledBackground.get(), nOutputWidth, nOutputHeight);
+
+            FrameCompositor compositor;
+            compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            compositor.SetCompositeMode(CompositeMode_DepthResolution);
+            compositor.SetOutputSize(nOutputWidth, nOutputHeight);
+
+            double fSeconds = TimeFrames(nFrameCount, [&](int)
+            {
+                compositor.ProcessFrame(pDepth.get(), pColor, pBodyIndex.get(), pScaledBackground.get(), pOutput.get());
+            });
+
+            char szVariant[32];
+            snprintf(szVariant, sizeof(szVariant), "%dx%d", nOutputWidth, nOutputHeight);
+            results.push_back(MakeResult("depthres", szVariant, threadPool.GetThreadCount(), fSeconds, nOutputPixels,
+                GetDepthResolutionBytes(nOutputPixels)));
+        }
+    }
+
+    // YUY2: the whole frame converted across the pool and then composited,
+    // against the conversion fused into the kernel, every color pixel and the
+    // player regions only
+    {
+        ThreadPool threadPool;
+        std::unique_ptr<UINT16[]> pDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pBodyIndex(new BYTE[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pYuy2(new BYTE[cColorPixels * 2]);
+        std::unique_ptr<RGBQUAD[]> pConverted(new RGBQUAD[cColorPixels]);
+        std::unique_ptr<RGBQUAD[]> pOutput(new RGBQUAD[cColorPixels]);
+
+        MakePlayerMask(cTilePlayerCoverage, 0, pDepth.get(), pBodyIndex.get());
+        EncodeYuy2(frames[0].pColorBuffer, cColorPixels, pYuy2.get());
+
+        const int nBands = threadPool.GetThreadCount() * 4;
+        const CompositeMode modes[] = {CompositeMode_Full, CompositeMode_PlayerRegions};
+
+        for (CompositeMode mode : modes)
+        {
+            const char* pszMode = (mode == CompositeMode_Full) ? "full" : "roi";
+
+            FrameCompositor compositor;
+            compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            compositor.SetCompositeMode(mode);
+
+            double fConvertSeconds = TimeFrames(nFrameCount, [&](int)
+            {
+                threadPool.ParallelFor(nBands, [&](int band)
+                {
+                    ConvertYuy2ToBgra(
+                        compositor.GetCompositeKernel(),
+                        pYuy2.get(),
+                        pConverted.get(),
+                        static_cast<int>(int64_t(cColorPixels) * band / nBands),
+                        static_cast<int>(int64_t(cColorPixels) * (band + 1) / nBands));
+                });
+
+                compositor.ProcessFrame(pDepth.get(), pConverted.get(), pBodyIndex.get(), pBackground.get(), pOutput.get());
+            });
+
+            double fFusedSeconds = TimeFrames(nFrameCount, [&](int)
+            {
+                compositor.ProcessFrame(pDepth.get(), pYuy2.get(), ColorFormat_Yuy2, pBodyIndex.get(), pBackground.get(), pOutput.get());
+            });
+
+            const double fBytes = (mode == CompositeMode_Full) ?
+                GetMappingBytes() + GetCompositeBytes() :
+                GetPlayerRegionBytes(compositor.GetPlayerCoverage(), false);
+
+            results.push_back(MakeResult("yuy2", std::string("convert-") + pszMode, threadPool.GetThreadCount(),
+                fConvertSeconds, cColorPixels, fBytes + GetYuy2ConversionBytes()));
+            results.push_back(MakeResult("yuy2", std::string("fused-") + pszMode, threadPool.GetThreadCount(),
+                fFusedSeconds, cColorPixels, fBytes));
+        }
+
+        printf("             conversion within %d of exact BT.601 for every YUV value\n", GetYuy2MaxDeviation());
+    }
+
+    // Low memory: full frames mapped in one piece against mapped and
+    // composited in row blocks, in both color formats
+    {
+        ThreadPool threadPool;
+        std::unique_ptr<UINT16[]> pDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pBodyIndex(new BYTE[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pYuy2(new BYTE[cColorPixels * 2]);
+        std::unique_ptr<RGBQUAD[]> pOutputs[2];
+
+        MakePlayerMask(cTilePlayerCoverage, 0, pDepth.get(), pBodyIndex.get());
+        EncodeYuy2(frames[0].pColorBuffer, cColorPixels, pYuy2.get());
+
+        const ColorFormat formats[] = {ColorFormat_Bgra, ColorFormat_Yuy2};
+        for (ColorFormat format : formats)
+        {
+            const BYTE* pColor = (format == ColorFormat_Yuy2) ? pYuy2.get() : reinterpret_cast<const BYTE*>(frames[0].pColorBuffer);
+            const size_t nColorBytesPerPixel = (format == ColorFormat_Yuy2) ? 2 : sizeof(RGBQUAD);
+            const char* pszFormat = (format == ColorFormat_Yuy2) ? "yuy2" : "bgra";
+
+            for (int nLowMemory = 0; nLowMemory < 2; ++nLowMemory)
+            {
+                pOutputs[nLowMemory].reset(new RGBQUAD[cColorPixels]);
+
+                // the frame buffers are the memory that differs between the
+                // modes, the process's peak resident size only ever grows
+                FrameBufferPool::GetShared().ResetHighWaterMark();
+                const size_t nPoolBytes = FrameBufferPool::GetShared().GetStats().nBytesInUse;
+                {
+                    FrameCompositor compositor;
+                    compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+                    compositor.SetLowMemory(nLowMemory != 0);
+
+                    const double fSeconds = TimeFrames(nFrameCount, [&](int)
+                    {
+                        compositor.ProcessFrame(pDepth.get(), pColor, format, pBodyIndex.get(), pBackground.get(), pOutputs[nLowMemory].get());
+                    });
+
+                    const FrameBufferPoolStats stats = FrameBufferPool::GetShared().GetStats();
+
+                    const double fBytes = nLowMemory ?
+                        GetRowBlockBytes(nColorBytesPerPixel) :
+                        GetMappingBytes() + GetCompositeBytes() - double(cColorPixels) * (sizeof(RGBQUAD) - nColorBytesPerPixel);
+
+                    results.push_back(MakeResult("lowmem", std::string(nLowMemory ? "blocks-" : "full-") + pszFormat,
+                        threadPool.GetThreadCount(), fSeconds, cColorPixels, fBytes));
+                    printf("             frame buffers %.1f MB at peak, %.1f MB held between frames, %.1f MB moved per frame\n",
+                        (stats.nHighWaterBytes - nPoolBytes) / 1e6, (stats.nBytesInUse - nPoolBytes) / 1e6, fBytes / 1e6);
+                }
+            }
+
+            const bool bIdentical = memcmp(pOutputs[0].get(), pOutputs[1].get(), cColorPixels * sizeof(RGBQUAD)) == 0;
+            printf("             %s output of both %s\n", pszFormat, bIdentical ? "identical" : "DIFFERS");
+        }
+    }
+
+    // Resolution: the synthetic source at each geometry, one compositor and
+    // mapper following it from size to size; timed flat out, then paced like
+    // a sensor through the app's pipeline
+    {
+        ThreadPool threadPool;
+        SoftwareCoordinateMapper resolutionMapper;
+        FrameCompositor compositor;
+        resolutionMapper.Initialize(calibration);
+        compositor.Initialize(&resolutionMapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+
+        double fKinectNanosecondsPerPixel = 0.0;
+        for (const int* pGeometry : cResolutionGeometries)
+        {
+            const int nDepthWidth = pGeometry[0];
+            const int nDepthHeight = pGeometry[1];
+            const int nColorWidth = pGeometry[2];
+            const int nColorHeight = pGeometry[3];
+            const int nColorPixels = nColorWidth * nColorHeight;
+
+            TimerFrameSource source;
+            PipelineFrame frame;
+            source.Initialize(nDepthWidth, nDepthHeight, nColorWidth, nColorHeight, std::chrono::microseconds(1));
+            source.WaitForFrame(std::chrono::milliseconds(1));
+            if (FAILED(source.AcquireFrame(&frame)))
+            {
+                continue;
+            }
+
+            std::unique_ptr<RGBQUAD[]> pScaledBackground(new RGBQUAD[nColorPixels]);
+            std::unique_ptr<RGBQUAD[]> pResolutionOutput(new RGBQUAD[nColorPixels]);
+            ScaleImage(pBackground.get(), cColorWidth, cColorHeight, pScaledBackground.get(), nColorWidth, nColorHeight);
+
+            // the mapper's tables rebuilt, then the first frame allocating
+            // the compositor's buffers
+            const auto switchStart = std::chrono::steady_clock::now();
+            compositor.SetOutputSize(nColorWidth, nColorHeight);
+            const HRESULT hr = compositor.ProcessFrame(
+                frame.GetDepthView(), frame.GetColorView(), frame.GetBodyIndexView(), pScaledBackground.get(), pResolutionOutput.get());
+            const double fSwitchMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - switchStart).count();
+            if (FAILED(hr))
+            {
+                fprintf(stderr, "cannot composite %dx%d depth with %dx%d color\n", nDepthWidth, nDepthHeight, nColorWidth, nColorHeight);
+                continue;
+            }
+
+            const double fSeconds = TimeFrames(nFrameCount, [&](int)
+            {
+                compositor.ProcessFrame(
+                    frame.GetDepthView(), frame.GetColorView(), frame.GetBodyIndexView(), pScaledBackground.get(), pResolutionOutput.get());
+            });
+
+            char szVariant[32];
+            snprintf(szVariant, sizeof(szVariant), "%dx%d-%dp", nDepthWidth, nDepthHeight, nColorHeight);
+            const StageResult result = MakeResult("resolution", szVariant, threadPool.GetThreadCount(), fSeconds, nColorPixels,
+                GetFrameBytes(nColorPixels, double(nDepthWidth) * nDepthHeight));
+            results.push_back(result);
+
+            if (fKinectNanosecondsPerPixel == 0.0)
+            {
+                fKinectNanosecondsPerPixel = result.fNanosecondsPerPixel;
+            }
+
+            // the same frames released on the sensor's clock; the source
+            // skips ticks nobody acquired in time, the pipeline drops frames
+            // the processing thread had no time for
+            TimerFrameSource pacedSource;
+            pacedSource.Initialize(nDepthWidth, nDepthHeight, nColorWidth, nColorHeight,
+                std::chrono::microseconds(1000000 / cResolutionFrameRate));
+
+            FramePipelineCallbacks callbacks;
+            callbacks.process = [&](const PipelineFrame& pacedFrame, RGBQUAD* pOutput)
+            {
+                compositor.ProcessFrame(
+                    pacedFrame.GetDepthView(), pacedFrame.GetColorView(), pacedFrame.GetBodyIndexView(), pScaledBackground.get(), pOutput);
+            };
+
+            FramePipeline pipeline;
+            pipeline.Start(&pacedSource, callbacks, nColorWidth, nColorHeight);
+            std::this_thread::sleep_for(std::chrono::microseconds(int64_t(nFrameCount) * 1000000 / cResolutionFrameRate));
+            pipeline.Stop();
+
+            const FramePipelineStats stats = pipeline.GetStats();
+            printf("             %s kernels, switched in %.1f ms, %.2fx the Kinect's ns/px; at %d fps %llu of %llu frames composited\n",
+                HasFixedCompositeGeometry(nDepthWidth, nDepthHeight) ? "fixed" : "generic",
+                fSwitchMilliseconds,
+                result.fNanosecondsPerPixel / fKinectNanosecondsPerPixel,
+                cResolutionFrameRate,
+                static_cast<unsigned long long>(stats.nProcessed),
+                static_cast<unsigned long long>(stats.nAcquired + pacedSource.GetSkippedFrameCount()));
+        }
+    }
+
+    // Depth keying: the mask kernel alone, on the range and against a learned
+    // background, then whole frames with the players keyed from depth against
+    // taken from the body index frame
+    {
+        ThreadPool threadPool;
+        std::unique_ptr<UINT16[]> pEmptyDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<UINT16[]> pDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pBodyIndex(new BYTE[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pKeyed(new BYTE[cDepthPixels]);
+
+        // the scene without players is the background to learn, the players
+        // stand at 1500 mm in front of the 2000 to 4000 mm ramp
+        MakePlayerMask(0.0, 0, pEmptyDepth.get(), pBodyIndex.get());
+        const double fCoverage = MakePlayerMask(cTilePlayerCoverage, 0, pDepth.get(), pBodyIndex.get());
+
+        // every depth, boundary values and no depth included, to hold the
+        // vector kernels to the scalar one
+        std::vector<UINT16> noiseDepth(cDepthPixels);
+        std::vector<UINT16> noiseBackground(cDepthPixels);
+        std::vector<BYTE> scalarKeyed(cDepthPixels);
+        std::vector<BYTE> vectorKeyed(cDepthPixels);
+        uint32_t nSeed = 1;
+        for (int i = 0; i < cDepthPixels; ++i)
+        {
+            nSeed = nSeed * 1664525 + 1013904223;
+            noiseDepth[i] = (i % 7 == 0) ? 0 : static_cast<UINT16>(nSeed >> 16);
+            noiseBackground[i] = (i % 5 == 0) ? 0 : static_cast<UINT16>(noiseDepth[i] + (nSeed >> 8) % 256 - 64);
+        }
+
+        const CompositeKernelType kernels[] = {CompositeKernel_Scalar, CompositeKernel_Sse41, CompositeKernel_Avx2};
+        for (CompositeKernelType kernel : kernels)
+        {
+            if (!IsCompositeKernelSupported(kernel))
+            {
+                continue;
+            }
+
+            bool bIdentical = true;
+            for (int nBackground = 0; nBackground < 2; ++nBackground)
+            {
+                const UINT16* pNoiseBackground = nBackground ? noiseBackground.data() : nullptr;
+                KeyDepthRange(CompositeKernel_Scalar, noiseDepth.data(), pNoiseBackground, 0, 40000, 100, scalarKeyed.data(), 0, cDepthPixels);
+                KeyDepthRange(kernel, noiseDepth.data(), pNoiseBackground, 0, 40000, 100, vectorKeyed.data(), 0, cDepthPixels);
+                bIdentical = bIdentical && scalarKeyed == vectorKeyed;
+            }
+
+            for (int nBackground = 0; nBackground < 2; ++nBackground)
+            {
+                // the range alone keys the players out of the ramp, against
+                // the background the range takes in the whole ramp
+                const UINT16* pBackgroundDepth = nBackground ? pEmptyDepth.get() : nullptr;
+                const UINT16 nFarDepth = nBackground ? 4500 : 1800;
+
+                const double fSeconds = TimeFrames(nFrameCount, [&](int)
+                {
+                    KeyDepthRange(kernel, pDepth.get(), pBackgroundDepth, 500, nFarDepth,
+                        DepthKeyer::cDefaultBackgroundMargin, pKeyed.get(), 0, cDepthPixels);
+                });
+
+                bIdentical = bIdentical && memcmp(pKeyed.get(), pBodyIndex.get(), cDepthPixels) == 0;
+
+                results.push_back(MakeResult("depthkey", std::string(nBackground ? "bg-" : "range-") + GetCompositeKernelName(kernel),
+                    1, fSeconds, cDepthPixels, double(cDepthPixels) * (nBackground ? 5 : 3)));
+            }
+
+            printf("             %s mask %s\n", GetCompositeKernelName(kernel), bIdentical ? "matches" : "DIFFERS");
+        }
+
+        std::unique_ptr<RGBQUAD[]> pOutputs[2];
+        const CompositeMode modes[] = {CompositeMode_Full, CompositeMode_PlayerRegions};
+        for (CompositeMode mode : modes)
+        {
+            const char* pszMode = (mode == CompositeMode_Full) ? "full" : "roi";
+
+            double seconds[2] = {};
+            for (int nKeyed = 0; nKeyed < 2; ++nKeyed)
+            {
+                pOutputs[nKeyed].reset(new RGBQUAD[cColorPixels]);
+
+                FrameCompositor compositor;
+                compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+                compositor.SetCompositeMode(mode);
+
+                if (nKeyed)
+                {
+                    // one frame of the empty scene learns the background,
+                    // the body index frame is not passed from then on
+                    compositor.SetSegmentationMode(SegmentationMode_DepthRange);
+                    compositor.GetDepthKeyer().SetDepthRange(500, 4500);
+                    compositor.GetDepthKeyer().SetBackgroundFrames(1);
+                    compositor.ProcessFrame(pEmptyDepth.get(), frames[0].pColorBuffer, nullptr, pBackground.get(), pOutputs[nKeyed].get());
+                }
+
+                seconds[nKeyed] = TimeFrames(nFrameCount, [&](int)
+                {
+                    compositor.ProcessFrame(pDepth.get(), frames[0].pColorBuffer, nKeyed ? nullptr : pBodyIndex.get(),
+                        pBackground.get(), pOutputs[nKeyed].get());
+                });
+
+                const double fBytes = ((mode == CompositeMode_Full) ?
+                    GetMappingBytes() + GetCompositeBytes() :
+                    GetPlayerRegionBytes(compositor.GetPlayerCoverage(), false)) + (nKeyed ? double(cDepthPixels) * 6 : 0.0);
+
+                results.push_back(MakeResult("depthkey", std::string(nKeyed ? "keyed-" : "bodyindex-") + pszMode,
+                    threadPool.GetThreadCount(), seconds[nKeyed], cColorPixels, fBytes));
+            }
+
+            const bool bIdentical = memcmp(pOutputs[0].get(), pOutputs[1].get(), cColorPixels * sizeof(RGBQUAD)) == 0;
+            printf("             %s: %.0f%% players, keying adds %.3f ms per frame, output %s\n",
+                pszMode, fCoverage * 100.0, (seconds[1] - seconds[0]) * 1e3, bIdentical ? "identical" : "DIFFERS");
+        }
+    }
+
+    // Matte refinement: each level alone, the blending kernels against the
+    // scalar one and the hard edges, then whole frames at each level
+    {
+        ThreadPool singleThread(1);
+        ThreadPool threadPool;
+        std::unique_ptr<UINT16[]> pDepth(new UINT16[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pBodyIndex(new BYTE[cDepthPixels]);
+        std::unique_ptr<BYTE[]> pYuy2(new BYTE[cColorPixels * 2]);
+        std::vector<BYTE> alphaMatte(cDepthPixels);
+        std::vector<BYTE> coverage(cDepthPixels);
+        const RGBQUAD* pColor = frames[0].pColorBuffer;
+
+        MakePlayerMask(cTilePlayerCoverage, 0, pDepth.get(), pBodyIndex.get());
+        EncodeYuy2(pColor, cColorPixels, pYuy2.get());
+
+        // the sensor's mask flickers along the edge and leaves specks about,
+        // a pixel in fifty flipped stands in for that
+        uint32_t nSeed = 1;
+        for (int i = 0; i < cDepthPixels; ++i)
+        {
+            nSeed = nSeed * 1664525 + 1013904223;
+            if ((nSeed >> 16) % 50 == 0)
+            {
+                pBodyIndex[i] = (pBodyIndex[i] == 0xff) ? 0 : 0xff;
+            }
+        }
+
+        const MatteRefinement refinements[] = {MatteRefinement_None, MatteRefinement_Feather, MatteRefinement_Clean};
+        MatteRefiner refiner;
+        refiner.Initialize(cDepthWidth, cDepthHeight);
+
+        for (MatteRefinement refinement : refinements)
+        {
+            const double fSeconds = TimeFrames(nFrameCount, [&](int)
+            {
+                refiner.Refine(refinement, pBodyIndex.get(), &singleThread, 1, alphaMatte.data(), coverage.data());
+            });
+
+            int nSoft = 0;
+            for (BYTE alpha : alphaMatte)
+            {
+                nSoft += (alpha != 0 && alpha != 0xff) ? 1 : 0;
+            }
+
+            results.push_back(MakeResult("matte", std::string("refine-") + GetMatteRefinementName(refinement),
+                1, fSeconds, cDepthPixels, double(cDepthPixels) * ((refinement == MatteRefinement_Clean) ? 22 : 8)));
+            printf("             %s: %.3f ms, %.1f%% of the depth pixels partly transparent\n",
+                GetMatteRefinementName(refinement), fSeconds * 1e3, nSoft * 100.0 / cDepthPixels);
+        }
+
+        // every alpha, against a matte of the players at 255
+        std::vector<BYTE> noiseMatte(cDepthPixels);
+        std::vector<BYTE> binaryMatte(cDepthPixels);
+        for (int i = 0; i < cDepthPixels; ++i)
+        {
+            nSeed = nSeed * 1664525 + 1013904223;
+            noiseMatte[i] = static_cast<BYTE>(nSeed >> 24);
+            binaryMatte[i] = (pBodyIndex[i] == 0xff) ? 0 : 0xff;
+        }
+
+        std::unique_ptr<RGBQUAD[]> pReference(new RGBQUAD[cColorPixels]);
+        std::unique_ptr<RGBQUAD[]> pOutput(new RGBQUAD[cColorPixels]);
+        const DepthMapFormat formats[] = {DepthMapFormat_Points, DepthMapFormat_Indices};
+        const CompositeKernelType kernels[] = {CompositeKernel_Scalar, CompositeKernel_Sse41, CompositeKernel_Avx2};
+        int nCompared = 0;
+        int nMismatched = 0;
+
+        for (DepthMapFormat format : formats)
+        {
+            FrameCompositor compositor;
+            compositor.Initialize(&mapper, &singleThread, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            compositor.SetDepthMapFormat(format);
+            compositor.MapFrame(pDepth.get());
+
+            const bool bIndices = (compositor.GetMappedFormat() == DepthMapFormat_Indices);
+            auto composite = [&](CompositeKernelType kernel, bool bYuy2, const BYTE* pMatte, RGBQUAD* pTarget)
+            {
+                // odd ends take the scalar lead-in and tail of the YUY2 pairs
+                const int nBegin = 1;
+                const int nEnd = cColorPixels - 1;
+                if (bYuy2 && bIndices)
+                {
+                    CompositeFrameMatteYuy2(kernel, compositor.GetDepthIndices(), pMatte, cDepthWidth, cDepthHeight,
+                        pYuy2.get(), pBackground.get(), pTarget, nBegin, nEnd);
+                }
+                else if (bYuy2)
+                {
+                    CompositeFrameMatteYuy2(kernel, compositor.GetDepthCoordinates(), pMatte, cDepthWidth, cDepthHeight,
+                        pYuy2.get(), pBackground.get(), pTarget, nBegin, nEnd);
+                }
+                else if (bIndices)
+                {
+                    CompositeFrameMatte(kernel, compositor.GetDepthIndices(), pMatte, cDepthWidth, cDepthHeight,
+                        pColor, pBackground.get(), pTarget, nBegin, nEnd);
+                }
+                else
+                {
+                    CompositeFrameMatte(kernel, compositor.GetDepthCoordinates(), pMatte, cDepthWidth, cDepthHeight,
+                        pColor, pBackground.get(), pTarget, nBegin, nEnd);
+                }
+            };
+
+            for (int nYuy2 = 0; nYuy2 < 2; ++nYuy2)
+            {
+                composite(CompositeKernel_Scalar, nYuy2 != 0, noiseMatte.data(), pReference.get());
+
+                for (CompositeKernelType kernel : kernels)
+                {
+                    if (!IsCompositeKernelSupported(kernel))
+                    {
+                        continue;
+                    }
+
+                    composite(kernel, nYuy2 != 0, noiseMatte.data(), pOutput.get());
+                    ++nCompared;
+                    nMismatched += (memcmp(pReference.get() + 1, pOutput.get() + 1, (cColorPixels - 2) * sizeof(RGBQUAD)) != 0) ? 1 : 0;
+
+                    // hard edges through the compositor, which composites
+                    // the whole frame
+                    compositor.SetCompositeKernel(kernel);
+                    compositor.Composite(nYuy2 ? pYuy2.get() : reinterpret_cast<const BYTE*>(pColor),
+                        nYuy2 ? ColorFormat_Yuy2 : ColorFormat_Bgra, pBodyIndex.get(), pBackground.get(), pReference.get());
+                    composite(kernel, nYuy2 != 0, binaryMatte.data(), pOutput.get());
+                    ++nCompared;
+                    nMismatched += (memcmp(pReference.get() + 1, pOutput.get() + 1, (cColorPixels - 2) * sizeof(RGBQUAD)) != 0) ? 1 : 0;
+
+                    composite(CompositeKernel_Scalar, nYuy2 != 0, noiseMatte.data(), pReference.get());
+                }
+            }
+        }
+
+        printf("             %d of %d blended frames match the scalar kernel and the hard edges\n",
+            nCompared - nMismatched, nCompared);
+
+        const CompositeMode modes[] = {CompositeMode_Full, CompositeMode_PlayerRegions};
+        for (CompositeMode mode : modes)
+        {
+            const char* pszMode = (mode == CompositeMode_Full) ? "full" : "roi";
+
+            FrameCompositor compositor;
+            compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            compositor.SetCompositeMode(mode);
+
+            double fHardSeconds = 0.0;
+            for (MatteRefinement refinement : refinements)
+            {
+                compositor.SetMatteRefinement(refinement);
+
+                const double fSeconds = TimeFrames(nFrameCount, [&](int)
+                {
+                    compositor.ProcessFrame(pDepth.get(), pColor, pBodyIndex.get(), pBackground.get(), pOutput.get());
+                });
+
+                if (refinement == MatteRefinement_None)
+                {
+                    fHardSeconds = fSeconds;
+                }
+
+                const double fBytes = (mode == CompositeMode_Full) ?
+                    GetMappingBytes() + GetCompositeBytes() :
+                    GetPlayerRegionBytes(compositor.GetPlayerCoverage(), false);
+
+                results.push_back(MakeResult("matte", std::string(pszMode) + "-" + GetMatteRefinementName(refinement),
+                    threadPool.GetThreadCount(), fSeconds, cColorPixels, fBytes));
+                printf("             %s %s: %.3f ms per frame, %+.3f ms against hard edges\n",
+                    pszMode, GetMatteRefinementName(refinement), fSeconds * 1e3, (fSeconds - fHardSeconds) * 1e3);
+            }
+        }
+    }
+
+    // Video background: a frame decoded and scaled on the calling thread, then
+    // the compositor at the sensor's pace over whatever the ring holds
+    if (WriteVideo(cVideoPath, cBackgroundWidth, cBackgroundHeight))
+    {
+        VideoBackground video;
+        if (SUCCEEDED(video.Open(cVideoPath, cColorWidth, cColorHeight)))
+        {
+            std::unique_ptr<RGBQUAD[]> pVideoFrame(new RGBQUAD[cColorPixels]);
+
+            double fSeconds = TimeFrames(nFrameCount, [&](int i)
+            {
+                video.DecodeFrame(i % video.GetFrameCount(), pVideoFrame.get());
+            });
+
+            // planes read, the decoded frame written then read by the scaler, output written
+            const double fSourcePixels = double(cBackgroundWidth) * cBackgroundHeight;
+            results.push_back(MakeResult("video", "decode", 1, fSeconds, cColorPixels,
+                1.5 * fSourcePixels + 2.0 * fSourcePixels * sizeof(RGBQUAD) + double(cColorPixels) * sizeof(RGBQUAD)));
+
+            ThreadPool threadPool;
+            FrameCompositor compositor;
+            compositor.Initialize(&mapper, &threadPool, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            compositor.MapFrame(frames[0].pDepthBuffer);
+
+            const std::chrono::microseconds period(1000000 / cVideoFrameRate);
+            const int64_t nTicksPerFrame = 10000000 / cVideoFrameRate;
+            auto nextFrame = std::chrono::steady_clock::now();
+            int64_t nTime = 0;
+
+            fSeconds = TimeFrames(nFrameCount,
+                [&](int)
+                {
+                    std::this_thread::sleep_until(nextFrame);
+                    nextFrame += period;
+                },
+                [&](int)
+                {
+                    int64_t nVideoFrame = 0;
+                    const RGBQUAD* pVideoBackground = video.GetFrame(nTime, &nVideoFrame);
+                    nTime += nTicksPerFrame;
+
+                    compositor.Composite(
+                        frames[0].pColorBuffer,
+                        frames[0].pBodyIndexBuffer,
+                        pVideoBackground ? pVideoBackground : pBackground.get(),
+                        pOutput.get());
+                });
+
+            results.push_back(MakeResult("video", "composite", threadPool.GetThreadCount(), fSeconds, cColorPixels, GetCompositeBytes()));
+
+            const VideoBackgroundStats stats = video.GetStats();
+            printf("             %llu of %llu frames found no decoded video frame, %.2f ms per decode on the ring's thread\n",
+                static_cast<unsigned long long>(stats.nMisses),
+                static_cast<unsigned long long>(stats.nRequests),
+                stats.nDecoded ? stats.fDecodeMilliseconds / stats.nDecoded : 0.0);
+        }
+
+        video.Close();
+        remove(cVideoPath);
+    }
+
+    // Encode: the composited frame into memory in every file format, PNG both
+    // on one thread and spread over the pool
+    std::vector<EncoderResult> encoders;
+    {
+        ThreadPool threadPool;
+        std::vector<BYTE> encoded;
+
+        const ImageFormat formats[] = {ImageFormat_Bmp, ImageFormat_Qoi, ImageFormat_Png, ImageFormat_Png};
+        for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i)
+        {
+            const ImageFormat format = formats[i];
+            ThreadPool* pThreadPool = (i + 1 == sizeof(formats) / sizeof(formats[0])) ? &threadPool : nullptr;
+
+            double fSeconds = TimeFrames(nFrameCount, [&](int)
+            {
+                EncodeImage(format, pOutput.get(), cColorWidth, cColorHeight, pThreadPool, &encoded);
+            });
+
+            EncoderResult encoder;
+            encoder.format = GetImageFormatName(format);
+            encoder.nThreads = pThreadPool ? pThreadPool->GetThreadCount() : 1;
+            encoder.fMedianMilliseconds = fSeconds * 1e3;
+            encoder.fMegabytesPerSecond = 3.0 * cColorPixels / fSeconds / 1e6;
+            encoder.nBytes = encoded.size();
+            encoder.fRatioToBitmap = double(GetBitmapFileSize(cColorWidth, cColorHeight)) / encoded.size();
+            encoders.push_back(encoder);
+
+            // the frame is read and the file written
+            results.push_back(MakeResult("encode", encoder.format, encoder.nThreads, fSeconds, cColorPixels,
+                double(cColorPixels) * sizeof(RGBQUAD) + encoded.size()));
+            printf("             %.1f MB/s, %llu bytes, %.2fx smaller than bmp\n",
+                encoder.fMegabytesPerSecond, static_cast<unsigned long long>(encoder.nBytes), encoder.fRatioToBitmap);
+        }
+    }
+
+    // Screenshot as the frame thread sees it: encoded and written in place, or
+    // copied into a pooled buffer for the writer thread, which gets to finish
+    // between frames
+    {
+        const double fFrameBytes = double(cColorPixels) * sizeof(RGBQUAD);
+
+        double fSeconds = TimeFrames(nFrameCount, [&](int)
+        {
+            SaveBitmapFile(cScreenshotPath, pOutput.get(), cColorWidth, cColorHeight);
+        });
+
+        results.push_back(MakeResult("screenshot", "sync", 1, fSeconds, cColorPixels, 3.0 * fFrameBytes));
+
+        ScreenshotWriter writer;
+        writer.Initialize(cColorWidth, cColorHeight);
+
+        fSeconds = TimeFrames(nFrameCount,
+            [&](int)
+            {
+                writer.Flush();
+            },
+            [&](int)
+            {
+                writer.Submit(pOutput.get(), cScreenshotPath, nullptr);
+            });
+
+        writer.Flush();
+        remove(cScreenshotPath);
+
+        results.push_back(MakeResult("screenshot", "async", 1, fSeconds, cColorPixels, 2.0 * fFrameBytes));
+
+        // instant replay copies every presented frame into its ring
+        InstantReplayRing instantReplay;
+        instantReplay.Initialize(cColorWidth, cColorHeight, cInstantReplayFrames);
+
+        fSeconds = TimeFrames(nFrameCount, [&](int)
+        {
+            instantReplay.Push(pOutput.get());
+        });
+
+        results.push_back(MakeResult("replay", "push", 1, fSeconds, cColorPixels, 2.0 * fFrameBytes));
+    }
+
+    if (!options.jsonPath.empty())
+    {
+        WriteJson(options.jsonPath.c_str(), options, results, encoders, overhead);
+    }
+
+    return 0;
+}
@@ -0,0 +1,260 @@
+#include "BitmapFile.h"
+#include "MappedFile.h"
+#include "WindowsHelper.h"
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    // sizeof(BITMAPFILEHEADER) and sizeof(BITMAPINFOHEADER)
+    const size_t cFileHeaderSize = 14;
+    const size_t cInfoHeaderSize = 40;
+    const size_t cHeadersSize = cFileHeaderSize + cInfoHeaderSize;
+
+    const UINT16 cBitmapSignature = 0x4D42;   // 'M''B'
+    const UINT cBiRgb = 0;
+
+    // BMP fields are little endian and unaligned, so they are written byte by byte
+    void Put16(BYTE* p, UINT16 nValue)
+    {
+        p[0] = static_cast<BYTE>(nValue);
+        p[1] = static_cast<BYTE>(nValue >> 8);
+    }
+
+    void Put32(BYTE* p, UINT nValue)
+    {
+        p[0] = static_cast<BYTE>(nValue);
+        p[1] = static_cast<BYTE>(nValue >> 8);
+        p[2] = static_cast<BYTE>(nValue >> 16);
+        p[3] = static_cast<BYTE>(nValue >> 24);
+    }
+
+    UINT16 Get16(const BYTE* p)
+    {
+        return static_cast<UINT16>(p[0] | (p[1] << 8));
+    }
+
+    UINT Get32(const BYTE* p)
+    {
+        return UINT(p[0]) | (UINT(p[1]) << 8) | (UINT(p[2]) << 16) | (UINT(p[3]) << 24);
+    }
+
+    BYTE Lerp(BYTE a, BYTE b, BYTE c, BYTE d, UINT nWeightX, UINT nWeightY)
+    {
+        // 8 bit fixed point weights
+        const UINT top = a * (256 - nWeightX) + b * nWeightX;
+        const UINT bottom = c * (256 - nWeightX) + d * nWeightX;
+        return static_cast<BYTE>((top * (256 - nWeightY) + bottom * nWeightY + (1 << 15)) >> 16);
+    }
+}
+
+size_t GetBitmapFileSize(int nWidth, int nHeight)
+{
+    return cHeadersSize + size_t(nWidth) * nHeight * sizeof(RGBQUAD);
+}
+
+HRESULT EncodeBitmap(
+    const RGBQUAD* pPixels,
+    int nWidth,
+    int nHeight,
+    BYTE* pBuffer,
+    size_t nBufferSize)
+{
+    if (!pPixels || !pBuffer || nWidth <= 0 || nHeight <= 0 || nBufferSize < GetBitmapFileSize(nWidth, nHeight))
+    {
+        return E_INVALIDARG;
+    }
+
+    const UINT nImageSize = static_cast<UINT>(size_t(nWidth) * nHeight * sizeof(RGBQUAD));
+
+    memset(pBuffer, 0, cHeadersSize);
+
+    // BITMAPFILEHEADER
+    Put16(pBuffer + 0, cBitmapSignature);
+    Put32(pBuffer + 2, static_cast<UINT>(cHeadersSize) + nImageSize);    // bfSize
+    Put32(pBuffer + 10, static_cast<UINT>(cHeadersSize));               // bfOffBits
+
+    // BITMAPINFOHEADER, negative height means rows are stored top-down
+    BYTE* pInfo = pBuffer + cFileHeaderSize;
+    Put32(pInfo + 0, static_cast<UINT>(cInfoHeaderSize));               // biSize
+    Put32(pInfo + 4, static_cast<UINT>(nWidth));                        // biWidth
+    Put32(pInfo + 8, static_cast<UINT>(-nHeight));                      // biHeight
+    Put16(pInfo + 12, 1);                                               // biPlanes
+    Put16(pInfo + 14, 32);                                              // biBitCount
+    Put32(pInfo + 16, cBiRgb);                                          // biCompression
+    Put32(pInfo + 20, nImageSize);                                      // biSizeImage
+
+    memcpy(pBuffer + cHeadersSize, pPixels, nImageSize);
+
+    return S_OK;
+}
+
+HRESULT SaveBitmapFile(const char* pszPath, const RGBQUAD* pPixels, int nWidth, int nHeight)
+{
+    if (!pszPath)
+    {
+        return E_INVALIDARG;
+    }
+
+    std::vector<BYTE> encoded(GetBitmapFileSize(nWidth, nHeight));
+    V_RET(EncodeBitmap(pPixels, nWidth, nHeight, encoded.data(), encoded.size()));
+
+    FILE* pFile = fopen(pszPath, "wb");
+    if (!pFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    const bool bWritten = fwrite(encoded.data(), 1, encoded.size(), pFile) == encoded.size();
+    const bool bClosed = fclose(pFile) == 0;
+
+    return (bWritten && bClosed) ? S_OK : E_FAIL;
+}
+
+HRESULT DecodeBitmap(
+    const BYTE* pData,
+    size_t nSize,
+    std::vector<RGBQUAD>* pPixels,
+    int* pWidth,
+    int* pHeight)
+{
+    if (!pData || !pPixels || !pWidth || !pHeight)
+    {
+        return E_INVALIDARG;
+    }
+
+    V_CHECK_HR(nSize >= cHeadersSize && Get16(pData) == cBitmapSignature);
+
+    const BYTE* pInfo = pData + cFileHeaderSize;
+    const UINT nPixelOffset = Get32(pData + 10);
+    const UINT nInfoSize = Get32(pInfo + 0);
+    const int nWidth = static_cast<int>(Get32(pInfo + 4));
+    const int nSignedHeight = static_cast<int>(Get32(pInfo + 8));
+    const UINT nBitCount = Get16(pInfo + 14);
+    const UINT nCompression = Get32(pInfo + 16);
+
+    // BI_BITFIELDS with the default masks is common for 32bpp files
+    const bool bUncompressed = (nCompression == cBiRgb) || (nCompression == 3 && nBitCount == 32);
+
+    const int nHeight = (nSignedHeight < 0) ? -nSignedHeight : nSignedHeight;
+    V_CHECK_HR(nInfoSize >= cInfoHeaderSize && nWidth > 0 && nHeight > 0 && bUncompressed &&
+        (nBitCount == 24 || nBitCount == 32));
+
+    // rows are padded to 4 bytes
+    const size_t nBytesPerPixel = nBitCount / 8;
+    const size_t nStride = (size_t(nWidth) * nBytesPerPixel + 3) & ~size_t(3);
+    V_CHECK_HR(nPixelOffset <= nSize && nStride * nHeight <= nSize - nPixelOffset);
+
+    pPixels->resize(size_t(nWidth) * nHeight);
+
+    for (int y = 0; y < nHeight; ++y)
+    {
+        // positive heights are stored bottom-up
+        const int nSourceRow = (nSignedHeight < 0) ? y : (nHeight - 1 - y);
+        const BYTE* pSource = pData + nPixelOffset + nStride * nSourceRow;
+        RGBQUAD* pDestination = pPixels->data() + size_t(y) * nWidth;
+
+        if (nBitCount == 32)
+        {
+            memcpy(pDestination, pSource, nWidth * sizeof(RGBQUAD));
+            continue;
+        }
+
+        for (int x = 0; x < nWidth; ++x, pSource += 3)
+        {
+            pDestination[x].rgbBlue = pSource[0];
+            pDestination[x].rgbGreen = pSource[1];
+            pDestination[x].rgbRed = pSource[2];
+            pDestination[x].rgbReserved = 0xff;
+        }
+    }
+
+    *pWidth = nWidth;
+    *pHeight = nHeight;
+
+    return S_OK;
+}
+
+void ScaleImage(
+    const RGBQUAD* pSource,
+    int nSourceWidth,
+    int nSourceHeight,
+    RGBQUAD* pDestination,
+    int nDestinationWidth,
+    int nDestinationHeight)
+{
+    // 16.16 fixed point source position of each destination pixel center
+    const int64_t nStepX = (int64_t(nSourceWidth) << 16) / nDestinationWidth;
+    const int64_t nStepY = (int64_t(nSourceHeight) << 16) / nDestinationHeight;
+
+    for (int y = 0; y < nDestinationHeight; ++y)
+    {
+        int64_t nSourceY = (y * nStepY) + (nStepY >> 1) - (1 << 15);
+        if (nSourceY < 0)
+        {
+            nSourceY = 0;
+        }
+
+        const int y0 = static_cast<int>(nSourceY >> 16);
+        const int y1 = (y0 + 1 < nSourceHeight) ? y0 + 1 : y0;
+        const UINT nWeightY = static_cast<UINT>((nSourceY >> 8) & 0xff);
+
+        const RGBQUAD* pRow0 = pSource + size_t(y0) * nSourceWidth;
+        const RGBQUAD* pRow1 = pSource + size_t(y1) * nSourceWidth;
+        RGBQUAD* pOut = pDestination + size_t(y) * nDestinationWidth;
+
+        for (int x = 0; x < nDestinationWidth; ++x)
+        {
+            int64_t nSourceX = (x * nStepX) + (nStepX >> 1) - (1 << 15);
+            if (nSourceX < 0)
+            {
+                nSourceX = 0;
+            }
+
+            const int x0 = static_cast<int>(nSourceX >> 16);
+            const int x1 = (x0 + 1 < nSourceWidth) ? x0 + 1 : x0;
+            const UINT nWeightX = static_cast<UINT>((nSourceX >> 8) & 0xff);
+
+            const RGBQUAD& a = pRow0[x0];
+            const RGBQUAD& b = pRow0[x1];
+            const RGBQUAD& c = pRow1[x0];
+            const RGBQUAD& d = pRow1[x1];
+
+            pOut[x].rgbBlue = Lerp(a.rgbBlue, b.rgbBlue, c.rgbBlue, d.rgbBlue, nWeightX, nWeightY);
+            pOut[x].rgbGreen = Lerp(a.rgbGreen, b.rgbGreen, c.rgbGreen, d.rgbGreen, nWeightX, nWeightY);
+            pOut[x].rgbRed = Lerp(a.rgbRed, b.rgbRed, c.rgbRed, d.rgbRed, nWeightX, nWeightY);
+            pOut[x].rgbReserved = Lerp(a.rgbReserved, b.rgbReserved, c.rgbReserved, d.rgbReserved, nWeightX, nWeightY);
+        }
+    }
+}
+
+HRESULT LoadBackgroundImage(
+    const char* pszPath,
+    int nOutputWidth,
+    int nOutputHeight,
+    RGBQUAD* pOutputBuffer)
+{
+    if (!pOutputBuffer || nOutputWidth <= 0 || nOutputHeight <= 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    MappedFile file;
+    V_RET(file.Open(pszPath));
+
+    std::vector<RGBQUAD> pixels;
+    int nWidth = 0;
+    int nHeight = 0;
+    V_RET(DecodeBitmap(file.GetData(), static_cast<size_t>(file.GetSize()), &pixels, &nWidth, &nHeight));
+
+    if (nWidth == nOutputWidth && nHeight == nOutputHeight)
+    {
+        memcpy(pOutputBuffer, pixels.data(), pixels.size() * sizeof(RGBQUAD));
+    }
+    else
+    {
+        ScaleImage(pixels.data(), nWidth, nHeight, pOutputBuffer, nOutputWidth, nOutputHeight);
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "KinectTypes.h"
+
+// BMP files without windows.h: 32bpp top-down images as written for
+// screenshots, and uncompressed 24/32bpp images of either row order as
+// backgrounds.
+
+// Bytes of a 32bpp BMP file (headers included) holding nWidth x nHeight pixels
+size_t GetBitmapFileSize(int nWidth, int nHeight);
+
+// Writes a complete BMP file into pBuffer, which holds GetBitmapFileSize bytes
+HRESULT EncodeBitmap(
+    const RGBQUAD* pPixels,
+    int nWidth,
+    int nHeight,
+    BYTE* pBuffer,
+    size_t nBufferSize);
+
+HRESULT SaveBitmapFile(const char* pszPath, const RGBQUAD* pPixels, int nWidth, int nHeight);
+
+// Reads an uncompressed 24 or 32bpp BMP held in memory. 24bpp pixels come
+// back opaque.
+HRESULT DecodeBitmap(
+    const BYTE* pData,
+    size_t nSize,
+    std::vector<RGBQUAD>* pPixels,
+    int* pWidth,
+    int* pHeight);
+
+// Bilinear resize, used to fit backgrounds to the color frame
+void ScaleImage(
+    const RGBQUAD* pSource,
+    int nSourceWidth,
+    int nSourceHeight,
+    RGBQUAD* pDestination,
+    int nDestinationWidth,
+    int nDestinationHeight);
+
+// Loads a BMP background and scales it to nOutputWidth x nOutputHeight
+HRESULT LoadBackgroundImage(
+    const char* pszPath,
+    int nOutputWidth,
+    int nOutputHeight,
+    RGBQUAD* pOutputBuffer);
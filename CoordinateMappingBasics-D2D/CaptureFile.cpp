@@ -0,0 +1,432 @@
+#include "CaptureFile.h"
+#include "WindowsHelper.h"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace
+{
+    // RelativeTime is in 100ns ticks
+    typedef std::chrono::duration<int64_t, std::ratio<1, 10000000>> RelativeTicks;
+
+    inline uint64_t AlignUp(uint64_t nValue)
+    {
+        return (nValue + cCaptureAlignment - 1) & ~uint64_t(cCaptureAlignment - 1);
+    }
+
+    // where a section of nBytes at nOffset ends, and whether that is at or
+    // before nEnd without wrapping around
+    inline bool SectionFits(uint64_t nOffset, uint64_t nBytes, uint64_t nEnd)
+    {
+        return nOffset <= nEnd && nBytes <= nEnd - nOffset;
+    }
+
+    int SeekFile(FILE* pFile, uint64_t nOffset)
+    {
+#ifdef _WIN32
+        return _fseeki64(pFile, static_cast<int64_t>(nOffset), SEEK_SET);
+#else
+        return fseeko(pFile, static_cast<off_t>(nOffset), SEEK_SET);
+#endif
+    }
+}
+
+UINT GetCaptureColorBytesPerPixel(UINT nColorFormat)
+{
+    return (nColorFormat == CaptureColorFormat_Yuy2) ? 2 : 4;
+}
+
+CaptureWriter::CaptureWriter() :
+    m_pFile(nullptr)
+{
+    memset(&m_header, 0, sizeof(m_header));
+    memset(&m_frameLayout, 0, sizeof(m_frameLayout));
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    Close();
+}
+
+HRESULT CaptureWriter::Open(
+    const char* pszPath,
+    int nDepthWidth,
+    int nDepthHeight,
+    int nColorWidth,
+    int nColorHeight,
+    CaptureColorFormat colorFormat)
+{
+    Close();
+
+    if (!pszPath || nDepthWidth <= 0 || nDepthHeight <= 0 || nColorWidth <= 0 || nColorHeight <= 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_pFile = fopen(pszPath, "wb");
+    if (!m_pFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    // frames are large, let the CRT hand them straight to the OS
+    setvbuf(m_pFile, nullptr, _IONBF, 0);
+
+    memset(&m_header, 0, sizeof(m_header));
+    m_header.nMagic = cCaptureMagic;
+    m_header.nVersion = cCaptureVersion;
+    m_header.nDepthWidth = nDepthWidth;
+    m_header.nDepthHeight = nDepthHeight;
+    m_header.nColorWidth = nColorWidth;
+    m_header.nColorHeight = nColorHeight;
+    m_header.nColorFormat = colorFormat;
+
+    const uint64_t nDepthPixels = uint64_t(nDepthWidth) * nDepthHeight;
+    const uint64_t nColorBytes = uint64_t(nColorWidth) * nColorHeight * GetCaptureColorBytesPerPixel(colorFormat);
+
+    m_frameLayout.nDepthOffset = AlignUp(sizeof(CaptureFrameHeader));
+    m_frameLayout.nColorOffset = m_frameLayout.nDepthOffset + AlignUp(nDepthPixels * sizeof(UINT16));
+    m_frameLayout.nBodyIndexOffset = m_frameLayout.nColorOffset + AlignUp(nColorBytes);
+    m_header.nFrameSize = m_frameLayout.nBodyIndexOffset + AlignUp(nDepthPixels);
+
+    m_index.clear();
+
+    // placeholder header, rewritten on close once the frame count is known
+    return WriteSection(&m_header, sizeof(m_header), AlignUp(sizeof(m_header)));
+}
+
+HRESULT CaptureWriter::WriteSection(const void* pData, uint64_t nBytes, uint64_t nPaddedBytes)
+{
+    static const BYTE padding[cCaptureAlignment] = {0};
+
+    if (fwrite(pData, 1, static_cast<size_t>(nBytes), m_pFile) != nBytes)
+    {
+        return E_FAIL;
+    }
+
+    const size_t nPadding = static_cast<size_t>(nPaddedBytes - nBytes);
+    if (nPadding && fwrite(padding, 1, nPadding, m_pFile) != nPadding)
+    {
+        return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+HRESULT CaptureWriter::WriteFrame(
+    int64_t nRelativeTime,
+    const UINT16* pDepthBuffer,
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer)
+{
+    if (!m_pFile)
+    {
+        return E_FAIL;
+    }
+
+    if (!pDepthBuffer || !pColorBuffer || !pBodyIndexBuffer)
+    {
+        return E_INVALIDARG;
+    }
+
+    const uint64_t nDepthPixels = uint64_t(m_header.nDepthWidth) * m_header.nDepthHeight;
+    const uint64_t nColorBytes = uint64_t(m_header.nColorWidth) * m_header.nColorHeight * GetCaptureColorBytesPerPixel(m_header.nColorFormat);
+
+    CaptureIndexEntry entry;
+    entry.nRelativeTime = nRelativeTime;
+    entry.nOffset = AlignUp(sizeof(m_header)) + uint64_t(m_header.nFrameCount) * m_header.nFrameSize;
+
+    CaptureFrameHeader frameHeader = m_frameLayout;
+    frameHeader.nRelativeTime = nRelativeTime;
+
+    const CaptureFrameHeader& layout = m_frameLayout;
+    V_RET(WriteSection(&frameHeader, sizeof(frameHeader), layout.nDepthOffset));
+    V_RET(WriteSection(pDepthBuffer, nDepthPixels * sizeof(UINT16), layout.nColorOffset - layout.nDepthOffset));
+    V_RET(WriteSection(pColorBuffer, nColorBytes, layout.nBodyIndexOffset - layout.nColorOffset));
+    V_RET(WriteSection(pBodyIndexBuffer, nDepthPixels, m_header.nFrameSize - layout.nBodyIndexOffset));
+
+    m_index.push_back(entry);
+    ++m_header.nFrameCount;
+
+    return S_OK;
+}
+
+HRESULT CaptureWriter::Close()
+{
+    if (!m_pFile)
+    {
+        return S_OK;
+    }
+
+    HRESULT hr = S_OK;
+
+    m_header.nIndexOffset = AlignUp(sizeof(m_header)) + uint64_t(m_header.nFrameCount) * m_header.nFrameSize;
+    if (!m_index.empty() &&
+        fwrite(m_index.data(), sizeof(CaptureIndexEntry), m_index.size(), m_pFile) != m_index.size())
+    {
+        hr = E_FAIL;
+    }
+
+    if (SUCCEEDED(hr) &&
+        (SeekFile(m_pFile, 0) != 0 || fwrite(&m_header, sizeof(m_header), 1, m_pFile) != 1))
+    {
+        hr = E_FAIL;
+    }
+
+    fclose(m_pFile);
+    m_pFile = nullptr;
+    m_index.clear();
+
+    return hr;
+}
+
+CaptureReader::CaptureReader() :
+    m_pIndex(nullptr)
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+HRESULT CaptureReader::Open(const char* pszPath)
+{
+    Close();
+
+    V_RET(m_file.Open(pszPath));
+
+    const BYTE* pData = m_file.GetData();
+    const uint64_t nSize = m_file.GetSize();
+
+    // Every size in the header is checked against the mapping before any
+    // product of them is formed, so a damaged or truncated file fails here
+    // or in GetFrame instead of reading past the end of the mapping
+    HRESULT hr = E_FAIL;
+    if (nSize >= AlignUp(sizeof(CaptureFileHeader)))
+    {
+        memcpy(&m_header, pData, sizeof(m_header));
+
+        const uint64_t nFramesBegin = AlignUp(sizeof(m_header));
+        const uint64_t nFramesSpace = nSize - nFramesBegin;
+        if (m_header.nMagic == cCaptureMagic &&
+            m_header.nVersion == cCaptureVersion &&
+            m_header.nDepthWidth > 0 && m_header.nDepthHeight > 0 &&
+            m_header.nColorWidth > 0 && m_header.nColorHeight > 0 &&
+            (m_header.nColorFormat == CaptureColorFormat_Bgra || m_header.nColorFormat == CaptureColorFormat_Yuy2) &&
+            m_header.nFrameSize >= sizeof(CaptureFrameHeader) &&
+            m_header.nFrameSize % cCaptureAlignment == 0 &&
+            m_header.nFrameCount <= nFramesSpace / m_header.nFrameSize &&
+            m_header.nIndexOffset == nFramesBegin + uint64_t(m_header.nFrameCount) * m_header.nFrameSize &&
+            m_header.nFrameCount <= (nSize - m_header.nIndexOffset) / sizeof(CaptureIndexEntry))
+        {
+            m_pIndex = reinterpret_cast<const CaptureIndexEntry*>(pData + m_header.nIndexOffset);
+            hr = S_OK;
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        Close();
+    }
+
+    return hr;
+}
+
+void CaptureReader::Close()
+{
+    m_file.Close();
+    memset(&m_header, 0, sizeof(m_header));
+    m_pIndex = nullptr;
+}
+
+HRESULT CaptureReader::GetFrame(UINT nFrame, CaptureFrame* pFrame) const
+{
+    if (!m_pIndex || nFrame >= m_header.nFrameCount || !pFrame)
+    {
+        return E_INVALIDARG;
+    }
+
+    // the index and the frame headers are trusted no more than the file
+    // header: the frame lies inside the mapping, its sections inside the
+    // frame and aligned for the vector kernels
+    const uint64_t nOffset = m_pIndex[nFrame].nOffset;
+    if (nOffset % cCaptureAlignment != 0 || !SectionFits(nOffset, m_header.nFrameSize, m_file.GetSize()))
+    {
+        return E_FAIL;
+    }
+
+    const BYTE* pBase = m_file.GetData() + nOffset;
+    const CaptureFrameHeader* pHeader = reinterpret_cast<const CaptureFrameHeader*>(pBase);
+
+    const uint64_t nDepthPixels = uint64_t(m_header.nDepthWidth) * m_header.nDepthHeight;
+    const uint64_t nColorBytes = uint64_t(m_header.nColorWidth) * m_header.nColorHeight * GetCaptureColorBytesPerPixel(m_header.nColorFormat);
+    const uint64_t sectionOffsets[3] = {pHeader->nDepthOffset, pHeader->nColorOffset, pHeader->nBodyIndexOffset};
+    const uint64_t sectionBytes[3] = {nDepthPixels * sizeof(UINT16), nColorBytes, nDepthPixels};
+
+    for (int nSection = 0; nSection < 3; ++nSection)
+    {
+        if (sectionOffsets[nSection] < sizeof(CaptureFrameHeader) ||
+            sectionOffsets[nSection] % cCaptureAlignment != 0 ||
+            !SectionFits(sectionOffsets[nSection], sectionBytes[nSection], m_header.nFrameSize))
+        {
+            return E_FAIL;
+        }
+    }
+
+    pFrame->nRelativeTime = pHeader->nRelativeTime;
+    pFrame->pDepthBuffer = reinterpret_cast<const UINT16*>(pBase + pHeader->nDepthOffset);
+    pFrame->pColorBuffer = pBase + pHeader->nColorOffset;
+    pFrame->pBodyIndexBuffer = pBase + pHeader->nBodyIndexOffset;
+
+    return S_OK;
+}
+
+UINT CaptureReader::FindFrame(int64_t nRelativeTime) const
+{
+    if (!m_pIndex)
+    {
+        return 0;
+    }
+
+    const CaptureIndexEntry* pEnd = m_pIndex + m_header.nFrameCount;
+    const CaptureIndexEntry* pFound = std::lower_bound(m_pIndex, pEnd, nRelativeTime,
+        [](const CaptureIndexEntry& entry, int64_t nTime) { return entry.nRelativeTime < nTime; });
+
+    return static_cast<UINT>(pFound - m_pIndex);
+}
+
+ReplayFrameSource::ReplayFrameSource() :
+    m_pacing(ReplayPacing_RealTime),
+    m_bLoop(false),
+    m_nNextFrame(0),
+    m_nStartRelativeTime(0)
+{
+}
+
+HRESULT ReplayFrameSource::Open(const char* pszPath, ReplayPacing pacing, bool bLoop)
+{
+    V_RET(m_reader.Open(pszPath));
+
+    if (m_reader.GetFrameCount() == 0)
+    {
+        return E_FAIL;
+    }
+
+    const CaptureFileHeader& header = m_reader.GetHeader();
+    m_geometry = MakeFrameGeometry(header.nDepthWidth, header.nDepthHeight, header.nColorWidth, header.nColorHeight);
+
+    m_pacing = pacing;
+    m_bLoop = bLoop;
+    m_nNextFrame = 0;
+    RestartClock();
+
+    return S_OK;
+}
+
+void ReplayFrameSource::RestartClock()
+{
+    CaptureFrame frame;
+    m_nStartRelativeTime = SUCCEEDED(m_reader.GetFrame(m_nNextFrame, &frame)) ? frame.nRelativeTime : 0;
+    m_startTime = std::chrono::steady_clock::now();
+}
+
+void ReplayFrameSource::Seek(int64_t nRelativeTime)
+{
+    m_nNextFrame = std::min(m_reader.FindFrame(nRelativeTime), m_reader.GetFrameCount() - 1);
+    RestartClock();
+}
+
+std::chrono::microseconds ReplayFrameSource::GetTimeUntilNextFrame() const
+{
+    CaptureFrame frame;
+    if (m_pacing != ReplayPacing_RealTime || FAILED(m_reader.GetFrame(m_nNextFrame, &frame)))
+    {
+        return std::chrono::microseconds(0);
+    }
+
+    const auto dueTime = m_startTime + RelativeTicks(frame.nRelativeTime - m_nStartRelativeTime);
+    const auto now = std::chrono::steady_clock::now();
+    if (dueTime <= now)
+    {
+        return std::chrono::microseconds(0);
+    }
+
+    return std::chrono::duration_cast<std::chrono::microseconds>(dueTime - now);
+}
+
+HRESULT ReplayFrameSource::AcquireNextFrame(CaptureFrame* pFrame)
+{
+    if (m_nNextFrame >= m_reader.GetFrameCount())
+    {
+        if (!m_bLoop)
+        {
+            return S_FALSE;
+        }
+
+        m_nNextFrame = 0;
+        RestartClock();
+    }
+
+    if (GetTimeUntilNextFrame().count() > 0)
+    {
+        return E_PENDING;
+    }
+
+    V_RET(m_reader.GetFrame(m_nNextFrame, pFrame));
+    ++m_nNextFrame;
+
+    return S_OK;
+}
+
+bool ReplayFrameSource::WaitForFrame(std::chrono::milliseconds timeout)
+{
+    if (m_nNextFrame >= m_reader.GetFrameCount() && !m_bLoop)
+    {
+        // nothing will ever arrive
+        std::this_thread::sleep_for(timeout);
+        return false;
+    }
+
+    const std::chrono::microseconds remaining = GetTimeUntilNextFrame();
+    if (remaining.count() == 0)
+    {
+        return true;
+    }
+
+    if (remaining > timeout)
+    {
+        std::this_thread::sleep_for(timeout);
+        return false;
+    }
+
+    const auto dueTime = std::chrono::steady_clock::now() + remaining;
+    std::this_thread::sleep_until(dueTime);
+    m_wakeLatency.Record(dueTime);
+
+    return true;
+}
+
+HRESULT ReplayFrameSource::AcquireFrame(PipelineFrame* pFrame)
+{
+    const CaptureFileHeader& header = m_reader.GetHeader();
+    if (!pFrame || (header.nColorFormat != CaptureColorFormat_Bgra && header.nColorFormat != CaptureColorFormat_Yuy2))
+    {
+        return E_FAIL;
+    }
+
+    CaptureFrame frame;
+    HRESULT hr = AcquireNextFrame(&frame);
+    if (hr != S_OK)
+    {
+        return hr;
+    }
+
+    pFrame->nRelativeTime = frame.nRelativeTime;
+    pFrame->nDepthWidth = header.nDepthWidth;
+    pFrame->nDepthHeight = header.nDepthHeight;
+    pFrame->nColorWidth = header.nColorWidth;
+    pFrame->nColorHeight = header.nColorHeight;
+    pFrame->pDepthBuffer = frame.pDepthBuffer;
+    pFrame->pColorBuffer = frame.pColorBuffer;
+    pFrame->colorFormat = (header.nColorFormat == CaptureColorFormat_Yuy2) ? ColorFormat_Yuy2 : ColorFormat_Bgra;
+    pFrame->pBodyIndexBuffer = frame.pBodyIndexBuffer;
+
+    return S_OK;
+}
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "KinectTypes.h"
+#include "MappedFile.h"
+#include "FrameSource.h"
+
+// Capture files hold synchronized depth, color and body index frames so the
+// pipeline can be replayed without a sensor.
+//
+//   CaptureFileHeader (padded to cCaptureAlignment)
+//   frame 0: CaptureFrameHeader | depth (UINT16) | color | body index
+//   frame 1: ...
+//   CaptureIndexEntry[frame count]
+//
+// Every section starts on a cCaptureAlignment boundary so mapped frames can be
+// handed to the vector kernels without copying.
+
+const UINT cCaptureMagic = 0x5041434b;      // 'KCAP'
+const UINT cCaptureVersion = 1;
+const UINT cCaptureAlignment = 64;
+
+enum CaptureColorFormat
+{
+    CaptureColorFormat_Bgra = 0,
+    CaptureColorFormat_Yuy2 = 1,
+};
+
+struct CaptureFileHeader
+{
+    UINT nMagic;
+    UINT nVersion;
+    int nDepthWidth;
+    int nDepthHeight;
+    int nColorWidth;
+    int nColorHeight;
+    UINT nColorFormat;
+    UINT nFrameCount;
+    uint64_t nFrameSize;
+    uint64_t nIndexOffset;
+};
+
+struct CaptureFrameHeader
+{
+    int64_t nRelativeTime;
+    uint64_t nDepthOffset;
+    uint64_t nColorOffset;
+    uint64_t nBodyIndexOffset;
+};
+
+struct CaptureIndexEntry
+{
+    int64_t nRelativeTime;
+    uint64_t nOffset;
+};
+
+// Zero copy view of one frame inside the mapped capture file
+struct CaptureFrame
+{
+    int64_t nRelativeTime;
+    const UINT16* pDepthBuffer;
+    const BYTE* pColorBuffer;
+    const BYTE* pBodyIndexBuffer;
+};
+
+UINT GetCaptureColorBytesPerPixel(UINT nColorFormat);
+
+class CaptureWriter
+{
+public:
+    CaptureWriter();
+    ~CaptureWriter();
+
+    HRESULT Open(
+        const char* pszPath,
+        int nDepthWidth,
+        int nDepthHeight,
+        int nColorWidth,
+        int nColorHeight,
+        CaptureColorFormat colorFormat);
+
+    HRESULT WriteFrame(
+        int64_t nRelativeTime,
+        const UINT16* pDepthBuffer,
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer);
+
+    // writes the seek index and finalizes the header
+    HRESULT Close();
+
+    bool IsOpen() const { return m_pFile != nullptr; }
+    UINT GetFrameCount() const { return m_header.nFrameCount; }
+
+private:
+    FILE* m_pFile;
+    CaptureFileHeader m_header;
+    CaptureFrameHeader m_frameLayout;
+    std::vector<CaptureIndexEntry> m_index;
+
+    HRESULT WriteSection(const void* pData, uint64_t nBytes, uint64_t nPaddedBytes);
+};
+
+class CaptureReader
+{
+public:
+    CaptureReader();
+
+    HRESULT Open(const char* pszPath);
+    void Close();
+
+    const CaptureFileHeader& GetHeader() const { return m_header; }
+    UINT GetFrameCount() const { return m_header.nFrameCount; }
+
+    HRESULT GetFrame(UINT nFrame, CaptureFrame* pFrame) const;
+
+    // first frame at or after nRelativeTime, using the seek index
+    UINT FindFrame(int64_t nRelativeTime) const;
+
+private:
+    MappedFile m_file;
+    CaptureFileHeader m_header;
+    const CaptureIndexEntry* m_pIndex;
+};
+
+enum ReplayPacing
+{
+    // frames are released following their RelativeTime stamps
+    ReplayPacing_RealTime = 0,
+    // every call returns the next frame
+    ReplayPacing_AsFastAsPossible,
+};
+
+// Hands out frames of a capture file in order, optionally paced like the sensor
+class ReplayFrameSource : public FrameSource
+{
+public:
+    ReplayFrameSource();
+
+    HRESULT Open(const char* pszPath, ReplayPacing pacing, bool bLoop);
+
+    const CaptureFileHeader& GetHeader() const { return m_reader.GetHeader(); }
+
+    // sleeps until the next frame is due
+    bool WaitForFrame(std::chrono::milliseconds timeout) override;
+
+    // points pFrame straight into the mapped file, BGRA or YUY2 color as
+    // captured and marked in its colorFormat
+    HRESULT AcquireFrame(PipelineFrame* pFrame) override;
+
+    // S_OK with the next frame, E_PENDING when the next frame is not due yet
+    // (like AcquireLatestFrame) and S_FALSE at the end of a non looping capture.
+    HRESULT AcquireNextFrame(CaptureFrame* pFrame);
+
+    // time until the next frame is due, zero when one is ready
+    std::chrono::microseconds GetTimeUntilNextFrame() const;
+
+    void Seek(int64_t nRelativeTime);
+
+private:
+    CaptureReader m_reader;
+    ReplayPacing m_pacing;
+    bool m_bLoop;
+    UINT m_nNextFrame;
+
+    // wall clock time that corresponds to m_nStartRelativeTime
+    std::chrono::steady_clock::time_point m_startTime;
+    int64_t m_nStartRelativeTime;
+
+    void RestartClock();
+};
@@ -0,0 +1,10 @@
+#pragma once
+
+// Pixel layouts a color frame can arrive in
+enum ColorFormat
+{
+    // four bytes per pixel, blue first
+    ColorFormat_Bgra = 0,
+    // the sensor's native format, two pixels in four bytes: Y0 U Y1 V
+    ColorFormat_Yuy2,
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "KinectTypes.h"
+#include "PixelRect.h"
+
+// Produces the per color pixel depth space coordinates ProcessFrame composites
+// with. Mirrors ICoordinateMapper::MapColorFrameToDepthSpace so the SDK mapper
+// and the built in software mapper can be swapped, along with the depth to
+// color mappings the other composite modes need.
+class ColorToDepthMapper
+{
+public:
+    virtual ~ColorToDepthMapper() {}
+
+    // Prepares for frames of these sizes, for sources that deliver another
+    // geometry than the mapper was created for or change it on the fly.
+    // Mappers bound to one sensor mode return E_NOTIMPL for any other.
+    virtual HRESULT SetFrameGeometry(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight) = 0;
+
+    // Unmapped color pixels are set to -infinity, same as the SDK.
+    virtual HRESULT MapColorFrameToDepthSpace(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        UINT nColorPointCount,
+        DepthSpacePoint* pDepthSpacePoints) = 0;
+
+    // Like MapColorFrameToDepthSpace but only the color pixels inside pRects
+    // need to be written, the rest of pDepthSpacePoints is left as it was.
+    // Mappers that cannot restrict the work map the whole frame.
+    virtual HRESULT MapColorRegionsToDepthSpace(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        UINT nColorPointCount,
+        DepthSpacePoint* pDepthSpacePoints,
+        const PixelRect* /*pRects*/,
+        int /*nRectCount*/)
+    {
+        return MapColorFrameToDepthSpace(nDepthPointCount, pDepthFrameData, nColorPointCount, pDepthSpacePoints);
+    }
+
+    // MapColorRegionsToDepthSpace straight into an index map: the depth pixel
+    // each color pixel inside pRects rounds to, or cInvalidDepthIndex (see
+    // CompositeKernel.h). Mappers that only produce points return E_NOTIMPL.
+    virtual HRESULT MapColorRegionsToDepthIndices(
+        UINT /*nDepthPointCount*/,
+        const UINT16* /*pDepthFrameData*/,
+        UINT /*nColorPointCount*/,
+        UINT* /*pDepthIndices*/,
+        const PixelRect* /*pRects*/,
+        int /*nRectCount*/)
+    {
+        return E_NOTIMPL;
+    }
+
+    // Row blocks, for callers that cannot afford a whole frame of mapping.
+    // PrepareColorRowBlocks takes in a depth frame and sorts out which depth
+    // pixels land in each block of nBlockRows color rows; the index map of a
+    // block (nBlockRows rows, fewer for the last) is then written by
+    // MapColorRowBlockToDepthIndices, with pZBuffer of the same size as
+    // scratch. Blocks may be mapped concurrently, and pDepthFrameData must
+    // stay valid until the last one is. Mappers that only map whole frames
+    // return E_NOTIMPL.
+    virtual HRESULT PrepareColorRowBlocks(
+        UINT /*nDepthPointCount*/,
+        const UINT16* /*pDepthFrameData*/,
+        int /*nBlockRows*/)
+    {
+        return E_NOTIMPL;
+    }
+
+    virtual HRESULT MapColorRowBlockToDepthIndices(
+        int /*nBlock*/,
+        UINT* /*pDepthIndices*/,
+        UINT16* /*pZBuffer*/) const
+    {
+        return E_NOTIMPL;
+    }
+
+    // Mirrors ICoordinateMapper::MapDepthPointsToColorSpace, pDepths holds
+    // one depth (mm) per point. Unmapped points are set to -infinity.
+    virtual HRESULT MapDepthPointsToColorSpace(
+        UINT nPointCount,
+        const DepthSpacePoint* pDepthPoints,
+        const UINT16* pDepths,
+        ColorSpacePoint* pColorPoints) = 0;
+
+    // Mirrors ICoordinateMapper::MapDepthFrameToColorSpace, one point per
+    // depth pixel. Invalid depth pixels are set to -infinity.
+    virtual HRESULT MapDepthFrameToColorSpace(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        UINT nColorPointCount,
+        ColorSpacePoint* pColorSpacePoints) = 0;
+};
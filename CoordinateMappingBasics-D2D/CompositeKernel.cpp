@@ -0,0 +1,1783 @@
+#include "CompositeKernel.h"
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define COMPOSITE_HAS_X86_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC lets us use any intrinsic in any function, GCC and Clang need the
+// target enabled per function so the rest of the file stays baseline x86.
+#if defined(COMPOSITE_HAS_X86_SIMD) && !defined(_MSC_VER)
+#define COMPOSITE_TARGET(__isa__) __attribute__((target(__isa__)))
+#else
+#define COMPOSITE_TARGET(__isa__)
+#endif
+
+namespace
+{
+    // The depth frame size as the kernels see it, read at run time...
+    struct DynamicDepthGeometry
+    {
+        int nWidth;
+        int nHeight;
+
+        int GetWidth() const { return nWidth; }
+        int GetHeight() const { return nHeight; }
+    };
+
+    // ...or folded into the code, for the scalar hard edge kernels only: the
+    // bounds tests compare against constants and the row multiply becomes a
+    // shift, over a tenth off the scalar composite from points. The vector
+    // and matte kernels ran no faster with it, loads and lookups bound them,
+    // so they always get the size at run time.
+    template <int Width, int Height>
+    struct FixedDepthGeometry
+    {
+        static int GetWidth() { return Width; }
+        static int GetHeight() { return Height; }
+    };
+
+    // the Kinect v2 depth and body index frames
+    typedef FixedDepthGeometry<512, 424> KinectDepthGeometry;
+
+    template <typename Geometry>
+    void CompositeScalar(
+        const DepthSpacePoint* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry,
+        const RGBQUAD* pColorBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        for (int colorIndex = nBeginIndex; colorIndex < nEndIndex; ++colorIndex)
+        {
+            // default setting source to copy from the background pixel
+            const RGBQUAD* pSrc = pBackgroundBuffer + colorIndex;
+
+            DepthSpacePoint p = pDepthCoordinates[colorIndex];
+
+            // Values that are negative infinity means it is an invalid color to depth mapping so we
+            // skip processing for this pixel
+            if (p.X != -std::numeric_limits<float>::infinity() && p.Y != -std::numeric_limits<float>::infinity())
+            {
+                int depthX = static_cast<int>(p.X + 0.5f);
+                int depthY = static_cast<int>(p.Y + 0.5f);
+
+                if ((depthX >= 0 && depthX < geometry.GetWidth()) && (depthY >= 0 && depthY < geometry.GetHeight()))
+                {
+                    BYTE player = pBodyIndexBuffer[depthX + (depthY * geometry.GetWidth())];
+
+                    // if we're tracking a player for the current pixel, draw from the color camera
+                    if (player != 0xff)
+                    {
+                        // set source for copy to the color pixel
+                        pSrc = pColorBuffer + colorIndex;
+                    }
+                }
+            }
+
+            // write output
+            pOutputBuffer[colorIndex] = *pSrc;
+        }
+    }
+
+    // the test CompositeScalar makes, for the loops that only need the answer
+    template <typename Geometry>
+    inline bool IsPlayerPixel(
+        const DepthSpacePoint& p,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry)
+    {
+        if (p.X == -std::numeric_limits<float>::infinity() || p.Y == -std::numeric_limits<float>::infinity())
+        {
+            return false;
+        }
+
+        const int depthX = static_cast<int>(p.X + 0.5f);
+        const int depthY = static_cast<int>(p.Y + 0.5f);
+
+        return depthX >= 0 && depthX < geometry.GetWidth() && depthY >= 0 && depthY < geometry.GetHeight() &&
+            pBodyIndexBuffer[depthX + (depthY * geometry.GetWidth())] != 0xff;
+    }
+
+    template <typename Geometry>
+    inline bool IsPlayerPixel(
+        UINT nDepthIndex,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& /*geometry*/)
+    {
+        return nDepthIndex != cInvalidDepthIndex && pBodyIndexBuffer[nDepthIndex] != 0xff;
+    }
+
+    // CompositeScalar on an index map, where the mapper already did the
+    // rounding and the bounds test
+    template <typename Geometry>
+    void CompositeScalar(
+        const UINT* pDepthIndices,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry,
+        const RGBQUAD* pColorBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        for (int colorIndex = nBeginIndex; colorIndex < nEndIndex; ++colorIndex)
+        {
+            pOutputBuffer[colorIndex] = IsPlayerPixel(pDepthIndices[colorIndex], pBodyIndexBuffer, geometry) ?
+                pColorBuffer[colorIndex] :
+                pBackgroundBuffer[colorIndex];
+        }
+    }
+
+    inline BYTE ClampToByte(int n)
+    {
+        return static_cast<BYTE>(n < 0 ? 0 : (n > 255 ? 255 : n));
+    }
+
+    // Studio range BT.601 with the usual 8 bit fixed point coefficients. The
+    // vector paths do exactly this arithmetic, shifts included.
+    inline RGBQUAD Yuy2ToBgra(int y, int u, int v)
+    {
+        const int c = (y - 16) * 298 + 128;
+        const int d = u - 128;
+        const int e = v - 128;
+
+        RGBQUAD pixel;
+        pixel.rgbBlue = ClampToByte((c + 516 * d) >> 8);
+        pixel.rgbGreen = ClampToByte((c - 100 * d - 208 * e) >> 8);
+        pixel.rgbRed = ClampToByte((c + 409 * e) >> 8);
+        pixel.rgbReserved = 0xff;
+        return pixel;
+    }
+
+    template <typename Geometry, typename DepthMap>
+    void CompositeYuy2Scalar(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry,
+        const BYTE* pYuy2Buffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        for (int colorIndex = nBeginIndex; colorIndex < nEndIndex; ++colorIndex)
+        {
+            pOutputBuffer[colorIndex] = IsPlayerPixel(pDepthCoordinates[colorIndex], pBodyIndexBuffer, geometry) ?
+                ConvertYuy2Pixel(pYuy2Buffer, colorIndex) :
+                pBackgroundBuffer[colorIndex];
+        }
+    }
+
+    void ConvertYuy2Scalar(const BYTE* pYuy2Buffer, RGBQUAD* pOutputBuffer, int nBeginIndex, int nEndIndex)
+    {
+        for (int colorIndex = nBeginIndex; colorIndex < nEndIndex; ++colorIndex)
+        {
+            pOutputBuffer[colorIndex] = ConvertYuy2Pixel(pYuy2Buffer, colorIndex);
+        }
+    }
+
+    void KeyDepthRangeScalar(
+        const UINT16* pDepthBuffer,
+        const UINT16* pBackgroundDepth,
+        UINT16 nNearDepth,
+        UINT16 nFarDepth,
+        UINT16 nBackgroundMargin,
+        BYTE* pBodyIndexBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        for (int depthIndex = nBeginIndex; depthIndex < nEndIndex; ++depthIndex)
+        {
+            const int nDepth = pDepthBuffer[depthIndex];
+            bool bKeyed = (nDepth >= nNearDepth && nDepth <= nFarDepth);
+
+            if (pBackgroundDepth)
+            {
+                const int nBackground = pBackgroundDepth[depthIndex];
+                bKeyed = bKeyed && (nBackground == 0 || nDepth + nBackgroundMargin < nBackground);
+            }
+
+            pBodyIndexBuffer[depthIndex] = bKeyed ? 0 : 0xff;
+        }
+    }
+
+    // Source sample left/above an output pixel, its neighbour and the
+    // neighbour's weight out of 256
+    struct UpscaleTap
+    {
+        int nFirst;
+        int nSecond;
+        int nWeight;
+    };
+
+    UpscaleTap GetUpscaleTap(int nOutput, int nSourceSize, int nOutputSize)
+    {
+        // center of the output pixel in source pixels, 8 fractional bits
+        const int64_t nPosition = (int64_t(2 * nOutput + 1) * nSourceSize * 256) / (2 * int64_t(nOutputSize)) - 128;
+
+        UpscaleTap tap = {0, 0, 0};
+        if (nPosition > 0)
+        {
+            tap.nFirst = static_cast<int>(nPosition >> 8);
+            tap.nWeight = static_cast<int>(nPosition & 255);
+        }
+
+        if (tap.nFirst >= nSourceSize - 1)
+        {
+            tap.nFirst = nSourceSize - 1;
+            tap.nWeight = 0;
+        }
+
+        tap.nSecond = std::min(tap.nFirst + 1, nSourceSize - 1);
+        return tap;
+    }
+
+    inline BYTE Lerp(BYTE a, BYTE b, int nWeight)
+    {
+        return static_cast<BYTE>((a * (256 - nWeight) + b * nWeight + 128) >> 8);
+    }
+
+    // premultiplied color over the background, rounded division by 255
+    inline BYTE Over(BYTE color, BYTE alpha, BYTE background)
+    {
+        const int t = background * (255 - alpha) + 128;
+        return static_cast<BYTE>(color + ((t + (t >> 8)) >> 8));
+    }
+
+    void LerpRowScalar(const RGBQUAD* pTop, const RGBQUAD* pBottom, int nWeight, RGBQUAD* pRow, int nBegin, int nWidth)
+    {
+        for (int x = nBegin; x < nWidth; ++x)
+        {
+            pRow[x].rgbBlue = Lerp(pTop[x].rgbBlue, pBottom[x].rgbBlue, nWeight);
+            pRow[x].rgbGreen = Lerp(pTop[x].rgbGreen, pBottom[x].rgbGreen, nWeight);
+            pRow[x].rgbRed = Lerp(pTop[x].rgbRed, pBottom[x].rgbRed, nWeight);
+            pRow[x].rgbReserved = Lerp(pTop[x].rgbReserved, pBottom[x].rgbReserved, nWeight);
+        }
+    }
+
+    void UpscaleRowScalar(
+        const RGBQUAD* pRow,
+        const UpscaleTap* pTaps,
+        const RGBQUAD* pBackground,
+        RGBQUAD* pOutput,
+        int nBegin,
+        int nWidth)
+    {
+        for (int x = nBegin; x < nWidth; ++x)
+        {
+            const RGBQUAD& a = pRow[pTaps[x].nFirst];
+            const RGBQUAD& b = pRow[pTaps[x].nSecond];
+            const int nWeight = pTaps[x].nWeight;
+            const BYTE alpha = Lerp(a.rgbReserved, b.rgbReserved, nWeight);
+
+            pOutput[x].rgbBlue = Over(Lerp(a.rgbBlue, b.rgbBlue, nWeight), alpha, pBackground[x].rgbBlue);
+            pOutput[x].rgbGreen = Over(Lerp(a.rgbGreen, b.rgbGreen, nWeight), alpha, pBackground[x].rgbGreen);
+            pOutput[x].rgbRed = Over(Lerp(a.rgbRed, b.rgbRed, nWeight), alpha, pBackground[x].rgbRed);
+            pOutput[x].rgbReserved = 0xff;
+        }
+    }
+
+    // The matte's alpha for a color pixel, found as IsPlayerPixel finds its
+    // body index, 0 for pixels that map nowhere
+    template <typename Geometry>
+    inline int GetMatteAlpha(
+        const DepthSpacePoint& p,
+        const BYTE* pAlphaMatte,
+        const Geometry& geometry)
+    {
+        if (p.X == -std::numeric_limits<float>::infinity() || p.Y == -std::numeric_limits<float>::infinity())
+        {
+            return 0;
+        }
+
+        const int depthX = static_cast<int>(p.X + 0.5f);
+        const int depthY = static_cast<int>(p.Y + 0.5f);
+
+        return (depthX >= 0 && depthX < geometry.GetWidth() && depthY >= 0 && depthY < geometry.GetHeight()) ?
+            pAlphaMatte[depthX + (depthY * geometry.GetWidth())] :
+            0;
+    }
+
+    template <typename Geometry>
+    inline int GetMatteAlpha(
+        UINT nDepthIndex,
+        const BYTE* pAlphaMatte,
+        const Geometry& /*geometry*/)
+    {
+        return (nDepthIndex != cInvalidDepthIndex) ? pAlphaMatte[nDepthIndex] : 0;
+    }
+
+    // color * alpha + background * (255 - alpha), rounded division by 255
+    inline BYTE Blend(BYTE color, BYTE background, int nAlpha)
+    {
+        const int t = color * nAlpha + background * (255 - nAlpha) + 128;
+        return static_cast<BYTE>((t + (t >> 8)) >> 8);
+    }
+
+    // The color frame of the matte kernels in either format, so one kernel
+    // serves both; YUY2 pixels are only converted where the matte is not 0
+    struct BgraColorFrame
+    {
+        const RGBQUAD* pBuffer;
+
+        RGBQUAD GetPixel(int colorIndex) const { return pBuffer[colorIndex]; }
+    };
+
+    struct Yuy2ColorFrame
+    {
+        const BYTE* pBuffer;
+
+        RGBQUAD GetPixel(int colorIndex) const { return ConvertYuy2Pixel(pBuffer, colorIndex); }
+    };
+
+    template <typename Geometry, typename DepthMap, typename ColorFrame>
+    void CompositeMatteScalar(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pAlphaMatte,
+        const Geometry& geometry,
+        const ColorFrame& colorFrame,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        for (int colorIndex = nBeginIndex; colorIndex < nEndIndex; ++colorIndex)
+        {
+            const int nAlpha = GetMatteAlpha(pDepthCoordinates[colorIndex], pAlphaMatte, geometry);
+            const RGBQUAD background = pBackgroundBuffer[colorIndex];
+
+            if (nAlpha == 0)
+            {
+                pOutputBuffer[colorIndex] = background;
+                continue;
+            }
+
+            const RGBQUAD color = colorFrame.GetPixel(colorIndex);
+            RGBQUAD& output = pOutputBuffer[colorIndex];
+            output.rgbBlue = Blend(color.rgbBlue, background.rgbBlue, nAlpha);
+            output.rgbGreen = Blend(color.rgbGreen, background.rgbGreen, nAlpha);
+            output.rgbRed = Blend(color.rgbRed, background.rgbRed, nAlpha);
+            output.rgbReserved = Blend(color.rgbReserved, background.rgbReserved, nAlpha);
+        }
+    }
+
+#ifdef COMPOSITE_HAS_X86_SIMD
+
+    // Truncating conversion gives INT_MIN for -infinity, NaN and anything out of
+    // int range, so the bounds test below also rejects the invalid mappings the
+    // scalar loop filters out with its explicit -infinity compare.
+
+    // The byte of each lane's depth pixel; lanes without one must hold index
+    // 0 so the lookup stays in bounds
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i GatherBytesSse41(__m128i depthIndex, const BYTE* pBuffer)
+    {
+        // SSE has no gather, the lookups are done one lane at a time
+        return _mm_setr_epi32(
+            pBuffer[_mm_cvtsi128_si32(depthIndex)],
+            pBuffer[_mm_extract_epi32(depthIndex, 1)],
+            pBuffer[_mm_extract_epi32(depthIndex, 2)],
+            pBuffer[_mm_extract_epi32(depthIndex, 3)]);
+    }
+
+    // All ones in the valid lanes whose depth pixel is a tracked body index
+    // pixel; invalid lanes must hold index 0 so the lookup stays in bounds
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i GetPlayerMaskSse41(__m128i depthIndex, __m128i valid, const BYTE* pBodyIndexBuffer)
+    {
+        const __m128i player = GatherBytesSse41(depthIndex, pBodyIndexBuffer);
+        return _mm_andnot_si128(_mm_cmpeq_epi32(player, _mm_set1_epi32(0xff)), valid);
+    }
+
+    // The depth pixel each of four color pixels rounds to, the test
+    // CompositeSse41 makes; *pValid gets all ones in the lanes that have one,
+    // the others hold index 0
+    template <typename Geometry>
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i GetDepthIndexSse41(
+        const DepthSpacePoint* pDepthCoordinates,
+        const Geometry& geometry,
+        __m128i* pValid)
+    {
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128i minusOne = _mm_set1_epi32(-1);
+        const __m128i width = _mm_set1_epi32(geometry.GetWidth());
+        const __m128i height = _mm_set1_epi32(geometry.GetHeight());
+
+        const float* pPoints = reinterpret_cast<const float*>(pDepthCoordinates);
+        __m128 p01 = _mm_loadu_ps(pPoints);
+        __m128 p23 = _mm_loadu_ps(pPoints + 4);
+        __m128 xs = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 ys = _mm_shuffle_ps(p01, p23, _MM_SHUFFLE(3, 1, 3, 1));
+
+        __m128i depthX = _mm_cvttps_epi32(_mm_add_ps(xs, half));
+        __m128i depthY = _mm_cvttps_epi32(_mm_add_ps(ys, half));
+
+        __m128i valid = _mm_and_si128(
+            _mm_and_si128(_mm_cmpgt_epi32(depthX, minusOne), _mm_cmplt_epi32(depthX, width)),
+            _mm_and_si128(_mm_cmpgt_epi32(depthY, minusOne), _mm_cmplt_epi32(depthY, height)));
+
+        *pValid = valid;
+        return _mm_and_si128(valid, _mm_add_epi32(depthX, _mm_mullo_epi32(depthY, width)));
+    }
+
+    // The same on four entries of an index map
+    template <typename Geometry>
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i GetDepthIndexSse41(
+        const UINT* pDepthIndices,
+        const Geometry& /*geometry*/,
+        __m128i* pValid)
+    {
+        const __m128i depthIndex = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pDepthIndices));
+        const __m128i valid = _mm_xor_si128(
+            _mm_cmpeq_epi32(depthIndex, _mm_set1_epi32(static_cast<int>(cInvalidDepthIndex))),
+            _mm_set1_epi32(-1));
+
+        *pValid = valid;
+        return _mm_and_si128(valid, depthIndex);
+    }
+
+    // All ones in the lanes of the four color pixels whose depth point is a
+    // tracked body index pixel
+    template <typename Geometry, typename DepthMap>
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i GetPlayerMaskSse41(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry)
+    {
+        __m128i valid;
+        const __m128i depthIndex = GetDepthIndexSse41(pDepthCoordinates, geometry, &valid);
+        return GetPlayerMaskSse41(depthIndex, valid, pBodyIndexBuffer);
+    }
+
+    // Four pixels of YUY2, the two pairs in the low 8 bytes, to BGRA with the
+    // arithmetic of Yuy2ToBgra; the 16 bit packs do its clamping
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i Yuy2ToBgraSse41(__m128i yuy2)
+    {
+        const __m128i y = _mm_shuffle_epi8(yuy2, _mm_setr_epi8(0, -1, -1, -1, 2, -1, -1, -1, 4, -1, -1, -1, 6, -1, -1, -1));
+        const __m128i u = _mm_shuffle_epi8(yuy2, _mm_setr_epi8(1, -1, -1, -1, 1, -1, -1, -1, 5, -1, -1, -1, 5, -1, -1, -1));
+        const __m128i v = _mm_shuffle_epi8(yuy2, _mm_setr_epi8(3, -1, -1, -1, 3, -1, -1, -1, 7, -1, -1, -1, 7, -1, -1, -1));
+
+        const __m128i c = _mm_add_epi32(_mm_mullo_epi32(_mm_sub_epi32(y, _mm_set1_epi32(16)), _mm_set1_epi32(298)), _mm_set1_epi32(128));
+        const __m128i d = _mm_sub_epi32(u, _mm_set1_epi32(128));
+        const __m128i e = _mm_sub_epi32(v, _mm_set1_epi32(128));
+
+        const __m128i b = _mm_srai_epi32(_mm_add_epi32(c, _mm_mullo_epi32(d, _mm_set1_epi32(516))), 8);
+        const __m128i g = _mm_srai_epi32(_mm_sub_epi32(_mm_sub_epi32(c,
+            _mm_mullo_epi32(d, _mm_set1_epi32(100))), _mm_mullo_epi32(e, _mm_set1_epi32(208))), 8);
+        const __m128i r = _mm_srai_epi32(_mm_add_epi32(c, _mm_mullo_epi32(e, _mm_set1_epi32(409))), 8);
+
+        // b0-3 g0-3 r0-3 a0-3, then interleaved per pixel
+        const __m128i planes = _mm_packus_epi16(_mm_packs_epi32(b, g), _mm_packs_epi32(r, _mm_set1_epi32(0xff)));
+        return _mm_shuffle_epi8(planes, _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15));
+    }
+
+    // nBeginIndex must be even so every step converts whole pairs
+    template <typename Geometry, typename DepthMap>
+    COMPOSITE_TARGET("sse4.1")
+    int CompositeYuy2Sse41(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry,
+        const BYTE* pYuy2Buffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        int colorIndex = nBeginIndex;
+        for (; colorIndex + 4 <= nEndIndex; colorIndex += 4)
+        {
+            const __m128i useColor = GetPlayerMaskSse41(pDepthCoordinates + colorIndex, pBodyIndexBuffer, geometry);
+            __m128i output = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBackgroundBuffer + colorIndex));
+
+            // most of the frame is background, which needs no conversion
+            if (!_mm_testz_si128(useColor, useColor))
+            {
+                const __m128i yuy2 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pYuy2Buffer + colorIndex * 2));
+                output = _mm_blendv_epi8(output, Yuy2ToBgraSse41(yuy2), useColor);
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutputBuffer + colorIndex), output);
+        }
+
+        return colorIndex;
+    }
+
+    COMPOSITE_TARGET("sse4.1")
+    int ConvertYuy2Sse41(const BYTE* pYuy2Buffer, RGBQUAD* pOutputBuffer, int nBeginIndex, int nEndIndex)
+    {
+        int colorIndex = nBeginIndex;
+        for (; colorIndex + 4 <= nEndIndex; colorIndex += 4)
+        {
+            const __m128i yuy2 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(pYuy2Buffer + colorIndex * 2));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutputBuffer + colorIndex), Yuy2ToBgraSse41(yuy2));
+        }
+
+        return colorIndex;
+    }
+
+    // Yuy2ToBgraSse41 on eight pixels, the first four pairs in the low 8 bytes
+    // of the low lane and the next four in the low 8 bytes of the high lane
+    COMPOSITE_TARGET("avx2")
+    inline __m256i Yuy2ToBgraAvx2(__m256i yuy2)
+    {
+        const __m256i y = _mm256_shuffle_epi8(yuy2, _mm256_setr_epi8(
+            0, -1, -1, -1, 2, -1, -1, -1, 4, -1, -1, -1, 6, -1, -1, -1,
+            0, -1, -1, -1, 2, -1, -1, -1, 4, -1, -1, -1, 6, -1, -1, -1));
+        const __m256i u = _mm256_shuffle_epi8(yuy2, _mm256_setr_epi8(
+            1, -1, -1, -1, 1, -1, -1, -1, 5, -1, -1, -1, 5, -1, -1, -1,
+            1, -1, -1, -1, 1, -1, -1, -1, 5, -1, -1, -1, 5, -1, -1, -1));
+        const __m256i v = _mm256_shuffle_epi8(yuy2, _mm256_setr_epi8(
+            3, -1, -1, -1, 3, -1, -1, -1, 7, -1, -1, -1, 7, -1, -1, -1,
+            3, -1, -1, -1, 3, -1, -1, -1, 7, -1, -1, -1, 7, -1, -1, -1));
+
+        const __m256i c = _mm256_add_epi32(
+            _mm256_mullo_epi32(_mm256_sub_epi32(y, _mm256_set1_epi32(16)), _mm256_set1_epi32(298)), _mm256_set1_epi32(128));
+        const __m256i d = _mm256_sub_epi32(u, _mm256_set1_epi32(128));
+        const __m256i e = _mm256_sub_epi32(v, _mm256_set1_epi32(128));
+
+        const __m256i b = _mm256_srai_epi32(_mm256_add_epi32(c, _mm256_mullo_epi32(d, _mm256_set1_epi32(516))), 8);
+        const __m256i g = _mm256_srai_epi32(_mm256_sub_epi32(_mm256_sub_epi32(c,
+            _mm256_mullo_epi32(d, _mm256_set1_epi32(100))), _mm256_mullo_epi32(e, _mm256_set1_epi32(208))), 8);
+        const __m256i r = _mm256_srai_epi32(_mm256_add_epi32(c, _mm256_mullo_epi32(e, _mm256_set1_epi32(409))), 8);
+
+        // the packs and the shuffle work per 128 bit lane, which keeps the pixel order
+        const __m256i planes = _mm256_packus_epi16(_mm256_packs_epi32(b, g), _mm256_packs_epi32(r, _mm256_set1_epi32(0xff)));
+        return _mm256_shuffle_epi8(planes, _mm256_setr_epi8(
+            0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+            0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15));
+    }
+
+    // 16 bytes of YUY2 spread so each lane holds four pixels in its low half
+    COMPOSITE_TARGET("avx2")
+    inline __m256i LoadYuy2Avx2(const BYTE* pYuy2)
+    {
+        const __m128i yuy2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pYuy2));
+        return _mm256_permute4x64_epi64(_mm256_castsi128_si256(yuy2), _MM_SHUFFLE(1, 1, 0, 0));
+    }
+
+    COMPOSITE_TARGET("avx2")
+    int ConvertYuy2Avx2(const BYTE* pYuy2Buffer, RGBQUAD* pOutputBuffer, int nBeginIndex, int nEndIndex)
+    {
+        int colorIndex = nBeginIndex;
+        for (; colorIndex + 8 <= nEndIndex; colorIndex += 8)
+        {
+            _mm256_storeu_si256(
+                reinterpret_cast<__m256i*>(pOutputBuffer + colorIndex),
+                Yuy2ToBgraAvx2(LoadYuy2Avx2(pYuy2Buffer + colorIndex * 2)));
+        }
+
+        return colorIndex;
+    }
+
+    template <typename Geometry, typename DepthMap>
+    COMPOSITE_TARGET("sse4.1")
+    int CompositeSse41(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry,
+        const RGBQUAD* pColorBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        int colorIndex = nBeginIndex;
+        for (; colorIndex + 4 <= nEndIndex; colorIndex += 4)
+        {
+            __m128i useColor = GetPlayerMaskSse41(pDepthCoordinates + colorIndex, pBodyIndexBuffer, geometry);
+
+            __m128i color = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pColorBuffer + colorIndex));
+            __m128i background = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBackgroundBuffer + colorIndex));
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i*>(pOutputBuffer + colorIndex),
+                _mm_blendv_epi8(background, color, useColor));
+        }
+
+        return colorIndex;
+    }
+
+    // GatherBytesSse41 for eight lanes, 0 in the lanes that are not valid.
+    // The dword gathers need the buffer to be a whole number of dwords.
+    COMPOSITE_TARGET("avx2")
+    inline __m256i GatherBytesAvx2(__m256i depthIndex, __m256i valid, const BYTE* pBuffer)
+    {
+        const __m256i byteMask = _mm256_set1_epi32(0xff);
+        const __m256i wordMask = _mm256_set1_epi32(~3);
+        const __m256i three = _mm256_set1_epi32(3);
+
+        // Gather the aligned dword holding each byte so we never read past
+        // the end of the buffer, then shift the byte down.
+        __m256i words = _mm256_mask_i32gather_epi32(
+            _mm256_setzero_si256(),
+            reinterpret_cast<const int*>(pBuffer),
+            _mm256_and_si256(depthIndex, wordMask),
+            valid,
+            1);
+        __m256i shift = _mm256_slli_epi32(_mm256_and_si256(depthIndex, three), 3);
+        return _mm256_and_si256(_mm256_srlv_epi32(words, shift), byteMask);
+    }
+
+    // GetPlayerMaskSse41 for eight lanes
+    COMPOSITE_TARGET("avx2")
+    inline __m256i GetPlayerMaskAvx2(__m256i depthIndex, __m256i valid, const BYTE* pBodyIndexBuffer)
+    {
+        const __m256i noPlayer = _mm256_set1_epi32(0xff);
+        const __m256i player = GatherBytesAvx2(depthIndex, valid, pBodyIndexBuffer);
+
+        return _mm256_andnot_si256(_mm256_cmpeq_epi32(player, noPlayer), valid);
+    }
+
+    // GetDepthIndexSse41 for eight pixels
+    template <typename Geometry>
+    COMPOSITE_TARGET("avx2")
+    inline __m256i GetDepthIndexAvx2(
+        const DepthSpacePoint* pDepthCoordinates,
+        const Geometry& geometry,
+        __m256i* pValid)
+    {
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256i minusOne = _mm256_set1_epi32(-1);
+        const __m256i width = _mm256_set1_epi32(geometry.GetWidth());
+        const __m256i height = _mm256_set1_epi32(geometry.GetHeight());
+
+        const float* pPoints = reinterpret_cast<const float*>(pDepthCoordinates);
+        __m256 p0123 = _mm256_loadu_ps(pPoints);
+        __m256 p4567 = _mm256_loadu_ps(pPoints + 8);
+
+        // shuffle works per 128 bit lane, which leaves the pairs as 0 1 4 5 | 2 3 6 7
+        __m256 xs = _mm256_shuffle_ps(p0123, p4567, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 ys = _mm256_shuffle_ps(p0123, p4567, _MM_SHUFFLE(3, 1, 3, 1));
+        xs = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(xs), _MM_SHUFFLE(3, 1, 2, 0)));
+        ys = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(ys), _MM_SHUFFLE(3, 1, 2, 0)));
+
+        __m256i depthX = _mm256_cvttps_epi32(_mm256_add_ps(xs, half));
+        __m256i depthY = _mm256_cvttps_epi32(_mm256_add_ps(ys, half));
+
+        __m256i valid = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi32(depthX, minusOne), _mm256_cmpgt_epi32(width, depthX)),
+            _mm256_and_si256(_mm256_cmpgt_epi32(depthY, minusOne), _mm256_cmpgt_epi32(height, depthY)));
+
+        *pValid = valid;
+        return _mm256_and_si256(valid, _mm256_add_epi32(depthX, _mm256_mullo_epi32(depthY, width)));
+    }
+
+    template <typename Geometry>
+    COMPOSITE_TARGET("avx2")
+    inline __m256i GetDepthIndexAvx2(
+        const UINT* pDepthIndices,
+        const Geometry& /*geometry*/,
+        __m256i* pValid)
+    {
+        const __m256i depthIndex = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pDepthIndices));
+        const __m256i valid = _mm256_xor_si256(
+            _mm256_cmpeq_epi32(depthIndex, _mm256_set1_epi32(static_cast<int>(cInvalidDepthIndex))),
+            _mm256_set1_epi32(-1));
+
+        *pValid = valid;
+        return _mm256_and_si256(valid, depthIndex);
+    }
+
+    // GetPlayerMaskSse41 for eight pixels
+    template <typename Geometry, typename DepthMap>
+    COMPOSITE_TARGET("avx2")
+    inline __m256i GetPlayerMaskAvx2(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry)
+    {
+        __m256i valid;
+        const __m256i depthIndex = GetDepthIndexAvx2(pDepthCoordinates, geometry, &valid);
+        return GetPlayerMaskAvx2(depthIndex, valid, pBodyIndexBuffer);
+    }
+
+    template <typename Geometry, typename DepthMap>
+    COMPOSITE_TARGET("avx2")
+    int CompositeAvx2(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry,
+        const RGBQUAD* pColorBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        int colorIndex = nBeginIndex;
+        for (; colorIndex + 8 <= nEndIndex; colorIndex += 8)
+        {
+            __m256i useColor = GetPlayerMaskAvx2(pDepthCoordinates + colorIndex, pBodyIndexBuffer, geometry);
+
+            __m256i color = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pColorBuffer + colorIndex));
+            __m256i background = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pBackgroundBuffer + colorIndex));
+            _mm256_storeu_si256(
+                reinterpret_cast<__m256i*>(pOutputBuffer + colorIndex),
+                _mm256_blendv_epi8(background, color, useColor));
+        }
+
+        return colorIndex;
+    }
+
+    template <typename Geometry, typename DepthMap>
+    COMPOSITE_TARGET("avx2")
+    int CompositeYuy2Avx2(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry,
+        const BYTE* pYuy2Buffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        int colorIndex = nBeginIndex;
+        for (; colorIndex + 8 <= nEndIndex; colorIndex += 8)
+        {
+            const __m256i useColor = GetPlayerMaskAvx2(pDepthCoordinates + colorIndex, pBodyIndexBuffer, geometry);
+            __m256i output = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pBackgroundBuffer + colorIndex));
+
+            if (!_mm256_testz_si256(useColor, useColor))
+            {
+                output = _mm256_blendv_epi8(output, Yuy2ToBgraAvx2(LoadYuy2Avx2(pYuy2Buffer + colorIndex * 2)), useColor);
+            }
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutputBuffer + colorIndex), output);
+        }
+
+        return colorIndex;
+    }
+
+    // Blend on the 16 bit lanes of two pixels, alpha in all four of a pixel's
+    // lanes; the products and the rounding stay below 65536
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i BlendWordsSse41(__m128i color, __m128i background, __m128i alpha)
+    {
+        const __m128i t = _mm_add_epi16(_mm_add_epi16(
+            _mm_mullo_epi16(color, alpha),
+            _mm_mullo_epi16(background, _mm_sub_epi16(_mm_set1_epi16(255), alpha))), _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+    }
+
+    // Blend on four pixels, each one's alpha in the low byte of its dword
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i BlendSse41(__m128i color, __m128i background, __m128i alpha)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i alphaBytes = _mm_shuffle_epi8(alpha, _mm_setr_epi8(0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12));
+
+        return _mm_packus_epi16(
+            BlendWordsSse41(_mm_unpacklo_epi8(color, zero), _mm_unpacklo_epi8(background, zero), _mm_unpacklo_epi8(alphaBytes, zero)),
+            BlendWordsSse41(_mm_unpackhi_epi8(color, zero), _mm_unpackhi_epi8(background, zero), _mm_unpackhi_epi8(alphaBytes, zero)));
+    }
+
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i LoadColorSse41(const BgraColorFrame& colorFrame, int colorIndex)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(colorFrame.pBuffer + colorIndex));
+    }
+
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i LoadColorSse41(const Yuy2ColorFrame& colorFrame, int colorIndex)
+    {
+        return Yuy2ToBgraSse41(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(colorFrame.pBuffer + colorIndex * 2)));
+    }
+
+    // For a YUY2 frame nBeginIndex must be even
+    template <typename Geometry, typename DepthMap, typename ColorFrame>
+    COMPOSITE_TARGET("sse4.1")
+    int CompositeMatteSse41(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pAlphaMatte,
+        const Geometry& geometry,
+        const ColorFrame& colorFrame,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        int colorIndex = nBeginIndex;
+        for (; colorIndex + 4 <= nEndIndex; colorIndex += 4)
+        {
+            __m128i valid;
+            const __m128i depthIndex = GetDepthIndexSse41(pDepthCoordinates + colorIndex, geometry, &valid);
+            const __m128i alpha = _mm_and_si128(GatherBytesSse41(depthIndex, pAlphaMatte), valid);
+            __m128i output = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBackgroundBuffer + colorIndex));
+
+            // most of the frame is transparent, which needs no blending
+            if (!_mm_testz_si128(alpha, alpha))
+            {
+                output = BlendSse41(LoadColorSse41(colorFrame, colorIndex), output, alpha);
+            }
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pOutputBuffer + colorIndex), output);
+        }
+
+        return colorIndex;
+    }
+
+    COMPOSITE_TARGET("avx2")
+    inline __m256i BlendWordsAvx2(__m256i color, __m256i background, __m256i alpha)
+    {
+        const __m256i t = _mm256_add_epi16(_mm256_add_epi16(
+            _mm256_mullo_epi16(color, alpha),
+            _mm256_mullo_epi16(background, _mm256_sub_epi16(_mm256_set1_epi16(255), alpha))), _mm256_set1_epi16(128));
+        return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+    }
+
+    // BlendSse41 on eight pixels; the shuffle, unpacks and pack all stay
+    // within their 128 bit lane, which keeps the pixel order
+    COMPOSITE_TARGET("avx2")
+    inline __m256i BlendAvx2(__m256i color, __m256i background, __m256i alpha)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i alphaBytes = _mm256_shuffle_epi8(alpha, _mm256_setr_epi8(
+            0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12,
+            0, 0, 0, 0, 4, 4, 4, 4, 8, 8, 8, 8, 12, 12, 12, 12));
+
+        return _mm256_packus_epi16(
+            BlendWordsAvx2(_mm256_unpacklo_epi8(color, zero), _mm256_unpacklo_epi8(background, zero), _mm256_unpacklo_epi8(alphaBytes, zero)),
+            BlendWordsAvx2(_mm256_unpackhi_epi8(color, zero), _mm256_unpackhi_epi8(background, zero), _mm256_unpackhi_epi8(alphaBytes, zero)));
+    }
+
+    COMPOSITE_TARGET("avx2")
+    inline __m256i LoadColorAvx2(const BgraColorFrame& colorFrame, int colorIndex)
+    {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colorFrame.pBuffer + colorIndex));
+    }
+
+    COMPOSITE_TARGET("avx2")
+    inline __m256i LoadColorAvx2(const Yuy2ColorFrame& colorFrame, int colorIndex)
+    {
+        return Yuy2ToBgraAvx2(LoadYuy2Avx2(colorFrame.pBuffer + colorIndex * 2));
+    }
+
+    template <typename Geometry, typename DepthMap, typename ColorFrame>
+    COMPOSITE_TARGET("avx2")
+    int CompositeMatteAvx2(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pAlphaMatte,
+        const Geometry& geometry,
+        const ColorFrame& colorFrame,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        int colorIndex = nBeginIndex;
+        for (; colorIndex + 8 <= nEndIndex; colorIndex += 8)
+        {
+            __m256i valid;
+            const __m256i depthIndex = GetDepthIndexAvx2(pDepthCoordinates + colorIndex, geometry, &valid);
+            const __m256i alpha = GatherBytesAvx2(depthIndex, valid, pAlphaMatte);
+            __m256i output = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pBackgroundBuffer + colorIndex));
+
+            if (!_mm256_testz_si256(alpha, alpha))
+            {
+                output = BlendAvx2(LoadColorAvx2(colorFrame, colorIndex), output, alpha);
+            }
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(pOutputBuffer + colorIndex), output);
+        }
+
+        return colorIndex;
+    }
+
+    COMPOSITE_TARGET("sse4.1")
+    int LerpRowSse41(const RGBQUAD* pTop, const RGBQUAD* pBottom, int nWeight, RGBQUAD* pRow, int nWidth)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi16(128);
+        const __m128i topWeight = _mm_set1_epi16(static_cast<short>(256 - nWeight));
+        const __m128i bottomWeight = _mm_set1_epi16(static_cast<short>(nWeight));
+
+        int x = 0;
+        for (; x + 4 <= nWidth; x += 4)
+        {
+            const __m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pTop + x));
+            const __m128i bottom = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBottom + x));
+
+            // 16 bit lanes hold at most 255 * 256 + 128
+            const __m128i low = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+                _mm_mullo_epi16(_mm_unpacklo_epi8(top, zero), topWeight),
+                _mm_mullo_epi16(_mm_unpacklo_epi8(bottom, zero), bottomWeight)), round), 8);
+            const __m128i high = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+                _mm_mullo_epi16(_mm_unpackhi_epi8(top, zero), topWeight),
+                _mm_mullo_epi16(_mm_unpackhi_epi8(bottom, zero), bottomWeight)), round), 8);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(pRow + x), _mm_packus_epi16(low, high));
+        }
+
+        return x;
+    }
+
+    COMPOSITE_TARGET("sse4.1")
+    int UpscaleRowSse41(
+        const RGBQUAD* pRow,
+        const UpscaleTap* pTaps,
+        const RGBQUAD* pBackground,
+        RGBQUAD* pOutput,
+        int nWidth)
+    {
+        const __m128i round = _mm_set1_epi16(128);
+        const __m128i full = _mm_set1_epi16(255);
+        const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xff000000));
+        const int* pSource = reinterpret_cast<const int*>(pRow);
+
+        // two output pixels per step, one in each half of the 16 bit lanes
+        int x = 0;
+        for (; x + 2 <= nWidth; x += 2)
+        {
+            const UpscaleTap& p = pTaps[x];
+            const UpscaleTap& q = pTaps[x + 1];
+
+            const __m128i first = _mm_cvtepu8_epi16(_mm_setr_epi32(pSource[p.nFirst], pSource[q.nFirst], 0, 0));
+            const __m128i second = _mm_cvtepu8_epi16(_mm_setr_epi32(pSource[p.nSecond], pSource[q.nSecond], 0, 0));
+            const __m128i secondWeight = _mm_setr_epi16(
+                static_cast<short>(p.nWeight), static_cast<short>(p.nWeight), static_cast<short>(p.nWeight), static_cast<short>(p.nWeight),
+                static_cast<short>(q.nWeight), static_cast<short>(q.nWeight), static_cast<short>(q.nWeight), static_cast<short>(q.nWeight));
+            const __m128i firstWeight = _mm_sub_epi16(_mm_set1_epi16(256), secondWeight);
+
+            const __m128i color = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+                _mm_mullo_epi16(first, firstWeight),
+                _mm_mullo_epi16(second, secondWeight)), round), 8);
+
+            // alpha of each pixel into all four of its lanes
+            const __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(color, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+            const __m128i background = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pBackground + x)));
+            const __m128i t = _mm_add_epi16(_mm_mullo_epi16(background, _mm_sub_epi16(full, alpha)), round);
+            const __m128i over = _mm_add_epi16(color, _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8));
+
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(pOutput + x), _mm_or_si128(_mm_packus_epi16(over, over), opaque));
+        }
+
+        return x;
+    }
+
+    // All ones in the 16 bit lanes KeyDepthRangeScalar keys. SSE has no
+    // unsigned 16 bit compare, a depth is in range when clamping it to the
+    // range leaves it as it was. depth + margin < background is tested as
+    // background - margin - depth > 0, the saturating subtractions keeping
+    // it from wrapping.
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i KeyDepthSse41(__m128i depth, __m128i nearDepth, __m128i farDepth)
+    {
+        return _mm_and_si128(
+            _mm_cmpeq_epi16(_mm_max_epu16(depth, nearDepth), depth),
+            _mm_cmpeq_epi16(_mm_min_epu16(depth, farDepth), depth));
+    }
+
+    COMPOSITE_TARGET("sse4.1")
+    inline __m128i KeyBackgroundSse41(__m128i keyed, __m128i depth, __m128i background, __m128i margin)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i behind = _mm_cmpeq_epi16(_mm_subs_epu16(_mm_subs_epu16(background, margin), depth), zero);
+        const __m128i unknown = _mm_cmpeq_epi16(background, zero);
+        return _mm_andnot_si128(_mm_andnot_si128(unknown, behind), keyed);
+    }
+
+    COMPOSITE_TARGET("sse4.1")
+    int KeyDepthRangeSse41(
+        const UINT16* pDepthBuffer,
+        const UINT16* pBackgroundDepth,
+        UINT16 nNearDepth,
+        UINT16 nFarDepth,
+        UINT16 nBackgroundMargin,
+        BYTE* pBodyIndexBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        const __m128i nearDepth = _mm_set1_epi16(static_cast<short>(nNearDepth));
+        const __m128i farDepth = _mm_set1_epi16(static_cast<short>(nFarDepth));
+        const __m128i margin = _mm_set1_epi16(static_cast<short>(nBackgroundMargin));
+        const __m128i ones = _mm_set1_epi32(-1);
+
+        int depthIndex = nBeginIndex;
+        for (; depthIndex + 16 <= nEndIndex; depthIndex += 16)
+        {
+            const __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pDepthBuffer + depthIndex));
+            const __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pDepthBuffer + depthIndex + 8));
+
+            __m128i firstKeyed = KeyDepthSse41(first, nearDepth, farDepth);
+            __m128i secondKeyed = KeyDepthSse41(second, nearDepth, farDepth);
+
+            if (pBackgroundDepth)
+            {
+                firstKeyed = KeyBackgroundSse41(firstKeyed, first,
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBackgroundDepth + depthIndex)), margin);
+                secondKeyed = KeyBackgroundSse41(secondKeyed, second,
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(pBackgroundDepth + depthIndex + 8)), margin);
+            }
+
+            // 0 for keyed lanes and -1 for the rest, which saturate to 0 and 0xff
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i*>(pBodyIndexBuffer + depthIndex),
+                _mm_packs_epi16(_mm_xor_si128(firstKeyed, ones), _mm_xor_si128(secondKeyed, ones)));
+        }
+
+        return depthIndex;
+    }
+
+    COMPOSITE_TARGET("avx2")
+    inline __m256i KeyDepthAvx2(__m256i depth, __m256i nearDepth, __m256i farDepth)
+    {
+        return _mm256_and_si256(
+            _mm256_cmpeq_epi16(_mm256_max_epu16(depth, nearDepth), depth),
+            _mm256_cmpeq_epi16(_mm256_min_epu16(depth, farDepth), depth));
+    }
+
+    COMPOSITE_TARGET("avx2")
+    inline __m256i KeyBackgroundAvx2(__m256i keyed, __m256i depth, __m256i background, __m256i margin)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i behind = _mm256_cmpeq_epi16(_mm256_subs_epu16(_mm256_subs_epu16(background, margin), depth), zero);
+        const __m256i unknown = _mm256_cmpeq_epi16(background, zero);
+        return _mm256_andnot_si256(_mm256_andnot_si256(unknown, behind), keyed);
+    }
+
+    COMPOSITE_TARGET("avx2")
+    int KeyDepthRangeAvx2(
+        const UINT16* pDepthBuffer,
+        const UINT16* pBackgroundDepth,
+        UINT16 nNearDepth,
+        UINT16 nFarDepth,
+        UINT16 nBackgroundMargin,
+        BYTE* pBodyIndexBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        const __m256i nearDepth = _mm256_set1_epi16(static_cast<short>(nNearDepth));
+        const __m256i farDepth = _mm256_set1_epi16(static_cast<short>(nFarDepth));
+        const __m256i margin = _mm256_set1_epi16(static_cast<short>(nBackgroundMargin));
+        const __m256i ones = _mm256_set1_epi32(-1);
+
+        int depthIndex = nBeginIndex;
+        for (; depthIndex + 32 <= nEndIndex; depthIndex += 32)
+        {
+            const __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pDepthBuffer + depthIndex));
+            const __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pDepthBuffer + depthIndex + 16));
+
+            __m256i firstKeyed = KeyDepthAvx2(first, nearDepth, farDepth);
+            __m256i secondKeyed = KeyDepthAvx2(second, nearDepth, farDepth);
+
+            if (pBackgroundDepth)
+            {
+                firstKeyed = KeyBackgroundAvx2(firstKeyed, first,
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pBackgroundDepth + depthIndex)), margin);
+                secondKeyed = KeyBackgroundAvx2(secondKeyed, second,
+                    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pBackgroundDepth + depthIndex + 16)), margin);
+            }
+
+            // the pack works per 128 bit lane, the permute puts the quarters back in order
+            const __m256i packed = _mm256_packs_epi16(_mm256_xor_si256(firstKeyed, ones), _mm256_xor_si256(secondKeyed, ones));
+            _mm256_storeu_si256(
+                reinterpret_cast<__m256i*>(pBodyIndexBuffer + depthIndex),
+                _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+
+        return depthIndex;
+    }
+
+    bool CpuSupportsSse41()
+    {
+#ifdef _MSC_VER
+        int info[4] = {0};
+        __cpuid(info, 1);
+        return (info[2] & (1 << 19)) != 0;
+#else
+        return __builtin_cpu_supports("sse4.1") != 0;
+#endif
+    }
+
+    bool CpuSupportsAvx2()
+    {
+#ifdef _MSC_VER
+        int info[4] = {0};
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+
+        // AVX needs OS support for saving the ymm registers
+        __cpuid(info, 1);
+        const int osxsaveAndAvx = (1 << 27) | (1 << 28);
+        if ((info[2] & osxsaveAndAvx) != osxsaveAndAvx || (_xgetbv(0) & 0x6) != 0x6)
+        {
+            return false;
+        }
+
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+
+#endif
+
+    // The public entry points, once per depth map representation and depth
+    // geometry: DepthMap is DepthSpacePoint for the mapper's points or UINT
+    // for an index map
+    template <typename Geometry, typename DepthMap>
+    void CompositeFrameImpl(
+        CompositeKernelType kernel,
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry,
+        const RGBQUAD* pColorBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        int colorIndex = nBeginIndex;
+
+#ifdef COMPOSITE_HAS_X86_SIMD
+        const DynamicDepthGeometry vectorGeometry = {geometry.GetWidth(), geometry.GetHeight()};
+
+        switch (kernel)
+        {
+        case CompositeKernel_Sse41:
+            colorIndex = CompositeSse41(
+                pDepthCoordinates, pBodyIndexBuffer, vectorGeometry,
+                pColorBuffer, pBackgroundBuffer, pOutputBuffer, colorIndex, nEndIndex);
+            break;
+
+        case CompositeKernel_Avx2:
+            // the dword gathers need the body index buffer to be a whole number of dwords
+            if ((vectorGeometry.GetWidth() * vectorGeometry.GetHeight()) % 4 == 0)
+            {
+                colorIndex = CompositeAvx2(
+                    pDepthCoordinates, pBodyIndexBuffer, vectorGeometry,
+                    pColorBuffer, pBackgroundBuffer, pOutputBuffer, colorIndex, nEndIndex);
+            }
+            break;
+
+        default:
+            break;
+        }
+#else
+        (void)kernel;
+#endif
+
+        // scalar loop handles the reference path and any remaining tail pixels
+        CompositeScalar(
+            pDepthCoordinates, pBodyIndexBuffer, geometry,
+            pColorBuffer, pBackgroundBuffer, pOutputBuffer, colorIndex, nEndIndex);
+    }
+
+    template <typename Geometry, typename DepthMap>
+    void CompositeFrameYuy2Impl(
+        CompositeKernelType kernel,
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        const Geometry& geometry,
+        const BYTE* pYuy2Buffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        const int nVectorBegin = std::min(nBeginIndex + (nBeginIndex & 1), nEndIndex);
+        CompositeYuy2Scalar(
+            pDepthCoordinates, pBodyIndexBuffer, geometry,
+            pYuy2Buffer, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nVectorBegin);
+
+        int colorIndex = nVectorBegin;
+
+#ifdef COMPOSITE_HAS_X86_SIMD
+        const DynamicDepthGeometry vectorGeometry = {geometry.GetWidth(), geometry.GetHeight()};
+
+        switch (kernel)
+        {
+        case CompositeKernel_Sse41:
+            colorIndex = CompositeYuy2Sse41(
+                pDepthCoordinates, pBodyIndexBuffer, vectorGeometry,
+                pYuy2Buffer, pBackgroundBuffer, pOutputBuffer, colorIndex, nEndIndex);
+            break;
+
+        case CompositeKernel_Avx2:
+            if ((vectorGeometry.GetWidth() * vectorGeometry.GetHeight()) % 4 == 0)
+            {
+                colorIndex = CompositeYuy2Avx2(
+                    pDepthCoordinates, pBodyIndexBuffer, vectorGeometry,
+                    pYuy2Buffer, pBackgroundBuffer, pOutputBuffer, colorIndex, nEndIndex);
+            }
+            break;
+
+        default:
+            break;
+        }
+#else
+        (void)kernel;
+#endif
+
+        CompositeYuy2Scalar(
+            pDepthCoordinates, pBodyIndexBuffer, geometry,
+            pYuy2Buffer, pBackgroundBuffer, pOutputBuffer, colorIndex, nEndIndex);
+    }
+
+    // The matte kernels for either color format; the YUY2 loads take whole
+    // pairs, so the vector loop starts on an even pixel for both
+    template <typename Geometry, typename DepthMap, typename ColorFrame>
+    void CompositeFrameMatteImpl(
+        CompositeKernelType kernel,
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pAlphaMatte,
+        const Geometry& geometry,
+        const ColorFrame& colorFrame,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex)
+    {
+        const int nVectorBegin = std::min(nBeginIndex + (nBeginIndex & 1), nEndIndex);
+        CompositeMatteScalar(
+            pDepthCoordinates, pAlphaMatte, geometry,
+            colorFrame, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nVectorBegin);
+
+        int colorIndex = nVectorBegin;
+
+#ifdef COMPOSITE_HAS_X86_SIMD
+        switch (kernel)
+        {
+        case CompositeKernel_Sse41:
+            colorIndex = CompositeMatteSse41(
+                pDepthCoordinates, pAlphaMatte, geometry,
+                colorFrame, pBackgroundBuffer, pOutputBuffer, colorIndex, nEndIndex);
+            break;
+
+        case CompositeKernel_Avx2:
+            if ((geometry.GetWidth() * geometry.GetHeight()) % 4 == 0)
+            {
+                colorIndex = CompositeMatteAvx2(
+                    pDepthCoordinates, pAlphaMatte, geometry,
+                    colorFrame, pBackgroundBuffer, pOutputBuffer, colorIndex, nEndIndex);
+            }
+            break;
+
+        default:
+            break;
+        }
+#else
+        (void)kernel;
+#endif
+
+        CompositeMatteScalar(
+            pDepthCoordinates, pAlphaMatte, geometry,
+            colorFrame, pBackgroundBuffer, pOutputBuffer, colorIndex, nEndIndex);
+    }
+
+    // Calls composite with the depth geometry to run: the fixed one for the
+    // frame's size, where there is one and geometry allows, else the size
+    // read at run time
+    template <typename Composite>
+    void WithDepthGeometry(CompositeGeometry geometry, int nDepthWidth, int nDepthHeight, Composite composite)
+    {
+        if (geometry == CompositeGeometry_Fixed && HasFixedCompositeGeometry(nDepthWidth, nDepthHeight))
+        {
+            composite(KinectDepthGeometry());
+            return;
+        }
+
+        const DynamicDepthGeometry dynamicGeometry = {nDepthWidth, nDepthHeight};
+        composite(dynamicGeometry);
+    }
+
+    template <typename DepthMap>
+    uint64_t HashCompositedPixelsImpl(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        int nDepthWidth,
+        int nDepthHeight,
+        const RGBQUAD* pColorBuffer,
+        int nBeginIndex,
+        int nEndIndex,
+        uint64_t nHash,
+        const BYTE* pAlphaMatte)
+    {
+        const uint64_t cFnvPrime = 0x100000001b3ULL;
+        const DynamicDepthGeometry geometry = {nDepthWidth, nDepthHeight};
+
+        for (int colorIndex = nBeginIndex; colorIndex < nEndIndex; ++colorIndex)
+        {
+            if (!IsPlayerPixel(pDepthCoordinates[colorIndex], pBodyIndexBuffer, geometry))
+            {
+                continue;
+            }
+
+            const RGBQUAD color = pColorBuffer[colorIndex];
+            uint64_t nValue = (uint64_t(colorIndex) << 32) | (uint64_t(color.rgbReserved) << 24) |
+                (uint64_t(color.rgbRed) << 16) | (uint64_t(color.rgbGreen) << 8) | color.rgbBlue;
+            if (pAlphaMatte)
+            {
+                nValue ^= uint64_t(GetMatteAlpha(pDepthCoordinates[colorIndex], pAlphaMatte, geometry)) << 56;
+            }
+
+            nHash = (nHash ^ nValue) * cFnvPrime;
+        }
+
+        return nHash;
+    }
+
+    template <typename DepthMap>
+    uint64_t HashCompositedPixelsYuy2Impl(
+        const DepthMap* pDepthCoordinates,
+        const BYTE* pBodyIndexBuffer,
+        int nDepthWidth,
+        int nDepthHeight,
+        const BYTE* pYuy2Buffer,
+        int nBeginIndex,
+        int nEndIndex,
+        uint64_t nHash,
+        const BYTE* pAlphaMatte)
+    {
+        const uint64_t cFnvPrime = 0x100000001b3ULL;
+        const DynamicDepthGeometry geometry = {nDepthWidth, nDepthHeight};
+
+        for (int colorIndex = nBeginIndex; colorIndex < nEndIndex; ++colorIndex)
+        {
+            if (!IsPlayerPixel(pDepthCoordinates[colorIndex], pBodyIndexBuffer, geometry))
+            {
+                continue;
+            }
+
+            const BYTE* pPair = pYuy2Buffer + (colorIndex & ~1) * 2;
+            uint64_t nValue = (uint64_t(colorIndex) << 32) | (uint64_t(pYuy2Buffer[colorIndex * 2]) << 16) |
+                (uint64_t(pPair[1]) << 8) | pPair[3];
+            if (pAlphaMatte)
+            {
+                nValue ^= uint64_t(GetMatteAlpha(pDepthCoordinates[colorIndex], pAlphaMatte, geometry)) << 56;
+            }
+
+            nHash = (nHash ^ nValue) * cFnvPrime;
+        }
+
+        return nHash;
+    }
+}
+
+bool IsCompositeKernelSupported(CompositeKernelType kernel)
+{
+    switch (kernel)
+    {
+    case CompositeKernel_Scalar:
+        return true;
+
+#ifdef COMPOSITE_HAS_X86_SIMD
+    case CompositeKernel_Sse41:
+        return CpuSupportsSse41();
+
+    case CompositeKernel_Avx2:
+        return CpuSupportsAvx2();
+#endif
+
+    default:
+        return false;
+    }
+}
+
+CompositeKernelType GetBestCompositeKernel()
+{
+    static const CompositeKernelType best =
+        IsCompositeKernelSupported(CompositeKernel_Avx2) ? CompositeKernel_Avx2 :
+        IsCompositeKernelSupported(CompositeKernel_Sse41) ? CompositeKernel_Sse41 :
+        CompositeKernel_Scalar;
+
+    return best;
+}
+
+bool HasFixedCompositeGeometry(int nDepthWidth, int nDepthHeight)
+{
+    return nDepthWidth == KinectDepthGeometry::GetWidth() && nDepthHeight == KinectDepthGeometry::GetHeight();
+}
+
+const char* GetCompositeKernelName(CompositeKernelType kernel)
+{
+    switch (kernel)
+    {
+    case CompositeKernel_Scalar:
+        return "scalar";
+    case CompositeKernel_Sse41:
+        return "sse4.1";
+    case CompositeKernel_Avx2:
+        return "avx2";
+    default:
+        return "unknown";
+    }
+}
+
+void CompositeFrame(
+    CompositeKernelType kernel,
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    CompositeGeometry geometry)
+{
+    WithDepthGeometry(geometry, nDepthWidth, nDepthHeight, [&](const auto& depthGeometry)
+    {
+        CompositeFrameImpl(
+            kernel, pDepthCoordinates, pBodyIndexBuffer, depthGeometry,
+            pColorBuffer, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+    });
+}
+
+void CompositeFrame(
+    CompositeKernelType kernel,
+    const UINT* pDepthIndices,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    CompositeGeometry geometry)
+{
+    WithDepthGeometry(geometry, nDepthWidth, nDepthHeight, [&](const auto& depthGeometry)
+    {
+        CompositeFrameImpl(
+            kernel, pDepthIndices, pBodyIndexBuffer, depthGeometry,
+            pColorBuffer, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+    });
+}
+
+uint64_t HashCompositedPixels(
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    uint64_t nHash,
+    const BYTE* pAlphaMatte)
+{
+    return HashCompositedPixelsImpl(
+        pDepthCoordinates, pBodyIndexBuffer, nDepthWidth, nDepthHeight,
+        pColorBuffer, nBeginIndex, nEndIndex, nHash, pAlphaMatte);
+}
+
+uint64_t HashCompositedPixels(
+    const UINT* pDepthIndices,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    uint64_t nHash,
+    const BYTE* pAlphaMatte)
+{
+    return HashCompositedPixelsImpl(
+        pDepthIndices, pBodyIndexBuffer, nDepthWidth, nDepthHeight,
+        pColorBuffer, nBeginIndex, nEndIndex, nHash, pAlphaMatte);
+}
+
+uint64_t HashCompositedPixelsYuy2(
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    int nBeginIndex,
+    int nEndIndex,
+    uint64_t nHash,
+    const BYTE* pAlphaMatte)
+{
+    return HashCompositedPixelsYuy2Impl(
+        pDepthCoordinates, pBodyIndexBuffer, nDepthWidth, nDepthHeight,
+        pYuy2Buffer, nBeginIndex, nEndIndex, nHash, pAlphaMatte);
+}
+
+uint64_t HashCompositedPixelsYuy2(
+    const UINT* pDepthIndices,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    int nBeginIndex,
+    int nEndIndex,
+    uint64_t nHash,
+    const BYTE* pAlphaMatte)
+{
+    return HashCompositedPixelsYuy2Impl(
+        pDepthIndices, pBodyIndexBuffer, nDepthWidth, nDepthHeight,
+        pYuy2Buffer, nBeginIndex, nEndIndex, nHash, pAlphaMatte);
+}
+
+RGBQUAD ConvertYuy2Pixel(const BYTE* pYuy2Buffer, int nIndex)
+{
+    const BYTE* pPair = pYuy2Buffer + (nIndex & ~1) * 2;
+    return Yuy2ToBgra(pYuy2Buffer[nIndex * 2], pPair[1], pPair[3]);
+}
+
+void ConvertYuy2ToBgra(
+    CompositeKernelType kernel,
+    const BYTE* pYuy2Buffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex)
+{
+    // the vector paths convert whole pairs, an odd first pixel goes the scalar way
+    const int nVectorBegin = std::min(nBeginIndex + (nBeginIndex & 1), nEndIndex);
+    ConvertYuy2Scalar(pYuy2Buffer, pOutputBuffer, nBeginIndex, nVectorBegin);
+
+    int colorIndex = nVectorBegin;
+
+#ifdef COMPOSITE_HAS_X86_SIMD
+    switch (kernel)
+    {
+    case CompositeKernel_Sse41:
+        colorIndex = ConvertYuy2Sse41(pYuy2Buffer, pOutputBuffer, colorIndex, nEndIndex);
+        break;
+
+    case CompositeKernel_Avx2:
+        colorIndex = ConvertYuy2Avx2(pYuy2Buffer, pOutputBuffer, colorIndex, nEndIndex);
+        break;
+
+    default:
+        break;
+    }
+#else
+    (void)kernel;
+#endif
+
+    ConvertYuy2Scalar(pYuy2Buffer, pOutputBuffer, colorIndex, nEndIndex);
+}
+
+void KeyDepthRange(
+    CompositeKernelType kernel,
+    const UINT16* pDepthBuffer,
+    const UINT16* pBackgroundDepth,
+    UINT16 nNearDepth,
+    UINT16 nFarDepth,
+    UINT16 nBackgroundMargin,
+    BYTE* pBodyIndexBuffer,
+    int nBeginIndex,
+    int nEndIndex)
+{
+    // a near depth of 0 would key the pixels without depth
+    nNearDepth = std::max<UINT16>(nNearDepth, 1);
+
+    int depthIndex = nBeginIndex;
+
+#ifdef COMPOSITE_HAS_X86_SIMD
+    switch (kernel)
+    {
+    case CompositeKernel_Sse41:
+        depthIndex = KeyDepthRangeSse41(
+            pDepthBuffer, pBackgroundDepth, nNearDepth, nFarDepth, nBackgroundMargin, pBodyIndexBuffer, depthIndex, nEndIndex);
+        break;
+
+    case CompositeKernel_Avx2:
+        depthIndex = KeyDepthRangeAvx2(
+            pDepthBuffer, pBackgroundDepth, nNearDepth, nFarDepth, nBackgroundMargin, pBodyIndexBuffer, depthIndex, nEndIndex);
+        break;
+
+    default:
+        break;
+    }
+#else
+    (void)kernel;
+#endif
+
+    KeyDepthRangeScalar(
+        pDepthBuffer, pBackgroundDepth, nNearDepth, nFarDepth, nBackgroundMargin, pBodyIndexBuffer, depthIndex, nEndIndex);
+}
+
+void CompositeFrameYuy2(
+    CompositeKernelType kernel,
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    CompositeGeometry geometry)
+{
+    WithDepthGeometry(geometry, nDepthWidth, nDepthHeight, [&](const auto& depthGeometry)
+    {
+        CompositeFrameYuy2Impl(
+            kernel, pDepthCoordinates, pBodyIndexBuffer, depthGeometry,
+            pYuy2Buffer, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+    });
+}
+
+void CompositeFrameYuy2(
+    CompositeKernelType kernel,
+    const UINT* pDepthIndices,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    CompositeGeometry geometry)
+{
+    WithDepthGeometry(geometry, nDepthWidth, nDepthHeight, [&](const auto& depthGeometry)
+    {
+        CompositeFrameYuy2Impl(
+            kernel, pDepthIndices, pBodyIndexBuffer, depthGeometry,
+            pYuy2Buffer, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+    });
+}
+
+void CompositeFrameMatte(
+    CompositeKernelType kernel,
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pAlphaMatte,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex)
+{
+    const BgraColorFrame colorFrame = {pColorBuffer};
+    const DynamicDepthGeometry depthGeometry = {nDepthWidth, nDepthHeight};
+    CompositeFrameMatteImpl(
+        kernel, pDepthCoordinates, pAlphaMatte, depthGeometry,
+        colorFrame, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+}
+
+void CompositeFrameMatte(
+    CompositeKernelType kernel,
+    const UINT* pDepthIndices,
+    const BYTE* pAlphaMatte,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex)
+{
+    const BgraColorFrame colorFrame = {pColorBuffer};
+    const DynamicDepthGeometry depthGeometry = {nDepthWidth, nDepthHeight};
+    CompositeFrameMatteImpl(
+        kernel, pDepthIndices, pAlphaMatte, depthGeometry,
+        colorFrame, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+}
+
+void CompositeFrameMatteYuy2(
+    CompositeKernelType kernel,
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pAlphaMatte,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex)
+{
+    const Yuy2ColorFrame colorFrame = {pYuy2Buffer};
+    const DynamicDepthGeometry depthGeometry = {nDepthWidth, nDepthHeight};
+    CompositeFrameMatteImpl(
+        kernel, pDepthCoordinates, pAlphaMatte, depthGeometry,
+        colorFrame, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+}
+
+void CompositeFrameMatteYuy2(
+    CompositeKernelType kernel,
+    const UINT* pDepthIndices,
+    const BYTE* pAlphaMatte,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex)
+{
+    const Yuy2ColorFrame colorFrame = {pYuy2Buffer};
+    const DynamicDepthGeometry depthGeometry = {nDepthWidth, nDepthHeight};
+    CompositeFrameMatteImpl(
+        kernel, pDepthIndices, pAlphaMatte, depthGeometry,
+        colorFrame, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+}
+
+void UpscaleComposite(
+    CompositeKernelType kernel,
+    const RGBQUAD* pSource,
+    int nSourceWidth,
+    int nSourceHeight,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nOutputWidth,
+    int nOutputHeight,
+    int nBeginRow,
+    int nEndRow)
+{
+    std::vector<UpscaleTap> taps(nOutputWidth);
+    for (int x = 0; x < nOutputWidth; ++x)
+    {
+        taps[x] = GetUpscaleTap(x, nSourceWidth, nOutputWidth);
+    }
+
+    // the two source rows blended vertically, then sampled horizontally
+    std::vector<RGBQUAD> row(nSourceWidth);
+
+#ifdef COMPOSITE_HAS_X86_SIMD
+    const bool bSse41 = (kernel == CompositeKernel_Sse41 || kernel == CompositeKernel_Avx2);
+#else
+    (void)kernel;
+#endif
+
+    for (int y = nBeginRow; y < nEndRow; ++y)
+    {
+        const UpscaleTap tap = GetUpscaleTap(y, nSourceHeight, nOutputHeight);
+        const RGBQUAD* pTop = pSource + tap.nFirst * nSourceWidth;
+        const RGBQUAD* pBottom = pSource + tap.nSecond * nSourceWidth;
+        const RGBQUAD* pBackground = pBackgroundBuffer + y * nOutputWidth;
+        RGBQUAD* pOutput = pOutputBuffer + y * nOutputWidth;
+
+        int nLerped = 0;
+        int nUpscaled = 0;
+
+#ifdef COMPOSITE_HAS_X86_SIMD
+        if (bSse41)
+        {
+            nLerped = LerpRowSse41(pTop, pBottom, tap.nWeight, row.data(), nSourceWidth);
+        }
+#endif
+        LerpRowScalar(pTop, pBottom, tap.nWeight, row.data(), nLerped, nSourceWidth);
+
+#ifdef COMPOSITE_HAS_X86_SIMD
+        if (bSse41)
+        {
+            nUpscaled = UpscaleRowSse41(row.data(), taps.data(), pBackground, pOutput, nOutputWidth);
+        }
+#endif
+        UpscaleRowScalar(row.data(), taps.data(), pBackground, pOutput, nUpscaled, nOutputWidth);
+    }
+}
@@ -0,0 +1,271 @@
+#pragma once
+
+#include <cstdint>
+#include "KinectTypes.h"
+
+// Instruction sets the composite kernel can run on. Scalar is the reference
+// implementation; the vector paths must produce bit-identical output.
+enum CompositeKernelType
+{
+    CompositeKernel_Scalar = 0,
+    CompositeKernel_Sse41,
+    CompositeKernel_Avx2,
+};
+
+// How the hard edge composite kernels get the depth frame size. For the
+// Kinect v2 depth frame (512x424) the scalar kernels have its size folded in,
+// which CompositeGeometry_Fixed runs for frames of that size; any other size,
+// CompositeGeometry_Generic, and the vector and matte kernels read the size
+// at run time. Both give the same output.
+enum CompositeGeometry
+{
+    CompositeGeometry_Fixed = 0,
+    CompositeGeometry_Generic,
+};
+
+// Index maps hold one UINT per color pixel instead of a DepthSpacePoint: the
+// depth pixel (x + y * depth width) its point rounds to, or this for color
+// pixels that map nowhere, half the bytes for the kernels to read.
+const UINT cInvalidDepthIndex = 0xffffffff;
+
+// The depth pixel the kernels test for point p, the rounding and bounds test
+// of the original per pixel loop. An index map holds this for every point the
+// mapper would have written, so both representations composite alike.
+inline UINT GetDepthIndex(const DepthSpacePoint& p, int nDepthWidth, int nDepthHeight)
+{
+    // -infinity and NaN fail the range test, truncating what passes gives
+    // the depth pixel the kernels round to
+    const float fX = p.X + 0.5f;
+    const float fY = p.Y + 0.5f;
+    if (!(fX > -1.0f && fX < nDepthWidth && fY > -1.0f && fY < nDepthHeight))
+    {
+        return cInvalidDepthIndex;
+    }
+
+    return UINT(static_cast<int>(fX) + static_cast<int>(fY) * nDepthWidth);
+}
+
+// Picks the widest kernel supported by the CPU we are running on.
+CompositeKernelType GetBestCompositeKernel();
+
+bool IsCompositeKernelSupported(CompositeKernelType kernel);
+
+const char* GetCompositeKernelName(CompositeKernelType kernel);
+
+// Whether a depth frame of this size has kernels of its own
+bool HasFixedCompositeGeometry(int nDepthWidth, int nDepthHeight);
+
+// Composites color pixels [nBeginIndex, nEndIndex) of the output. A pixel is taken
+// from the color frame when it maps to a tracked body index pixel in depth space
+// and from the background otherwise.
+void CompositeFrame(
+    CompositeKernelType kernel,
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    CompositeGeometry geometry = CompositeGeometry_Fixed);
+
+// The same on an index map, whose entries must be below nDepthWidth * nDepthHeight
+void CompositeFrame(
+    CompositeKernelType kernel,
+    const UINT* pDepthIndices,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    CompositeGeometry geometry = CompositeGeometry_Fixed);
+
+// CompositeFrame with the color frame in YUY2, two pixels in four bytes
+// (Y0 U Y1 V), the sensor's native format. Only the pixels taken from the
+// color frame are converted, with ConvertYuy2Pixel's arithmetic.
+void CompositeFrameYuy2(
+    CompositeKernelType kernel,
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    CompositeGeometry geometry = CompositeGeometry_Fixed);
+
+// and on an index map
+void CompositeFrameYuy2(
+    CompositeKernelType kernel,
+    const UINT* pDepthIndices,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    CompositeGeometry geometry = CompositeGeometry_Fixed);
+
+// CompositeFrame with a soft edge: pAlphaMatte holds an alpha per depth
+// pixel, and each color pixel is its color frame pixel blended over the
+// background by the alpha of the depth pixel it maps to, all four channels
+// rounded to nearest. Alpha 0 and pixels that map nowhere take the
+// background, 255 the color frame, so a matte of only those composites as
+// CompositeFrame does. Every kernel gives the same output.
+void CompositeFrameMatte(
+    CompositeKernelType kernel,
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pAlphaMatte,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex);
+
+// and on an index map
+void CompositeFrameMatte(
+    CompositeKernelType kernel,
+    const UINT* pDepthIndices,
+    const BYTE* pAlphaMatte,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex);
+
+// CompositeFrameMatte for a YUY2 color frame
+void CompositeFrameMatteYuy2(
+    CompositeKernelType kernel,
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pAlphaMatte,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex);
+
+// and on an index map
+void CompositeFrameMatteYuy2(
+    CompositeKernelType kernel,
+    const UINT* pDepthIndices,
+    const BYTE* pAlphaMatte,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex);
+
+// Pixel nIndex of a YUY2 frame as BGRA with alpha 0xff: studio range BT.601
+// in 8 bit fixed point, at most one step from the exact conversion
+RGBQUAD ConvertYuy2Pixel(const BYTE* pYuy2Buffer, int nIndex);
+
+// Converts pixels [nBeginIndex, nEndIndex) of a YUY2 frame, every kernel
+// giving ConvertYuy2Pixel's output
+void ConvertYuy2ToBgra(
+    CompositeKernelType kernel,
+    const BYTE* pYuy2Buffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex);
+
+// Bilinear upscale of a premultiplied image (alpha in rgbReserved) over the
+// background, rows [nBeginRow, nEndRow) of the output. Source pixel centers
+// are spread evenly over the output and the edges clamp. Weights are 8 bit
+// fixed point; every kernel gives the same output, AVX2 runs the SSE4.1 path.
+void UpscaleComposite(
+    CompositeKernelType kernel,
+    const RGBQUAD* pSource,
+    int nSourceWidth,
+    int nSourceHeight,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nOutputWidth,
+    int nOutputHeight,
+    int nBeginRow,
+    int nEndRow);
+
+// Keys depth pixels [nBeginIndex, nEndIndex) into a body index frame: 0, the
+// first body, where the depth (mm) lies in [nNearDepth, nFarDepth] and, where
+// pBackgroundDepth has a depth, more than nBackgroundMargin in front of it;
+// 0xff (no player) everywhere else. pBackgroundDepth may be null, 0 in it is
+// a pixel the background has no depth for. Pixels without depth are never
+// keyed. Every kernel gives the same output.
+void KeyDepthRange(
+    CompositeKernelType kernel,
+    const UINT16* pDepthBuffer,
+    const UINT16* pBackgroundDepth,
+    UINT16 nNearDepth,
+    UINT16 nFarDepth,
+    UINT16 nBackgroundMargin,
+    BYTE* pBodyIndexBuffer,
+    int nBeginIndex,
+    int nEndIndex);
+
+// Folds the color pixels [nBeginIndex, nEndIndex) that CompositeFrame would
+// take from the color frame, and where they are, into nHash, FNV-1a over 64 bit words. Pixels
+// left to the background do not change the hash, so a span without players
+// keeps nHash as it was. With pAlphaMatte (see CompositeFrameMatte) each
+// pixel's alpha is folded in as well.
+uint64_t HashCompositedPixels(
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    uint64_t nHash,
+    const BYTE* pAlphaMatte = nullptr);
+
+// HashCompositedPixels on an index map
+uint64_t HashCompositedPixels(
+    const UINT* pDepthIndices,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const RGBQUAD* pColorBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    uint64_t nHash,
+    const BYTE* pAlphaMatte = nullptr);
+
+// HashCompositedPixels for a YUY2 color frame, hashing each pixel's Y, U and V
+uint64_t HashCompositedPixelsYuy2(
+    const DepthSpacePoint* pDepthCoordinates,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    int nBeginIndex,
+    int nEndIndex,
+    uint64_t nHash,
+    const BYTE* pAlphaMatte = nullptr);
+
+// and on an index map
+uint64_t HashCompositedPixelsYuy2(
+    const UINT* pDepthIndices,
+    const BYTE* pBodyIndexBuffer,
+    int nDepthWidth,
+    int nDepthHeight,
+    const BYTE* pYuy2Buffer,
+    int nBeginIndex,
+    int nEndIndex,
+    uint64_t nHash,
+    const BYTE* pAlphaMatte = nullptr);
@@ -2,10 +2,15 @@
 #include <assert.h>
 #include <strsafe.h>
 #include <math.h>
+#include <algorithm>
 #include <limits>
 #include <Wincodec.h>
 #include "resource.h"
 #include "CoordinateMappingBasics.h"
+#include "KinectCoordinateMapper.h"
+#include "KinectFrameSource.h"
+#include "TimerFrameSource.h"
+#include "CpuUsage.h"
 
 #ifndef HINST_THISCOMPONENT
 EXTERN_C IMAGE_DOS_HEADER __ImageBase;
@@ -20,28 +25,53 @@ int APIENTRY wWinMain(
 )
 {
     UNREFERENCED_PARAMETER(hPrevInstance);
-    UNREFERENCED_PARAMETER(lpCmdLine);
+
+    AppOptions options;
+    CCoordinateMappingBasics::ParseCommandLine(lpCmdLine, &options);
 
     CoInitialize(nullptr);
 
-    CCoordinateMappingBasics application;
+    CCoordinateMappingBasics application(options);
     application.Run(hInstance, nShowCmd);
 
     CoUninitialize();
 }
 
-CCoordinateMappingBasics::CCoordinateMappingBasics() :
+CCoordinateMappingBasics::CCoordinateMappingBasics(const AppOptions& options) :
     m_hWnd(nullptr),
     m_nStartTime(0),
     m_nLastCounter(0),
     m_nFramesSinceUpdate(0),
+    m_nLastProcessed(0),
+    m_lastCpuTime(0),
+    m_nLastPresentTime(0),
     m_fFreq(0),
     m_nNextStatusTime(0LL),
     m_bSaveScreenshot(false),
+    m_bSaveReplay(false),
     m_pKinectSensor(nullptr),
     m_pCoordinateMapper(nullptr),
-    m_pMultiSourceFrameReader(nullptr),
-    m_pD2DFactory(nullptr)
+    m_calibrationPath(options.calibrationPath),
+    m_saveMappingPath(options.saveMappingPath),
+    m_recordPath(options.recordPath),
+    m_replayPath(options.replayPath),
+    m_replayPacing(options.replayPacing),
+    m_bSynthetic(options.bSynthetic),
+    m_nSyntheticFps(options.nSyntheticFps),
+    m_pD2DFactory(nullptr),
+    m_backgroundPath(options.backgroundPath),
+    m_backgroundDirectory(options.backgroundDirectory),
+    m_pCompositedBackground(nullptr),
+    m_videoBackgroundPath(options.videoBackgroundPath),
+    m_nCompositedVideoFrame(-1),
+    m_nOutputWidth(options.nOutputWidth),
+    m_nOutputHeight(options.nOutputHeight),
+    m_bOutputMismatchReported(false),
+    m_screenshotFormat(options.screenshotFormat),
+    m_nInstantReplaySeconds(options.nInstantReplaySeconds),
+    m_nUploadedFrame(0),
+    m_profilePath(options.profilePath),
+    m_tracePath(options.tracePath)
 {
     LARGE_INTEGER qpf = {0};
     if (QueryPerformanceFrequency(&qpf))
@@ -49,21 +79,52 @@ CCoordinateMappingBasics::CCoordinateMappingBasics() :
         m_fFreq = double(qpf.QuadPart);
     }
 
-    // create heap storage for composite image pixel data in RGBX format
-    m_pOutputRGBX = std::make_unique<RGBQUAD[]>(cColorWidth * cColorHeight);
+    m_syntheticGeometry = MakeFrameGeometry(
+        options.nSyntheticDepthWidth,
+        options.nSyntheticDepthHeight,
+        options.nSyntheticColorWidth,
+        options.nSyntheticColorHeight);
+
+    // persistent workers for the per-frame compositing
+    m_pThreadPool = std::make_unique<ThreadPool>(options.nThreadCount);
 
-    // create heap storage for background image pixel data in RGBX format
-    m_pBackgroundRGBX = std::make_unique<RGBQUAD[]>(cColorWidth * cColorHeight);
+    // only the pipeline writes its output surfaces, so they can keep the
+    // background until ProcessFrame sees a different one
+    m_compositor.SetCompositeMode(options.compositeMode);
+    m_compositor.SetBackgroundPersistent(options.compositeMode != CompositeMode_Full);
+    m_compositor.SetMappingCacheEnabled(options.bMappingCache);
+    m_compositor.SetLowMemory(options.bLowMemory);
+    m_compositor.SetMatteRefinement(options.matteRefinement);
 
-    // create heap storage for color pixel data in RGBX format
-    m_pColorRGBX = std::make_unique<RGBQUAD[]>(cColorWidth * cColorHeight);
+    if (options.bDepthKey)
+    {
+        m_compositor.SetSegmentationMode(SegmentationMode_DepthRange);
+        m_compositor.GetDepthKeyer().SetDepthRange(
+            static_cast<UINT16>(options.nDepthKeyNear),
+            static_cast<UINT16>(options.nDepthKeyFar));
+        m_compositor.GetDepthKeyer().SetBackgroundFrames(options.nDepthKeyBackgroundFrames);
+    }
 
-    // create heap storage for the coorinate mapping from color to depth
-    m_pDepthCoordinates = std::make_unique<DepthSpacePoint[]>(cColorWidth * cColorHeight);
+    // never empty, so a frame without changes still passes a dirty rect list
+    m_dirtyRects.reserve(16);
+
+    m_profiler.SetEnabled(options.bProfile);
+    if (!m_tracePath.empty())
+    {
+        m_profiler.StartTrace(options.nTraceStart, options.nTraceFrames);
+    }
 }
   
 CCoordinateMappingBasics::~CCoordinateMappingBasics()
 {
+    // the pipeline threads use the sensor and our buffers, stop them first
+    m_pipeline.Stop();
+
+    if (!m_profilePath.empty())
+    {
+        m_profiler.WriteReport(m_profilePath.c_str());
+    }
+
     // close the Kinect Sensor
     if (m_pKinectSensor)
     {
@@ -71,29 +132,202 @@ CCoordinateMappingBasics::~CCoordinateMappingBasics()
     }
 }
 
-int CCoordinateMappingBasics::Run(
-    HINSTANCE hInstance,
-    int nCmdShow)
+namespace
 {
-    if (m_pBackgroundRGBX)
+    // the portable frame processing code takes narrow (ANSI code page) paths
+    std::string WideToNarrow(LPCWSTR pszWide)
     {
-        if (FAILED(LoadResourceImage(
-            L"Background",
-            L"Image",
-            cColorWidth,
-            cColorHeight,
-            m_pBackgroundRGBX.get())))
+        int nLength = WideCharToMultiByte(CP_ACP, 0, pszWide, -1, nullptr, 0, nullptr, nullptr);
+        if (nLength <= 1)
         {
-            const RGBQUAD c_green = {0, 255, 0}; 
+            return std::string();
+        }
 
-            // Fill in with a background colour of green if we can't load the background image
-            for (int i = 0 ; i < cColorWidth * cColorHeight ; ++i)
+        std::string narrow(nLength - 1, '\0');
+        WideCharToMultiByte(CP_ACP, 0, pszWide, -1, &narrow[0], nLength, nullptr, nullptr);
+        return narrow;
+    }
+}
+
+void CCoordinateMappingBasics::ParseCommandLine(LPCWSTR lpCmdLine, AppOptions* pOptions)
+{
+    if (!lpCmdLine || !*lpCmdLine)
+    {
+        return;
+    }
+
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(lpCmdLine, &argc);
+    if (!argv)
+    {
+        return;
+    }
+
+    for (int i = 0; i < argc; ++i)
+    {
+        bool bHasValue = (i + 1 < argc);
+
+        if (_wcsicmp(argv[i], L"-threads") == 0 && bHasValue)
+        {
+            pOptions->nThreadCount = _wtoi(argv[++i]);
+        }
+        else if (_wcsicmp(argv[i], L"-calibration") == 0 && bHasValue)
+        {
+            pOptions->calibrationPath = WideToNarrow(argv[++i]);
+        }
+        else if (_wcsicmp(argv[i], L"-savemapping") == 0 && bHasValue)
+        {
+            pOptions->saveMappingPath = WideToNarrow(argv[++i]);
+        }
+        else if (_wcsicmp(argv[i], L"-record") == 0 && bHasValue)
+        {
+            pOptions->recordPath = WideToNarrow(argv[++i]);
+        }
+        else if (_wcsicmp(argv[i], L"-replay") == 0 && bHasValue)
+        {
+            pOptions->replayPath = WideToNarrow(argv[++i]);
+        }
+        else if (_wcsicmp(argv[i], L"-replayfast") == 0)
+        {
+            pOptions->replayPacing = ReplayPacing_AsFastAsPossible;
+        }
+        else if (_wcsicmp(argv[i], L"-synthetic") == 0)
+        {
+            pOptions->bSynthetic = true;
+        }
+        else if (_wcsicmp(argv[i], L"-syntheticdepth") == 0 && bHasValue)
+        {
+            // e.g. 1024x1024; a malformed size keeps the current one
+            int nWidth = 0;
+            int nHeight = 0;
+            if (swscanf_s(argv[++i], L"%dx%d", &nWidth, &nHeight) == 2 && nWidth > 0 && nHeight > 0)
             {
-                m_pBackgroundRGBX[i] = c_green;
+                pOptions->bSynthetic = true;
+                pOptions->nSyntheticDepthWidth = nWidth;
+                pOptions->nSyntheticDepthHeight = nHeight;
             }
         }
+        else if (_wcsicmp(argv[i], L"-syntheticcolor") == 0 && bHasValue)
+        {
+            // e.g. 3840x2160
+            int nWidth = 0;
+            int nHeight = 0;
+            if (swscanf_s(argv[++i], L"%dx%d", &nWidth, &nHeight) == 2 && nWidth > 0 && nHeight > 0)
+            {
+                pOptions->bSynthetic = true;
+                pOptions->nSyntheticColorWidth = nWidth;
+                pOptions->nSyntheticColorHeight = nHeight;
+            }
+        }
+        else if (_wcsicmp(argv[i], L"-syntheticfps") == 0 && bHasValue)
+        {
+            const int nFps = _wtoi(argv[++i]);
+            if (nFps > 0)
+            {
+                pOptions->bSynthetic = true;
+                pOptions->nSyntheticFps = nFps;
+            }
+        }
+        else if (_wcsicmp(argv[i], L"-background") == 0 && bHasValue)
+        {
+            pOptions->backgroundPath = WideToNarrow(argv[++i]);
+        }
+        else if (_wcsicmp(argv[i], L"-backgrounds") == 0 && bHasValue)
+        {
+            pOptions->backgroundDirectory = WideToNarrow(argv[++i]);
+        }
+        else if (_wcsicmp(argv[i], L"-videobackground") == 0 && bHasValue)
+        {
+            pOptions->videoBackgroundPath = WideToNarrow(argv[++i]);
+        }
+        else if (_wcsicmp(argv[i], L"-roi") == 0)
+        {
+            pOptions->compositeMode = CompositeMode_PlayerRegions;
+        }
+        else if (_wcsicmp(argv[i], L"-tiles") == 0)
+        {
+            pOptions->compositeMode = CompositeMode_DirtyTiles;
+        }
+        else if (_wcsicmp(argv[i], L"-mapcache") == 0)
+        {
+            pOptions->bMappingCache = true;
+        }
+        else if (_wcsicmp(argv[i], L"-lowmem") == 0)
+        {
+            pOptions->bLowMemory = true;
+        }
+        else if (_wcsicmp(argv[i], L"-depthkey") == 0 && bHasValue)
+        {
+            // e.g. 500-2500; a malformed range keys on the default one
+            int nNear = 0;
+            int nFar = 0;
+            pOptions->bDepthKey = true;
+            if (swscanf_s(argv[++i], L"%d-%d", &nNear, &nFar) == 2 && nNear > 0 && nNear <= nFar && nFar <= 0xffff)
+            {
+                pOptions->nDepthKeyNear = nNear;
+                pOptions->nDepthKeyFar = nFar;
+            }
+        }
+        else if (_wcsicmp(argv[i], L"-depthbackground") == 0 && bHasValue)
+        {
+            pOptions->bDepthKey = true;
+            pOptions->nDepthKeyBackgroundFrames = std::max(0, _wtoi(argv[++i]));
+        }
+        else if (_wcsicmp(argv[i], L"-matte") == 0 && bHasValue)
+        {
+            // none, feather or clean; anything else keeps hard edges
+            ParseMatteRefinement(WideToNarrow(argv[++i]).c_str(), &pOptions->matteRefinement);
+        }
+        else if (_wcsicmp(argv[i], L"-depthres") == 0 && bHasValue)
+        {
+            // e.g. 1280x720; a malformed size keeps the current mode
+            int nWidth = 0;
+            int nHeight = 0;
+            if (swscanf_s(argv[++i], L"%dx%d", &nWidth, &nHeight) == 2 && nWidth > 0 && nHeight > 0)
+            {
+                pOptions->compositeMode = CompositeMode_DepthResolution;
+                pOptions->nOutputWidth = nWidth;
+                pOptions->nOutputHeight = nHeight;
+            }
+        }
+        else if (_wcsicmp(argv[i], L"-format") == 0 && bHasValue)
+        {
+            // bmp, qoi or png; anything else keeps BMP
+            ParseImageFormat(WideToNarrow(argv[++i]).c_str(), &pOptions->screenshotFormat);
+        }
+        else if (_wcsicmp(argv[i], L"-instantreplay") == 0 && bHasValue)
+        {
+            pOptions->nInstantReplaySeconds = std::max(0, _wtoi(argv[++i]));
+        }
+        else if (_wcsicmp(argv[i], L"-noprofile") == 0)
+        {
+            pOptions->bProfile = false;
+        }
+        else if (_wcsicmp(argv[i], L"-profile") == 0 && bHasValue)
+        {
+            pOptions->profilePath = WideToNarrow(argv[++i]);
+        }
+        else if (_wcsicmp(argv[i], L"-trace") == 0 && bHasValue)
+        {
+            pOptions->tracePath = WideToNarrow(argv[++i]);
+        }
+        else if (_wcsicmp(argv[i], L"-tracestart") == 0 && bHasValue)
+        {
+            pOptions->nTraceStart = std::max(0, _wtoi(argv[++i]));
+        }
+        else if (_wcsicmp(argv[i], L"-traceframes") == 0 && bHasValue)
+        {
+            pOptions->nTraceFrames = std::max(1, _wtoi(argv[++i]));
+        }
     }
 
+    LocalFree(argv);
+}
+
+int CCoordinateMappingBasics::Run(
+    HINSTANCE hInstance,
+    int nCmdShow)
+{
     MSG       msg = {0};
     WNDCLASS  wc;
 
@@ -122,10 +356,23 @@ int CCoordinateMappingBasics::Run(
     // Show window
     ShowWindow(hWndApp, nCmdShow);
 
-    // Main message loop
+    // Main message loop, frames are acquired and composited on the pipeline threads.
+    // Sleep until either a composited frame or a window message is waiting.
+    HANDLE hFramePublished = m_pipeline.GetPresentEvent().GetHandle();
+
     while (WM_QUIT != msg.message)
     {
-        Update();
+        DWORD dwWait = MsgWaitForMultipleObjects(1, &hFramePublished, FALSE, cStatusRefreshMsec, QS_ALLINPUT);
+        if (dwWait == WAIT_OBJECT_0)
+        {
+            m_pipeline.GetPresentEvent().OnWoken();
+            Present();
+        }
+        else if (dwWait == WAIT_TIMEOUT)
+        {
+            // keep the statistics current while no frames arrive
+            UpdateFrameRate(m_nLastPresentTime, false);
+        }
 
         while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE))
         {
@@ -143,109 +390,6 @@ int CCoordinateMappingBasics::Run(
     return static_cast<int>(msg.wParam);
 }
 
-void CCoordinateMappingBasics::Update()
-{
-    V_CHECK(m_pMultiSourceFrameReader != nullptr);
-
-    Microsoft::WRL::ComPtr<IMultiSourceFrame> pMultiSourceFrame;
-    V(m_pMultiSourceFrameReader->AcquireLatestFrame(&pMultiSourceFrame));
-
-    // Get the depth frame data
-    Microsoft::WRL::ComPtr<IDepthFrameReference> pDepthFrameReference;
-    V(pMultiSourceFrame->get_DepthFrameReference(&pDepthFrameReference));
-
-    Microsoft::WRL::ComPtr<IDepthFrame> pDepthFrame;
-    V(pDepthFrameReference->AcquireFrame(&pDepthFrame));
-
-    int64_t nDepthTime = 0;
-    V(pDepthFrame->get_RelativeTime(&nDepthTime));
-
-    Microsoft::WRL::ComPtr<IFrameDescription> pDepthFrameDescription;
-    V(pDepthFrame->get_FrameDescription(&pDepthFrameDescription));
-
-    int nDepthWidth = 0;
-    V(pDepthFrameDescription->get_Width(&nDepthWidth));
-
-    int nDepthHeight = 0;
-    V(pDepthFrameDescription->get_Height(&nDepthHeight));
-
-    UINT16 *pDepthBuffer = nullptr;
-    UINT nDepthBufferSize = 0;
-    V(pDepthFrame->AccessUnderlyingBuffer(&nDepthBufferSize, &pDepthBuffer));
-
-    // Get the color frame data
-    Microsoft::WRL::ComPtr<IColorFrameReference> pColorFrameReference;
-    V(pMultiSourceFrame->get_ColorFrameReference(&pColorFrameReference));
-
-    Microsoft::WRL::ComPtr<IColorFrame> pColorFrame;
-    V(pColorFrameReference->AcquireFrame(&pColorFrame));
-
-
-    // get color frame data
-    Microsoft::WRL::ComPtr<IFrameDescription> pColorFrameDescription;
-    V(pColorFrame->get_FrameDescription(&pColorFrameDescription));
-
-    int nColorWidth = 0;
-    V(pColorFrameDescription->get_Width(&nColorWidth));
-
-    int nColorHeight = 0;
-    V(pColorFrameDescription->get_Height(&nColorHeight));
-
-    ColorImageFormat imageFormat = ColorImageFormat_None;
-    V(pColorFrame->get_RawColorImageFormat(&imageFormat));
-
-    UINT nColorBufferSize = 0;
-    RGBQUAD *pColorBuffer = nullptr;
-    if (imageFormat == ColorImageFormat_Bgra)
-    {
-        V(pColorFrame->AccessRawUnderlyingBuffer(&nColorBufferSize, reinterpret_cast<BYTE**>(&pColorBuffer)));
-    }
-    else if (m_pColorRGBX)
-    {
-        pColorBuffer = m_pColorRGBX.get();
-        nColorBufferSize = cColorWidth * cColorHeight * sizeof(RGBQUAD);
-        V(pColorFrame->CopyConvertedFrameDataToArray(nColorBufferSize, reinterpret_cast<BYTE*>(pColorBuffer), ColorImageFormat_Bgra));
-    }
-    else
-    {
-        assert(false);
-        return;
-    }
-
-    // Get the body index frame data
-    Microsoft::WRL::ComPtr<IBodyIndexFrameReference> pBodyIndexFrameReference;
-    V(pMultiSourceFrame->get_BodyIndexFrameReference(&pBodyIndexFrameReference));
-
-    Microsoft::WRL::ComPtr<IBodyIndexFrame> pBodyIndexFrame;
-    V(pBodyIndexFrameReference->AcquireFrame(&pBodyIndexFrame));
-
-    Microsoft::WRL::ComPtr<IFrameDescription> pBodyIndexFrameDescription;
-    V(pBodyIndexFrame->get_FrameDescription(&pBodyIndexFrameDescription));
-
-    int nBodyIndexWidth = 0;
-    V(pBodyIndexFrameDescription->get_Width(&nBodyIndexWidth));
-
-    int nBodyIndexHeight = 0;
-    V(pBodyIndexFrameDescription->get_Height(&nBodyIndexHeight));
-
-    UINT nBodyIndexBufferSize = 0;
-    BYTE* pBodyIndexBuffer = nullptr;
-    V(pBodyIndexFrame->AccessUnderlyingBuffer(&nBodyIndexBufferSize, &pBodyIndexBuffer));            
-
-    // TODO: [thperry] Combine them into objects with buffer pointer, width and height.
-    ProcessFrame(
-        nDepthTime,
-        pDepthBuffer,
-        nDepthWidth,
-        nDepthHeight, 
-        pColorBuffer,
-        nColorWidth,
-        nColorHeight,
-        pBodyIndexBuffer,
-        nBodyIndexWidth,
-        nBodyIndexHeight);
-}
-
 LRESULT CALLBACK CCoordinateMappingBasics::MessageRouter(HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
 {
     CCoordinateMappingBasics* pThis = nullptr;
@@ -285,22 +429,49 @@ LRESULT CALLBACK CCoordinateMappingBasics::DlgProc(HWND hWnd, UINT message, WPAR
             D2D1CreateFactory(D2D1_FACTORY_TYPE_SINGLE_THREADED, &rawD2DFactory);
             m_pD2DFactory.Attach(rawD2DFactory);
 
+            // Get and initialize the default Kinect sensor, or whichever source
+            // replaces it; it describes the frames everything is sized from
+            const HRESULT hrSensor = InitializeDefaultSensor();
+            InitializeOutput();
+
             // Create and initialize a new Direct2D image renderer (take a look at ImageRenderer.h)
             // We'll use this to draw the data we receive from the Kinect to the screen
             m_pDrawCoordinateMapping = std::make_unique<ImageRenderer>(); 
             HRESULT hr = m_pDrawCoordinateMapping->Initialize(
                 GetDlgItem(m_hWnd, IDC_VIDEOVIEW),
                 m_pD2DFactory.Get(),
-                cColorWidth,
-                cColorHeight,
-                cColorWidth * sizeof(RGBQUAD));
+                m_nOutputWidth,
+                m_nOutputHeight,
+                m_nOutputWidth * sizeof(RGBQUAD));
             if (FAILED(hr))
             {
                 SetStatusMessage(L"Failed to initialize the Direct2D draw device.", 10000, true);
             }
 
-            // Get and initialize the default Kinect sensor
-            InitializeDefaultSensor();
+            // the replay button only does something with -instantreplay
+            EnableWindow(GetDlgItem(m_hWnd, IDC_BUTTON_SAVEREPLAY), m_instantReplay.GetCapacity() > 0);
+            EnableWindow(GetDlgItem(m_hWnd, IDC_BUTTON_NEXTBACKGROUND), m_backgroundLibrary.GetCount() > 1);
+
+            if (SUCCEEDED(hrSensor))
+            {
+                StartPipeline();
+            }
+        }
+        break;
+
+        // Status update from one of the pipeline threads
+        case WM_APP_STATUS:
+        {
+            std::wstring status;
+            {
+                std::lock_guard<std::mutex> lock(m_statusLock);
+                status.swap(m_pendingStatus);
+            }
+
+            if (!status.empty())
+            {
+                SetStatusMessage(&status[0], 10000, true);
+            }
         }
         break;
 
@@ -321,6 +492,14 @@ LRESULT CALLBACK CCoordinateMappingBasics::DlgProc(HWND hWnd, UINT message, WPAR
             {
                 m_bSaveScreenshot = true;
             }
+            else if (IDC_BUTTON_SAVEREPLAY == LOWORD(wParam) && BN_CLICKED == HIWORD(wParam))
+            {
+                m_bSaveReplay = true;
+            }
+            else if (IDC_BUTTON_NEXTBACKGROUND == LOWORD(wParam) && BN_CLICKED == HIWORD(wParam))
+            {
+                NextBackground();
+            }
             break;
     }
 
@@ -329,6 +508,16 @@ LRESULT CALLBACK CCoordinateMappingBasics::DlgProc(HWND hWnd, UINT message, WPAR
 
 HRESULT CCoordinateMappingBasics::InitializeDefaultSensor()
 {
+    if (!m_replayPath.empty())
+    {
+        return InitializeReplay();
+    }
+
+    if (m_bSynthetic)
+    {
+        return InitializeSyntheticSource();
+    }
+
     HRESULT hr = S_OK;
 
     hr = GetDefaultKinectSensor(&m_pKinectSensor);
@@ -350,9 +539,15 @@ HRESULT CCoordinateMappingBasics::InitializeDefaultSensor()
 
         if (SUCCEEDED(hr))
         {
-            hr = m_pKinectSensor->OpenMultiSourceFrameReader(
-                FrameSourceTypes::FrameSourceTypes_Depth | FrameSourceTypes::FrameSourceTypes_Color | FrameSourceTypes::FrameSourceTypes_BodyIndex,
-                &m_pMultiSourceFrameReader);
+            auto pKinectSource = std::make_unique<KinectFrameSource>();
+            // keying on depth needs no body tracking
+            hr = pKinectSource->Initialize(
+                m_pKinectSensor.Get(),
+                m_compositor.GetSegmentationMode() == SegmentationMode_BodyIndex);
+            if (SUCCEEDED(hr))
+            {
+                m_pFrameSource = std::move(pKinectSource);
+            }
         }
     }
 
@@ -362,132 +557,622 @@ HRESULT CCoordinateMappingBasics::InitializeDefaultSensor()
         return E_FAIL;
     }
 
+    if (!m_calibrationPath.empty())
+    {
+        // map with our own calibration tables instead of the SDK
+        V_RET(InitializeSoftwareMapper());
+    }
+    else if (m_pCoordinateMapper)
+    {
+        m_pColorToDepthMapper = std::make_unique<KinectCoordinateMapper>(m_pCoordinateMapper.Get());
+    }
+
     return hr;
 }
 
-void CCoordinateMappingBasics::ProcessFrame(
-    int64_t nTime, 
-    const UINT16* pDepthBuffer,
-    int nDepthWidth,
-    int nDepthHeight, 
-    const RGBQUAD* pColorBuffer,
-    int nColorWidth,
-    int nColorHeight,
-    const BYTE* pBodyIndexBuffer,
-    int nBodyIndexWidth,
-    int nBodyIndexHeight)
+HRESULT CCoordinateMappingBasics::InitializeSoftwareMapper()
 {
-    if (m_hWnd)
+    SensorCalibration calibration;
+    auto pSoftwareMapper = std::make_unique<SoftwareCoordinateMapper>();
+
+    HRESULT hr = LoadSensorCalibration(m_calibrationPath.c_str(), &calibration);
+    if (SUCCEEDED(hr))
     {
-        if (!m_nStartTime)
-        {
-            m_nStartTime = nTime;
-        }
+        hr = pSoftwareMapper->Initialize(calibration);
+    }
 
-        double fps = 0.0;
+    if (FAILED(hr))
+    {
+        SetStatusMessage(L"Failed to load the calibration file!", 10000, true);
+        return hr;
+    }
+
+    m_pColorToDepthMapper = std::move(pSoftwareMapper);
+    return S_OK;
+}
+
+HRESULT CCoordinateMappingBasics::InitializeReplay()
+{
+    // without a sensor the SDK mapper has no calibration, so replay needs our own
+    if (m_calibrationPath.empty())
+    {
+        SetStatusMessage(L"Replay needs a -calibration file!", 10000, true);
+        return E_FAIL;
+    }
 
-        LARGE_INTEGER qpcNow = {0};
-        if (m_fFreq)
+    V_RET(InitializeSoftwareMapper());
+
+    // YUY2 captures are handed on as they are, the compositor converts them
+    // in the same pass as the composite like frames straight from the sensor
+    auto pReplaySource = std::make_unique<ReplayFrameSource>();
+    HRESULT hr = pReplaySource->Open(m_replayPath.c_str(), m_replayPacing, true);
+    if (FAILED(hr))
+    {
+        SetStatusMessage(L"Failed to open the capture file!", 10000, true);
+        return hr;
+    }
+
+    m_pFrameSource = std::move(pReplaySource);
+    return S_OK;
+}
+
+HRESULT CCoordinateMappingBasics::InitializeSyntheticSource()
+{
+    // like replay, there is no sensor to ask for the calibration
+    if (m_calibrationPath.empty())
+    {
+        SetStatusMessage(L"Synthetic frames need a -calibration file!", 10000, true);
+        return E_FAIL;
+    }
+
+    V_RET(InitializeSoftwareMapper());
+
+    // the calibration is scaled to whatever size is asked for, like a
+    // sensor mode with more or fewer pixels
+    auto pTimerSource = std::make_unique<TimerFrameSource>();
+    V_RET(pTimerSource->Initialize(
+        m_syntheticGeometry.nDepthWidth,
+        m_syntheticGeometry.nDepthHeight,
+        m_syntheticGeometry.nColorWidth,
+        m_syntheticGeometry.nColorHeight,
+        std::chrono::microseconds(1000000 / m_nSyntheticFps)));
+
+    m_pFrameSource = std::move(pTimerSource);
+    return S_OK;
+}
+
+void CCoordinateMappingBasics::InitializeOutput()
+{
+    // -depthres picks its own size, otherwise the color frames set it
+    if (m_nOutputWidth <= 0 || m_nOutputHeight <= 0)
+    {
+        const FrameGeometry geometry = m_pFrameSource ? m_pFrameSource->GetGeometry() : FrameGeometry();
+        m_nOutputWidth = geometry.IsEmpty() ? cDefaultOutputWidth : geometry.nColorWidth;
+        m_nOutputHeight = geometry.IsEmpty() ? cDefaultOutputHeight : geometry.nColorHeight;
+    }
+
+    m_compositor.SetOutputSize(m_nOutputWidth, m_nOutputHeight);
+
+    // storage for background image pixel data in RGBX format, from the frame buffer pool
+    m_pBackgroundRGBX.Allocate(size_t(m_nOutputWidth) * m_nOutputHeight);
+
+    {
+        HRESULT hr = m_backgroundPath.empty() ?
+            LoadResourceImage(L"Background", L"Image", m_nOutputWidth, m_nOutputHeight, m_pBackgroundRGBX.get()) :
+            LoadBackgroundImage(m_backgroundPath.c_str(), m_nOutputWidth, m_nOutputHeight, m_pBackgroundRGBX.get());
+
+        if (FAILED(hr))
         {
-            if (QueryPerformanceCounter(&qpcNow))
+            const RGBQUAD c_green = {0, 255, 0}; 
+
+            // Fill in with a background colour of green if we can't load the background image
+            for (int i = 0 ; i < m_nOutputWidth * m_nOutputHeight ; ++i)
             {
-                if (m_nLastCounter)
-                {
-                    m_nFramesSinceUpdate++;
-                    fps = m_fFreq * m_nFramesSinceUpdate / double(qpcNow.QuadPart - m_nLastCounter);
-                }
+                m_pBackgroundRGBX[i] = c_green;
             }
         }
+    }
+
+    // The first background of the library is waited for, a warm start only
+    // maps its cache file. The others load behind it, until they do the
+    // button keeps showing the current one.
+    if (!m_backgroundDirectory.empty())
+    {
+        const RGBQUAD* pFirstBackground = nullptr;
+        if (FAILED(m_backgroundLibrary.Open(m_backgroundDirectory.c_str(), m_nOutputWidth, m_nOutputHeight, ".bmp;.png;.jpg;.jpeg", LoadImageFile)) ||
+            FAILED(m_backgroundLibrary.WaitForBackground(0, &pFirstBackground)))
+        {
+            m_backgroundLibrary.Close();
+        }
+    }
 
-        WCHAR szStatusMessage[64];
-        StringCchPrintf(szStatusMessage, _countof(szStatusMessage), L" FPS = %0.2f    Time = %I64d", fps, (nTime - m_nStartTime));
+    // until the first video frame is decoded the image background shows
+    if (!m_videoBackgroundPath.empty())
+    {
+        m_videoBackground.Open(m_videoBackgroundPath.c_str(), m_nOutputWidth, m_nOutputHeight, cRawVideoFps);
+    }
 
-        if (SetStatusMessage(szStatusMessage, 1000, false))
+    // a couple of preallocated frames for screenshots, plus the replay history
+    m_screenshotWriter.Initialize(m_nOutputWidth, m_nOutputHeight, m_screenshotFormat);
+    if (m_nInstantReplaySeconds > 0)
+    {
+        m_instantReplay.Initialize(m_nOutputWidth, m_nOutputHeight, m_nInstantReplaySeconds * cInstantReplayFps);
+    }
+}
+
+void CCoordinateMappingBasics::RecordFrame(const PipelineFrame& frame)
+{
+    if (!m_pCaptureWriter)
+    {
+        m_pCaptureWriter = std::make_unique<CaptureWriter>();
+
+        // the geometry is only known once the first frame arrives
+        if (FAILED(m_pCaptureWriter->Open(
+            m_recordPath.c_str(),
+            frame.nDepthWidth,
+            frame.nDepthHeight,
+            frame.nColorWidth,
+            frame.nColorHeight,
+            (frame.colorFormat == ColorFormat_Yuy2) ? CaptureColorFormat_Yuy2 : CaptureColorFormat_Bgra)))
         {
-            m_nLastCounter = qpcNow.QuadPart;
-            m_nFramesSinceUpdate = 0;
+            PostStatusMessage(L"Failed to create the capture file!");
+            m_recordPath.clear();
+            m_pCaptureWriter.reset();
+            return;
         }
     }
 
-    // Make sure we've received valid data
-    V_CHECK(m_pCoordinateMapper && m_pDepthCoordinates && m_pOutputRGBX &&
-        pDepthBuffer && (nDepthWidth == cDepthWidth) && (nDepthHeight == cDepthHeight) &&
-        pColorBuffer && (nColorWidth == cColorWidth) && (nColorHeight == cColorHeight) &&
-        pBodyIndexBuffer && (nBodyIndexWidth == cDepthWidth) && (nBodyIndexHeight == cDepthHeight));
+    if (FAILED(m_pCaptureWriter->WriteFrame(
+        frame.nRelativeTime,
+        frame.pDepthBuffer,
+        frame.pColorBuffer,
+        frame.pBodyIndexBuffer)))
+    {
+        PostStatusMessage(L"Failed to write to the capture file, recording stopped.");
+        m_recordPath.clear();
+        m_pCaptureWriter.reset();
+    }
+}
+
+void CCoordinateMappingBasics::SaveMapping(const DepthFrameView& depth)
+{
+    ReferenceMapping mapping;
+    mapping.nDepthWidth = depth.nWidth;
+    mapping.nDepthHeight = depth.nHeight;
+    mapping.nColorWidth = m_nOutputWidth;
+    mapping.nColorHeight = m_nOutputHeight;
+    mapping.depth.resize(size_t(depth.nWidth) * depth.nHeight);
+    mapping.points.resize(size_t(m_nOutputWidth) * m_nOutputHeight);
+
+    for (int y = 0; y < depth.nHeight; ++y)
+    {
+        memcpy(&mapping.depth[size_t(y) * depth.nWidth], depth.GetRow(y), depth.nWidth * sizeof(UINT16));
+    }
 
-    V(m_pCoordinateMapper->MapColorFrameToDepthSpace(
-        nDepthWidth * nDepthHeight,
-        (UINT16*)pDepthBuffer,
-        nColorWidth * nColorHeight,
-        m_pDepthCoordinates.get()));
+    HRESULT hr = m_pColorToDepthMapper->MapColorFrameToDepthSpace(
+        static_cast<UINT>(mapping.depth.size()),
+        mapping.depth.data(),
+        static_cast<UINT>(mapping.points.size()),
+        mapping.points.data());
 
-    // loop over output pixels
-    for (int colorIndex = 0; colorIndex < (nColorWidth*nColorHeight); ++colorIndex)
+    if (SUCCEEDED(hr))
     {
-        // default setting source to copy from the background pixel
-        const RGBQUAD* pSrc = m_pBackgroundRGBX.get() + colorIndex;
+        hr = SaveReferenceMapping(m_saveMappingPath.c_str(), mapping);
+    }
 
-        DepthSpacePoint p = m_pDepthCoordinates[colorIndex];
+    PostStatusMessage(SUCCEEDED(hr) ? L"Mapping saved." : L"Failed to save the mapping!");
+    m_saveMappingPath.clear();
+}
 
-        // Values that are negative infinity means it is an invalid color to depth mapping so we
-        // skip processing for this pixel
-        if (p.X != -std::numeric_limits<float>::infinity() && p.Y != -std::numeric_limits<float>::infinity())
+void CCoordinateMappingBasics::ProcessFrame(
+    int64_t nTime,
+    const DepthFrameView& depth,
+    const ColorFrameView& color,
+    const BodyIndexFrameView& bodyIndex,
+    RGBQUAD* pOutputBuffer)
+{
+    // Make sure we've received valid data, the compositor checks the sizes;
+    // keying on depth does without the body index frame
+    V_CHECK(pOutputBuffer && !depth.IsEmpty() && !color.IsEmpty() &&
+        (!bodyIndex.IsEmpty() || m_compositor.GetSegmentationMode() == SegmentationMode_DepthRange));
+
+    // the output surfaces and everything presented from them keep the size
+    // they started with, color frames of another size only fit -depthres
+    if (m_compositor.GetCompositeMode() != CompositeMode_DepthResolution && !color.HasSize(m_nOutputWidth, m_nOutputHeight))
+    {
+        if (!m_bOutputMismatchReported)
         {
-            int depthX = static_cast<int>(p.X + 0.5f);
-            int depthY = static_cast<int>(p.Y + 0.5f);
+            PostStatusMessage(L"The color frames changed size, restart to show them.");
+            m_bOutputMismatchReported = true;
+        }
+        return;
+    }
 
-            if ((depthX >= 0 && depthX < nDepthWidth) && (depthY >= 0 && depthY < nDepthHeight))
-            {
-                BYTE player = pBodyIndexBuffer[depthX + (depthY * cDepthWidth)];
-
-                // if we're tracking a player for the current pixel, draw from the color camera
-                if (player != 0xff)
-                {
-                    // set source for copy to the color pixel
-                    pSrc = m_pColorRGBX.get() + colorIndex;
-                }
-            }
+    if (!m_saveMappingPath.empty() && m_compositor.GetCompositeMode() != CompositeMode_DepthResolution)
+    {
+        SaveMapping(depth);
+    }
+
+    // the library's selection and the video frame are switched here, between
+    // frames; the output surfaces still hold the old background
+    const RGBQUAD* pBackground = m_backgroundLibrary.GetSelectedPixels();
+
+    int64_t nVideoFrame = -1;
+    if (m_videoBackground.IsOpen())
+    {
+        const RGBQUAD* pVideoFrame = m_videoBackground.GetFrame(nTime, &nVideoFrame);
+        if (pVideoFrame)
+        {
+            pBackground = pVideoFrame;
         }
+    }
+
+    if (!pBackground)
+    {
+        pBackground = m_pBackgroundRGBX.get();
+    }
 
-        // write output
-        m_pOutputRGBX[colorIndex] = *pSrc;
+    if (pBackground != m_pCompositedBackground || nVideoFrame != m_nCompositedVideoFrame)
+    {
+        m_compositor.InvalidateBackground();
+        m_pCompositedBackground = pBackground;
+        m_nCompositedVideoFrame = nVideoFrame;
+    }
+
+    // map to depth space, then composite the player over the background in row bands
+    // spread across the thread pool, using the widest SIMD kernel the CPU supports
+    V(m_compositor.ProcessFrame(
+        depth,
+        color,
+        bodyIndex,
+        pBackground,
+        pOutputBuffer));
+}
+
+void CCoordinateMappingBasics::NextBackground()
+{
+    const int nCount = m_backgroundLibrary.GetCount();
+    if (nCount == 0)
+    {
+        return;
     }
 
-    // Draw the data with Direct2D
-    V(m_pDrawCoordinateMapping->Draw(
-        reinterpret_cast<BYTE*>(m_pOutputRGBX.get()),
-        cColorWidth * cColorHeight * sizeof(RGBQUAD)));
+    const int nIndex = (m_backgroundLibrary.GetSelectedIndex() + 1) % nCount;
+    m_backgroundLibrary.Select(nIndex);
+
+    WCHAR szStatusMessage[64 + MAX_PATH];
+    StringCchPrintf(
+        szStatusMessage,
+        _countof(szStatusMessage),
+        L"Background %d of %d: %S",
+        nIndex + 1,
+        nCount,
+        m_backgroundLibrary.GetName(nIndex).c_str());
+    SetStatusMessage(szStatusMessage, 5000, true);
+}
 
-    if (m_bSaveScreenshot)
+void CCoordinateMappingBasics::Present()
+{
+    m_pipeline.PresentLatest([this](const RGBQUAD* pOutputBuffer, int64_t nTime)
     {
-        WCHAR szScreenshotPath[MAX_PATH];
+        m_nLastPresentTime = nTime;
+        m_profiler.RecordFrame(nTime);
+        UpdateFrameRate(nTime, true);
 
-        // Retrieve the path to My Photos
-        GetScreenshotFileName(szScreenshotPath, _countof(szScreenshotPath));
+        // Draw the data with Direct2D, uploading only the tiles that changed
+        // since the frame the bitmap holds (everything unless -tiles)
+        {
+            ProfileScope scope(&m_profiler, ProfileStage_Draw);
 
-        // Write out the bitmap to disk
-        HRESULT hr = SaveBitmapToFile(
-            reinterpret_cast<BYTE*>(m_pOutputRGBX.get()),
-            nColorWidth, nColorHeight,
-            sizeof(RGBQUAD) * 8,
-            szScreenshotPath);
+            m_compositor.GetDirtyTiles().GetChangedRects(pOutputBuffer, m_nUploadedFrame, &m_changedRects, &m_nUploadedFrame);
 
-        WCHAR szStatusMessage[64 + MAX_PATH];
-        if (SUCCEEDED(hr))
+            m_dirtyRects.clear();
+            for (const PixelRect& rect : m_changedRects)
+            {
+                m_dirtyRects.push_back(D2D1::RectU(rect.nLeft, rect.nTop, rect.nRight, rect.nBottom));
+            }
+
+            // the tiles cover the color frame, not a -depthres output
+            const bool bFullUpload = (m_compositor.GetCompositeMode() == CompositeMode_DepthResolution);
+
+            V(m_pDrawCoordinateMapping->Draw(
+                reinterpret_cast<BYTE*>(const_cast<RGBQUAD*>(pOutputBuffer)),
+                m_nOutputWidth * m_nOutputHeight * sizeof(RGBQUAD),
+                bFullUpload ? nullptr : m_dirtyRects.data(),
+                bFullUpload ? 0 : static_cast<UINT>(m_dirtyRects.size())));
+        }
+
+        if (!m_tracePath.empty() && m_profiler.IsTraceComplete())
         {
-            // Set the status bar to show where the screenshot was saved
-            StringCchPrintf(szStatusMessage, _countof(szStatusMessage), L"Screenshot saved to %s", szScreenshotPath);
+            HRESULT hr = m_profiler.WriteChromeTrace(m_tracePath.c_str());
+
+            WCHAR szStatusMessage[64 + MAX_PATH];
+            StringCchPrintf(
+                szStatusMessage,
+                _countof(szStatusMessage),
+                SUCCEEDED(hr) ? L"Trace saved to %S" : L"Failed to write trace to %S",
+                m_tracePath.c_str());
+            SetStatusMessage(szStatusMessage, 5000, true);
+
+            m_tracePath.clear();
         }
-        else
+
+        if (m_instantReplay.GetCapacity())
         {
-            StringCchPrintf(szStatusMessage, _countof(szStatusMessage), L"Failed to write screenshot to %s", szScreenshotPath);
+            ProfileScope scope(&m_profiler, ProfileStage_Replay);
+            m_instantReplay.Push(pOutputBuffer);
         }
 
+        if (m_bSaveScreenshot)
+        {
+            ProfileScope scope(&m_profiler, ProfileStage_Screenshot);
+            SaveScreenshot(pOutputBuffer);
+
+            // toggle off so we don't save a screenshot again next frame
+            m_bSaveScreenshot = false;
+        }
+
+        if (m_bSaveReplay)
+        {
+            SaveReplay();
+            m_bSaveReplay = false;
+        }
+    });
+}
+
+void CCoordinateMappingBasics::SaveScreenshot(const RGBQUAD* pOutputBuffer)
+{
+    WCHAR szScreenshotPath[MAX_PATH];
+
+    // Retrieve the path to My Photos
+    WCHAR szExtension[8];
+    StringCchPrintf(szExtension, _countof(szExtension), L"%S", GetImageFormatExtension(m_screenshotWriter.GetFormat()));
+    GetScreenshotFileName(szScreenshotPath, _countof(szScreenshotPath), szExtension);
+
+    // the frame is copied here, encoding and writing happen on the writer thread
+    HRESULT hr = m_screenshotWriter.Submit(
+        pOutputBuffer,
+        WideToNarrow(szScreenshotPath),
+        [this](HRESULT hrWrite, const std::string& path)
+        {
+            WCHAR szStatusMessage[64 + MAX_PATH];
+            if (SUCCEEDED(hrWrite))
+            {
+                // Set the status bar to show where the screenshot was saved
+                StringCchPrintf(szStatusMessage, _countof(szStatusMessage), L"Screenshot saved to %S", path.c_str());
+            }
+            else
+            {
+                StringCchPrintf(szStatusMessage, _countof(szStatusMessage), L"Failed to write screenshot to %S", path.c_str());
+            }
+
+            PostStatusMessage(szStatusMessage);
+        });
+
+    if (FAILED(hr))
+    {
+        WCHAR szStatusMessage[] = L"Still writing earlier screenshots, try again in a moment.";
+        SetStatusMessage(szStatusMessage, 5000, true);
+    }
+}
+
+void CCoordinateMappingBasics::SaveReplay()
+{
+    WCHAR szReplayPath[MAX_PATH];
+
+    // frames are numbered after this prefix
+    GetScreenshotFileName(szReplayPath, _countof(szReplayPath), L"");
+
+    HRESULT hr = m_instantReplay.Save(
+        &m_screenshotWriter,
+        WideToNarrow(szReplayPath),
+        [this](HRESULT hrWrite, int nFramesWritten)
+        {
+            WCHAR szStatusMessage[64];
+            StringCchPrintf(
+                szStatusMessage,
+                _countof(szStatusMessage),
+                SUCCEEDED(hrWrite) ? L"Replay of %d frames saved to My Pictures" : L"Failed to write the replay, %d frames saved",
+                nFramesWritten);
+
+            PostStatusMessage(szStatusMessage);
+        });
+
+    if (hr == E_PENDING)
+    {
+        WCHAR szStatusMessage[] = L"Still saving the previous replay.";
+        SetStatusMessage(szStatusMessage, 5000, true);
+    }
+    else if (hr != S_OK)
+    {
+        WCHAR szStatusMessage[] = L"Nothing to save yet.";
         SetStatusMessage(szStatusMessage, 5000, true);
+    }
+}
+
+void CCoordinateMappingBasics::UpdateFrameRate(int64_t nTime, bool bPresented)
+{
+    if (!m_hWnd)
+    {
+        return;
+    }
 
-        // toggle off so we don't save a screenshot again next frame
-        m_bSaveScreenshot = false;
+    if (!m_nStartTime)
+    {
+        m_nStartTime = nTime;
     }
+
+    FramePipelineStats stats = m_pipeline.GetStats();
+
+    std::chrono::microseconds cpuTimeNow = GetProcessCpuTime();
+
+    double fps = 0.0;
+    double processFps = 0.0;
+    double cpuUsage = 0.0;
+
+    LARGE_INTEGER qpcNow = {0};
+    if (m_fFreq)
+    {
+        if (QueryPerformanceCounter(&qpcNow))
+        {
+            if (bPresented)
+            {
+                m_nFramesSinceUpdate++;
+            }
+
+            if (m_nLastCounter)
+            {
+                double elapsed = double(qpcNow.QuadPart - m_nLastCounter) / m_fFreq;
+                fps = m_nFramesSinceUpdate / elapsed;
+                processFps = (stats.nProcessed - m_nLastProcessed) / elapsed;
+
+                // share of one core, so an idle pipeline shows close to 0%
+                cpuUsage = 100.0 * std::chrono::duration<double>(cpuTimeNow - m_lastCpuTime).count() / elapsed;
+            }
+        }
+    }
+
+    // p50/p99 of the busiest stages in milliseconds
+    const ProfileStats mapStats = m_profiler.GetStageStats(ProfileStage_Map);
+    const ProfileStats compositeStats = m_profiler.GetStageStats(ProfileStage_Composite);
+    const ProfileStats drawStats = m_profiler.GetStageStats(ProfileStage_Draw);
+
+    WCHAR szStatusMessage[320];
+    StringCchPrintf(
+        szStatusMessage,
+        _countof(szStatusMessage),
+        L" FPS = %0.2f (processed %0.2f)    Time = %I64d    Queued = %Iu/%Iu    Dropped = %I64u/%I64u/%I64u    "
+        L"Map = %0.1f/%0.1f    Composite = %0.1f/%0.1f    Draw = %0.1f/%0.1f ms    CPU = %0.0f%%    Wake = %0.0f/%0.0f us",
+        fps,
+        processFps,
+        (nTime - m_nStartTime),
+        stats.nProcessQueueDepth,
+        stats.nPresentQueueDepth,
+        m_profiler.GetDroppedFrameCount(),
+        stats.nDroppedBeforeProcessing,
+        stats.nDroppedBeforePresent,
+        mapStats.nP50 / 1e6,
+        mapStats.nP99 / 1e6,
+        compositeStats.nP50 / 1e6,
+        compositeStats.nP99 / 1e6,
+        drawStats.nP50 / 1e6,
+        drawStats.nP99 / 1e6,
+        cpuUsage,
+        stats.processWake.GetAverageMicroseconds(),
+        stats.presentWake.GetAverageMicroseconds());
+
+    // frames that found no decoded video frame for their time
+    if (m_videoBackground.IsOpen())
+    {
+        const VideoBackgroundStats videoStats = m_videoBackground.GetStats();
+
+        WCHAR szVideoMessage[64];
+        StringCchPrintf(
+            szVideoMessage,
+            _countof(szVideoMessage),
+            L"    Video misses = %I64u/%I64u",
+            videoStats.nMisses,
+            videoStats.nRequests);
+        StringCchCat(szStatusMessage, _countof(szStatusMessage), szVideoMessage);
+    }
+
+    // share of the color frame the cache kept, and the mapping time it saved
+    if (m_compositor.IsMappingCacheEnabled())
+    {
+        const MappingCacheStats cacheStats = m_compositor.GetMappingCache().GetStats();
+
+        WCHAR szCacheMessage[80];
+        StringCchPrintf(
+            szCacheMessage,
+            _countof(szCacheMessage),
+            L"    Map cache = %0.0f%% (saved %0.1f ms)",
+            100.0 * m_compositor.GetMappingCache().GetHitRate(),
+            cacheStats.nFrames ? cacheStats.fSavedMilliseconds / cacheStats.nFrames : 0.0);
+        StringCchCat(szStatusMessage, _countof(szStatusMessage), szCacheMessage);
+    }
+
+    if (SetStatusMessage(szStatusMessage, cStatusRefreshMsec, false))
+    {
+        m_nLastCounter = qpcNow.QuadPart;
+        m_nLastProcessed = stats.nProcessed;
+        m_lastCpuTime = cpuTimeNow;
+        m_nFramesSinceUpdate = 0;
+    }
+}
+
+void CCoordinateMappingBasics::PostStatusMessage(LPCWSTR szMessage)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_statusLock);
+        m_pendingStatus = szMessage;
+    }
+
+    // SetDlgItemText from a worker thread would block on the UI thread
+    PostMessageW(m_hWnd, WM_APP_STATUS, 0, 0);
+}
+
+HRESULT CCoordinateMappingBasics::StartPipeline()
+{
+    V_CHECK_HR(m_pFrameSource && m_pColorToDepthMapper);
+
+    // sized for the frames the source describes; frames of another size
+    // switch the compositor and mapper over when they arrive
+    const FrameGeometry geometry = m_pFrameSource->GetGeometry();
+    V_CHECK_HR(!geometry.IsEmpty());
+
+    if (FAILED(m_pColorToDepthMapper->SetFrameGeometry(geometry.nDepthWidth, geometry.nDepthHeight, geometry.nColorWidth, geometry.nColorHeight)))
+    {
+        SetStatusMessage(L"The coordinate mapper cannot map frames of this size!", 10000, true);
+        return E_FAIL;
+    }
+
+    V_RET(m_compositor.Initialize(
+        m_pColorToDepthMapper.get(),
+        m_pThreadPool.get(),
+        geometry.nDepthWidth,
+        geometry.nDepthHeight,
+        geometry.nColorWidth,
+        geometry.nColorHeight));
+
+    m_compositor.SetProfiler(&m_profiler);
+    m_pipeline.SetProfiler(&m_profiler);
+
+    FramePipelineCallbacks callbacks;
+
+    if (!m_recordPath.empty())
+    {
+        callbacks.acquired = [this](const PipelineFrame& frame)
+        {
+            if (!m_recordPath.empty())
+            {
+                ProfileScope scope(&m_profiler, ProfileStage_Record);
+                RecordFrame(frame);
+            }
+        };
+    }
+
+    callbacks.process = [this](const PipelineFrame& frame, RGBQUAD* pOutputBuffer)
+    {
+        ProcessFrame(
+            frame.nRelativeTime,
+            frame.GetDepthView(),
+            frame.GetColorView(),
+            frame.GetBodyIndexView(),
+            pOutputBuffer);
+    };
+
+    // the SDK objects are used from the acquisition thread
+    callbacks.acquireThreadStart = []()
+    {
+        CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    };
+
+    callbacks.acquireThreadStop = []()
+    {
+        CoUninitialize();
+    };
+
+    return m_pipeline.Start(m_pFrameSource.get(), callbacks, m_nOutputWidth, m_nOutputHeight);
 }
 
 bool CCoordinateMappingBasics::SetStatusMessage(
@@ -510,7 +1195,8 @@ bool CCoordinateMappingBasics::SetStatusMessage(
 
 HRESULT CCoordinateMappingBasics::GetScreenshotFileName(
     _Out_writes_z_(nFilePathSize) LPWSTR lpszFilePath,
-    UINT nFilePathSize)
+    UINT nFilePathSize,
+    LPCWSTR lpszExtension)
 {
     WCHAR* pszKnownPath = nullptr;
     V_RET(SHGetKnownFolderPath(FOLDERID_Pictures, 0, nullptr, &pszKnownPath));
@@ -519,8 +1205,8 @@ HRESULT CCoordinateMappingBasics::GetScreenshotFileName(
     WCHAR szTimeString[MAX_PATH];
     GetTimeFormatEx(nullptr, 0, nullptr, L"hh'-'mm'-'ss", szTimeString, _countof(szTimeString));
 
-    // File name will be KinectScreenshotDepth-HH-MM-SS.bmp
-    StringCchPrintfW(lpszFilePath, nFilePathSize, L"%s\\KinectScreenshot-CoordinateMapping-%s.bmp", pszKnownPath, szTimeString);
+    // File name will be KinectScreenshot-CoordinateMapping-HH-MM-SS followed by the extension
+    StringCchPrintfW(lpszFilePath, nFilePathSize, L"%s\\KinectScreenshot-CoordinateMapping-%s%s", pszKnownPath, szTimeString, lpszExtension);
 
     if (pszKnownPath)
     {
@@ -531,68 +1217,6 @@ HRESULT CCoordinateMappingBasics::GetScreenshotFileName(
     return S_OK;
 }
 
-HRESULT CCoordinateMappingBasics::SaveBitmapToFile(
-    BYTE* pBitmapBits,
-    LONG lWidth,
-    LONG lHeight,
-    WORD wBitsPerPixel,
-    LPCWSTR lpszFilePath)
-{
-    DWORD dwByteCount = lWidth * lHeight * (wBitsPerPixel / 8);
-
-    BITMAPINFOHEADER bmpInfoHeader = {0};
-
-    bmpInfoHeader.biSize        = sizeof(BITMAPINFOHEADER);  // Size of the header
-    bmpInfoHeader.biBitCount    = wBitsPerPixel;             // Bit count
-    bmpInfoHeader.biCompression = BI_RGB;                    // Standard RGB, no compression
-    bmpInfoHeader.biWidth       = lWidth;                    // Width in pixels
-    bmpInfoHeader.biHeight      = -lHeight;                  // Height in pixels, negative indicates it's stored right-side-up
-    bmpInfoHeader.biPlanes      = 1;                         // Default
-    bmpInfoHeader.biSizeImage   = dwByteCount;               // Image size in bytes
-
-    BITMAPFILEHEADER bfh = {0};
-
-    bfh.bfType    = 0x4D42;                                           // 'M''B', indicates bitmap
-    bfh.bfOffBits = bmpInfoHeader.biSize + sizeof(BITMAPFILEHEADER);  // Offset to the start of pixel data
-    bfh.bfSize    = bfh.bfOffBits + bmpInfoHeader.biSizeImage;        // Size of image + headers
-
-    // Create the file on disk to write to
-    HANDLE hFile = CreateFileW(lpszFilePath, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
-
-    // Return if error opening file
-    if (nullptr == hFile) 
-    {
-        return E_ACCESSDENIED;
-    }
-
-    DWORD dwBytesWritten = 0;
-    
-    // Write the bitmap file header
-    if (!WriteFile(hFile, &bfh, sizeof(bfh), &dwBytesWritten, nullptr))
-    {
-        CloseHandle(hFile);
-        return E_FAIL;
-    }
-    
-    // Write the bitmap info header
-    if (!WriteFile(hFile, &bmpInfoHeader, sizeof(bmpInfoHeader), &dwBytesWritten, nullptr))
-    {
-        CloseHandle(hFile);
-        return E_FAIL;
-    }
-    
-    // Write the RGB Data
-    if (!WriteFile(hFile, pBitmapBits, bmpInfoHeader.biSizeImage, &dwBytesWritten, nullptr))
-    {
-        CloseHandle(hFile);
-        return E_FAIL;
-    }    
-
-    // Close the file
-    CloseHandle(hFile);
-    return S_OK;
-}
-
 HRESULT CCoordinateMappingBasics::LoadResourceImage(
     PCWSTR resourceName,
     PCWSTR resourceType,
@@ -648,6 +1272,61 @@ HRESULT CCoordinateMappingBasics::LoadResourceImage(
         WICDecodeMetadataCacheOnLoad,
         &pDecoder));
 
+    return CopyScaledFrame(pIWICFactory.Get(), pDecoder.Get(), nOutputWidth, nOutputHeight, pOutputBuffer);
+}
+
+HRESULT CCoordinateMappingBasics::LoadImageFile(
+    const char* pszPath,
+    int nOutputWidth,
+    int nOutputHeight,
+    RGBQUAD* pOutputBuffer)
+{
+    V_CHECK_HR(pszPath && pOutputBuffer && nOutputWidth > 0 && nOutputHeight > 0);
+
+    WCHAR szPath[MAX_PATH];
+    V_CHECK_HR(MultiByteToWideChar(CP_ACP, 0, pszPath, -1, szPath, _countof(szPath)) > 0);
+
+    // called on the library's thread
+    V_RET(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+
+    HRESULT hr = S_OK;
+    {
+        Microsoft::WRL::ComPtr<IWICImagingFactory> pIWICFactory;
+        Microsoft::WRL::ComPtr<IWICBitmapDecoder> pDecoder;
+        hr = CoCreateInstance(
+            CLSID_WICImagingFactory,
+            nullptr,
+            CLSCTX_INPROC_SERVER,
+            IID_IWICImagingFactory,
+            (LPVOID*)&pIWICFactory);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = pIWICFactory->CreateDecoderFromFilename(
+                szPath,
+                nullptr,
+                GENERIC_READ,
+                WICDecodeMetadataCacheOnLoad,
+                &pDecoder);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = CopyScaledFrame(pIWICFactory.Get(), pDecoder.Get(), nOutputWidth, nOutputHeight, pOutputBuffer);
+        }
+    }
+
+    CoUninitialize();
+    return hr;
+}
+
+HRESULT CCoordinateMappingBasics::CopyScaledFrame(
+    IWICImagingFactory* pIWICFactory,
+    IWICBitmapDecoder* pDecoder,
+    UINT nOutputWidth,
+    UINT nOutputHeight,
+    RGBQUAD* pOutputBuffer)
+{
     // Create the initial frame.
     Microsoft::WRL::ComPtr<IWICBitmapFrameDecode> pSource;
     V_RET(pDecoder->GetFrame(0, &pSource));
@@ -678,7 +1357,7 @@ HRESULT CCoordinateMappingBasics::LoadResourceImage(
     V_RET(pConverter->GetSize(&width, &height));
 
     // make sure the image scaled correctly so the output buffer is big enough
-    V_CHECK_HR(!(width != nOutputWidth) || (height != nOutputHeight));
+    V_CHECK_HR(width == nOutputWidth && height == nOutputHeight);
 
     V_RET(pConverter->CopyPixels(
         nullptr,
@@ -8,18 +8,150 @@
 
 #include "resource.h"
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <Wincodec.h>
 #include "WindowsHelper.h"
 #include "ImageRenderer.h"
+#include "ThreadPool.h"
+#include "SoftwareCoordinateMapper.h"
+#include "VideoBackground.h"
+#include "FrameCompositor.h"
+#include "BackgroundLibrary.h"
+#include "BitmapFile.h"
+#include "ImageEncoder.h"
+#include "CaptureFile.h"
+#include "FramePipeline.h"
+#include "FrameProfiler.h"
+#include "InstantReplayRing.h"
+#include "ScreenshotWriter.h"
+
+// posted by the pipeline threads when they have a status message for the UI thread
+#define WM_APP_STATUS (WM_APP + 1)
+
+// Settings taken from the command line
+struct AppOptions
+{
+    // worker threads used for compositing, 0 means one per hardware thread
+    int nThreadCount;
+
+    // calibration file for the software coordinate mapper, empty uses the SDK mapper
+    std::string calibrationPath;
+
+    // record every frame into this capture file
+    std::string recordPath;
+
+    // save the first frame's depth and its color to depth mapping into this
+    // file, the SDK's unless -calibration is given, see ReferenceMapping
+    std::string saveMappingPath;
+
+    // replay this capture file instead of opening the sensor
+    std::string replayPath;
+    ReplayPacing replayPacing;
+
+    // composite generated frames instead of opening the sensor, of any size
+    // (-syntheticdepth WxH, -syntheticcolor WxH) at any rate (-syntheticfps N)
+    bool bSynthetic;
+    int nSyntheticDepthWidth;
+    int nSyntheticDepthHeight;
+    int nSyntheticColorWidth;
+    int nSyntheticColorHeight;
+    int nSyntheticFps;
+
+    // BMP file to use instead of the built in background
+    std::string backgroundPath;
+
+    // directory of images the Next Background button cycles through
+    std::string backgroundDirectory;
+
+    // looping Y4M or raw BGRA video shown instead of the background image
+    std::string videoBackgroundPath;
+
+    // how much of each frame is mapped and composited, -roi, -tiles or -depthres
+    CompositeMode compositeMode;
+
+    // output size of -depthres WxH, 0 keeps the color frame size
+    int nOutputWidth;
+    int nOutputHeight;
+
+    // -mapcache: reuse the color to depth mapping of depth tiles that did not move
+    bool bMappingCache;
+
+    // -lowmem: map and composite full frames in cache sized row blocks
+    bool bLowMemory;
+
+    // -depthkey NEAR-FAR (mm): players are whatever lies in that depth range,
+    // the body index source is not opened; -depthbackground N also learns the
+    // empty scene over the first N frames and keys only what is in front of it
+    bool bDepthKey;
+    int nDepthKeyNear;
+    int nDepthKeyFar;
+    int nDepthKeyBackgroundFrames;
+
+    // -matte feather|clean: soft player edges, see MatteRefinement
+    MatteRefinement matteRefinement;
+
+    // per stage timing, on unless -noprofile; the report is written on exit
+    bool bProfile;
+    std::string profilePath;
+
+    // Chrome trace of nTraceFrames presented frames, starting after nTraceStart
+    std::string tracePath;
+    int nTraceStart;
+    int nTraceFrames;
+
+    // file format of screenshots and saved replays
+    ImageFormat screenshotFormat;
+
+    // seconds of composited output kept for the Save Replay button, 0 turns it off
+    int nInstantReplaySeconds;
+
+    AppOptions() :
+        nThreadCount(0),
+        replayPacing(ReplayPacing_RealTime),
+        bSynthetic(false),
+        nSyntheticDepthWidth(512),
+        nSyntheticDepthHeight(424),
+        nSyntheticColorWidth(1920),
+        nSyntheticColorHeight(1080),
+        nSyntheticFps(30),
+        compositeMode(CompositeMode_Full),
+        nOutputWidth(0),
+        nOutputHeight(0),
+        bMappingCache(false),
+        bLowMemory(false),
+        bDepthKey(false),
+        nDepthKeyNear(DepthKeyer::cDefaultNearDepth),
+        nDepthKeyFar(DepthKeyer::cDefaultFarDepth),
+        nDepthKeyBackgroundFrames(0),
+        matteRefinement(MatteRefinement_None),
+        screenshotFormat(ImageFormat_Bmp),
+        bProfile(true),
+        nTraceStart(0),
+        nTraceFrames(300),
+        nInstantReplaySeconds(0)
+    {
+    }
+};
 
 class CCoordinateMappingBasics
 {
-    static const int        cDepthWidth  = 512;
-    static const int        cDepthHeight = 424;
-    static const int        cColorWidth  = 1920;
-    static const int        cColorHeight = 1080;
+    // output size when there is no source to describe the frames
+    static const int        cDefaultOutputWidth  = 1920;
+    static const int        cDefaultOutputHeight = 1080;
+
+    // the main loop wakes at least this often to refresh the status bar
+    static const DWORD      cStatusRefreshMsec = 1000;
+
+    // frames per second of instant replay, the sensor's rate
+    static const int        cInstantReplayFps = 30;
+
+    // raw video backgrounds play at the sensor's rate too, Y4M at its own
+    static const int        cRawVideoFps = 30;
 
 public:
-    CCoordinateMappingBasics();
+    CCoordinateMappingBasics(const AppOptions& options);
     ~CCoordinateMappingBasics();
 
     // TODO: Move this stuff to new file
@@ -29,6 +161,8 @@ public:
 
     int Run(HINSTANCE hInstance, int nCmdShow);
 
+    static void ParseCommandLine(LPCWSTR lpCmdLine, AppOptions* pOptions);
+
 private:
     HWND m_hWnd;
     int64_t m_nStartTime;
@@ -36,52 +170,124 @@ private:
     double m_fFreq;
     int64_t m_nNextStatusTime;
     DWORD m_nFramesSinceUpdate;
+    uint64_t m_nLastProcessed;
+    std::chrono::microseconds m_lastCpuTime;
+    int64_t m_nLastPresentTime;
     bool m_bSaveScreenshot;
+    bool m_bSaveReplay;
+    std::unique_ptr<ThreadPool> m_pThreadPool;
 
     // Current Kinect
     Microsoft::WRL::ComPtr<IKinectSensor> m_pKinectSensor;
     Microsoft::WRL::ComPtr<ICoordinateMapper> m_pCoordinateMapper;
-    std::unique_ptr<DepthSpacePoint[]> m_pDepthCoordinates;
+    std::unique_ptr<ColorToDepthMapper> m_pColorToDepthMapper;
+    std::string m_calibrationPath;
+    std::string m_saveMappingPath;
 
-    // Frame reader
-    Microsoft::WRL::ComPtr<IMultiSourceFrameReader> m_pMultiSourceFrameReader;
+    // Capture recording and replay
+    std::string m_recordPath;
+    std::string m_replayPath;
+    ReplayPacing m_replayPacing;
+    std::unique_ptr<CaptureWriter> m_pCaptureWriter;
+    bool m_bSynthetic;
+    FrameGeometry m_syntheticGeometry;
+    int m_nSyntheticFps;
+
+    // Sensor, capture file or synthetic frames
+    std::unique_ptr<FrameSource> m_pFrameSource;
 
     // Direct2D
     Microsoft::WRL::ComPtr<ID2D1Factory> m_pD2DFactory;
     std::unique_ptr<ImageRenderer> m_pDrawCoordinateMapping;
-    std::unique_ptr<RGBQUAD[]> m_pOutputRGBX; 
-    std::unique_ptr<RGBQUAD[]> m_pBackgroundRGBX;
-    std::unique_ptr<RGBQUAD[]> m_pColorRGBX;
+    FrameBuffer<RGBQUAD> m_pBackgroundRGBX;
+    std::string m_backgroundPath;
+
+    // -backgrounds, loaded behind the first one on the library's thread.
+    // m_pCompositedBackground is the background of the last processed frame.
+    std::string m_backgroundDirectory;
+    BackgroundLibrary m_backgroundLibrary;
+    const RGBQUAD* m_pCompositedBackground;
+
+    // -videobackground, decoded ahead on its own thread; the frame of it the
+    // last processed frame showed
+    std::string m_videoBackgroundPath;
+    VideoBackground m_videoBackground;
+    int64_t m_nCompositedVideoFrame;
+
+    // size of the background, the output surfaces and everything presented
+    // from them; the color frame size the source describes unless -depthres.
+    // Color frames that change size later are not shown, once reported.
+    int m_nOutputWidth;
+    int m_nOutputHeight;
+    bool m_bOutputMismatchReported;
+
+    // sized with the output
+    ImageFormat m_screenshotFormat;
+    int m_nInstantReplaySeconds;
+
+    // frame the renderer's bitmap holds, only the tiles changed since are uploaded
+    int64_t m_nUploadedFrame;
+    std::vector<PixelRect> m_changedRects;
+    std::vector<D2D1_RECT_U> m_dirtyRects;
+
+    // Maps and composites each frame on the processing thread
+    FrameCompositor m_compositor;
+
+    // Acquire, composite and present on separate threads
+    FramePipeline m_pipeline;
+
+    // Stage latencies, dropped frames and the optional trace
+    FrameProfiler m_profiler;
+    std::string m_profilePath;
+    std::string m_tracePath;
+
+    // Status text handed from the pipeline threads to the UI thread
+    std::mutex m_statusLock;
+    std::wstring m_pendingStatus;
+
+    // Screenshots and instant replay are written on the writer's thread. The
+    // writer is declared last so it finishes while the ring and the status
+    // members above are still alive.
+    InstantReplayRing m_instantReplay;
+    ScreenshotWriter m_screenshotWriter;
 
-    void Update();
+    void Present();
+    HRESULT StartPipeline();
     HRESULT InitializeDefaultSensor();
+    HRESULT InitializeSoftwareMapper();
+    HRESULT InitializeReplay();
+    HRESULT InitializeSyntheticSource();
+
+    // sizes and fills everything of the output size, once the source is known
+    void InitializeOutput();
+
+    void RecordFrame(const PipelineFrame& frame);
+    void SaveMapping(const DepthFrameView& depth);
+
     void ProcessFrame(
-        int64_t nTime, 
-        const UINT16* pDepthBuffer,
-        int nDepthHeight,
-        int nDepthWidth, 
-        const RGBQUAD* pColorBuffer,
-        int nColorWidth,
-        int nColorHeight,
-        const BYTE* pBodyIndexBuffer,
-        int nBodyIndexWidth,
-        int nBodyIndexHeight);
+        int64_t nTime,
+        const DepthFrameView& depth,
+        const ColorFrameView& color,
+        const BodyIndexFrameView& bodyIndex,
+        RGBQUAD* pOutputBuffer);
+
+    void UpdateFrameRate(int64_t nTime, bool bPresented);
+    void PostStatusMessage(LPCWSTR szMessage);
 
     bool SetStatusMessage(
         _In_z_ WCHAR* szMessage,
         DWORD nShowTimeMsec,
         bool bForce);
 
+    void SaveScreenshot(const RGBQUAD* pOutputBuffer);
+    void SaveReplay();
+
     HRESULT GetScreenshotFileName(
         _Out_writes_z_(nFilePathSize) LPWSTR lpszFilePath,
-        UINT nFilePathSize);
+        UINT nFilePathSize,
+        LPCWSTR lpszExtension);
 
-    HRESULT SaveBitmapToFile(
-        BYTE* pBitmapBits,
-        LONG lWidth,
-        LONG lHeight,
-        WORD wBitsPerPixel,
-        LPCWSTR lpszFilePath);
+    void NextBackground();
 
     HRESULT LoadResourceImage(
         PCWSTR resourceName,
@@ -89,4 +295,19 @@ private:
         UINT nOutputWidth,
         UINT nOutputHeight,
         RGBQUAD* pOutputBuffer);
+
+    // Any image WIC decodes, for the background library's thread
+    static HRESULT LoadImageFile(
+        const char* pszPath,
+        int nOutputWidth,
+        int nOutputHeight,
+        RGBQUAD* pOutputBuffer);
+
+    // Scales the first frame of pDecoder to nOutputWidth x nOutputHeight premultiplied BGRA
+    static HRESULT CopyScaledFrame(
+        IWICImagingFactory* pIWICFactory,
+        IWICBitmapDecoder* pDecoder,
+        UINT nOutputWidth,
+        UINT nOutputHeight,
+        RGBQUAD* pOutputBuffer);
 };
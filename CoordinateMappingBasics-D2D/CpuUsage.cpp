@@ -0,0 +1,34 @@
+#include "CpuUsage.h"
+#include "KinectTypes.h"
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+std::chrono::microseconds GetProcessCpuTime()
+{
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+    {
+        return std::chrono::microseconds(0);
+    }
+
+    // FILETIME counts 100ns ticks
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+
+    return std::chrono::microseconds((kernel.QuadPart + user.QuadPart) / 10);
+#else
+    timespec now;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now) != 0)
+    {
+        return std::chrono::microseconds(0);
+    }
+
+    return std::chrono::seconds(now.tv_sec) + std::chrono::microseconds(now.tv_nsec / 1000);
+#endif
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <chrono>
+
+// CPU time used so far by all threads of this process. Sampled against wall
+// clock time it shows how much of a core we burn, which should be near zero
+// while the pipeline is waiting for frames.
+std::chrono::microseconds GetProcessCpuTime();
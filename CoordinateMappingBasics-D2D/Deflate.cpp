@@ -0,0 +1,612 @@
+#include "Deflate.h"
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+namespace
+{
+    const int cWindowSize = 32768;
+    const int cMinMatch = 3;
+    const int cMaxMatch = 258;
+
+    const int cHashBits = 15;
+    const int cHashSize = 1 << cHashBits;
+
+    // candidates tried per position, trades ratio for speed
+    const int cMaxChain = 32;
+
+    // tokens per Huffman block, so the codes follow the content down the image
+    const size_t cBlockTokens = 1 << 15;
+
+    const int cLiteralLengthCodes = 286;
+    const int cDistanceCodes = 30;
+    const int cCodeLengthCodes = 19;
+    const int cEndOfBlock = 256;
+    const int cMaxCodeLength = 15;
+    const int cMaxCodeLengthCodeLength = 7;
+
+    const int cLengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    const int cLengthExtraBits[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    const int cDistanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    const int cDistanceExtraBits[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    const int cCodeLengthOrder[cCodeLengthCodes] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    const uint32_t cAdlerModulus = 65521;
+    // bytes that can be summed before the Adler sums could overflow 32 bits
+    const size_t cAdlerBlock = 5552;
+
+    // a literal byte when nDistance is 0, otherwise a match
+    struct Token
+    {
+        uint16_t nLength;
+        uint16_t nDistance;
+    };
+
+    // Deflate packs bits starting at the least significant bit of each byte
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<BYTE>* pOutput) :
+            m_pOutput(pOutput),
+            m_nBits(0),
+            m_nCount(0)
+        {
+        }
+
+        void Write(uint32_t nValue, int nBits)
+        {
+            m_nBits |= uint64_t(nValue) << m_nCount;
+            m_nCount += nBits;
+
+            while (m_nCount >= 8)
+            {
+                m_pOutput->push_back(static_cast<BYTE>(m_nBits));
+                m_nBits >>= 8;
+                m_nCount -= 8;
+            }
+        }
+
+        void Align()
+        {
+            if (m_nCount)
+            {
+                Write(0, 8 - m_nCount);
+            }
+        }
+
+    private:
+        std::vector<BYTE>* m_pOutput;
+        uint64_t m_nBits;
+        int m_nCount;
+    };
+
+    uint32_t Hash(const BYTE* p)
+    {
+        const uint32_t nValue = p[0] | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16);
+        return (nValue * 2654435761u) >> (32 - cHashBits);
+    }
+
+    int GetLengthCode(int nLength)
+    {
+        return static_cast<int>(std::upper_bound(cLengthBase, cLengthBase + 29, nLength) - cLengthBase) - 1;
+    }
+
+    int GetDistanceCode(int nDistance)
+    {
+        return static_cast<int>(std::upper_bound(cDistanceBase, cDistanceBase + 30, nDistance) - cDistanceBase) - 1;
+    }
+
+    // Every tree gets at least two symbols, which keeps the codes complete
+    void EnsureTwoSymbols(uint32_t* pFrequencies, int nSymbols)
+    {
+        int nUsed = 0;
+        for (int i = 0; i < nSymbols; ++i)
+        {
+            nUsed += (pFrequencies[i] != 0);
+        }
+
+        for (int i = 0; i < nSymbols && nUsed < 2; ++i)
+        {
+            if (!pFrequencies[i])
+            {
+                pFrequencies[i] = 1;
+                ++nUsed;
+            }
+        }
+    }
+
+    // Huffman code lengths no longer than nMaxLength. Lengths deeper than the
+    // limit are folded in and the Kraft sum repaired by pushing codes down
+    // from the shallower levels.
+    void BuildCodeLengths(const uint32_t* pFrequencies, int nSymbols, int nMaxLength, BYTE* pLengths)
+    {
+        std::fill(pLengths, pLengths + nSymbols, BYTE(0));
+
+        std::vector<int> symbols;
+        for (int i = 0; i < nSymbols; ++i)
+        {
+            if (pFrequencies[i])
+            {
+                symbols.push_back(i);
+            }
+        }
+
+        const int nUsed = static_cast<int>(symbols.size());
+        if (nUsed < 2)
+        {
+            for (int nSymbol : symbols)
+            {
+                pLengths[nSymbol] = 1;
+            }
+            return;
+        }
+
+        // leaves are nodes [0, nUsed), internal nodes follow
+        typedef std::pair<uint64_t, int> Node;
+        std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+        std::vector<int> parents(2 * nUsed - 1, -1);
+
+        for (int i = 0; i < nUsed; ++i)
+        {
+            queue.push(Node(pFrequencies[symbols[i]], i));
+        }
+
+        int nNext = nUsed;
+        while (queue.size() > 1)
+        {
+            const Node first = queue.top();
+            queue.pop();
+            const Node second = queue.top();
+            queue.pop();
+
+            parents[first.second] = nNext;
+            parents[second.second] = nNext;
+            queue.push(Node(first.first + second.first, nNext++));
+        }
+
+        std::vector<int> counts(std::max(nUsed, nMaxLength) + 1, 0);
+        for (int i = 0; i < nUsed; ++i)
+        {
+            int nDepth = 0;
+            for (int n = i; parents[n] >= 0; n = parents[n])
+            {
+                ++nDepth;
+            }
+            ++counts[std::min(nDepth, nMaxLength)];
+        }
+
+        uint32_t nTotal = 0;
+        for (int i = 1; i <= nMaxLength; ++i)
+        {
+            nTotal += uint32_t(counts[i]) << (nMaxLength - i);
+        }
+
+        while (nTotal != (1u << nMaxLength))
+        {
+            --counts[nMaxLength];
+            for (int i = nMaxLength - 1; i > 0; --i)
+            {
+                if (counts[i])
+                {
+                    --counts[i];
+                    counts[i + 1] += 2;
+                    break;
+                }
+            }
+            --nTotal;
+        }
+
+        // the most frequent symbols take the shortest codes
+        std::stable_sort(symbols.begin(), symbols.end(), [pFrequencies](int nLeft, int nRight)
+        {
+            return pFrequencies[nLeft] > pFrequencies[nRight];
+        });
+
+        int nSymbol = 0;
+        for (int nLength = 1; nLength <= nMaxLength; ++nLength)
+        {
+            for (int i = 0; i < counts[nLength]; ++i)
+            {
+                pLengths[symbols[nSymbol++]] = static_cast<BYTE>(nLength);
+            }
+        }
+    }
+
+    // Canonical codes from the lengths, bit reversed for the LSB first writer
+    void BuildCodes(const BYTE* pLengths, int nSymbols, uint16_t* pCodes)
+    {
+        int lengthCounts[cMaxCodeLength + 1] = {0};
+        for (int i = 0; i < nSymbols; ++i)
+        {
+            ++lengthCounts[pLengths[i]];
+        }
+        lengthCounts[0] = 0;
+
+        int nextCodes[cMaxCodeLength + 1] = {0};
+        int nCode = 0;
+        for (int nLength = 1; nLength <= cMaxCodeLength; ++nLength)
+        {
+            nCode = (nCode + lengthCounts[nLength - 1]) << 1;
+            nextCodes[nLength] = nCode;
+        }
+
+        for (int i = 0; i < nSymbols; ++i)
+        {
+            const int nLength = pLengths[i];
+            if (!nLength)
+            {
+                pCodes[i] = 0;
+                continue;
+            }
+
+            const int nValue = nextCodes[nLength]++;
+            int nReversed = 0;
+            for (int b = 0; b < nLength; ++b)
+            {
+                nReversed |= ((nValue >> b) & 1) << (nLength - 1 - b);
+            }
+            pCodes[i] = static_cast<uint16_t>(nReversed);
+        }
+    }
+
+    void WriteBlock(BitWriter* pWriter, const std::vector<Token>& tokens, bool bFinal)
+    {
+        uint32_t literalFrequencies[cLiteralLengthCodes] = {0};
+        uint32_t distanceFrequencies[cDistanceCodes] = {0};
+
+        for (const Token& token : tokens)
+        {
+            if (token.nDistance)
+            {
+                ++literalFrequencies[257 + GetLengthCode(token.nLength)];
+                ++distanceFrequencies[GetDistanceCode(token.nDistance)];
+            }
+            else
+            {
+                ++literalFrequencies[token.nLength];
+            }
+        }
+
+        literalFrequencies[cEndOfBlock] = 1;
+        EnsureTwoSymbols(literalFrequencies, cLiteralLengthCodes);
+        EnsureTwoSymbols(distanceFrequencies, cDistanceCodes);
+
+        BYTE literalLengths[cLiteralLengthCodes];
+        BYTE distanceLengths[cDistanceCodes];
+        uint16_t literalCodes[cLiteralLengthCodes];
+        uint16_t distanceCodes[cDistanceCodes];
+        BuildCodeLengths(literalFrequencies, cLiteralLengthCodes, cMaxCodeLength, literalLengths);
+        BuildCodeLengths(distanceFrequencies, cDistanceCodes, cMaxCodeLength, distanceLengths);
+        BuildCodes(literalLengths, cLiteralLengthCodes, literalCodes);
+        BuildCodes(distanceLengths, cDistanceCodes, distanceCodes);
+
+        int nLiteralCount = cLiteralLengthCodes;
+        while (nLiteralCount > 257 && !literalLengths[nLiteralCount - 1])
+        {
+            --nLiteralCount;
+        }
+
+        int nDistanceCount = cDistanceCodes;
+        while (nDistanceCount > 1 && !distanceLengths[nDistanceCount - 1])
+        {
+            --nDistanceCount;
+        }
+
+        // both length tables, run length coded with symbols 16 to 18
+        std::vector<BYTE> lengths(literalLengths, literalLengths + nLiteralCount);
+        lengths.insert(lengths.end(), distanceLengths, distanceLengths + nDistanceCount);
+
+        std::vector<std::pair<int, int>> runs;
+        const int nLengths = static_cast<int>(lengths.size());
+        for (int i = 0; i < nLengths;)
+        {
+            const BYTE nLength = lengths[i];
+            int nRun = 1;
+            while (i + nRun < nLengths && lengths[i + nRun] == nLength)
+            {
+                ++nRun;
+            }
+            i += nRun;
+
+            if (nLength == 0)
+            {
+                while (nRun >= 11)
+                {
+                    const int nRepeat = std::min(nRun, 138);
+                    runs.push_back(std::make_pair(18, nRepeat - 11));
+                    nRun -= nRepeat;
+                }
+                if (nRun >= 3)
+                {
+                    runs.push_back(std::make_pair(17, nRun - 3));
+                    nRun = 0;
+                }
+            }
+            else
+            {
+                runs.push_back(std::make_pair(nLength, 0));
+                --nRun;
+                while (nRun >= 3)
+                {
+                    const int nRepeat = std::min(nRun, 6);
+                    runs.push_back(std::make_pair(16, nRepeat - 3));
+                    nRun -= nRepeat;
+                }
+            }
+
+            for (; nRun > 0; --nRun)
+            {
+                runs.push_back(std::make_pair(nLength, 0));
+            }
+        }
+
+        uint32_t codeLengthFrequencies[cCodeLengthCodes] = {0};
+        for (const auto& run : runs)
+        {
+            ++codeLengthFrequencies[run.first];
+        }
+        EnsureTwoSymbols(codeLengthFrequencies, cCodeLengthCodes);
+
+        BYTE codeLengthLengths[cCodeLengthCodes];
+        uint16_t codeLengthCodes[cCodeLengthCodes];
+        BuildCodeLengths(codeLengthFrequencies, cCodeLengthCodes, cMaxCodeLengthCodeLength, codeLengthLengths);
+        BuildCodes(codeLengthLengths, cCodeLengthCodes, codeLengthCodes);
+
+        int nCodeLengthCount = cCodeLengthCodes;
+        while (nCodeLengthCount > 4 && !codeLengthLengths[cCodeLengthOrder[nCodeLengthCount - 1]])
+        {
+            --nCodeLengthCount;
+        }
+
+        // block header, dynamic Huffman
+        pWriter->Write(bFinal ? 1 : 0, 1);
+        pWriter->Write(2, 2);
+        pWriter->Write(nLiteralCount - 257, 5);
+        pWriter->Write(nDistanceCount - 1, 5);
+        pWriter->Write(nCodeLengthCount - 4, 4);
+
+        for (int i = 0; i < nCodeLengthCount; ++i)
+        {
+            pWriter->Write(codeLengthLengths[cCodeLengthOrder[i]], 3);
+        }
+
+        for (const auto& run : runs)
+        {
+            pWriter->Write(codeLengthCodes[run.first], codeLengthLengths[run.first]);
+            if (run.first == 16)
+            {
+                pWriter->Write(run.second, 2);
+            }
+            else if (run.first == 17)
+            {
+                pWriter->Write(run.second, 3);
+            }
+            else if (run.first == 18)
+            {
+                pWriter->Write(run.second, 7);
+            }
+        }
+
+        for (const Token& token : tokens)
+        {
+            if (!token.nDistance)
+            {
+                pWriter->Write(literalCodes[token.nLength], literalLengths[token.nLength]);
+                continue;
+            }
+
+            const int nLengthCode = GetLengthCode(token.nLength);
+            pWriter->Write(literalCodes[257 + nLengthCode], literalLengths[257 + nLengthCode]);
+            pWriter->Write(token.nLength - cLengthBase[nLengthCode], cLengthExtraBits[nLengthCode]);
+
+            const int nDistanceCode = GetDistanceCode(token.nDistance);
+            pWriter->Write(distanceCodes[nDistanceCode], distanceLengths[nDistanceCode]);
+            pWriter->Write(token.nDistance - cDistanceBase[nDistanceCode], cDistanceExtraBits[nDistanceCode]);
+        }
+
+        pWriter->Write(literalCodes[cEndOfBlock], literalLengths[cEndOfBlock]);
+    }
+
+    struct Crc32Table
+    {
+        uint32_t entries[256];
+
+        Crc32Table()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t nCrc = i;
+                for (int b = 0; b < 8; ++b)
+                {
+                    nCrc = (nCrc & 1) ? (0xedb88320u ^ (nCrc >> 1)) : (nCrc >> 1);
+                }
+                entries[i] = nCrc;
+            }
+        }
+    };
+}
+
+void DeflateCompress(const BYTE* pData, size_t nSize, bool bFinal, std::vector<BYTE>* pOutput)
+{
+    BitWriter writer(pOutput);
+
+    // most recent position per hash, then the previous one with the same hash
+    std::vector<int64_t> heads(cHashSize, -1);
+    std::vector<int64_t> previous(cWindowSize, -1);
+
+    auto insert = [&](size_t nPosition)
+    {
+        if (nPosition + cMinMatch <= nSize)
+        {
+            const uint32_t nHash = Hash(pData + nPosition);
+            previous[nPosition & (cWindowSize - 1)] = heads[nHash];
+            heads[nHash] = static_cast<int64_t>(nPosition);
+        }
+    };
+
+    std::vector<Token> tokens;
+    tokens.reserve(cBlockTokens);
+
+    size_t nPosition = 0;
+    while (nPosition < nSize)
+    {
+        int nBestLength = 0;
+        int nBestDistance = 0;
+
+        if (nPosition + cMinMatch <= nSize)
+        {
+            const int nMaxLength = static_cast<int>(std::min<size_t>(cMaxMatch, nSize - nPosition));
+            const BYTE* pCurrent = pData + nPosition;
+
+            int64_t nCandidate = heads[Hash(pCurrent)];
+            for (int nChain = 0; nChain < cMaxChain && nCandidate >= 0; ++nChain)
+            {
+                const int64_t nDistance = static_cast<int64_t>(nPosition) - nCandidate;
+                if (nDistance > cWindowSize)
+                {
+                    break;
+                }
+
+                // a longer match has to agree at the current best length first
+                const BYTE* pMatch = pData + nCandidate;
+                if (pMatch[nBestLength] == pCurrent[nBestLength])
+                {
+                    int nLength = 0;
+                    while (nLength < nMaxLength && pMatch[nLength] == pCurrent[nLength])
+                    {
+                        ++nLength;
+                    }
+
+                    if (nLength > nBestLength)
+                    {
+                        nBestLength = nLength;
+                        nBestDistance = static_cast<int>(nDistance);
+                        if (nLength == nMaxLength)
+                        {
+                            break;
+                        }
+                    }
+                }
+
+                const int64_t nNext = previous[nCandidate & (cWindowSize - 1)];
+                if (nNext >= nCandidate)
+                {
+                    break;
+                }
+                nCandidate = nNext;
+            }
+        }
+
+        Token token;
+        if (nBestLength >= cMinMatch)
+        {
+            token.nLength = static_cast<uint16_t>(nBestLength);
+            token.nDistance = static_cast<uint16_t>(nBestDistance);
+
+            for (int i = 0; i < nBestLength; ++i)
+            {
+                insert(nPosition + i);
+            }
+            nPosition += nBestLength;
+        }
+        else
+        {
+            token.nLength = pData[nPosition];
+            token.nDistance = 0;
+
+            insert(nPosition);
+            ++nPosition;
+        }
+
+        tokens.push_back(token);
+        if (tokens.size() == cBlockTokens)
+        {
+            WriteBlock(&writer, tokens, false);
+            tokens.clear();
+        }
+    }
+
+    WriteBlock(&writer, tokens, bFinal);
+
+    if (!bFinal)
+    {
+        // empty stored block, byte aligned so the next piece can follow
+        writer.Write(0, 3);
+        writer.Align();
+        pOutput->push_back(0x00);
+        pOutput->push_back(0x00);
+        pOutput->push_back(0xff);
+        pOutput->push_back(0xff);
+    }
+    else
+    {
+        writer.Align();
+    }
+}
+
+uint32_t UpdateAdler32(uint32_t nAdler, const BYTE* pData, size_t nSize)
+{
+    uint32_t nSum1 = nAdler & 0xffff;
+    uint32_t nSum2 = nAdler >> 16;
+
+    while (nSize)
+    {
+        const size_t nBlock = std::min(nSize, cAdlerBlock);
+        for (size_t i = 0; i < nBlock; ++i)
+        {
+            nSum1 += pData[i];
+            nSum2 += nSum1;
+        }
+
+        nSum1 %= cAdlerModulus;
+        nSum2 %= cAdlerModulus;
+        pData += nBlock;
+        nSize -= nBlock;
+    }
+
+    return (nSum2 << 16) | nSum1;
+}
+
+uint32_t CombineAdler32(uint32_t nFirst, uint32_t nSecond, size_t nSecondSize)
+{
+    // the first buffer's sum is counted once more per byte of the second
+    const uint32_t nRemainder = static_cast<uint32_t>(nSecondSize % cAdlerModulus);
+    uint32_t nSum1 = nFirst & 0xffff;
+    uint32_t nSum2 = static_cast<uint32_t>((uint64_t(nRemainder) * nSum1) % cAdlerModulus);
+
+    nSum1 += (nSecond & 0xffff) + cAdlerModulus - 1;
+    nSum2 += (nFirst >> 16) + (nSecond >> 16) + cAdlerModulus - nRemainder;
+
+    if (nSum1 >= cAdlerModulus)
+    {
+        nSum1 -= cAdlerModulus;
+    }
+    if (nSum1 >= cAdlerModulus)
+    {
+        nSum1 -= cAdlerModulus;
+    }
+    if (nSum2 >= 2 * cAdlerModulus)
+    {
+        nSum2 -= 2 * cAdlerModulus;
+    }
+    if (nSum2 >= cAdlerModulus)
+    {
+        nSum2 -= cAdlerModulus;
+    }
+
+    return (nSum2 << 16) | nSum1;
+}
+
+uint32_t UpdateCrc32(uint32_t nCrc, const BYTE* pData, size_t nSize)
+{
+    static const Crc32Table s_table;
+
+    nCrc = ~nCrc;
+    for (size_t i = 0; i < nSize; ++i)
+    {
+        nCrc = s_table.entries[(nCrc ^ pData[i]) & 0xff] ^ (nCrc >> 8);
+    }
+
+    return ~nCrc;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "KinectTypes.h"
+
+// Raw deflate (RFC 1951) for the PNG encoder, so we do not need zlib. LZ77
+// over a 32K window with hash chains, one dynamic Huffman block per run of
+// tokens. A stream that is not final ends with an empty stored block, like
+// zlib's Z_SYNC_FLUSH, which leaves it byte aligned: pieces compressed
+// independently (and in parallel) can be appended into one stream as long as
+// only the last one is final.
+void DeflateCompress(const BYTE* pData, size_t nSize, bool bFinal, std::vector<BYTE>* pOutput);
+
+// Checksums used by zlib streams and PNG chunks. Start Adler-32 at 1 and
+// CRC-32 at 0.
+uint32_t UpdateAdler32(uint32_t nAdler, const BYTE* pData, size_t nSize);
+uint32_t UpdateCrc32(uint32_t nCrc, const BYTE* pData, size_t nSize);
+
+// Adler-32 of two buffers back to back from the checksums of each, nSecondSize
+// being the length of the second
+uint32_t CombineAdler32(uint32_t nFirst, uint32_t nSecond, size_t nSecondSize);
@@ -0,0 +1,79 @@
+#include "DepthKeyer.h"
+#include <algorithm>
+#include "WindowsHelper.h"
+
+DepthKeyer::DepthKeyer() :
+    m_nDepthPixels(0),
+    m_nNearDepth(cDefaultNearDepth),
+    m_nFarDepth(cDefaultFarDepth),
+    m_nBackgroundMargin(cDefaultBackgroundMargin),
+    m_nBackgroundFrames(0),
+    m_nLearnedFrames(0)
+{
+}
+
+HRESULT DepthKeyer::Initialize(int nDepthWidth, int nDepthHeight)
+{
+    V_CHECK_HR(nDepthWidth > 0 && nDepthHeight > 0);
+
+    m_nDepthPixels = nDepthWidth * nDepthHeight;
+    m_background.assign(m_nDepthPixels, 0);
+    m_nLearnedFrames = 0;
+
+    return S_OK;
+}
+
+HRESULT DepthKeyer::SetDepthRange(UINT16 nNearDepth, UINT16 nFarDepth)
+{
+    V_CHECK_HR(nNearDepth <= nFarDepth);
+
+    m_nNearDepth = nNearDepth;
+    m_nFarDepth = nFarDepth;
+
+    return S_OK;
+}
+
+void DepthKeyer::SetBackgroundFrames(int nFrames)
+{
+    m_nBackgroundFrames = std::max(0, nFrames);
+    m_nLearnedFrames = 0;
+    std::fill(m_background.begin(), m_background.end(), UINT16(0));
+}
+
+void DepthKeyer::BeginFrame(const UINT16* pDepthBuffer)
+{
+    if (!IsLearningBackground() || !pDepthBuffer)
+    {
+        return;
+    }
+
+    // 0 is no depth, which the maximum leaves alone
+    for (int depthIndex = 0; depthIndex < m_nDepthPixels; ++depthIndex)
+    {
+        m_background[depthIndex] = std::max(m_background[depthIndex], pDepthBuffer[depthIndex]);
+    }
+
+    ++m_nLearnedFrames;
+}
+
+void DepthKeyer::KeyPixels(
+    CompositeKernelType kernel,
+    const UINT16* pDepthBuffer,
+    BYTE* pBodyIndexBuffer,
+    int nBeginIndex,
+    int nEndIndex) const
+{
+    // the frame that completes the model is keyed with it already
+    const bool bBackground = (m_nBackgroundFrames > 0 && !IsLearningBackground());
+
+    KeyDepthRange(
+        kernel,
+        pDepthBuffer,
+        bBackground ? m_background.data() : nullptr,
+        m_nNearDepth,
+        m_nFarDepth,
+        m_nBackgroundMargin,
+        pBodyIndexBuffer,
+        nBeginIndex,
+        nEndIndex);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <vector>
+#include "KinectTypes.h"
+#include "CompositeKernel.h"
+
+// Segments players by depth alone, for when the sensor's body tracking is
+// not wanted or not there: a depth pixel is a player when its depth lies in
+// the near/far range and, once a background model has been learned, is
+// clearly in front of the background. The model is the farthest depth each
+// pixel reported over the first frames, which should show the scene without
+// anybody in it; someone passing through only leaves the nearer depths they
+// covered, which the model takes no notice of. Keyed frames come out as body
+// index frames with every player pixel on the first body.
+//
+// Per frame: BeginFrame, then KeyPixels over the frame.
+class DepthKeyer
+{
+public:
+    static const UINT16 cDefaultNearDepth = 500;
+    static const UINT16 cDefaultFarDepth = 3000;
+    // several times the sensor's depth noise at the far end of the range
+    static const UINT16 cDefaultBackgroundMargin = 100;
+
+    DepthKeyer();
+
+    // discards the background model, which has to be learned again
+    HRESULT Initialize(int nDepthWidth, int nDepthHeight);
+
+    // mm, both included; E_INVALIDARG when near is beyond far
+    HRESULT SetDepthRange(UINT16 nNearDepth, UINT16 nFarDepth);
+    UINT16 GetNearDepth() const { return m_nNearDepth; }
+    UINT16 GetFarDepth() const { return m_nFarDepth; }
+
+    // Learns the background over the next nFrames frames, keying on the
+    // range alone meanwhile. 0, the default, never models the background.
+    void SetBackgroundFrames(int nFrames);
+    int GetBackgroundFrames() const { return m_nBackgroundFrames; }
+    bool IsLearningBackground() const { return m_nLearnedFrames < m_nBackgroundFrames; }
+
+    // how much nearer than the background (mm) a pixel must be to be keyed
+    UINT16 GetBackgroundMargin() const { return m_nBackgroundMargin; }
+    void SetBackgroundMargin(UINT16 nMillimeters) { m_nBackgroundMargin = nMillimeters; }
+
+    // Learns from pDepthBuffer while the background is being learned
+    void BeginFrame(const UINT16* pDepthBuffer);
+
+    // Keys depth pixels [nBeginIndex, nEndIndex) of the frame BeginFrame saw,
+    // 0 for players and 0xff for the rest. Disjoint ranges may be keyed
+    // concurrently.
+    void KeyPixels(
+        CompositeKernelType kernel,
+        const UINT16* pDepthBuffer,
+        BYTE* pBodyIndexBuffer,
+        int nBeginIndex,
+        int nEndIndex) const;
+
+private:
+    int m_nDepthPixels;
+    UINT16 m_nNearDepth;
+    UINT16 m_nFarDepth;
+    UINT16 m_nBackgroundMargin;
+    int m_nBackgroundFrames;
+    int m_nLearnedFrames;
+
+    // farthest depth per pixel so far, 0 where there never was one
+    std::vector<UINT16> m_background;
+};
@@ -0,0 +1,248 @@
+#include "DirtyTileTracker.h"
+#include "WindowsHelper.h"
+
+DirtyTileTracker::DirtyTileTracker() :
+    m_nWidth(0),
+    m_nHeight(0),
+    m_nTileSize(0),
+    m_nColumns(0),
+    m_nRows(0),
+    m_nFrame(0),
+    m_bInvalidated(false),
+    m_nNextBuffer(0),
+    m_nFrames(0),
+    m_nRedrawnTiles(0),
+    m_nLastRedrawnTiles(0)
+{
+    Invalidate();
+}
+
+HRESULT DirtyTileTracker::Initialize(int nWidth, int nHeight, int nTileSize)
+{
+    V_CHECK_HR(nWidth > 0 && nHeight > 0 && nTileSize > 0);
+
+    const int nColumns = (nWidth + nTileSize - 1) / nTileSize;
+    const int nRows = (nHeight + nTileSize - 1) / nTileSize;
+    const int nTiles = nColumns * nRows;
+
+    std::unique_ptr<std::atomic<int64_t>[]> pChangedFrames = std::make_unique<std::atomic<int64_t>[]>(nTiles);
+    for (int i = 0; i < nTiles; ++i)
+    {
+        pChangedFrames[i].store(0, std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+
+        m_nWidth = nWidth;
+        m_nHeight = nHeight;
+        m_nTileSize = nTileSize;
+        m_nColumns = nColumns;
+        m_nRows = nRows;
+        m_pChangedFrames = std::move(pChangedFrames);
+    }
+
+    m_signatures.assign(nTiles, 0);
+
+    m_nFrames = 0;
+    m_nRedrawnTiles = 0;
+    m_nLastRedrawnTiles = 0;
+    Invalidate();
+
+    return S_OK;
+}
+
+PixelRect DirtyTileTracker::GetTileRect(int nTile) const
+{
+    const int nLeft = (nTile % m_nColumns) * m_nTileSize;
+    const int nTop = (nTile / m_nColumns) * m_nTileSize;
+
+    PixelRect rect = {nLeft, nTop, nLeft + m_nTileSize, nTop + m_nTileSize};
+    rect.Clip(m_nWidth, m_nHeight);
+    return rect;
+}
+
+int64_t DirtyTileTracker::BeginFrame()
+{
+    ++m_nFrames;
+    ++m_nFrame;
+
+    // the buffers a presenter already uploaded hold the old content in
+    // every tile, whatever the signatures say
+    if (m_bInvalidated.exchange(false))
+    {
+        const int nTiles = GetTileCount();
+        for (int i = 0; i < nTiles; ++i)
+        {
+            m_pChangedFrames[i].store(m_nFrame, std::memory_order_relaxed);
+        }
+    }
+
+    return m_nFrame;
+}
+
+bool DirtyTileTracker::UpdateTile(int nTile, uint64_t nSignature)
+{
+    if (m_signatures[nTile] == nSignature)
+    {
+        return false;
+    }
+
+    m_signatures[nTile] = nSignature;
+    m_pChangedFrames[nTile].store(m_nFrame, std::memory_order_relaxed);
+    return true;
+}
+
+void DirtyTileTracker::GetTilesToRedraw(const void* pBuffer, std::vector<int>* pTiles)
+{
+    int64_t nBufferFrame = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        nBufferFrame = FindBufferFrame(pBuffer);
+    }
+
+    pTiles->clear();
+
+    const int nTiles = GetTileCount();
+    for (int i = 0; i < nTiles; ++i)
+    {
+        if (nBufferFrame == 0 || m_pChangedFrames[i].load(std::memory_order_relaxed) > nBufferFrame)
+        {
+            pTiles->push_back(i);
+        }
+    }
+
+    m_nLastRedrawnTiles = static_cast<int>(pTiles->size());
+    m_nRedrawnTiles += pTiles->size();
+}
+
+void DirtyTileTracker::MarkWritten(const void* pBuffer)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    TrackedBuffer* pEntry = nullptr;
+    for (TrackedBuffer& buffer : m_buffers)
+    {
+        if (buffer.pBuffer == pBuffer)
+        {
+            pEntry = &buffer;
+            break;
+        }
+    }
+
+    if (!pEntry)
+    {
+        pEntry = &m_buffers[m_nNextBuffer];
+        m_nNextBuffer = (m_nNextBuffer + 1) % cMaxTrackedBuffers;
+    }
+
+    pEntry->pBuffer = pBuffer;
+    pEntry->nFrame = m_nFrame;
+}
+
+void DirtyTileTracker::GetChangedRects(const void* pBuffer, int64_t nSinceFrame, std::vector<PixelRect>* pRects, int64_t* pnBufferFrame) const
+{
+    // the whole call, Initialize may lay the tiles out again meanwhile
+    std::lock_guard<std::mutex> lock(m_lock);
+    const int64_t nBufferFrame = FindBufferFrame(pBuffer);
+
+    *pnBufferFrame = nBufferFrame;
+    pRects->clear();
+
+    if (nSinceFrame == 0 || nBufferFrame == 0)
+    {
+        const PixelRect frame = {0, 0, m_nWidth, m_nHeight};
+        pRects->push_back(frame);
+        return;
+    }
+
+    // Runs of changed tiles per row, a run extends the rect ending right above
+    // it when it spans the same columns. Tiles that changed after the buffer's
+    // frame are included too, they cost a little upload but never leave
+    // anything stale.
+    std::vector<size_t> open;
+    std::vector<size_t> nextOpen;
+
+    for (int nRow = 0; nRow < m_nRows; ++nRow)
+    {
+        const std::atomic<int64_t>* pChanged = &m_pChangedFrames[nRow * m_nColumns];
+        nextOpen.clear();
+
+        for (int nColumn = 0; nColumn < m_nColumns; )
+        {
+            if (pChanged[nColumn].load(std::memory_order_relaxed) <= nSinceFrame)
+            {
+                ++nColumn;
+                continue;
+            }
+
+            const int nFirst = nColumn;
+            while (nColumn < m_nColumns && pChanged[nColumn].load(std::memory_order_relaxed) > nSinceFrame)
+            {
+                ++nColumn;
+            }
+
+            PixelRect span = GetTileRect(nRow * m_nColumns + nFirst);
+            span.nRight = GetTileRect(nRow * m_nColumns + nColumn - 1).nRight;
+
+            size_t nRect = pRects->size();
+            for (size_t i : open)
+            {
+                if ((*pRects)[i].nLeft == span.nLeft && (*pRects)[i].nRight == span.nRight)
+                {
+                    nRect = i;
+                    break;
+                }
+            }
+
+            if (nRect < pRects->size())
+            {
+                (*pRects)[nRect].nBottom = span.nBottom;
+            }
+            else
+            {
+                pRects->push_back(span);
+            }
+
+            nextOpen.push_back(nRect);
+        }
+
+        open.swap(nextOpen);
+    }
+}
+
+void DirtyTileTracker::Invalidate()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    for (TrackedBuffer& buffer : m_buffers)
+    {
+        buffer.pBuffer = nullptr;
+        buffer.nFrame = 0;
+    }
+
+    m_bInvalidated = true;
+}
+
+double DirtyTileTracker::GetRedrawnFraction() const
+{
+    return m_nFrames ? double(m_nRedrawnTiles) / (double(m_nFrames) * GetTileCount()) : 0.0;
+}
+
+double DirtyTileTracker::GetLastRedrawnFraction() const
+{
+    return GetTileCount() ? double(m_nLastRedrawnTiles) / GetTileCount() : 0.0;
+}
+
+int64_t DirtyTileTracker::FindBufferFrame(const void* pBuffer) const
+{
+    for (const TrackedBuffer& buffer : m_buffers)
+    {
+        if (buffer.pBuffer == pBuffer)
+        {
+            return buffer.nFrame;
+        }
+    }
+
+    return 0;
+}
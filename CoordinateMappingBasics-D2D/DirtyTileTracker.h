@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "KinectTypes.h"
+#include "PixelRect.h"
+
+// Splits a frame into square tiles and remembers a signature of each tile's
+// content, so only the tiles whose signature changed have to be redrawn.
+// Output buffers are tracked by the frame they last received, which lets a
+// pool of rotating buffers catch up on every change they missed, and lets
+// the presenter upload only the tiles that changed since its last upload.
+//
+// Per frame: BeginFrame, UpdateTile for every tile (from any threads), then
+// GetTilesToRedraw and MarkWritten for the buffer being written.
+// GetChangedRects and Invalidate may be called from another thread, also
+// while Initialize lays the tiles out again for frames of another size.
+class DirtyTileTracker
+{
+public:
+    static const int cDefaultTileSize = 64;
+
+    DirtyTileTracker();
+
+    // Frame numbers carry on from the last layout, so a presenter's
+    // nSinceFrame stays meaningful across a change of frame size
+    HRESULT Initialize(int nWidth, int nHeight, int nTileSize = cDefaultTileSize);
+
+    int GetTileCount() const { return m_nColumns * m_nRows; }
+    int GetColumnCount() const { return m_nColumns; }
+    int GetRowCount() const { return m_nRows; }
+
+    // clipped to the frame at the right and bottom edges
+    PixelRect GetTileRect(int nTile) const;
+
+    // Starts the next frame and returns its number, the first is 1
+    int64_t BeginFrame();
+
+    // Records the tile's signature for the current frame, true when it differs
+    // from the last one. Different tiles may be updated concurrently.
+    bool UpdateTile(int nTile, uint64_t nSignature);
+
+    // Tiles pBuffer needs redrawn to hold the current frame: the ones changed
+    // since the frame it holds, all of them for a buffer not seen yet
+    void GetTilesToRedraw(const void* pBuffer, std::vector<int>* pTiles);
+
+    // pBuffer now holds the current frame
+    void MarkWritten(const void* pBuffer);
+
+    // Rectangles covering the tiles that changed after nSinceFrame, adjacent
+    // tiles merged. Covers the whole frame when nSinceFrame is 0 or pBuffer
+    // is not tracked. *pnBufferFrame receives the frame pBuffer holds, the
+    // nSinceFrame to pass next time.
+    void GetChangedRects(const void* pBuffer, int64_t nSinceFrame, std::vector<PixelRect>* pRects, int64_t* pnBufferFrame) const;
+
+    // Forget what every buffer holds and count every tile as changed in the
+    // next frame, e.g. after the background changed
+    void Invalidate();
+
+    uint64_t GetFrameCount() const { return m_nFrames; }
+    uint64_t GetRedrawnTileCount() const { return m_nRedrawnTiles; }
+
+    // share of tiles redrawn over all frames, and in the last one
+    double GetRedrawnFraction() const;
+    double GetLastRedrawnFraction() const;
+
+private:
+    // the pipeline rotates three output surfaces
+    static const int cMaxTrackedBuffers = 4;
+
+    struct TrackedBuffer
+    {
+        const void* pBuffer;
+        int64_t nFrame;
+    };
+
+    int m_nWidth;
+    int m_nHeight;
+    int m_nTileSize;
+    int m_nColumns;
+    int m_nRows;
+
+    int64_t m_nFrame;
+    std::vector<uint64_t> m_signatures;
+
+    // frame each tile last changed in, read by GetChangedRects on another thread
+    std::unique_ptr<std::atomic<int64_t>[]> m_pChangedFrames;
+
+    // set by Invalidate, BeginFrame then marks every tile changed
+    std::atomic<bool> m_bInvalidated;
+
+    // guards the tracked buffers, and the tile layout while GetChangedRects
+    // reads it on another thread
+    mutable std::mutex m_lock;
+    TrackedBuffer m_buffers[cMaxTrackedBuffers];
+    int m_nNextBuffer;
+
+    uint64_t m_nFrames;
+    uint64_t m_nRedrawnTiles;
+    int m_nLastRedrawnTiles;
+
+    // frame pBuffer holds, 0 when unknown; m_lock must be held
+    int64_t FindBufferFrame(const void* pBuffer) const;
+};
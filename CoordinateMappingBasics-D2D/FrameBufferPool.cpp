@@ -0,0 +1,306 @@
+#include "FrameBufferPool.h"
+#include <algorithm>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+    // sixteen 2 MB pages, enough for a 1080p BGRA frame and its index map
+    const size_t cArenaBytes = size_t(32) << 20;
+    const size_t cHugePageBytes = size_t(2) << 20;
+
+    size_t RoundUp(size_t nBytes, size_t nMultiple)
+    {
+        return (nBytes + nMultiple - 1) / nMultiple * nMultiple;
+    }
+
+#ifdef _WIN32
+    // Large pages need SeLockMemoryPrivilege, which accounts only hold when
+    // granted "Lock pages in memory" and which starts out disabled even then.
+    // Returns the large page size, or 0 when they cannot be used.
+    size_t EnableLargePages()
+    {
+        static const size_t nLargePageBytes = []() -> size_t
+        {
+            const size_t nMinimum = GetLargePageMinimum();
+            if (nMinimum == 0)
+            {
+                return 0;
+            }
+
+            HANDLE hToken = nullptr;
+            if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken))
+            {
+                return 0;
+            }
+
+            TOKEN_PRIVILEGES privileges = {};
+            privileges.PrivilegeCount = 1;
+            privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+            // succeeds without enabling anything when the privilege is not held
+            const bool bEnabled =
+                LookupPrivilegeValueW(nullptr, L"SeLockMemoryPrivilege", &privileges.Privileges[0].Luid) &&
+                AdjustTokenPrivileges(hToken, FALSE, &privileges, 0, nullptr, nullptr) &&
+                GetLastError() == ERROR_SUCCESS;
+
+            CloseHandle(hToken);
+            return bEnabled ? nMinimum : 0;
+        }();
+
+        return nLargePageBytes;
+    }
+#endif
+}
+
+FrameBufferPool::FrameBufferPool(bool bHugePages) :
+    m_bHugePages(bHugePages)
+{
+    m_stats = FrameBufferPoolStats();
+}
+
+FrameBufferPool::~FrameBufferPool()
+{
+    for (const Arena& arena : m_arenas)
+    {
+        FreeArena(arena);
+    }
+}
+
+FrameBufferPool& FrameBufferPool::GetShared()
+{
+    static FrameBufferPool* pShared = new FrameBufferPool();
+    return *pShared;
+}
+
+void* FrameBufferPool::Acquire(size_t nBytes)
+{
+    nBytes = RoundUp(std::max<size_t>(nBytes, 1), cAlignment);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    void* pBuffer = nullptr;
+
+    // a frame of the geometry just released is the common case
+    auto recycled = std::find_if(m_freeBuffers.begin(), m_freeBuffers.end(),
+        [nBytes](const FreeBuffer& buffer) { return buffer.nBytes == nBytes; });
+
+    if (recycled != m_freeBuffers.end())
+    {
+        pBuffer = recycled->pBuffer;
+        m_freeBuffers.erase(recycled);
+        ++m_stats.nRecycled;
+    }
+    else
+    {
+        // only the newest arena is carved from, the tail an older one was
+        // left with is smaller than the buffer that opened the next
+        if (m_arenas.empty() || m_arenas.back().nBytes - m_arenas.back().nUsed < nBytes)
+        {
+            if (!AllocateArena(nBytes))
+            {
+                return nullptr;
+            }
+        }
+
+        Arena& arena = m_arenas.back();
+        pBuffer = arena.pBase + arena.nUsed;
+        arena.nUsed += nBytes;
+        ++m_stats.nCarved;
+    }
+
+    m_stats.nBytesInUse += nBytes;
+    m_stats.nHighWaterBytes = std::max(m_stats.nHighWaterBytes, m_stats.nBytesInUse);
+
+    return pBuffer;
+}
+
+void FrameBufferPool::Release(void* pBuffer, size_t nBytes)
+{
+    if (!pBuffer)
+    {
+        return;
+    }
+
+    nBytes = RoundUp(std::max<size_t>(nBytes, 1), cAlignment);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    const FreeBuffer buffer = {pBuffer, nBytes};
+    m_freeBuffers.push_back(buffer);
+    m_stats.nBytesInUse -= nBytes;
+}
+
+FrameBufferPoolStats FrameBufferPool::GetStats() const
+{
+    FrameBufferPoolStats stats;
+    std::vector<Arena> arenas;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        stats = m_stats;
+        arenas = m_arenas;
+    }
+
+    // arenas stay mapped until the pool is destroyed, no need to hold the
+    // lock while the system is asked
+    stats.nHugePageBytes = GetHugePageBytes(arenas);
+    return stats;
+}
+
+void FrameBufferPool::ResetHighWaterMark()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_stats.nHighWaterBytes = m_stats.nBytesInUse;
+}
+
+#ifdef _WIN32
+
+bool FrameBufferPool::AllocateArena(size_t nMinimumBytes)
+{
+    Arena arena = {};
+
+    const size_t nLargePageBytes = m_bHugePages ? EnableLargePages() : 0;
+    if (nLargePageBytes)
+    {
+        arena.nBytes = RoundUp(std::max(nMinimumBytes, cArenaBytes), nLargePageBytes);
+        arena.pBase = static_cast<BYTE*>(VirtualAlloc(nullptr, arena.nBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE));
+        arena.bHugePages = (arena.pBase != nullptr);
+    }
+
+    // large pages are physically contiguous, a fragmented system may have none left
+    if (!arena.pBase)
+    {
+        arena.nBytes = RoundUp(std::max(nMinimumBytes, cArenaBytes), cHugePageBytes);
+        arena.pBase = static_cast<BYTE*>(VirtualAlloc(nullptr, arena.nBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    }
+
+    if (!arena.pBase)
+    {
+        return false;
+    }
+
+    m_arenas.push_back(arena);
+    m_stats.nArenaBytes += arena.nBytes;
+    ++m_stats.nArenas;
+    return true;
+}
+
+void FrameBufferPool::FreeArena(const Arena& arena)
+{
+    VirtualFree(arena.pBase, 0, MEM_RELEASE);
+}
+
+// large pages are committed and locked when the arena is allocated
+size_t FrameBufferPool::GetHugePageBytes(const std::vector<Arena>& arenas)
+{
+    size_t nBytes = 0;
+    for (const Arena& arena : arenas)
+    {
+        nBytes += arena.bHugePages ? arena.nBytes : 0;
+    }
+    return nBytes;
+}
+
+#else
+
+bool FrameBufferPool::AllocateArena(size_t nMinimumBytes)
+{
+    Arena arena = {};
+    arena.nBytes = RoundUp(std::max(nMinimumBytes, cArenaBytes), cHugePageBytes);
+
+    // one huge page more than needed, so the arena can start on a huge page
+    // boundary; the unaligned ends are unmapped again
+    const size_t nMappedBytes = arena.nBytes + cHugePageBytes;
+    void* pMapped = mmap(nullptr, nMappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pMapped == MAP_FAILED)
+    {
+        return false;
+    }
+
+    BYTE* pBase = reinterpret_cast<BYTE*>(RoundUp(reinterpret_cast<uintptr_t>(pMapped), cHugePageBytes));
+    const size_t nHead = pBase - static_cast<BYTE*>(pMapped);
+    const size_t nTail = nMappedBytes - nHead - arena.nBytes;
+    if (nHead)
+    {
+        munmap(pMapped, nHead);
+    }
+    if (nTail)
+    {
+        munmap(pBase + arena.nBytes, nTail);
+    }
+
+    arena.pBase = pBase;
+
+    // transparent huge pages back the arena as it is first touched, if the
+    // kernel has them free; without huge pages the arena is kept on small
+    // pages even when the system enables them for everything
+    arena.bHugePages = m_bHugePages && madvise(pBase, arena.nBytes, MADV_HUGEPAGE) == 0;
+    if (!m_bHugePages)
+    {
+        madvise(pBase, arena.nBytes, MADV_NOHUGEPAGE);
+    }
+
+    m_arenas.push_back(arena);
+    m_stats.nArenaBytes += arena.nBytes;
+    ++m_stats.nArenas;
+    return true;
+}
+
+void FrameBufferPool::FreeArena(const Arena& arena)
+{
+    munmap(arena.pBase, arena.nBytes);
+}
+
+// MADV_HUGEPAGE only asks: a huge page backs a stretch of the arena once it is
+// touched and the kernel has one free, which smaps counts as AnonHugePages per
+// mapping. Adjacent arenas may share a mapping with arenas of another pool,
+// so a mapping counts at most for the part of it in this pool's arenas.
+size_t FrameBufferPool::GetHugePageBytes(const std::vector<Arena>& arenas)
+{
+    if (std::none_of(arenas.begin(), arenas.end(), [](const Arena& arena) { return arena.bHugePages; }))
+    {
+        return 0;
+    }
+
+    FILE* pFile = fopen("/proc/self/smaps", "r");
+    if (!pFile)
+    {
+        return 0;
+    }
+
+    size_t nBytes = 0;
+    size_t nOverlap = 0;
+    char szLine[512];
+    while (fgets(szLine, sizeof(szLine), pFile))
+    {
+        unsigned long long nStart = 0;
+        unsigned long long nEnd = 0;
+        unsigned long long nKilobytes = 0;
+        if (sscanf(szLine, "%llx-%llx ", &nStart, &nEnd) == 2)
+        {
+            // a new mapping, how much of it lies in the arenas
+            nOverlap = 0;
+            for (const Arena& arena : arenas)
+            {
+                const unsigned long long nArenaStart = reinterpret_cast<uintptr_t>(arena.pBase);
+                const unsigned long long nArenaEnd = nArenaStart + arena.nBytes;
+                if (arena.bHugePages && nArenaStart < nEnd && nStart < nArenaEnd)
+                {
+                    nOverlap += static_cast<size_t>(std::min(nEnd, nArenaEnd) - std::max(nStart, nArenaStart));
+                }
+            }
+        }
+        else if (nOverlap && sscanf(szLine, "AnonHugePages: %llu kB", &nKilobytes) == 1)
+        {
+            nBytes += std::min(static_cast<size_t>(nKilobytes) * 1024, nOverlap);
+        }
+    }
+
+    fclose(pFile);
+    return nBytes;
+}
+
+#endif
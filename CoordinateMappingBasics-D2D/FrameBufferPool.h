@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "KinectTypes.h"
+
+struct FrameBufferPoolStats
+{
+    // memory reserved from the system, and how much of it is backed by huge
+    // pages; on Linux that is what the kernel reports transparent huge pages
+    // back, which only covers pages touched so far, not what was asked for
+    size_t nArenaBytes;
+    size_t nHugePageBytes;
+    int nArenas;
+
+    // handed out right now, and the most that ever was at once (or since
+    // ResetHighWaterMark)
+    size_t nBytesInUse;
+    size_t nHighWaterBytes;
+
+    // buffers carved from an arena and buffers served from released ones; after
+    // warm-up only the latter should grow
+    uint64_t nCarved;
+    uint64_t nRecycled;
+};
+
+// Frame sized buffers for the pipeline. Buffers are carved 64-byte aligned from
+// large arenas backed by huge pages where the system allows (transparent huge
+// pages on Linux, large pages on Windows when the account may lock memory), so
+// a 1080p frame spans a handful of TLB entries instead of two thousand. Nothing
+// is zeroed: a fresh arena page is touched the first time a stage writes it,
+// not at startup, and a released buffer goes back on a free list for the next
+// buffer of its size, so a fixed geometry stops allocating after warm-up.
+// Arenas are only returned to the system when the pool is destroyed.
+class FrameBufferPool
+{
+public:
+    static const size_t cAlignment = 64;
+
+    explicit FrameBufferPool(bool bHugePages = true);
+    ~FrameBufferPool();
+
+    FrameBufferPool(const FrameBufferPool&) = delete;
+    FrameBufferPool& operator=(const FrameBufferPool&) = delete;
+
+    // The pool FrameBuffer allocates from unless told otherwise. Never
+    // destroyed, so buffers released during static destruction stay valid.
+    static FrameBufferPool& GetShared();
+
+    // nullptr when the system is out of memory; the contents are undefined
+    void* Acquire(size_t nBytes);
+    // nBytes as passed to Acquire
+    void Release(void* pBuffer, size_t nBytes);
+
+    FrameBufferPoolStats GetStats() const;
+
+    // Starts the high water mark over from the bytes in use now, so it tells
+    // the most a stretch of work had at once
+    void ResetHighWaterMark();
+
+private:
+    struct Arena
+    {
+        BYTE* pBase;
+        size_t nBytes;
+        size_t nUsed;
+        bool bHugePages;
+    };
+
+    struct FreeBuffer
+    {
+        void* pBuffer;
+        size_t nBytes;
+    };
+
+    const bool m_bHugePages;
+
+    mutable std::mutex m_lock;
+    std::vector<Arena> m_arenas;
+    std::vector<FreeBuffer> m_freeBuffers;
+    FrameBufferPoolStats m_stats;
+
+    bool AllocateArena(size_t nMinimumBytes);
+    static void FreeArena(const Arena& arena);
+    static size_t GetHugePageBytes(const std::vector<Arena>& arenas);
+};
+
+// Owns a buffer of nCount T from a FrameBufferPool, a drop-in for the
+// std::unique_ptr<T[]> the frame buffers used to be (hence get and reset).
+// Throws std::bad_alloc like new T[] when the pool is out of memory. T must
+// be trivial, the elements are neither constructed nor destroyed.
+template <typename T>
+class FrameBuffer
+{
+public:
+    FrameBuffer() : m_pBuffer(nullptr), m_nCount(0), m_pPool(nullptr) {}
+    ~FrameBuffer() { reset(); }
+
+    FrameBuffer(FrameBuffer&& other) : m_pBuffer(other.m_pBuffer), m_nCount(other.m_nCount), m_pPool(other.m_pPool)
+    {
+        other.m_pBuffer = nullptr;
+        other.m_nCount = 0;
+    }
+
+    FrameBuffer& operator=(FrameBuffer&& other)
+    {
+        if (this != &other)
+        {
+            reset();
+            m_pBuffer = other.m_pBuffer;
+            m_nCount = other.m_nCount;
+            m_pPool = other.m_pPool;
+            other.m_pBuffer = nullptr;
+            other.m_nCount = 0;
+        }
+        return *this;
+    }
+
+    FrameBuffer(const FrameBuffer&) = delete;
+    FrameBuffer& operator=(const FrameBuffer&) = delete;
+
+    // keeps the current buffer when it already holds nCount elements
+    void Allocate(size_t nCount, FrameBufferPool* pPool = &FrameBufferPool::GetShared())
+    {
+        if (m_pBuffer && m_nCount == nCount && m_pPool == pPool)
+        {
+            return;
+        }
+
+        reset();
+
+        void* pBuffer = pPool->Acquire(nCount * sizeof(T));
+        if (!pBuffer)
+        {
+            throw std::bad_alloc();
+        }
+
+        m_pBuffer = static_cast<T*>(pBuffer);
+        m_nCount = nCount;
+        m_pPool = pPool;
+    }
+
+    void reset()
+    {
+        if (m_pBuffer)
+        {
+            m_pPool->Release(m_pBuffer, m_nCount * sizeof(T));
+            m_pBuffer = nullptr;
+            m_nCount = 0;
+        }
+    }
+
+    T* get() const { return m_pBuffer; }
+    size_t GetCount() const { return m_nCount; }
+
+    T& operator[](size_t i) const { return m_pBuffer[i]; }
+    explicit operator bool() const { return m_pBuffer != nullptr; }
+
+private:
+    T* m_pBuffer;
+    size_t m_nCount;
+    FrameBufferPool* m_pPool;
+};
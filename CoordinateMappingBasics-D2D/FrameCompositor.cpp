@@ -0,0 +1,1112 @@
+#include "FrameCompositor.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include "WindowsHelper.h"
+
+namespace
+{
+    // Region boxes are built from the centers of the outermost player pixels.
+    // A depth pixel covers about three color pixels at the distances players
+    // stand at, the margin takes that and the splat overlap with room to spare.
+    const int cRegionMargin = 8;
+
+    const BYTE cNoPlayer = 0xff;
+
+    void CopyPixels(const RGBQUAD* pSource, RGBQUAD* pDestination, int nBegin, int nEnd)
+    {
+        if (nEnd > nBegin)
+        {
+            memcpy(pDestination + nBegin, pSource + nBegin, size_t(nEnd - nBegin) * sizeof(RGBQUAD));
+        }
+    }
+}
+
+FrameCompositor::FrameCompositor() :
+    m_pMapper(nullptr),
+    m_pThreadPool(nullptr),
+    m_compositeKernel(GetBestCompositeKernel()),
+    m_compositeGeometry(CompositeGeometry_Fixed),
+    m_compositeMode(CompositeMode_Full),
+    m_segmentationMode(SegmentationMode_BodyIndex),
+    m_depthMapFormat(DepthMapFormat_Indices),
+    m_mappedFormat(DepthMapFormat_Points),
+    m_bBackgroundPersistent(false),
+    m_pProfiler(nullptr),
+    m_colorFormat(ColorFormat_Bgra),
+    m_pFrameMatte(nullptr),
+    m_nDepthWidth(0),
+    m_nDepthHeight(0),
+    m_nColorWidth(0),
+    m_nColorHeight(0),
+    m_nOutputWidth(0),
+    m_nOutputHeight(0),
+    m_nNextOutputRegions(0),
+    m_bMappingCacheEnabled(false),
+    m_matteRefinement(MatteRefinement_None),
+    m_bLowMemory(false),
+    m_bRowBlocksSupported(true)
+{
+    for (OutputRegions& output : m_outputRegions)
+    {
+        output.pOutputBuffer = nullptr;
+    }
+}
+
+HRESULT FrameCompositor::Initialize(
+    ColorToDepthMapper* pMapper,
+    ThreadPool* pThreadPool,
+    int nDepthWidth,
+    int nDepthHeight,
+    int nColorWidth,
+    int nColorHeight)
+{
+    if (!pMapper || !pThreadPool || nDepthWidth <= 0 || nDepthHeight <= 0 || nColorWidth <= 0 || nColorHeight <= 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_pMapper = pMapper;
+    m_pThreadPool = pThreadPool;
+    m_nDepthWidth = nDepthWidth;
+    m_nDepthHeight = nDepthHeight;
+    m_nColorWidth = nColorWidth;
+    m_nColorHeight = nColorHeight;
+
+    m_pDepthCoordinates.reset();
+    m_pDepthIndices.reset();
+    m_pColorCoordinates.reset();
+    m_pDepthComposite.reset();
+    m_pBlockIndices.reset();
+    m_pBlockZBuffer.reset();
+    m_pKeyedBodyIndex.reset();
+    m_pAlphaMatte.reset();
+    m_pMatteCoverage.reset();
+    m_bRowBlocksSupported = true;
+
+    m_rowFirst.resize(size_t(cBodyCount) * nDepthHeight);
+    m_rowLast.resize(size_t(cBodyCount) * nDepthHeight);
+
+    // at most four edges per body per row
+    const size_t nMaxEdges = size_t(4) * cBodyCount * nDepthHeight;
+    m_edgePoints.reserve(nMaxEdges);
+    m_edgeDepths.reserve(nMaxEdges);
+    m_edgeBodies.reserve(nMaxEdges);
+    m_edgeColorPoints.resize(nMaxEdges);
+
+    V_RET(m_dirtyTiles.Initialize(nColorWidth, nColorHeight));
+    V_RET(m_mappingCache.Initialize(pMapper, nDepthWidth, nDepthHeight, nColorWidth, nColorHeight));
+    V_RET(m_depthKeyer.Initialize(nDepthWidth, nDepthHeight));
+    V_RET(m_matteRefiner.Initialize(nDepthWidth, nDepthHeight));
+    m_redrawTiles.reserve(m_dirtyTiles.GetTileCount());
+
+    InvalidateBackground();
+
+    return S_OK;
+}
+
+HRESULT FrameCompositor::SetFrameGeometry(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight)
+{
+    V_CHECK_HR(m_pMapper && m_pThreadPool);
+
+    if (HasFrameGeometry(nDepthWidth, nDepthHeight, nColorWidth, nColorHeight))
+    {
+        return S_OK;
+    }
+
+    V_RET(m_pMapper->SetFrameGeometry(nDepthWidth, nDepthHeight, nColorWidth, nColorHeight));
+
+    return Initialize(m_pMapper, m_pThreadPool, nDepthWidth, nDepthHeight, nColorWidth, nColorHeight);
+}
+
+bool FrameCompositor::HasFrameGeometry(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight) const
+{
+    return m_nDepthWidth == nDepthWidth && m_nDepthHeight == nDepthHeight &&
+        m_nColorWidth == nColorWidth && m_nColorHeight == nColorHeight;
+}
+
+HRESULT FrameCompositor::SetOutputSize(int nWidth, int nHeight)
+{
+    V_CHECK_HR(nWidth > 0 && nHeight > 0);
+
+    m_nOutputWidth = nWidth;
+    m_nOutputHeight = nHeight;
+    InvalidateBackground();
+
+    return S_OK;
+}
+
+void FrameCompositor::SetDepthMapFormat(DepthMapFormat format)
+{
+    m_depthMapFormat = format;
+    m_mappingCache.Invalidate();
+}
+
+void FrameCompositor::SetMappingCacheEnabled(bool bEnabled)
+{
+    m_bMappingCacheEnabled = bEnabled;
+    m_mappingCache.Invalidate();
+}
+
+void FrameCompositor::SetLowMemory(bool bLowMemory)
+{
+    m_bLowMemory = bLowMemory;
+    m_mappingCache.Invalidate();
+}
+
+void FrameCompositor::SetMatteRefinement(MatteRefinement refinement)
+{
+    m_matteRefinement = refinement;
+
+    // tile signatures taken with the other edges would leave tiles stale
+    m_dirtyTiles.Invalidate();
+}
+
+void FrameCompositor::SetBackgroundPersistent(bool bPersistent)
+{
+    m_bBackgroundPersistent = bPersistent;
+    InvalidateBackground();
+}
+
+void FrameCompositor::InvalidateBackground()
+{
+    m_dirtyTiles.Invalidate();
+
+    for (OutputRegions& output : m_outputRegions)
+    {
+        output.pOutputBuffer = nullptr;
+        output.regions.clear();
+    }
+}
+
+double FrameCompositor::GetPlayerCoverage() const
+{
+    const int nColorPixels = m_nColorWidth * m_nColorHeight;
+    if (nColorPixels == 0)
+    {
+        return 0.0;
+    }
+
+    int nCovered = 0;
+    for (const PixelRect& region : m_playerRegions)
+    {
+        nCovered += region.GetArea();
+    }
+
+    return static_cast<double>(nCovered) / nColorPixels;
+}
+
+HRESULT FrameCompositor::MapFrame(const UINT16* pDepthBuffer)
+{
+    V_CHECK_HR(m_pMapper && pDepthBuffer);
+
+    ProfileScope scope(m_pProfiler, ProfileStage_Map);
+
+    if (!m_bMappingCacheEnabled)
+    {
+        const PixelRect frame = {0, 0, m_nColorWidth, m_nColorHeight};
+        return MapRegions(pDepthBuffer, &frame, 1);
+    }
+
+    V_RET(m_mappingCache.BeginFrame(pDepthBuffer, &m_remapRegions));
+
+    const auto start = std::chrono::steady_clock::now();
+    const HRESULT hr = m_remapRegions.empty() ?
+        S_OK :
+        MapRegions(pDepthBuffer, m_remapRegions.data(), static_cast<int>(m_remapRegions.size()));
+
+    m_mappingCache.EndFrame(
+        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+        SUCCEEDED(hr));
+
+    return hr;
+}
+
+HRESULT FrameCompositor::MapRegions(const UINT16* pDepthBuffer, const PixelRect* pRects, int nRectCount)
+{
+    const UINT nDepthPoints = UINT(m_nDepthWidth * m_nDepthHeight);
+    const UINT nColorPoints = UINT(m_nColorWidth * m_nColorHeight);
+
+    if (m_depthMapFormat == DepthMapFormat_Indices)
+    {
+        if (!m_pDepthIndices)
+        {
+            m_pDepthIndices.Allocate(nColorPoints);
+        }
+
+        const HRESULT hr = m_pMapper->MapColorRegionsToDepthIndices(
+            nDepthPoints, pDepthBuffer, nColorPoints, m_pDepthIndices.get(), pRects, nRectCount);
+        if (hr != E_NOTIMPL)
+        {
+            m_mappedFormat = DepthMapFormat_Indices;
+            return hr;
+        }
+
+        // the SDK mapper only maps to points, stop asking
+        m_pDepthIndices.reset();
+        m_depthMapFormat = DepthMapFormat_Points;
+    }
+
+    if (!m_pDepthCoordinates)
+    {
+        m_pDepthCoordinates.Allocate(nColorPoints);
+    }
+
+    m_mappedFormat = DepthMapFormat_Points;
+
+    return m_pMapper->MapColorRegionsToDepthSpace(
+        nDepthPoints, pDepthBuffer, nColorPoints, m_pDepthCoordinates.get(), pRects, nRectCount);
+}
+
+void FrameCompositor::Composite(
+    const RGBQUAD* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer)
+{
+    Composite(reinterpret_cast<const BYTE*>(pColorBuffer), ColorFormat_Bgra, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer);
+}
+
+void FrameCompositor::Composite(
+    const BYTE* pColorBuffer,
+    ColorFormat colorFormat,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer)
+{
+    V_CHECK(m_pThreadPool && pColorBuffer && pBodyIndexBuffer && pBackgroundBuffer && pOutputBuffer);
+
+    m_colorFormat = colorFormat;
+
+    CompositeBands(pColorBuffer, RefineMatte(pBodyIndexBuffer), pBackgroundBuffer, pOutputBuffer);
+}
+
+void FrameCompositor::CompositeBands(
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer)
+{
+    ProfileScope scope(m_pProfiler, ProfileStage_Composite);
+
+    int nBands = m_pThreadPool->GetThreadCount() * cBandsPerThread;
+    if (nBands > cMaxBands)
+    {
+        nBands = cMaxBands;
+    }
+
+    int bandBoundaries[cMaxBands + 1];
+    SplitCacheAlignedBands(
+        pOutputBuffer,
+        sizeof(RGBQUAD),
+        m_nColorWidth * m_nColorHeight,
+        m_nColorWidth,
+        nBands,
+        bandBoundaries);
+
+    m_pThreadPool->ParallelFor(nBands, [&](int band)
+    {
+        CompositePixels(pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer, bandBoundaries[band], bandBoundaries[band + 1]);
+    });
+
+    const PixelRect frame = {0, 0, m_nColorWidth, m_nColorHeight};
+    RememberRegions(pOutputBuffer, &frame, 1);
+
+    // the tile signatures no longer describe what the buffers hold
+    m_dirtyTiles.Invalidate();
+}
+
+HRESULT FrameCompositor::ProcessRowBlocks(
+    const UINT16* pDepthBuffer,
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer)
+{
+    V_CHECK_HR(m_pMapper && m_pThreadPool && pDepthBuffer && pColorBuffer && pBodyIndexBuffer && pBackgroundBuffer && pOutputBuffer);
+
+    // the map stage only projects the depth frame, the blocks are mapped as
+    // they are composited
+    {
+        ProfileScope scope(m_pProfiler, ProfileStage_Map);
+
+        const HRESULT hr = m_pMapper->PrepareColorRowBlocks(m_nDepthWidth * m_nDepthHeight, pDepthBuffer, cRowBlockRows);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+    }
+
+    ProfileScope scope(m_pProfiler, ProfileStage_Composite);
+
+    const int nLanes = m_pThreadPool->GetThreadCount();
+    const size_t nBlockPixels = size_t(cRowBlockRows) * m_nColorWidth;
+    m_pBlockIndices.Allocate(nLanes * nBlockPixels);
+    m_pBlockZBuffer.Allocate(nLanes * nBlockPixels);
+
+    const int nColorPixels = m_nColorWidth * m_nColorHeight;
+    const int nBlocks = (m_nColorHeight + cRowBlockRows - 1) / cRowBlockRows;
+    const size_t nColorPixelBytes = (m_colorFormat == ColorFormat_Yuy2) ? 2 : sizeof(RGBQUAD);
+
+    // each lane takes the next block until none are left, so a lane's
+    // scratch is only ever used by one thread at a time
+    std::atomic<int> nNextBlock(0);
+    std::atomic<bool> bFailed(false);
+    m_pThreadPool->ParallelFor(nLanes, [&](int nLane)
+    {
+        UINT* pBlockIndices = m_pBlockIndices.get() + nLane * nBlockPixels;
+        UINT16* pBlockZBuffer = m_pBlockZBuffer.get() + nLane * nBlockPixels;
+
+        for (int nBlock = nNextBlock++; nBlock < nBlocks; nBlock = nNextBlock++)
+        {
+            if (FAILED(m_pMapper->MapColorRowBlockToDepthIndices(nBlock, pBlockIndices, pBlockZBuffer)))
+            {
+                bFailed = true;
+                continue;
+            }
+
+            const int nBegin = nBlock * cRowBlockRows * m_nColorWidth;
+            const int nEnd = std::min(nBegin + cRowBlockRows * m_nColorWidth, nColorPixels);
+
+            // the block's map starts at its first pixel, so do the buffers
+            CompositeMapped(
+                pBlockIndices,
+                pColorBuffer + nBegin * nColorPixelBytes,
+                pBodyIndexBuffer,
+                pBackgroundBuffer + nBegin,
+                pOutputBuffer + nBegin,
+                0,
+                nEnd - nBegin);
+        }
+    });
+
+    V_CHECK_HR(!bFailed);
+
+    const PixelRect frame = {0, 0, m_nColorWidth, m_nColorHeight};
+    RememberRegions(pOutputBuffer, &frame, 1);
+
+    m_dirtyTiles.Invalidate();
+    m_mappingCache.Invalidate();
+
+    return S_OK;
+}
+
+HRESULT FrameCompositor::FindPlayerRegions(const UINT16* pDepthBuffer, const BYTE* pBodyIndexBuffer)
+{
+    // leftmost and rightmost player pixel per row and body, -1 for none
+    for (int y = 0; y < m_nDepthHeight; ++y)
+    {
+        const BYTE* pRow = pBodyIndexBuffer + y * m_nDepthWidth;
+        int* pFirst = &m_rowFirst[y * cBodyCount];
+        int* pLast = &m_rowLast[y * cBodyCount];
+        std::fill(pFirst, pFirst + cBodyCount, -1);
+
+        for (int x = 0; x < m_nDepthWidth; ++x)
+        {
+            const BYTE player = pRow[x];
+            if (player == cNoPlayer)
+            {
+                continue;
+            }
+
+            // the kernel composites any index but 0xff, stray values share the last box
+            const int nBody = std::min<int>(player, cBodyCount - 1);
+            if (pFirst[nBody] < 0)
+            {
+                pFirst[nBody] = x;
+            }
+            pLast[nBody] = x;
+        }
+    }
+
+    m_edgePoints.clear();
+    m_edgeDepths.clear();
+    m_edgeBodies.clear();
+
+    auto addEdge = [&](int x, int y, int nBody)
+    {
+        const DepthSpacePoint point = {static_cast<float>(x), static_cast<float>(y)};
+        m_edgePoints.push_back(point);
+        m_edgeDepths.push_back(pDepthBuffer[x + y * m_nDepthWidth]);
+        m_edgeBodies.push_back(static_cast<BYTE>(nBody));
+    };
+
+    for (int y = 0; y < m_nDepthHeight; ++y)
+    {
+        for (int nBody = 0; nBody < cBodyCount; ++nBody)
+        {
+            // The pixels around a player splat over color pixels that can round
+            // into the player, and they sit at their own depth, so parallax
+            // moves them elsewhere than the player's outline. The outline of
+            // the player grown by a pixel is projected along with the player's.
+            int nGrownFirst = m_nDepthWidth;
+            int nGrownLast = -1;
+            for (int nNeighbour = std::max(0, y - 1); nNeighbour <= std::min(m_nDepthHeight - 1, y + 1); ++nNeighbour)
+            {
+                const int nIndex = nNeighbour * cBodyCount + nBody;
+                if (m_rowFirst[nIndex] >= 0)
+                {
+                    nGrownFirst = std::min(nGrownFirst, m_rowFirst[nIndex]);
+                    nGrownLast = std::max(nGrownLast, m_rowLast[nIndex]);
+                }
+            }
+
+            if (nGrownLast < 0)
+            {
+                continue;
+            }
+
+            const int edges[4] =
+            {
+                std::max(0, nGrownFirst - 1),
+                std::min(m_nDepthWidth - 1, nGrownLast + 1),
+                m_rowFirst[y * cBodyCount + nBody],
+                m_rowLast[y * cBodyCount + nBody],
+            };
+
+            const int nEdgeCount = (edges[2] < 0) ? 2 : 4;
+            for (int nEdge = 0; nEdge < nEdgeCount; ++nEdge)
+            {
+                addEdge(edges[nEdge], y, nBody);
+            }
+        }
+    }
+
+    m_playerRegions.clear();
+    if (m_edgePoints.empty())
+    {
+        return S_OK;
+    }
+
+    const UINT nEdgeCount = static_cast<UINT>(m_edgePoints.size());
+    V_RET(m_pMapper->MapDepthPointsToColorSpace(
+        nEdgeCount,
+        m_edgePoints.data(),
+        m_edgeDepths.data(),
+        m_edgeColorPoints.data()));
+
+    PixelRect boxes[cBodyCount];
+    bool bFound[cBodyCount] = {false};
+
+    for (UINT i = 0; i < nEdgeCount; ++i)
+    {
+        const ColorSpacePoint& p = m_edgeColorPoints[i];
+
+        // -infinity for body pixels without a valid depth, NaN fails too
+        if (!(p.X > -m_nColorWidth && p.X < 2.0f * m_nColorWidth && p.Y > -m_nColorHeight && p.Y < 2.0f * m_nColorHeight))
+        {
+            continue;
+        }
+
+        const PixelRect box =
+        {
+            static_cast<int>(floorf(p.X)) - cRegionMargin,
+            static_cast<int>(floorf(p.Y)) - cRegionMargin,
+            static_cast<int>(ceilf(p.X)) + cRegionMargin + 1,
+            static_cast<int>(ceilf(p.Y)) + cRegionMargin + 1,
+        };
+
+        const int nBody = m_edgeBodies[i];
+        if (bFound[nBody])
+        {
+            boxes[nBody].Union(box);
+        }
+        else
+        {
+            boxes[nBody] = box;
+            bFound[nBody] = true;
+        }
+    }
+
+    for (int nBody = 0; nBody < cBodyCount; ++nBody)
+    {
+        if (!bFound[nBody])
+        {
+            continue;
+        }
+
+        boxes[nBody].Clip(m_nColorWidth, m_nColorHeight);
+        if (!boxes[nBody].IsEmpty())
+        {
+            m_playerRegions.push_back(boxes[nBody]);
+        }
+    }
+
+    // players standing close together share a box, so no pixel is mapped twice
+    bool bMerged = true;
+    while (bMerged)
+    {
+        bMerged = false;
+        for (size_t i = 0; i < m_playerRegions.size() && !bMerged; ++i)
+        {
+            for (size_t j = i + 1; j < m_playerRegions.size(); ++j)
+            {
+                if (m_playerRegions[i].Intersects(m_playerRegions[j]))
+                {
+                    m_playerRegions[i].Union(m_playerRegions[j]);
+                    m_playerRegions.erase(m_playerRegions.begin() + j);
+                    bMerged = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // spans within a row are walked left to right
+    std::sort(m_playerRegions.begin(), m_playerRegions.end(), [](const PixelRect& a, const PixelRect& b)
+    {
+        return a.nLeft < b.nLeft;
+    });
+
+    return S_OK;
+}
+
+void FrameCompositor::KeyDepthFrame(const UINT16* pDepthBuffer)
+{
+    ProfileScope scope(m_pProfiler, ProfileStage_Key);
+
+    const int nDepthPixels = m_nDepthWidth * m_nDepthHeight;
+    m_pKeyedBodyIndex.Allocate(nDepthPixels);
+
+    m_depthKeyer.BeginFrame(pDepthBuffer);
+
+    const int nBands = std::min(m_pThreadPool->GetThreadCount() * cBandsPerThread, cMaxBands);
+    m_pThreadPool->ParallelFor(nBands, [&](int band)
+    {
+        m_depthKeyer.KeyPixels(
+            m_compositeKernel,
+            pDepthBuffer,
+            m_pKeyedBodyIndex.get(),
+            static_cast<int>(int64_t(nDepthPixels) * band / nBands),
+            static_cast<int>(int64_t(nDepthPixels) * (band + 1) / nBands));
+    });
+}
+
+const BYTE* FrameCompositor::RefineMatte(const BYTE* pBodyIndexBuffer)
+{
+    if (m_matteRefinement == MatteRefinement_None)
+    {
+        m_pFrameMatte = nullptr;
+        return pBodyIndexBuffer;
+    }
+
+    ProfileScope scope(m_pProfiler, ProfileStage_Matte);
+
+    const size_t nDepthPixels = size_t(m_nDepthWidth) * m_nDepthHeight;
+    m_pAlphaMatte.Allocate(nDepthPixels);
+    m_pMatteCoverage.Allocate(nDepthPixels);
+
+    m_matteRefiner.Refine(
+        m_matteRefinement,
+        pBodyIndexBuffer,
+        m_pThreadPool,
+        std::min(m_pThreadPool->GetThreadCount() * cBandsPerThread, cMaxBands),
+        m_pAlphaMatte.get(),
+        m_pMatteCoverage.get());
+
+    m_pFrameMatte = m_pAlphaMatte.get();
+
+    return m_pMatteCoverage.get();
+}
+
+void FrameCompositor::CompositePixels(
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex) const
+{
+    if (m_mappedFormat == DepthMapFormat_Indices)
+    {
+        CompositeMapped(m_pDepthIndices.get(), pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+    }
+    else
+    {
+        CompositeMapped(m_pDepthCoordinates.get(), pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+    }
+}
+
+template <typename DepthMap>
+void FrameCompositor::CompositeMapped(
+    const DepthMap* pDepthMap,
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer,
+    int nBeginIndex,
+    int nEndIndex) const
+{
+    if (m_pFrameMatte)
+    {
+        if (m_colorFormat == ColorFormat_Yuy2)
+        {
+            CompositeFrameMatteYuy2(
+                m_compositeKernel, pDepthMap, m_pFrameMatte, m_nDepthWidth, m_nDepthHeight,
+                pColorBuffer, pBackgroundBuffer, pOutputBuffer, nBeginIndex, nEndIndex);
+        }
+        else
+        {
+            CompositeFrameMatte(
+                m_compositeKernel, pDepthMap, m_pFrameMatte, m_nDepthWidth, m_nDepthHeight,
+                reinterpret_cast<const RGBQUAD*>(pColorBuffer), pBackgroundBuffer, pOutputBuffer,
+                nBeginIndex, nEndIndex);
+        }
+        return;
+    }
+
+    if (m_colorFormat == ColorFormat_Yuy2)
+    {
+        CompositeFrameYuy2(
+            m_compositeKernel,
+            pDepthMap,
+            pBodyIndexBuffer,
+            m_nDepthWidth,
+            m_nDepthHeight,
+            pColorBuffer,
+            pBackgroundBuffer,
+            pOutputBuffer,
+            nBeginIndex,
+            nEndIndex,
+            m_compositeGeometry);
+        return;
+    }
+
+    CompositeFrame(
+        m_compositeKernel,
+        pDepthMap,
+        pBodyIndexBuffer,
+        m_nDepthWidth,
+        m_nDepthHeight,
+        reinterpret_cast<const RGBQUAD*>(pColorBuffer),
+        pBackgroundBuffer,
+        pOutputBuffer,
+        nBeginIndex,
+        nEndIndex,
+        m_compositeGeometry);
+}
+
+uint64_t FrameCompositor::HashPixels(
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    uint64_t nHash) const
+{
+    if (m_mappedFormat == DepthMapFormat_Indices)
+    {
+        return HashMapped(m_pDepthIndices.get(), pColorBuffer, pBodyIndexBuffer, nBeginIndex, nEndIndex, nHash);
+    }
+
+    return HashMapped(m_pDepthCoordinates.get(), pColorBuffer, pBodyIndexBuffer, nBeginIndex, nEndIndex, nHash);
+}
+
+template <typename DepthMap>
+uint64_t FrameCompositor::HashMapped(
+    const DepthMap* pDepthMap,
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    int nBeginIndex,
+    int nEndIndex,
+    uint64_t nHash) const
+{
+    if (m_colorFormat == ColorFormat_Yuy2)
+    {
+        return HashCompositedPixelsYuy2(
+            pDepthMap, pBodyIndexBuffer, m_nDepthWidth, m_nDepthHeight,
+            pColorBuffer, nBeginIndex, nEndIndex, nHash, m_pFrameMatte);
+    }
+
+    return HashCompositedPixels(
+        pDepthMap, pBodyIndexBuffer, m_nDepthWidth, m_nDepthHeight,
+        reinterpret_cast<const RGBQUAD*>(pColorBuffer), nBeginIndex, nEndIndex, nHash, m_pFrameMatte);
+}
+
+void FrameCompositor::CompositeSpan(
+    int y,
+    int nLeft,
+    int nRight,
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer) const
+{
+    const int nRow = y * m_nColorWidth;
+
+    int x = nLeft;
+    for (const PixelRect& region : m_playerRegions)
+    {
+        if (!region.ContainsRow(y) || region.nRight <= nLeft || region.nLeft >= nRight)
+        {
+            continue;
+        }
+
+        const int nBegin = std::max(region.nLeft, nLeft);
+        const int nEnd = std::min(region.nRight, nRight);
+
+        CopyPixels(pBackgroundBuffer, pOutputBuffer, nRow + x, nRow + nBegin);
+
+        CompositePixels(pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer, nRow + nBegin, nRow + nEnd);
+
+        x = nEnd;
+    }
+
+    CopyPixels(pBackgroundBuffer, pOutputBuffer, nRow + x, nRow + nRight);
+}
+
+void FrameCompositor::CompositeRegions(
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer)
+{
+    ProfileScope scope(m_pProfiler, ProfileStage_Composite);
+
+    const std::vector<PixelRect>* pPrevious = m_bBackgroundPersistent ? FindPreviousRegions(pOutputBuffer) : nullptr;
+
+    int nBands = std::min(m_pThreadPool->GetThreadCount() * cBandsPerThread, cMaxBands);
+    nBands = std::min(nBands, m_nColorHeight);
+
+    // whole rows per band, the kernels and copies work on row spans
+    m_pThreadPool->ParallelFor(nBands, [&](int band)
+    {
+        const int nBeginRow = static_cast<int>(int64_t(m_nColorHeight) * band / nBands);
+        const int nEndRow = static_cast<int>(int64_t(m_nColorHeight) * (band + 1) / nBands);
+
+        for (int y = nBeginRow; y < nEndRow; ++y)
+        {
+            if (!pPrevious)
+            {
+                CompositeSpan(y, 0, m_nColorWidth, pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer);
+                continue;
+            }
+
+            const int nRow = y * m_nColorWidth;
+
+            // everything outside last time's players still shows the background
+            for (const PixelRect& previous : *pPrevious)
+            {
+                if (previous.ContainsRow(y))
+                {
+                    CopyPixels(pBackgroundBuffer, pOutputBuffer, nRow + previous.nLeft, nRow + previous.nRight);
+                }
+            }
+
+            for (const PixelRect& region : m_playerRegions)
+            {
+                if (region.ContainsRow(y))
+                {
+                    CompositePixels(pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer,
+                        nRow + region.nLeft, nRow + region.nRight);
+                }
+            }
+        }
+    });
+
+    RememberRegions(pOutputBuffer, m_playerRegions.data(), static_cast<int>(m_playerRegions.size()));
+    m_dirtyTiles.Invalidate();
+}
+
+void FrameCompositor::CompositeDepthResolution(
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer)
+{
+    ProfileScope scope(m_pProfiler, ProfileStage_Composite);
+
+    const int nOutputWidth = GetOutputWidth();
+    const int nOutputHeight = GetOutputHeight();
+
+    const int nBands = std::min(m_pThreadPool->GetThreadCount() * cBandsPerThread, cMaxBands);
+
+    // one color pixel per player depth pixel, transparent everywhere else
+    m_pThreadPool->ParallelFor(nBands, [&](int band)
+    {
+        const int nBegin = static_cast<int>(int64_t(m_nDepthWidth) * m_nDepthHeight * band / nBands);
+        const int nEnd = static_cast<int>(int64_t(m_nDepthWidth) * m_nDepthHeight * (band + 1) / nBands);
+        const RGBQUAD transparent = {0, 0, 0, 0};
+
+        for (int i = nBegin; i < nEnd; ++i)
+        {
+            const ColorSpacePoint& p = m_pColorCoordinates[i];
+            RGBQUAD& pixel = m_pDepthComposite[i];
+
+            // -infinity and NaN fail the range test
+            if (pBodyIndexBuffer[i] == cNoPlayer ||
+                !(p.X >= -0.5f && p.X < m_nColorWidth - 0.5f && p.Y >= -0.5f && p.Y < m_nColorHeight - 0.5f))
+            {
+                pixel = transparent;
+                continue;
+            }
+
+            const int colorX = static_cast<int>(p.X + 0.5f);
+            const int colorY = static_cast<int>(p.Y + 0.5f);
+            const int colorIndex = colorX + colorY * m_nColorWidth;
+            pixel = (m_colorFormat == ColorFormat_Yuy2) ?
+                ConvertYuy2Pixel(pColorBuffer, colorIndex) :
+                reinterpret_cast<const RGBQUAD*>(pColorBuffer)[colorIndex];
+            pixel.rgbReserved = 0xff;
+
+            // a soft edge is premultiplied by its alpha, rounded to nearest
+            const int nAlpha = m_pFrameMatte ? m_pFrameMatte[i] : 0xff;
+            if (nAlpha != 0xff)
+            {
+                auto premultiply = [nAlpha](BYTE channel)
+                {
+                    const int t = channel * nAlpha + 128;
+                    return static_cast<BYTE>((t + (t >> 8)) >> 8);
+                };
+
+                pixel.rgbBlue = premultiply(pixel.rgbBlue);
+                pixel.rgbGreen = premultiply(pixel.rgbGreen);
+                pixel.rgbRed = premultiply(pixel.rgbRed);
+                pixel.rgbReserved = static_cast<BYTE>(nAlpha);
+            }
+        }
+    });
+
+    const int nOutputBands = std::min(nBands, nOutputHeight);
+    m_pThreadPool->ParallelFor(nOutputBands, [&](int band)
+    {
+        UpscaleComposite(
+            m_compositeKernel,
+            m_pDepthComposite.get(),
+            m_nDepthWidth,
+            m_nDepthHeight,
+            pBackgroundBuffer,
+            pOutputBuffer,
+            nOutputWidth,
+            nOutputHeight,
+            static_cast<int>(int64_t(nOutputHeight) * band / nOutputBands),
+            static_cast<int>(int64_t(nOutputHeight) * (band + 1) / nOutputBands));
+    });
+
+    m_dirtyTiles.Invalidate();
+}
+
+void FrameCompositor::CompositeTiles(
+    const BYTE* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer)
+{
+    ProfileScope scope(m_pProfiler, ProfileStage_Composite);
+
+    m_dirtyTiles.BeginFrame();
+
+    // A tile's signature covers which of its pixels show a player and their
+    // color. Outside the player regions everything is background, which keeps
+    // the signature at 0 without looking at a pixel.
+    m_pThreadPool->ParallelFor(m_dirtyTiles.GetTileCount(), [&](int nTile)
+    {
+        const PixelRect tile = m_dirtyTiles.GetTileRect(nTile);
+        uint64_t nSignature = 0;
+
+        for (const PixelRect& region : m_playerRegions)
+        {
+            if (!region.Intersects(tile))
+            {
+                continue;
+            }
+
+            const int nLeft = std::max(region.nLeft, tile.nLeft);
+            const int nRight = std::min(region.nRight, tile.nRight);
+
+            for (int y = std::max(region.nTop, tile.nTop); y < std::min(region.nBottom, tile.nBottom); ++y)
+            {
+                nSignature = HashPixels(pColorBuffer, pBodyIndexBuffer, y * m_nColorWidth + nLeft, y * m_nColorWidth + nRight, nSignature);
+            }
+        }
+
+        m_dirtyTiles.UpdateTile(nTile, nSignature);
+    });
+
+    m_dirtyTiles.GetTilesToRedraw(pOutputBuffer, &m_redrawTiles);
+
+    m_pThreadPool->ParallelFor(static_cast<int>(m_redrawTiles.size()), [&](int i)
+    {
+        const PixelRect tile = m_dirtyTiles.GetTileRect(m_redrawTiles[i]);
+
+        for (int y = tile.nTop; y < tile.nBottom; ++y)
+        {
+            CompositeSpan(y, tile.nLeft, tile.nRight, pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer);
+        }
+    });
+
+    m_dirtyTiles.MarkWritten(pOutputBuffer);
+}
+
+const std::vector<PixelRect>* FrameCompositor::FindPreviousRegions(const RGBQUAD* pOutputBuffer) const
+{
+    for (const OutputRegions& output : m_outputRegions)
+    {
+        if (output.pOutputBuffer == pOutputBuffer)
+        {
+            return &output.regions;
+        }
+    }
+
+    return nullptr;
+}
+
+void FrameCompositor::RememberRegions(const RGBQUAD* pOutputBuffer, const PixelRect* pRegions, int nRegionCount)
+{
+    OutputRegions* pEntry = nullptr;
+    for (OutputRegions& output : m_outputRegions)
+    {
+        if (output.pOutputBuffer == pOutputBuffer)
+        {
+            pEntry = &output;
+            break;
+        }
+    }
+
+    if (!pEntry)
+    {
+        pEntry = &m_outputRegions[m_nNextOutputRegions];
+        m_nNextOutputRegions = (m_nNextOutputRegions + 1) % cMaxTrackedOutputs;
+    }
+
+    pEntry->pOutputBuffer = pOutputBuffer;
+    pEntry->regions.assign(pRegions, pRegions + nRegionCount);
+}
+
+HRESULT FrameCompositor::ProcessFrame(
+    const UINT16* pDepthBuffer,
+    const RGBQUAD* pColorBuffer,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer)
+{
+    return ProcessFrame(
+        pDepthBuffer,
+        reinterpret_cast<const BYTE*>(pColorBuffer),
+        ColorFormat_Bgra,
+        pBodyIndexBuffer,
+        pBackgroundBuffer,
+        pOutputBuffer);
+}
+
+HRESULT FrameCompositor::ProcessFrame(
+    const DepthFrameView& depth,
+    const ColorFrameView& color,
+    const BodyIndexFrameView& bodyIndex,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer)
+{
+    const bool bBodyIndex = (m_segmentationMode == SegmentationMode_BodyIndex);
+    if (!depth.IsPacked() || !color.IsPacked() ||
+        (bBodyIndex && (!bodyIndex.IsPacked() || !bodyIndex.HasSize(depth.nWidth, depth.nHeight))))
+    {
+        return E_INVALIDARG;
+    }
+
+    // only depth resolution mode writes outputs of a size of their own
+    if (m_compositeMode != CompositeMode_DepthResolution && m_nOutputWidth &&
+        !color.HasSize(m_nOutputWidth, m_nOutputHeight))
+    {
+        return E_INVALIDARG;
+    }
+
+    V_RET(SetFrameGeometry(depth.nWidth, depth.nHeight, color.nWidth, color.nHeight));
+
+    return ProcessFrame(depth.pData, color.pData, color.format, bodyIndex.pData, pBackgroundBuffer, pOutputBuffer);
+}
+
+HRESULT FrameCompositor::ProcessFrame(
+    const UINT16* pDepthBuffer,
+    const BYTE* pColorBuffer,
+    ColorFormat colorFormat,
+    const BYTE* pBodyIndexBuffer,
+    const RGBQUAD* pBackgroundBuffer,
+    RGBQUAD* pOutputBuffer)
+{
+    m_colorFormat = colorFormat;
+
+    if (m_segmentationMode == SegmentationMode_DepthRange)
+    {
+        V_CHECK_HR(m_pThreadPool && pDepthBuffer);
+
+        KeyDepthFrame(pDepthBuffer);
+        pBodyIndexBuffer = m_pKeyedBodyIndex.get();
+    }
+
+    V_CHECK_HR(m_matteRefinement == MatteRefinement_None || (m_pThreadPool && pBodyIndexBuffer));
+    pBodyIndexBuffer = RefineMatte(pBodyIndexBuffer);
+
+    if (m_compositeMode == CompositeMode_DepthResolution)
+    {
+        V_CHECK_HR(m_pMapper && m_pThreadPool && pDepthBuffer && pColorBuffer && pBodyIndexBuffer && pBackgroundBuffer && pOutputBuffer);
+
+        m_pColorCoordinates.Allocate(size_t(m_nDepthWidth) * m_nDepthHeight);
+        m_pDepthComposite.Allocate(size_t(m_nDepthWidth) * m_nDepthHeight);
+
+        {
+            ProfileScope scope(m_pProfiler, ProfileStage_Map);
+
+            V_RET(m_pMapper->MapDepthFrameToColorSpace(
+                m_nDepthWidth * m_nDepthHeight,
+                pDepthBuffer,
+                m_nDepthWidth * m_nDepthHeight,
+                m_pColorCoordinates.get()));
+        }
+
+        CompositeDepthResolution(pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer);
+
+        return S_OK;
+    }
+
+    if (m_compositeMode == CompositeMode_Full)
+    {
+        if (m_bLowMemory && m_bRowBlocksSupported)
+        {
+            const HRESULT hr = ProcessRowBlocks(pDepthBuffer, pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer);
+            if (hr != E_NOTIMPL)
+            {
+                return hr;
+            }
+
+            // the SDK mapper only maps whole frames, stop asking
+            m_bRowBlocksSupported = false;
+        }
+
+        V_RET(MapFrame(pDepthBuffer));
+
+        V_CHECK_HR(m_pThreadPool && pColorBuffer && pBodyIndexBuffer && pBackgroundBuffer && pOutputBuffer);
+
+        CompositeBands(pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer);
+
+        return S_OK;
+    }
+
+    V_CHECK_HR(m_pMapper && m_pThreadPool && pDepthBuffer && pColorBuffer && pBodyIndexBuffer && pBackgroundBuffer && pOutputBuffer);
+
+    {
+        ProfileScope scope(m_pProfiler, ProfileStage_Map);
+
+        V_RET(FindPlayerRegions(pDepthBuffer, pBodyIndexBuffer));
+
+        // nobody in view, the frame is all background
+        if (!m_playerRegions.empty())
+        {
+            V_RET(MapRegions(pDepthBuffer, m_playerRegions.data(), static_cast<int>(m_playerRegions.size())));
+        }
+
+        // the mapping now belongs to different frames in different places
+        m_mappingCache.Invalidate();
+    }
+
+    if (m_compositeMode == CompositeMode_DirtyTiles)
+    {
+        CompositeTiles(pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer);
+    }
+    else
+    {
+        CompositeRegions(pColorBuffer, pBodyIndexBuffer, pBackgroundBuffer, pOutputBuffer);
+    }
+
+    return S_OK;
+}
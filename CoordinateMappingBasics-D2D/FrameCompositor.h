@@ -0,0 +1,390 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "KinectTypes.h"
+#include "ColorFormat.h"
+#include "ColorToDepthMapper.h"
+#include "CompositeKernel.h"
+#include "DepthKeyer.h"
+#include "DirtyTileTracker.h"
+#include "FrameBufferPool.h"
+#include "FrameProfiler.h"
+#include "FrameView.h"
+#include "MappingCache.h"
+#include "MatteRefiner.h"
+#include "ThreadPool.h"
+
+// How much of the color frame ProcessFrame maps and tests
+enum CompositeMode
+{
+    // every color pixel, the original behaviour
+    CompositeMode_Full = 0,
+    // only boxes around the tracked players, the rest is copied from the background
+    CompositeMode_PlayerRegions,
+    // player regions, but only the tiles whose players or player colors
+    // changed since an output buffer was last written get recomposited
+    CompositeMode_DirtyTiles,
+    // players composited per depth pixel, then upscaled over the background
+    // to the output size; shows the depth camera's view
+    CompositeMode_DepthResolution,
+};
+
+// How the color to depth mapping is kept between mapping and compositing
+enum DepthMapFormat
+{
+    // a DepthSpacePoint per color pixel, what the SDK maps to
+    DepthMapFormat_Points = 0,
+    // the depth pixel index each color pixel rounds to, half the bytes to
+    // write and read; mappers that cannot produce one fall back to points
+    DepthMapFormat_Indices,
+};
+
+// Where ProcessFrame takes the players from
+enum SegmentationMode
+{
+    // the sensor's body index frame
+    SegmentationMode_BodyIndex = 0,
+    // the depth frame keyed by the DepthKeyer; no body index frame is needed
+    SegmentationMode_DepthRange,
+};
+
+// The per frame work of the app without any windowing: map the color frame
+// into depth space, then composite the tracked players over a background in
+// row bands spread across a thread pool.
+class FrameCompositor
+{
+public:
+    FrameCompositor();
+
+    // pMapper and pThreadPool are not owned and must outlive the compositor
+    HRESULT Initialize(
+        ColorToDepthMapper* pMapper,
+        ThreadPool* pThreadPool,
+        int nDepthWidth,
+        int nDepthHeight,
+        int nColorWidth,
+        int nColorHeight);
+
+    // Switches to frames of another size: the mapper is told first, then
+    // everything sized from the frames is sized again as by Initialize,
+    // keeping the settings. Nothing happens for the current sizes, so
+    // buffers are only reallocated when the geometry really changes.
+    HRESULT SetFrameGeometry(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight);
+    bool HasFrameGeometry(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight) const;
+
+    CompositeKernelType GetCompositeKernel() const { return m_compositeKernel; }
+    void SetCompositeKernel(CompositeKernelType kernel) { m_compositeKernel = kernel; }
+
+    // Fixed by default, the scalar hard edge kernels compiled for the depth
+    // size where there are some; Generic is only worth it to compare against
+    CompositeGeometry GetCompositeGeometry() const { return m_compositeGeometry; }
+    void SetCompositeGeometry(CompositeGeometry geometry) { m_compositeGeometry = geometry; }
+
+    CompositeMode GetCompositeMode() const { return m_compositeMode; }
+    void SetCompositeMode(CompositeMode mode) { m_compositeMode = mode; }
+
+    // BodyIndex by default. In depth range mode ProcessFrame ignores the body
+    // index frame it is given, which may be null, and composites the pixels
+    // GetDepthKeyer keys instead; Composite still takes a body index frame.
+    SegmentationMode GetSegmentationMode() const { return m_segmentationMode; }
+    void SetSegmentationMode(SegmentationMode mode) { m_segmentationMode = mode; }
+    DepthKeyer& GetDepthKeyer() { return m_depthKeyer; }
+    const DepthKeyer& GetDepthKeyer() const { return m_depthKeyer; }
+
+    // None by default, hard edged players. Otherwise every frame's players,
+    // keyed or not, are refined into an alpha matte that the kernels blend
+    // the color frame over the background by, and the regions and tiles
+    // follow the pixels the matte shows; see MatteRefiner.
+    MatteRefinement GetMatteRefinement() const { return m_matteRefinement; }
+    void SetMatteRefinement(MatteRefinement refinement);
+
+    // Indices by default; turns to points for good the first time the
+    // mapper cannot map to indices
+    DepthMapFormat GetDepthMapFormat() const { return m_depthMapFormat; }
+    void SetDepthMapFormat(DepthMapFormat format);
+
+    // Full frame mode only: reuse the mapping wherever the depth frame did
+    // not change, see MappingCache. Off by default.
+    bool IsMappingCacheEnabled() const { return m_bMappingCacheEnabled; }
+    void SetMappingCacheEnabled(bool bEnabled);
+    MappingCache& GetMappingCache() { return m_mappingCache; }
+    const MappingCache& GetMappingCache() const { return m_mappingCache; }
+
+    // Full frame mode only: instead of a whole frame of mapping, map and
+    // composite blocks of cRowBlockRows color rows, each block's index map
+    // and z-buffer in scratch per lane that stays in cache. Takes the place
+    // of the mapping cache, and GetDepthIndices is left stale. Mappers that
+    // cannot map row blocks map whole frames as before. Off by default.
+    bool IsLowMemory() const { return m_bLowMemory; }
+    void SetLowMemory(bool bLowMemory);
+
+    // Size of the background and output buffers in depth resolution mode,
+    // every other mode writes color frame sized buffers. Defaults to the
+    // color frame size.
+    HRESULT SetOutputSize(int nWidth, int nHeight);
+    int GetOutputWidth() const { return m_nOutputWidth ? m_nOutputWidth : m_nColorWidth; }
+    int GetOutputHeight() const { return m_nOutputHeight ? m_nOutputHeight : m_nColorHeight; }
+
+    // Output buffers are assumed to keep what was composited into them and the
+    // background is assumed not to change, so in player region mode only the
+    // boxes players covered the last time a buffer was used get restored.
+    // Buffers the compositor has not seen yet are filled completely.
+    void SetBackgroundPersistent(bool bPersistent);
+    // call when the background or the contents of the output buffers change
+    void InvalidateBackground();
+
+    // times the map and composite stages, may be null
+    void SetProfiler(FrameProfiler* pProfiler) { m_pProfiler = pProfiler; }
+
+    // Maps every color pixel of the next frame to depth space
+    HRESULT MapFrame(const UINT16* pDepthBuffer);
+
+    // Composites using the mapping of the last MapFrame
+    void Composite(
+        const RGBQUAD* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer);
+
+    // Same with the color frame in colorFormat. YUY2 is converted only where
+    // players are composited, so the frame never needs a separate conversion.
+    void Composite(
+        const BYTE* pColorBuffer,
+        ColorFormat colorFormat,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer);
+
+    // MapFrame followed by Composite, or in player region mode the same
+    // restricted to the player boxes
+    HRESULT ProcessFrame(
+        const UINT16* pDepthBuffer,
+        const RGBQUAD* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer);
+
+    // Same with the color frame in colorFormat
+    HRESULT ProcessFrame(
+        const UINT16* pDepthBuffer,
+        const BYTE* pColorBuffer,
+        ColorFormat colorFormat,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer);
+
+    // Same on views, which must be packed with body index at the depth size
+    // unless the depth is keyed, when the body index view may be empty.
+    // Frames of another size switch the compositor over with SetFrameGeometry.
+    // E_INVALIDARG for anything else, or for a color frame that does not fit
+    // the output size set outside depth resolution mode.
+    HRESULT ProcessFrame(
+        const DepthFrameView& depth,
+        const ColorFrameView& color,
+        const BodyIndexFrameView& bodyIndex,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer);
+
+    // The mapping of the last frame, in the format GetMappedFormat says; the
+    // other one is stale or null. In player region mode only the entries
+    // inside the player regions belong to the last frame.
+    DepthMapFormat GetMappedFormat() const { return m_mappedFormat; }
+    const DepthSpacePoint* GetDepthCoordinates() const { return m_pDepthCoordinates.get(); }
+    const UINT* GetDepthIndices() const { return m_pDepthIndices.get(); }
+
+    // color space boxes of the last player region frame, non overlapping,
+    // sorted by their left edge
+    const std::vector<PixelRect>& GetPlayerRegions() const { return m_playerRegions; }
+    // share of the color frame inside the player regions
+    double GetPlayerCoverage() const;
+
+    // Tiles of the dirty tile mode, also what the presenter needs to upload
+    const DirtyTileTracker& GetDirtyTiles() const { return m_dirtyTiles; }
+
+private:
+    // a few bands per thread give the work stealing something to balance
+    static const int cBandsPerThread = 4;
+    static const int cMaxBands = 256;
+
+    // body index values the sensor reports, 0xff is no player
+    static const int cBodyCount = 6;
+
+    // output buffers whose player regions are remembered, the pipeline rotates three
+    static const int cMaxTrackedOutputs = 4;
+
+    // 16 rows of 1920 indices and depths are 184 KB, an L2 cache's worth
+    static const int cRowBlockRows = 16;
+
+    struct OutputRegions
+    {
+        const RGBQUAD* pOutputBuffer;
+        std::vector<PixelRect> regions;
+    };
+
+    // maps the color pixels in pRects in m_depthMapFormat when the mapper can
+    HRESULT MapRegions(const UINT16* pDepthBuffer, const PixelRect* pRects, int nRectCount);
+
+    HRESULT FindPlayerRegions(const UINT16* pDepthBuffer, const BYTE* pBodyIndexBuffer);
+
+    // the depth range mode's body index frame, into m_pKeyedBodyIndex
+    void KeyDepthFrame(const UINT16* pDepthBuffer);
+
+    // Refines the frame's players into m_pAlphaMatte and points
+    // m_pFrameMatte at it, returning the matte's coverage to composite in
+    // place of the body index; with no refinement, clears m_pFrameMatte and
+    // returns pBodyIndexBuffer
+    const BYTE* RefineMatte(const BYTE* pBodyIndexBuffer);
+
+    // Composite on the frame's body index and matte as they are
+    void CompositeBands(
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer);
+
+    // the low memory full frame, E_NOTIMPL when the mapper maps whole frames only
+    HRESULT ProcessRowBlocks(
+        const UINT16* pDepthBuffer,
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer);
+
+    void CompositeRegions(
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer);
+
+    void CompositeDepthResolution(
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer);
+
+    void CompositeTiles(
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer);
+
+    // CompositeFrame or HashCompositedPixels on pixels [nBeginIndex, nEndIndex)
+    // of a color frame in m_colorFormat
+    void CompositePixels(
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex) const;
+    uint64_t HashPixels(
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        int nBeginIndex,
+        int nEndIndex,
+        uint64_t nHash) const;
+
+    // the same on the map of either format
+    template <typename DepthMap>
+    void CompositeMapped(
+        const DepthMap* pDepthMap,
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer,
+        int nBeginIndex,
+        int nEndIndex) const;
+    template <typename DepthMap>
+    uint64_t HashMapped(
+        const DepthMap* pDepthMap,
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        int nBeginIndex,
+        int nEndIndex,
+        uint64_t nHash) const;
+
+    // Output pixels [nLeft, nRight) of row y, the player regions through the
+    // kernel and the rest copied from the background
+    void CompositeSpan(
+        int y,
+        int nLeft,
+        int nRight,
+        const BYTE* pColorBuffer,
+        const BYTE* pBodyIndexBuffer,
+        const RGBQUAD* pBackgroundBuffer,
+        RGBQUAD* pOutputBuffer) const;
+
+    // null when the buffer contents are unknown
+    const std::vector<PixelRect>* FindPreviousRegions(const RGBQUAD* pOutputBuffer) const;
+    void RememberRegions(const RGBQUAD* pOutputBuffer, const PixelRect* pRegions, int nRegionCount);
+
+    ColorToDepthMapper* m_pMapper;
+    ThreadPool* m_pThreadPool;
+    CompositeKernelType m_compositeKernel;
+    CompositeGeometry m_compositeGeometry;
+    CompositeMode m_compositeMode;
+    SegmentationMode m_segmentationMode;
+    DepthMapFormat m_depthMapFormat;
+    DepthMapFormat m_mappedFormat;
+    bool m_bBackgroundPersistent;
+    FrameProfiler* m_pProfiler;
+
+    // format of the frame being processed, and its alpha matte, null for
+    // hard edges
+    ColorFormat m_colorFormat;
+    const BYTE* m_pFrameMatte;
+
+    int m_nDepthWidth;
+    int m_nDepthHeight;
+    int m_nColorWidth;
+    int m_nColorHeight;
+    int m_nOutputWidth;
+    int m_nOutputHeight;
+
+    // color to depth mapping of the current frame, allocated in the format
+    // first mapped to
+    FrameBuffer<DepthSpacePoint> m_pDepthCoordinates;
+    FrameBuffer<UINT> m_pDepthIndices;
+
+    // depth to color mapping and the players at depth resolution, premultiplied,
+    // allocated by the first depth resolution frame
+    FrameBuffer<ColorSpacePoint> m_pColorCoordinates;
+    FrameBuffer<RGBQUAD> m_pDepthComposite;
+
+    std::vector<PixelRect> m_playerRegions;
+
+    // leftmost and rightmost player pixel of every depth row, per body
+    std::vector<int> m_rowFirst;
+    std::vector<int> m_rowLast;
+
+    // depth pixels whose projections bound the player regions
+    std::vector<DepthSpacePoint> m_edgePoints;
+    std::vector<UINT16> m_edgeDepths;
+    std::vector<BYTE> m_edgeBodies;
+    std::vector<ColorSpacePoint> m_edgeColorPoints;
+
+    OutputRegions m_outputRegions[cMaxTrackedOutputs];
+    int m_nNextOutputRegions;
+
+    DirtyTileTracker m_dirtyTiles;
+    std::vector<int> m_redrawTiles;
+
+    bool m_bMappingCacheEnabled;
+    MappingCache m_mappingCache;
+    std::vector<PixelRect> m_remapRegions;
+
+    DepthKeyer m_depthKeyer;
+    FrameBuffer<BYTE> m_pKeyedBodyIndex;
+
+    MatteRefinement m_matteRefinement;
+    MatteRefiner m_matteRefiner;
+    FrameBuffer<BYTE> m_pAlphaMatte;
+    FrameBuffer<BYTE> m_pMatteCoverage;
+
+    // low memory mode, and a block's index map and z-buffer per lane
+    bool m_bLowMemory;
+    bool m_bRowBlocksSupported;
+    FrameBuffer<UINT> m_pBlockIndices;
+    FrameBuffer<UINT16> m_pBlockZBuffer;
+};
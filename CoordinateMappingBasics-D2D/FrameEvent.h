@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include "KinectTypes.h"
+
+#ifndef _WIN32
+#include <condition_variable>
+#include <mutex>
+#endif
+
+struct WakeLatencyStats
+{
+    uint64_t nWakes;
+    int64_t nTotalMicroseconds;
+    int64_t nMaxMicroseconds;
+
+    double GetAverageMicroseconds() const
+    {
+        return nWakes ? double(nTotalMicroseconds) / nWakes : 0.0;
+    }
+};
+
+// Accumulates how long waiting threads took to run after the thing they were
+// waiting for became ready. Safe to record from one thread and read from another.
+class WakeLatencyCounter
+{
+public:
+    WakeLatencyCounter() :
+        m_nWakes(0),
+        m_nTotalMicroseconds(0),
+        m_nMaxMicroseconds(0)
+    {
+    }
+
+    void Record(std::chrono::steady_clock::time_point readyTime)
+    {
+        const auto latency = std::chrono::steady_clock::now() - readyTime;
+        int64_t nMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        if (nMicroseconds < 0)
+        {
+            nMicroseconds = 0;
+        }
+
+        m_nTotalMicroseconds += nMicroseconds;
+        ++m_nWakes;
+
+        int64_t nMax = m_nMaxMicroseconds;
+        while (nMicroseconds > nMax && !m_nMaxMicroseconds.compare_exchange_weak(nMax, nMicroseconds))
+        {
+        }
+    }
+
+    WakeLatencyStats GetStats() const
+    {
+        WakeLatencyStats stats;
+        stats.nWakes = m_nWakes;
+        stats.nTotalMicroseconds = m_nTotalMicroseconds;
+        stats.nMaxMicroseconds = m_nMaxMicroseconds;
+        return stats;
+    }
+
+private:
+    std::atomic<uint64_t> m_nWakes;
+    std::atomic<int64_t> m_nTotalMicroseconds;
+    std::atomic<int64_t> m_nMaxMicroseconds;
+};
+
+// Auto-reset event for waking pipeline threads. On Windows it is a kernel
+// event so the UI thread can wait on it together with window messages.
+// Every wake records the time since the first Set it consumed.
+class FrameEvent
+{
+public:
+#ifdef _WIN32
+    FrameEvent() :
+        m_hEvent(CreateEventW(nullptr, FALSE, FALSE, nullptr)),
+        m_nSetTime(0)
+    {
+    }
+
+    ~FrameEvent()
+    {
+        if (m_hEvent)
+        {
+            CloseHandle(m_hEvent);
+        }
+    }
+
+    // for MsgWaitForMultipleObjects; call OnWoken after the wait succeeds
+    HANDLE GetHandle() const { return m_hEvent; }
+
+    void Set()
+    {
+        MarkSetTime();
+        SetEvent(m_hEvent);
+    }
+
+    // returns true when signaled, false on timeout
+    bool Wait(std::chrono::milliseconds timeout)
+    {
+        if (WaitForSingleObject(m_hEvent, static_cast<DWORD>(timeout.count())) != WAIT_OBJECT_0)
+        {
+            return false;
+        }
+
+        OnWoken();
+        return true;
+    }
+#else
+    FrameEvent() :
+        m_bSignaled(false),
+        m_nSetTime(0)
+    {
+    }
+
+    void Set()
+    {
+        MarkSetTime();
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_bSignaled = true;
+        }
+        m_signal.notify_one();
+    }
+
+    // returns true when signaled, false on timeout
+    bool Wait(std::chrono::milliseconds timeout)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            if (!m_signal.wait_for(lock, timeout, [this] { return m_bSignaled; }))
+            {
+                return false;
+            }
+
+            m_bSignaled = false;
+        }
+
+        OnWoken();
+        return true;
+    }
+#endif
+
+    FrameEvent(const FrameEvent&) = delete;
+    FrameEvent& operator=(const FrameEvent&) = delete;
+
+    // records the wake latency of a wait that consumed the signal
+    void OnWoken()
+    {
+        const int64_t nSetTime = m_nSetTime.exchange(0);
+        if (nSetTime)
+        {
+            m_wakeLatency.Record(std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(nSetTime)));
+        }
+    }
+
+    WakeLatencyStats GetWakeLatency() const { return m_wakeLatency.GetStats(); }
+
+private:
+#ifdef _WIN32
+    HANDLE m_hEvent;
+#else
+    std::mutex m_lock;
+    std::condition_variable m_signal;
+    bool m_bSignaled;
+#endif
+
+    // first Set since the last wake, zero when none is pending
+    std::atomic<int64_t> m_nSetTime;
+    WakeLatencyCounter m_wakeLatency;
+
+    void MarkSetTime()
+    {
+        int64_t nExpected = 0;
+        const int64_t nNow = std::chrono::steady_clock::now().time_since_epoch().count();
+        m_nSetTime.compare_exchange_strong(nExpected, nNow ? nNow : 1);
+    }
+};
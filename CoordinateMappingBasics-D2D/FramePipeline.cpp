@@ -0,0 +1,226 @@
+#include "FramePipeline.h"
+
+namespace
+{
+    // how long an idle stage sleeps before checking for shutdown
+    const std::chrono::milliseconds cIdleWait(100);
+}
+
+FramePipeline::FramePipeline() :
+    m_pSource(nullptr),
+    m_pProfiler(nullptr),
+    m_processQueue(cQueuedFrames),
+    m_freeFrames(cFrameSlots),
+    m_bRunning(false),
+    m_nAcquired(0),
+    m_nProcessed(0),
+    m_nPresented(0),
+    m_nDroppedBeforeProcessing(0),
+    m_nDroppedBeforePresent(0)
+{
+    for (int i = 0; i < cOutputSurfaces; ++i)
+    {
+        m_surfaceTimes[i] = 0;
+    }
+}
+
+FramePipeline::~FramePipeline()
+{
+    Stop();
+}
+
+HRESULT FramePipeline::Start(FrameSource* pSource, const FramePipelineCallbacks& callbacks, int nOutputWidth, int nOutputHeight)
+{
+    if (m_bRunning || !pSource || !callbacks.process || nOutputWidth <= 0 || nOutputHeight <= 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_pSource = pSource;
+    m_callbacks = callbacks;
+
+    for (int i = 0; i < cOutputSurfaces; ++i)
+    {
+        m_pSurfaces[i].Allocate(size_t(nOutputWidth) * nOutputHeight);
+    }
+
+    // every slot starts out free, owned by the acquisition thread
+    int nSlot = 0;
+    while (m_processQueue.TryPop(&nSlot) || m_freeFrames.TryPop(&nSlot))
+    {
+    }
+
+    for (int i = 0; i < cFrameSlots; ++i)
+    {
+        m_freeFrames.TryPush(i);
+    }
+
+    m_bRunning = true;
+    m_processThread = std::thread(&FramePipeline::ProcessMain, this);
+    m_acquireThread = std::thread(&FramePipeline::AcquireMain, this);
+
+    return S_OK;
+}
+
+void FramePipeline::Stop()
+{
+    if (!m_bRunning.exchange(false))
+    {
+        return;
+    }
+
+    m_frameQueued.Set();
+
+    if (m_acquireThread.joinable())
+    {
+        m_acquireThread.join();
+    }
+
+    if (m_processThread.joinable())
+    {
+        m_processThread.join();
+    }
+}
+
+void FramePipeline::AcquireMain()
+{
+    if (m_callbacks.acquireThreadStart)
+    {
+        m_callbacks.acquireThreadStart();
+    }
+
+    // The processing thread is the only one returning slots to
+    // m_freeFrames; slots this thread drops stay with it and are filled next
+    int nSlot = -1;
+    int nDropped = -1;
+
+    while (m_bRunning)
+    {
+        if (nSlot < 0 && nDropped >= 0)
+        {
+            nSlot = nDropped;
+            nDropped = -1;
+        }
+
+        if (nSlot < 0 && !m_freeFrames.TryPop(&nSlot))
+        {
+            // processing is behind and holds every free slot: recycle the oldest queued frame
+            if (m_processQueue.TryPop(&nSlot))
+            {
+                ++m_nDroppedBeforeProcessing;
+            }
+            else
+            {
+                std::this_thread::yield();
+                continue;
+            }
+        }
+
+        // sleeps until the source has a frame, the timeout only bounds how
+        // long Stop waits for us
+        if (!m_pSource->WaitForFrame(cIdleWait))
+        {
+            continue;
+        }
+
+        // only frames we actually got count towards the acquire stage
+        const bool bProfiled = m_pProfiler && m_pProfiler->IsEnabled();
+        const int64_t nAcquireStart = bProfiled ? FrameProfiler::Now() : 0;
+
+        if (m_pSource->AcquireFrame(&m_frames[nSlot]) != S_OK)
+        {
+            continue;
+        }
+
+        if (bProfiled)
+        {
+            m_pProfiler->RecordStage(ProfileStage_Acquire, nAcquireStart, FrameProfiler::Now());
+        }
+
+        ++m_nAcquired;
+
+        if (m_callbacks.acquired)
+        {
+            m_callbacks.acquired(m_frames[nSlot]);
+        }
+
+        // we are the queue's only producer, so once the oldest entry is
+        // dropped (or the processing thread took it) the push succeeds
+        while (!m_processQueue.TryPush(nSlot))
+        {
+            if (m_processQueue.TryPop(&nDropped))
+            {
+                ++m_nDroppedBeforeProcessing;
+            }
+        }
+
+        nSlot = -1;
+        m_frameQueued.Set();
+    }
+
+    // slots still held here are handed out again by the next Start
+
+    if (m_callbacks.acquireThreadStop)
+    {
+        m_callbacks.acquireThreadStop();
+    }
+}
+
+void FramePipeline::ProcessMain()
+{
+    while (m_bRunning)
+    {
+        int nSlot = 0;
+        if (!m_processQueue.TryPop(&nSlot))
+        {
+            m_frameQueued.Wait(cIdleWait);
+            continue;
+        }
+
+        const PipelineFrame& frame = m_frames[nSlot];
+        const int nSurface = m_surfaces.GetBackIndex();
+
+        m_callbacks.process(frame, m_pSurfaces[nSurface].get());
+        m_surfaceTimes[nSurface] = frame.nRelativeTime;
+
+        m_freeFrames.TryPush(nSlot);
+        ++m_nProcessed;
+
+        if (!m_surfaces.Publish())
+        {
+            ++m_nDroppedBeforePresent;
+        }
+
+        m_framePublished.Set();
+    }
+}
+
+bool FramePipeline::PresentLatest(const std::function<void(const RGBQUAD* pOutput, int64_t nRelativeTime)>& present)
+{
+    if (!m_surfaces.AcquireLatest())
+    {
+        return false;
+    }
+
+    const int nSurface = m_surfaces.GetFrontIndex();
+    present(m_pSurfaces[nSurface].get(), m_surfaceTimes[nSurface]);
+    ++m_nPresented;
+
+    return true;
+}
+
+FramePipelineStats FramePipeline::GetStats() const
+{
+    FramePipelineStats stats;
+    stats.nAcquired = m_nAcquired;
+    stats.nProcessed = m_nProcessed;
+    stats.nPresented = m_nPresented;
+    stats.nDroppedBeforeProcessing = m_nDroppedBeforeProcessing;
+    stats.nDroppedBeforePresent = m_nDroppedBeforePresent;
+    stats.nProcessQueueDepth = m_processQueue.GetSize();
+    stats.nPresentQueueDepth = m_surfaces.HasFresh() ? 1 : 0;
+    stats.acquireWake = m_pSource ? m_pSource->GetWakeLatency() : WakeLatencyStats();
+    stats.processWake = m_frameQueued.GetWakeLatency();
+    stats.presentWake = m_framePublished.GetWakeLatency();
+    return stats;
+}
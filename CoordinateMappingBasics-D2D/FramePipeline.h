@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "KinectTypes.h"
+#include "FrameEvent.h"
+#include "FrameSource.h"
+#include "FrameProfiler.h"
+#include "SpscRing.h"
+
+struct FramePipelineStats
+{
+    uint64_t nAcquired;
+    uint64_t nProcessed;
+    uint64_t nPresented;
+
+    // frames thrown away because the next stage was still busy
+    uint64_t nDroppedBeforeProcessing;
+    uint64_t nDroppedBeforePresent;
+
+    // frames waiting for the processing stage
+    size_t nProcessQueueDepth;
+    // 1 when a composited frame is waiting to be presented
+    size_t nPresentQueueDepth;
+
+    // how late each stage woke up after its input became ready
+    WakeLatencyStats acquireWake;
+    WakeLatencyStats processWake;
+    WakeLatencyStats presentWake;
+};
+
+struct FramePipelineCallbacks
+{
+    // Processing thread. Maps and composites frame into pOutput.
+    std::function<void(const PipelineFrame& frame, RGBQUAD* pOutput)> process;
+
+    // Optional, acquisition thread. Sees every acquired frame, e.g. for recording.
+    std::function<void(const PipelineFrame& frame)> acquired;
+
+    // Optional, run on the acquisition thread before the first and after the last acquire
+    std::function<void()> acquireThreadStart;
+    std::function<void()> acquireThreadStop;
+};
+
+// Acquire -> process -> present, each stage on its own thread. Acquired frames
+// go through a bounded ring of pooled slots and composited frames through
+// triple-buffered output surfaces. Neither hand-off ever blocks the upstream
+// stage: when the downstream stage is behind, the oldest frame is dropped.
+// Presentation runs on whichever thread calls PresentLatest (the UI thread in
+// the app). Every stage sleeps until its input is ready: the acquisition
+// thread in FrameSource::WaitForFrame, the others on FrameEvents.
+class FramePipeline
+{
+public:
+    FramePipeline();
+    ~FramePipeline();
+
+    // pSource is only used by the acquisition thread and must outlive Stop
+    HRESULT Start(FrameSource* pSource, const FramePipelineCallbacks& callbacks, int nOutputWidth, int nOutputHeight);
+    void Stop();
+
+    // Set whenever a composited frame is published. The presenting thread waits
+    // on it before calling PresentLatest.
+    FrameEvent& GetPresentEvent() { return m_framePublished; }
+
+    // times the acquire stage, may be null; set before Start
+    void SetProfiler(FrameProfiler* pProfiler) { m_pProfiler = pProfiler; }
+
+    // Calls present with the newest composited frame, if there is one we have
+    // not presented yet. Returns true when something was presented.
+    bool PresentLatest(const std::function<void(const RGBQUAD* pOutput, int64_t nRelativeTime)>& present);
+
+    FramePipelineStats GetStats() const;
+
+private:
+    // frames queued for processing, plus the one being filled and the one being processed
+    static const int cQueuedFrames = 2;
+    static const int cFrameSlots = cQueuedFrames + 2;
+    static const int cOutputSurfaces = 3;
+
+    FrameSource* m_pSource;
+    FrameProfiler* m_pProfiler;
+    FramePipelineCallbacks m_callbacks;
+
+    // A slot is in exactly one place: m_freeFrames, m_processQueue, or held
+    // by the acquisition or processing thread. Only the processing thread
+    // pushes m_freeFrames, only the acquisition thread m_processQueue.
+    PipelineFrame m_frames[cFrameSlots];
+    SpscRing<int> m_processQueue;
+    SpscRing<int> m_freeFrames;
+
+    FrameBuffer<RGBQUAD> m_pSurfaces[cOutputSurfaces];
+    int64_t m_surfaceTimes[cOutputSurfaces];
+    TripleBuffer m_surfaces;
+
+    FrameEvent m_frameQueued;
+    FrameEvent m_framePublished;
+    std::atomic<bool> m_bRunning;
+    std::thread m_acquireThread;
+    std::thread m_processThread;
+
+    std::atomic<uint64_t> m_nAcquired;
+    std::atomic<uint64_t> m_nProcessed;
+    std::atomic<uint64_t> m_nPresented;
+    std::atomic<uint64_t> m_nDroppedBeforeProcessing;
+    std::atomic<uint64_t> m_nDroppedBeforePresent;
+
+    void AcquireMain();
+    void ProcessMain();
+};
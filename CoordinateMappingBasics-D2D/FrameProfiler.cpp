@@ -0,0 +1,353 @@
+#include "FrameProfiler.h"
+#include <algorithm>
+#include "FrameBufferPool.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    // trace events kept per traced frame, every stage with room to spare
+    const size_t cTraceEventsPerFrame = ProfileStage_Count * 2;
+
+    int GetHighestBit(uint64_t nValue)
+    {
+#if defined(_MSC_VER) && defined(_WIN64)
+        unsigned long nIndex = 0;
+        _BitScanReverse64(&nIndex, nValue);
+        return static_cast<int>(nIndex);
+#elif defined(_MSC_VER)
+        // x86 has no 64 bit scan, take the high half when it has a bit set
+        unsigned long nIndex = 0;
+        if (_BitScanReverse(&nIndex, static_cast<unsigned long>(nValue >> 32)))
+        {
+            return static_cast<int>(nIndex) + 32;
+        }
+        _BitScanReverse(&nIndex, static_cast<unsigned long>(nValue));
+        return static_cast<int>(nIndex);
+#else
+        return 63 - __builtin_clzll(nValue);
+#endif
+    }
+
+    // small stable id per thread for the trace viewer's rows
+    int GetTraceThreadId()
+    {
+        static std::atomic<int> s_nNextThread(1);
+        thread_local int s_nThread = s_nNextThread++;
+        return s_nThread;
+    }
+}
+
+const char* GetProfileStageName(ProfileStage stage)
+{
+    switch (stage)
+    {
+    case ProfileStage_Acquire:
+        return "acquire";
+    case ProfileStage_Record:
+        return "record";
+    case ProfileStage_Key:
+        return "key";
+    case ProfileStage_Matte:
+        return "matte";
+    case ProfileStage_Map:
+        return "map";
+    case ProfileStage_Composite:
+        return "composite";
+    case ProfileStage_Draw:
+        return "draw";
+    case ProfileStage_Screenshot:
+        return "screenshot";
+    case ProfileStage_Replay:
+        return "replay";
+    default:
+        return "unknown";
+    }
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    Reset();
+}
+
+int LatencyHistogram::GetBucketIndex(int64_t nNanoseconds)
+{
+    if (nNanoseconds < 2 * cSubBucketCount)
+    {
+        return (nNanoseconds < 0) ? 0 : static_cast<int>(nNanoseconds);
+    }
+
+    // the top cSubBucketBits + 1 bits select the bucket
+    const int nShift = GetHighestBit(static_cast<uint64_t>(nNanoseconds)) - cSubBucketBits;
+    const int nBucket = (nShift + 1) * cSubBucketCount + static_cast<int>((nNanoseconds >> nShift) - cSubBucketCount);
+
+    return std::min(nBucket, cBucketCount - 1);
+}
+
+int64_t LatencyHistogram::GetBucketLowerBound(int nBucket)
+{
+    if (nBucket < 2 * cSubBucketCount)
+    {
+        return nBucket;
+    }
+
+    const int nShift = nBucket / cSubBucketCount - 1;
+    return int64_t(nBucket % cSubBucketCount + cSubBucketCount) << nShift;
+}
+
+void LatencyHistogram::Record(int64_t nNanoseconds)
+{
+    // the only writer, so a load and a store each rather than locked adds
+    std::atomic<uint64_t>& bucket = m_counts[GetBucketIndex(nNanoseconds)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_nTotal.store(m_nTotal.load(std::memory_order_relaxed) + nNanoseconds, std::memory_order_relaxed);
+    m_nCount.store(m_nCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    if (nNanoseconds > m_nMax.load(std::memory_order_relaxed))
+    {
+        m_nMax.store(nNanoseconds, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::Reset()
+{
+    for (int i = 0; i < cBucketCount; ++i)
+    {
+        m_counts[i] = 0;
+    }
+
+    m_nCount = 0;
+    m_nTotal = 0;
+    m_nMax = 0;
+}
+
+int64_t LatencyHistogram::GetPercentile(double fPercentile, uint64_t nCount) const
+{
+    // rank of the sample we are after, 1 based
+    const uint64_t nRank = std::max<uint64_t>(1, static_cast<uint64_t>(fPercentile * nCount + 0.5));
+
+    uint64_t nSeen = 0;
+    for (int i = 0; i < cBucketCount; ++i)
+    {
+        nSeen += m_counts[i].load(std::memory_order_relaxed);
+        if (nSeen >= nRank)
+        {
+            // report the middle of the bucket
+            return (GetBucketLowerBound(i) + GetBucketLowerBound(i + 1) - 1) / 2;
+        }
+    }
+
+    return m_nMax;
+}
+
+ProfileStats LatencyHistogram::GetStats() const
+{
+    ProfileStats stats;
+    stats.nCount = m_nCount.load(std::memory_order_relaxed);
+    stats.nMax = m_nMax.load(std::memory_order_relaxed);
+
+    if (stats.nCount == 0)
+    {
+        stats.nMean = stats.nP50 = stats.nP95 = stats.nP99 = 0;
+        return stats;
+    }
+
+    stats.nMean = m_nTotal.load(std::memory_order_relaxed) / static_cast<int64_t>(stats.nCount);
+    stats.nP50 = std::min(GetPercentile(0.50, stats.nCount), stats.nMax);
+    stats.nP95 = std::min(GetPercentile(0.95, stats.nCount), stats.nMax);
+    stats.nP99 = std::min(GetPercentile(0.99, stats.nCount), stats.nMax);
+
+    return stats;
+}
+
+FrameProfiler::FrameProfiler() :
+    m_bEnabled(true),
+    m_nLastRelativeTime(0),
+    m_nFrames(0),
+    m_nDroppedFrames(0),
+    m_nTraceCapacity(0),
+    m_nTraceEvents(0),
+    m_bTracing(false),
+    m_nTraceFirstFrame(0),
+    m_nTraceEndFrame(0),
+    m_nTraceStart(0)
+{
+}
+
+void FrameProfiler::RecordStage(ProfileStage stage, int64_t nStart, int64_t nEnd)
+{
+    m_stages[stage].Record(nEnd - nStart);
+
+    if (!m_bTracing.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    const size_t nEvent = m_nTraceEvents.fetch_add(1, std::memory_order_relaxed);
+    if (nEvent < m_nTraceCapacity)
+    {
+        TraceEvent& event = m_pTraceEvents[nEvent];
+        event.nStage = stage;
+        event.nThread = GetTraceThreadId();
+        event.nStart = nStart;
+        event.nEnd.store(std::max(nEnd, nStart + 1), std::memory_order_release);
+    }
+}
+
+void FrameProfiler::RecordFrame(int64_t nRelativeTime)
+{
+    // replay jumps back when it loops, only forward gaps count
+    if (m_nLastRelativeTime && nRelativeTime > m_nLastRelativeTime)
+    {
+        const int64_t nPeriods = (nRelativeTime - m_nLastRelativeTime + cDefaultFramePeriod / 2) / cDefaultFramePeriod;
+        if (nPeriods > 1)
+        {
+            m_nDroppedFrames += static_cast<uint64_t>(nPeriods - 1);
+        }
+    }
+
+    m_nLastRelativeTime = nRelativeTime;
+
+    const uint64_t nFrame = m_nFrames++;
+    if (!m_pTraceEvents)
+    {
+        return;
+    }
+
+    if (nFrame == m_nTraceFirstFrame)
+    {
+        m_nTraceStart = Now();
+        m_bTracing = true;
+    }
+
+    if (nFrame + 1 >= m_nTraceEndFrame)
+    {
+        m_bTracing = false;
+    }
+}
+
+ProfileStats FrameProfiler::GetStageStats(ProfileStage stage) const
+{
+    return m_stages[stage].GetStats();
+}
+
+void FrameProfiler::Reset()
+{
+    for (int i = 0; i < ProfileStage_Count; ++i)
+    {
+        m_stages[i].Reset();
+    }
+
+    m_nLastRelativeTime = 0;
+    m_nFrames = 0;
+    m_nDroppedFrames = 0;
+}
+
+HRESULT FrameProfiler::WriteReport(const char* pszPath) const
+{
+    if (!pszPath)
+    {
+        return E_INVALIDARG;
+    }
+
+    FILE* pFile = fopen(pszPath, "w");
+    if (!pFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    fprintf(pFile, "frames %llu dropped %llu\n",
+        static_cast<unsigned long long>(m_nFrames.load()),
+        static_cast<unsigned long long>(m_nDroppedFrames.load()));
+
+    // a steady geometry recycles every buffer, carved should stop at warm-up
+    const FrameBufferPoolStats pool = FrameBufferPool::GetShared().GetStats();
+    fprintf(pFile, "frame buffers %.1f MB peak of %.1f MB reserved (%.1f MB huge pages), %llu carved %llu recycled\n",
+        pool.nHighWaterBytes / 1e6,
+        pool.nArenaBytes / 1e6,
+        pool.nHugePageBytes / 1e6,
+        static_cast<unsigned long long>(pool.nCarved),
+        static_cast<unsigned long long>(pool.nRecycled));
+    fprintf(pFile, "%-12s %10s %10s %10s %10s %10s %10s\n", "stage", "count", "mean_us", "p50_us", "p95_us", "p99_us", "max_us");
+
+    for (int i = 0; i < ProfileStage_Count; ++i)
+    {
+        const ProfileStats stats = m_stages[i].GetStats();
+        fprintf(pFile, "%-12s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            GetProfileStageName(static_cast<ProfileStage>(i)),
+            static_cast<unsigned long long>(stats.nCount),
+            stats.nMean / 1000.0,
+            stats.nP50 / 1000.0,
+            stats.nP95 / 1000.0,
+            stats.nP99 / 1000.0,
+            stats.nMax / 1000.0);
+    }
+
+    return (fclose(pFile) == 0) ? S_OK : E_FAIL;
+}
+
+void FrameProfiler::StartTrace(uint64_t nFirstFrame, uint64_t nFrameCount)
+{
+    m_bTracing = false;
+
+    m_nTraceCapacity = static_cast<size_t>(nFrameCount) * cTraceEventsPerFrame;
+    m_pTraceEvents.reset(new TraceEvent[m_nTraceCapacity]);
+    for (size_t i = 0; i < m_nTraceCapacity; ++i)
+    {
+        m_pTraceEvents[i].nEnd = 0;
+    }
+
+    m_nTraceEvents = 0;
+    m_nTraceFirstFrame = m_nFrames + nFirstFrame;
+    m_nTraceEndFrame = m_nTraceFirstFrame + nFrameCount;
+}
+
+bool FrameProfiler::IsTraceComplete() const
+{
+    return m_pTraceEvents && !m_bTracing && m_nFrames >= m_nTraceEndFrame;
+}
+
+HRESULT FrameProfiler::WriteChromeTrace(const char* pszPath) const
+{
+    if (!pszPath || !m_pTraceEvents)
+    {
+        return E_INVALIDARG;
+    }
+
+    FILE* pFile = fopen(pszPath, "w");
+    if (!pFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    const size_t nEvents = std::min(m_nTraceEvents.load(), m_nTraceCapacity);
+
+    // "X" complete events with microsecond timestamps from the start of the window
+    fprintf(pFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    bool bFirst = true;
+    for (size_t i = 0; i < nEvents; ++i)
+    {
+        const TraceEvent& event = m_pTraceEvents[i];
+        const int64_t nEnd = event.nEnd.load(std::memory_order_acquire);
+        if (!nEnd)
+        {
+            continue;
+        }
+
+        fprintf(pFile, "%s{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+            bFirst ? "" : ",\n",
+            GetProfileStageName(static_cast<ProfileStage>(event.nStage)),
+            event.nThread,
+            (event.nStart - m_nTraceStart) / 1000.0,
+            (nEnd - event.nStart) / 1000.0);
+
+        bFirst = false;
+    }
+
+    fprintf(pFile, "\n]}\n");
+
+    return (fclose(pFile) == 0) ? S_OK : E_FAIL;
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include "KinectTypes.h"
+
+// Stages timed by FrameProfiler. Each one runs on a single thread, which keeps
+// the histogram counters uncontended.
+enum ProfileStage
+{
+    ProfileStage_Acquire = 0,
+    ProfileStage_Record,
+    ProfileStage_Key,
+    ProfileStage_Matte,
+    ProfileStage_Map,
+    ProfileStage_Composite,
+    ProfileStage_Draw,
+    ProfileStage_Screenshot,
+    ProfileStage_Replay,
+    ProfileStage_Count,
+};
+
+const char* GetProfileStageName(ProfileStage stage);
+
+struct ProfileStats
+{
+    uint64_t nCount;
+    // nanoseconds, percentiles are accurate to the histogram's ~3% buckets
+    int64_t nMean;
+    int64_t nP50;
+    int64_t nP95;
+    int64_t nP99;
+    int64_t nMax;
+};
+
+// Log-linear histogram of durations in nanoseconds: 32 linear buckets per
+// power of two, the layout HdrHistogram uses, so relative precision is the
+// same from microseconds to seconds. One thread records into a histogram,
+// with relaxed loads and stores rather than locked adds, and never blocks;
+// any thread may read it.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void Record(int64_t nNanoseconds);
+    void Reset();
+
+    ProfileStats GetStats() const;
+
+    static int GetBucketIndex(int64_t nNanoseconds);
+    // smallest value that falls into nBucket
+    static int64_t GetBucketLowerBound(int nBucket);
+
+private:
+    static const int cSubBucketBits = 5;
+    static const int cSubBucketCount = 1 << cSubBucketBits;
+    // covers up to 2^40ns, about 18 minutes
+    static const int cBucketCount = (40 - cSubBucketBits + 2) * cSubBucketCount;
+
+    std::atomic<uint64_t> m_counts[cBucketCount];
+    std::atomic<uint64_t> m_nCount;
+    std::atomic<int64_t> m_nTotal;
+    std::atomic<int64_t> m_nMax;
+
+    int64_t GetPercentile(double fPercentile, uint64_t nCount) const;
+};
+
+// Per stage latency histograms, a dropped frame counter driven by gaps in the
+// sensor RelativeTime, and a Chrome trace (chrome://tracing, Perfetto) of a
+// window of frames.
+class FrameProfiler
+{
+public:
+    // RelativeTime ticks between frames at the sensor's 30 fps
+    static const int64_t cDefaultFramePeriod = 333333;
+
+    FrameProfiler();
+
+    bool IsEnabled() const { return m_bEnabled.load(std::memory_order_relaxed); }
+    void SetEnabled(bool bEnabled) { m_bEnabled = bEnabled; }
+
+    // nanoseconds on the profiler clock
+    static int64_t Now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void RecordStage(ProfileStage stage, int64_t nStart, int64_t nEnd);
+
+    // Called once per presented frame. Counts frames missing between this one
+    // and the previous and advances the trace window.
+    void RecordFrame(int64_t nRelativeTime);
+
+    ProfileStats GetStageStats(ProfileStage stage) const;
+    uint64_t GetFrameCount() const { return m_nFrames; }
+    uint64_t GetDroppedFrameCount() const { return m_nDroppedFrames; }
+
+    void Reset();
+
+    // p50/p95/p99/max of every stage and the dropped frame count as text
+    HRESULT WriteReport(const char* pszPath) const;
+
+    // Traces frames [nFirstFrame, nFirstFrame + nFrameCount) counted by
+    // RecordFrame from now on. Events go into a buffer allocated here.
+    void StartTrace(uint64_t nFirstFrame, uint64_t nFrameCount);
+    bool IsTraceComplete() const;
+    HRESULT WriteChromeTrace(const char* pszPath) const;
+
+private:
+    struct TraceEvent
+    {
+        int nStage;
+        int nThread;
+        int64_t nStart;
+        // written last, zero while the event is being filled in
+        std::atomic<int64_t> nEnd;
+    };
+
+    std::atomic<bool> m_bEnabled;
+    LatencyHistogram m_stages[ProfileStage_Count];
+
+    int64_t m_nLastRelativeTime;
+    std::atomic<uint64_t> m_nFrames;
+    std::atomic<uint64_t> m_nDroppedFrames;
+
+    std::unique_ptr<TraceEvent[]> m_pTraceEvents;
+    size_t m_nTraceCapacity;
+    std::atomic<size_t> m_nTraceEvents;
+    std::atomic<bool> m_bTracing;
+    uint64_t m_nTraceFirstFrame;
+    uint64_t m_nTraceEndFrame;
+    int64_t m_nTraceStart;
+};
+
+// Times the enclosing scope into a stage. Costs one relaxed load when the
+// profiler is off or missing.
+class ProfileScope
+{
+public:
+    ProfileScope(FrameProfiler* pProfiler, ProfileStage stage) :
+        m_pProfiler((pProfiler && pProfiler->IsEnabled()) ? pProfiler : nullptr),
+        m_stage(stage),
+        m_nStart(m_pProfiler ? FrameProfiler::Now() : 0)
+    {
+    }
+
+    ~ProfileScope()
+    {
+        if (m_pProfiler)
+        {
+            m_pProfiler->RecordStage(m_stage, m_nStart, FrameProfiler::Now());
+        }
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    FrameProfiler* m_pProfiler;
+    ProfileStage m_stage;
+    int64_t m_nStart;
+};
@@ -0,0 +1,41 @@
+#include "FrameSource.h"
+
+PipelineFrame::PipelineFrame() :
+    nRelativeTime(0),
+    nDepthWidth(0),
+    nDepthHeight(0),
+    nColorWidth(0),
+    nColorHeight(0),
+    pDepthBuffer(nullptr),
+    pColorBuffer(nullptr),
+    colorFormat(ColorFormat_Bgra),
+    pBodyIndexBuffer(nullptr)
+{
+}
+
+void PipelineFrame::Reserve(
+    int nNewDepthWidth,
+    int nNewDepthHeight,
+    int nNewColorWidth,
+    int nNewColorHeight,
+    ColorFormat newColorFormat)
+{
+    if (!pDepthStorage || nNewDepthWidth != nDepthWidth || nNewDepthHeight != nDepthHeight)
+    {
+        pDepthStorage.Allocate(size_t(nNewDepthWidth) * nNewDepthHeight);
+        pBodyIndexStorage.Allocate(size_t(nNewDepthWidth) * nNewDepthHeight);
+    }
+
+    // YUY2 keeps half the bytes, no BGRA sized buffer is held for it
+    pColorStorage.Allocate(size_t(nNewColorWidth) * nNewColorHeight * ((newColorFormat == ColorFormat_Yuy2) ? 2 : sizeof(RGBQUAD)));
+
+    nDepthWidth = nNewDepthWidth;
+    nDepthHeight = nNewDepthHeight;
+    nColorWidth = nNewColorWidth;
+    nColorHeight = nNewColorHeight;
+
+    pDepthBuffer = pDepthStorage.get();
+    pColorBuffer = pColorStorage.get();
+    colorFormat = newColorFormat;
+    pBodyIndexBuffer = pBodyIndexStorage.get();
+}
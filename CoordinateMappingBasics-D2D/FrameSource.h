@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include "KinectTypes.h"
+#include "ColorFormat.h"
+#include "FrameEvent.h"
+#include "FrameBufferPool.h"
+#include "FrameView.h"
+
+// The sizes of a set of frames, body index at the depth size
+struct FrameGeometry
+{
+    int nDepthWidth;
+    int nDepthHeight;
+    int nColorWidth;
+    int nColorHeight;
+
+    bool IsEmpty() const { return nDepthWidth <= 0 || nDepthHeight <= 0 || nColorWidth <= 0 || nColorHeight <= 0; }
+
+    bool operator==(const FrameGeometry& other) const
+    {
+        return nDepthWidth == other.nDepthWidth && nDepthHeight == other.nDepthHeight &&
+            nColorWidth == other.nColorWidth && nColorHeight == other.nColorHeight;
+    }
+    bool operator!=(const FrameGeometry& other) const { return !(*this == other); }
+};
+
+inline FrameGeometry MakeFrameGeometry(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight)
+{
+    const FrameGeometry geometry = {nDepthWidth, nDepthHeight, nColorWidth, nColorHeight};
+    return geometry;
+}
+
+// One set of synchronized sensor frames. The buffer pointers either point at
+// the frame's own storage or at memory that outlives the frame, e.g. a mapped
+// capture file, so replayed frames need not be copied. Color stays in the
+// format the source delivered it in.
+struct PipelineFrame
+{
+    int64_t nRelativeTime;
+
+    int nDepthWidth;
+    int nDepthHeight;
+    int nColorWidth;
+    int nColorHeight;
+
+    const UINT16* pDepthBuffer;
+    const BYTE* pColorBuffer;
+    ColorFormat colorFormat;
+    const BYTE* pBodyIndexBuffer;
+
+    FrameBuffer<UINT16> pDepthStorage;
+    // sized for the color format Reserve was given
+    FrameBuffer<BYTE> pColorStorage;
+    FrameBuffer<BYTE> pBodyIndexStorage;
+
+    PipelineFrame();
+
+    // (re)allocates the storage from the shared FrameBufferPool when the
+    // geometry or color format changes and points the buffers at it
+    void Reserve(
+        int nNewDepthWidth,
+        int nNewDepthHeight,
+        int nNewColorWidth,
+        int nNewColorHeight,
+        ColorFormat newColorFormat = ColorFormat_Bgra);
+
+    FrameGeometry GetGeometry() const { return MakeFrameGeometry(nDepthWidth, nDepthHeight, nColorWidth, nColorHeight); }
+
+    // the buffers as views, body index at the depth size
+    DepthFrameView GetDepthView() const { return MakeFrameView(pDepthBuffer, nDepthWidth, nDepthHeight); }
+    ColorFrameView GetColorView() const { return MakeColorFrameView(pColorBuffer, colorFormat, nColorWidth, nColorHeight); }
+    BodyIndexFrameView GetBodyIndexView() const { return MakeFrameView(pBodyIndexBuffer, nDepthWidth, nDepthHeight); }
+};
+
+// Produces frames and tells a waiting thread when the next one is ready, so
+// the acquisition thread sleeps instead of polling.
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    // Blocks until a frame is ready or the timeout passes. Returns true when
+    // AcquireFrame is expected to succeed.
+    virtual bool WaitForFrame(std::chrono::milliseconds timeout) = 0;
+
+    // S_OK with the next frame, E_PENDING when none is ready yet and S_FALSE
+    // when the source has no more frames.
+    virtual HRESULT AcquireFrame(PipelineFrame* pFrame) = 0;
+
+    // How late WaitForFrame returned after a frame became ready. Sources that
+    // cannot tell when that was (the sensor) report no wakes.
+    WakeLatencyStats GetWakeLatency() const { return m_wakeLatency.GetStats(); }
+
+    // The sizes of the frames to come as the source describes them once
+    // opened, so consumers can be sized before the first frame arrives.
+    // Empty when the source only learns them from the frames. Frames may
+    // still change size later, e.g. when a sensor switches modes.
+    FrameGeometry GetGeometry() const { return m_geometry; }
+
+protected:
+    FrameSource() : m_geometry() {}
+
+    WakeLatencyCounter m_wakeLatency;
+    FrameGeometry m_geometry;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include "KinectTypes.h"
+#include "ColorFormat.h"
+
+// A frame someone else owns: its first pixel, its size and the distance
+// between the starts of its rows, in pixels. Views are copied around by
+// value and never copy the pixels, so one can wrap an SDK or capture buffer
+// as it is.
+template <typename T>
+struct FrameView
+{
+    T* pData;
+    int nWidth;
+    int nHeight;
+    int nStride;
+
+    bool IsEmpty() const { return !pData || nWidth <= 0 || nHeight <= 0; }
+    // rows follow each other without padding, the layout the kernels walk
+    bool IsPacked() const { return nStride == nWidth; }
+    bool HasSize(int nOtherWidth, int nOtherHeight) const { return nWidth == nOtherWidth && nHeight == nOtherHeight; }
+
+    T* GetRow(int y) const { return pData + ptrdiff_t(y) * nStride; }
+    T& operator()(int x, int y) const { return GetRow(y)[x]; }
+};
+
+// nStride 0 means packed rows
+template <typename T>
+FrameView<T> MakeFrameView(T* pData, int nWidth, int nHeight, int nStride = 0)
+{
+    const FrameView<T> view = {pData, nWidth, nHeight, nStride ? nStride : nWidth};
+    return view;
+}
+
+typedef FrameView<const UINT16> DepthFrameView;
+typedef FrameView<const BYTE> BodyIndexFrameView;
+typedef FrameView<RGBQUAD> OutputFrameView;
+
+// A color frame in either format, whose pixels are not all the same number
+// of bytes, so the stride is in bytes
+struct ColorFrameView
+{
+    const BYTE* pData;
+    ColorFormat format;
+    int nWidth;
+    int nHeight;
+    int nStride;
+
+    static int GetBytesPerPixel(ColorFormat format) { return (format == ColorFormat_Yuy2) ? 2 : sizeof(RGBQUAD); }
+
+    bool IsEmpty() const { return !pData || nWidth <= 0 || nHeight <= 0; }
+    bool IsPacked() const { return nStride == nWidth * GetBytesPerPixel(format); }
+    bool HasSize(int nOtherWidth, int nOtherHeight) const { return nWidth == nOtherWidth && nHeight == nOtherHeight; }
+
+    const BYTE* GetRow(int y) const { return pData + ptrdiff_t(y) * nStride; }
+};
+
+// nStride 0 means packed rows
+inline ColorFrameView MakeColorFrameView(const BYTE* pData, ColorFormat format, int nWidth, int nHeight, int nStride = 0)
+{
+    const ColorFrameView view = {pData, format, nWidth, nHeight, nStride ? nStride : nWidth * ColorFrameView::GetBytesPerPixel(format)};
+    return view;
+}
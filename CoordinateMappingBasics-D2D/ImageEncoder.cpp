@@ -0,0 +1,71 @@
+#include "ImageEncoder.h"
+#include <cstring>
+#include "BitmapFile.h"
+#include "PngFile.h"
+#include "QoiFile.h"
+
+const char* GetImageFormatName(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat_Qoi:
+        return "qoi";
+    case ImageFormat_Png:
+        return "png";
+    default:
+        return "bmp";
+    }
+}
+
+const char* GetImageFormatExtension(ImageFormat format)
+{
+    switch (format)
+    {
+    case ImageFormat_Qoi:
+        return ".qoi";
+    case ImageFormat_Png:
+        return ".png";
+    default:
+        return ".bmp";
+    }
+}
+
+bool ParseImageFormat(const char* pszName, ImageFormat* pFormat)
+{
+    const ImageFormat formats[] = {ImageFormat_Bmp, ImageFormat_Qoi, ImageFormat_Png};
+    for (ImageFormat format : formats)
+    {
+        if (pszName && strcmp(pszName, GetImageFormatName(format)) == 0)
+        {
+            *pFormat = format;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+HRESULT EncodeImage(
+    ImageFormat format,
+    const RGBQUAD* pPixels,
+    int nWidth,
+    int nHeight,
+    ThreadPool* pThreadPool,
+    std::vector<BYTE>* pOutput)
+{
+    if (!pOutput)
+    {
+        return E_INVALIDARG;
+    }
+
+    switch (format)
+    {
+    case ImageFormat_Qoi:
+        return EncodeQoi(pPixels, nWidth, nHeight, pOutput);
+    case ImageFormat_Png:
+        return EncodePng(pPixels, nWidth, nHeight, pThreadPool, pOutput);
+    default:
+        pOutput->resize(GetBitmapFileSize(nWidth, nHeight));
+        return EncodeBitmap(pPixels, nWidth, nHeight, pOutput->data(), pOutput->size());
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vector>
+#include "KinectTypes.h"
+
+class ThreadPool;
+
+// File formats composited frames can be saved as
+enum ImageFormat
+{
+    // uncompressed 32bpp, the original screenshot format
+    ImageFormat_Bmp = 0,
+    // lossless 24bpp, fastest to write
+    ImageFormat_Qoi,
+    // lossless 24bpp, smallest, deflated in parallel strips
+    ImageFormat_Png,
+};
+
+// "bmp", "qoi" or "png"
+const char* GetImageFormatName(ImageFormat format);
+// ".bmp", ".qoi" or ".png"
+const char* GetImageFormatExtension(ImageFormat format);
+bool ParseImageFormat(const char* pszName, ImageFormat* pFormat);
+
+// Encodes a complete file of the given format into pOutput. pThreadPool
+// spreads the PNG strips and may be null.
+HRESULT EncodeImage(
+    ImageFormat format,
+    const RGBQUAD* pPixels,
+    int nWidth,
+    int nHeight,
+    ThreadPool* pThreadPool,
+    std::vector<BYTE>* pOutput);
@@ -17,7 +17,8 @@ ImageRenderer::ImageRenderer() :
     m_sourceStride(0),
     m_pD2DFactory(NULL), 
     m_pRenderTarget(NULL),
-    m_pBitmap(0)
+    m_pBitmap(0),
+    m_bBitmapFilled(false)
 {
 }
 
@@ -70,6 +71,8 @@ HRESULT ImageRenderer::EnsureResources()
             SafeRelease(m_pRenderTarget);
             return hr;
         }
+
+        m_bBitmapFilled = false;
     }
 
     return hr;
@@ -123,6 +126,21 @@ HRESULT ImageRenderer::Initialize(HWND hWnd, ID2D1Factory* pD2DFactory, int sour
 /// <param name="cbImage">size of image data in bytes</param>
 /// <returns>indicates success or failure</returns>
 HRESULT ImageRenderer::Draw(BYTE* pImage, unsigned long cbImage)
+{
+    return Draw(pImage, cbImage, NULL, 0);
+}
+
+/// <summary>
+/// Draws an image like Draw, but only copies the given regions of it into the bitmap,
+/// the rest of the bitmap keeps the previously drawn image.
+/// A bitmap that was just (re)created gets the whole image
+/// </summary>
+/// <param name="pImage">image data in RGBX format</param>
+/// <param name="cbImage">size of image data in bytes</param>
+/// <param name="pDirtyRects">regions that changed since the last draw, NULL copies the whole image</param>
+/// <param name="nDirtyRectCount">number of regions</param>
+/// <returns>indicates success or failure</returns>
+HRESULT ImageRenderer::Draw(BYTE* pImage, unsigned long cbImage, const D2D1_RECT_U* pDirtyRects, UINT nDirtyRectCount)
 {
     // incorrectly sized image data passed in
     if (cbImage < ((m_sourceHeight - 1) * m_sourceStride) + (m_sourceWidth * 4))
@@ -139,12 +157,46 @@ HRESULT ImageRenderer::Draw(BYTE* pImage, unsigned long cbImage)
         return hr;
     }
     
-    // Copy the image that was passed in into the direct2d bitmap
-    hr = m_pBitmap->CopyFromMemory(NULL, pImage, m_sourceStride);
+    if (NULL == pDirtyRects || !m_bBitmapFilled)
+    {
+        // Copy the image that was passed in into the direct2d bitmap
+        hr = m_pBitmap->CopyFromMemory(NULL, pImage, m_sourceStride);
 
-    if (FAILED(hr))
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        m_bBitmapFilled = true;
+    }
+    else
     {
-        return hr;
+        // Copy only the regions that changed, each from its own spot in the image
+        for (UINT i = 0; i < nDirtyRectCount; ++i)
+        {
+            D2D1_RECT_U rect = pDirtyRects[i];
+            if (rect.right > m_sourceWidth)
+            {
+                rect.right = m_sourceWidth;
+            }
+
+            if (rect.bottom > m_sourceHeight)
+            {
+                rect.bottom = m_sourceHeight;
+            }
+
+            if (rect.left >= rect.right || rect.top >= rect.bottom)
+            {
+                continue;
+            }
+
+            hr = m_pBitmap->CopyFromMemory(&rect, pImage + (rect.top * m_sourceStride) + (rect.left * 4), m_sourceStride);
+
+            if (FAILED(hr))
+            {
+                return hr;
+            }
+        }
     }
        
     m_pRenderTarget->BeginDraw();
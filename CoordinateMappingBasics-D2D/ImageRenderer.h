@@ -43,6 +43,18 @@ public:
     /// <returns>indicates success or failure</returns>
     HRESULT Draw(BYTE* pImage, unsigned long cbImage);
 
+    /// <summary>
+    /// Draws an image like Draw, but only copies the given regions of it into the bitmap,
+    /// the rest of the bitmap keeps the previously drawn image.
+    /// A bitmap that was just (re)created gets the whole image
+    /// </summary>
+    /// <param name="pImage">image data in RGBX format</param>
+    /// <param name="cbImage">size of image data in bytes</param>
+    /// <param name="pDirtyRects">regions that changed since the last draw, NULL copies the whole image</param>
+    /// <param name="nDirtyRectCount">number of regions</param>
+    /// <returns>indicates success or failure</returns>
+    HRESULT Draw(BYTE* pImage, unsigned long cbImage, const D2D1_RECT_U* pDirtyRects, UINT nDirtyRectCount);
+
 private:
     HWND                     m_hWnd;
 
@@ -56,6 +68,9 @@ private:
     ID2D1HwndRenderTarget*   m_pRenderTarget;
     ID2D1Bitmap*             m_pBitmap;
 
+    // false until the bitmap has been given a whole image
+    bool                     m_bBitmapFilled;
+
     /// <summary>
     /// Ensure necessary Direct2d resources are created
     /// </summary>
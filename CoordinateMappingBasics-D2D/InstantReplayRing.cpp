@@ -0,0 +1,160 @@
+#include "InstantReplayRing.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "WindowsHelper.h"
+
+namespace
+{
+    // shared by the writes of one Save, the last one to finish reports
+    struct SaveState
+    {
+        std::atomic<int> nRemaining;
+        std::atomic<int> nWritten;
+        std::atomic<HRESULT> hrFirstFailure;
+        InstantReplayRing::SaveCallback done;
+    };
+}
+
+InstantReplayRing::InstantReplayRing() :
+    m_nWidth(0),
+    m_nHeight(0),
+    m_nCapacity(0),
+    m_nNext(0),
+    m_nPushed(0),
+    m_nSkipped(0),
+    m_nSaving(0)
+{
+}
+
+HRESULT InstantReplayRing::Initialize(int nWidth, int nHeight, int nFrameCount)
+{
+    V_CHECK_HR(nWidth > 0 && nHeight > 0 && nFrameCount > 0);
+    V_CHECK_HR(!IsSaving());
+
+    m_nWidth = nWidth;
+    m_nHeight = nHeight;
+    m_nCapacity = nFrameCount;
+    m_pSlots.reset(new Slot[nFrameCount]);
+
+    for (int i = 0; i < nFrameCount; ++i)
+    {
+        m_pSlots[i].pPixels = std::make_unique<RGBQUAD[]>(size_t(nWidth) * nHeight);
+        m_pSlots[i].nSequence = 0;
+        m_pSlots[i].bSaving = false;
+    }
+
+    m_nNext = 0;
+    m_nPushed = 0;
+    m_nSkipped = 0;
+
+    return S_OK;
+}
+
+bool InstantReplayRing::Push(const RGBQUAD* pPixels)
+{
+    if (!pPixels || !m_pSlots)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < m_nCapacity; ++i)
+    {
+        Slot& slot = m_pSlots[m_nNext];
+        m_nNext = (m_nNext + 1) % m_nCapacity;
+
+        if (slot.bSaving.load(std::memory_order_acquire))
+        {
+            continue;
+        }
+
+        memcpy(slot.pPixels.get(), pPixels, size_t(m_nWidth) * m_nHeight * sizeof(RGBQUAD));
+        slot.nSequence = ++m_nPushed;
+        return true;
+    }
+
+    ++m_nSkipped;
+    return false;
+}
+
+HRESULT InstantReplayRing::Save(ScreenshotWriter* pWriter, const std::string& pathPrefix, const SaveCallback& done)
+{
+    V_CHECK_HR(pWriter && m_pSlots);
+
+    if (IsSaving())
+    {
+        return E_PENDING;
+    }
+
+    std::vector<Slot*> held;
+    for (int i = 0; i < m_nCapacity; ++i)
+    {
+        if (m_pSlots[i].nSequence)
+        {
+            held.push_back(&m_pSlots[i]);
+        }
+    }
+
+    if (held.empty())
+    {
+        return S_FALSE;
+    }
+
+    std::sort(held.begin(), held.end(), [](const Slot* pLeft, const Slot* pRight)
+    {
+        return pLeft->nSequence < pRight->nSequence;
+    });
+
+    auto pState = std::make_shared<SaveState>();
+    pState->nRemaining = static_cast<int>(held.size());
+    pState->nWritten = 0;
+    pState->hrFirstFailure = S_OK;
+    pState->done = done;
+
+    // hand the frames over before queueing, the writer may start right away
+    m_nSaving.store(static_cast<int>(held.size()), std::memory_order_release);
+    for (Slot* pSlot : held)
+    {
+        pSlot->bSaving.store(true, std::memory_order_release);
+    }
+
+    for (size_t i = 0; i < held.size(); ++i)
+    {
+        Slot* pSlot = held[i];
+
+        char szSuffix[16];
+        snprintf(szSuffix, sizeof(szSuffix), "-%04u%s", static_cast<unsigned>(i), GetImageFormatExtension(pWriter->GetFormat()));
+
+        const std::string path = pathPrefix + szSuffix;
+        const ScreenshotWriter::WriteCallback written = [this, pSlot, pState](HRESULT hr, const std::string&)
+        {
+            if (SUCCEEDED(hr))
+            {
+                ++pState->nWritten;
+            }
+            else
+            {
+                HRESULT hrNone = S_OK;
+                pState->hrFirstFailure.compare_exchange_strong(hrNone, hr);
+            }
+
+            // the frame is Push's again
+            pSlot->bSaving.store(false, std::memory_order_release);
+            m_nSaving.fetch_sub(1, std::memory_order_acq_rel);
+
+            if (--pState->nRemaining == 0 && pState->done)
+            {
+                pState->done(pState->hrFirstFailure, pState->nWritten);
+            }
+        };
+
+        HRESULT hr = pWriter->SubmitBorrowed(pSlot->pPixels.get(), path, written);
+        if (FAILED(hr))
+        {
+            written(hr, path);
+        }
+    }
+
+    return S_OK;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include "KinectTypes.h"
+#include "ScreenshotWriter.h"
+
+// Keeps the last few seconds of composited output in preallocated frames, so
+// one button press can save what just happened. Push copies a frame in on the
+// presenting thread. Save hands the held frames to a ScreenshotWriter without
+// copying them, and Push steps around frames until they are written, so
+// saving never stalls the frame thread. Push and Save are called from the
+// same thread, and the writer has to finish before the ring goes away.
+class InstantReplayRing
+{
+public:
+    // run on the writer thread after the last frame of a Save
+    typedef std::function<void(HRESULT hr, int nFramesWritten)> SaveCallback;
+
+    InstantReplayRing();
+
+    InstantReplayRing(const InstantReplayRing&) = delete;
+    InstantReplayRing& operator=(const InstantReplayRing&) = delete;
+
+    // nFrameCount frames of nWidth x nHeight are allocated here
+    HRESULT Initialize(int nWidth, int nHeight, int nFrameCount);
+
+    int GetCapacity() const { return m_nCapacity; }
+    bool IsSaving() const { return m_nSaving.load(std::memory_order_acquire) != 0; }
+
+    // Copies pPixels over the oldest frame that is not being written. Returns
+    // false when every frame is still being saved.
+    bool Push(const RGBQUAD* pPixels);
+
+    // Writes the held frames oldest first as <pathPrefix>-0000.<ext> and on,
+    // in the writer's format.
+    // E_PENDING while the previous save is running, S_FALSE when there is
+    // nothing to save.
+    HRESULT Save(ScreenshotWriter* pWriter, const std::string& pathPrefix, const SaveCallback& done);
+
+    // frames Push could not keep because the whole ring was being saved
+    uint64_t GetSkippedCount() const { return m_nSkipped; }
+
+private:
+    struct Slot
+    {
+        std::unique_ptr<RGBQUAD[]> pPixels;
+        // push order, 0 while the slot is empty
+        uint64_t nSequence;
+        // set while the writer owns the pixels
+        std::atomic<bool> bSaving;
+    };
+
+    int m_nWidth;
+    int m_nHeight;
+    int m_nCapacity;
+    std::unique_ptr<Slot[]> m_pSlots;
+
+    int m_nNext;
+    uint64_t m_nPushed;
+    uint64_t m_nSkipped;
+
+    // frames of the running save not written yet
+    std::atomic<int> m_nSaving;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "stdafx.h"
+#include "WindowsHelper.h"
+#include "ColorToDepthMapper.h"
+
+// Forwards to the Kinect SDK coordinate mapper of an open sensor
+class KinectCoordinateMapper : public ColorToDepthMapper
+{
+public:
+    explicit KinectCoordinateMapper(ICoordinateMapper* pCoordinateMapper) :
+        m_pCoordinateMapper(pCoordinateMapper)
+    {
+    }
+
+    // the SDK only maps the frames of the sensor's single mode
+    HRESULT SetFrameGeometry(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight) override
+    {
+        return (nDepthWidth == cDepthWidth && nDepthHeight == cDepthHeight && nColorWidth == cColorWidth && nColorHeight == cColorHeight) ?
+            S_OK : E_NOTIMPL;
+    }
+
+    HRESULT MapColorFrameToDepthSpace(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        UINT nColorPointCount,
+        DepthSpacePoint* pDepthSpacePoints) override
+    {
+        return m_pCoordinateMapper->MapColorFrameToDepthSpace(
+            nDepthPointCount,
+            const_cast<UINT16*>(pDepthFrameData),
+            nColorPointCount,
+            pDepthSpacePoints);
+    }
+
+    HRESULT MapDepthPointsToColorSpace(
+        UINT nPointCount,
+        const DepthSpacePoint* pDepthPoints,
+        const UINT16* pDepths,
+        ColorSpacePoint* pColorPoints) override
+    {
+        return m_pCoordinateMapper->MapDepthPointsToColorSpace(
+            nPointCount,
+            const_cast<DepthSpacePoint*>(pDepthPoints),
+            nPointCount,
+            const_cast<UINT16*>(pDepths),
+            nPointCount,
+            pColorPoints);
+    }
+
+    HRESULT MapDepthFrameToColorSpace(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        UINT nColorPointCount,
+        ColorSpacePoint* pColorSpacePoints) override
+    {
+        return m_pCoordinateMapper->MapDepthFrameToColorSpace(
+            nDepthPointCount,
+            const_cast<UINT16*>(pDepthFrameData),
+            nColorPointCount,
+            pColorSpacePoints);
+    }
+
+private:
+    static const int cDepthWidth = 512;
+    static const int cDepthHeight = 424;
+    static const int cColorWidth = 1920;
+    static const int cColorHeight = 1080;
+
+    Microsoft::WRL::ComPtr<ICoordinateMapper> m_pCoordinateMapper;
+};
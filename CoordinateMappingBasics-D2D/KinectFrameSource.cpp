@@ -0,0 +1,190 @@
+#include "KinectFrameSource.h"
+#include <cstring>
+
+KinectFrameSource::KinectFrameSource() :
+    m_hFrameArrived(0),
+    m_bBodyIndex(true)
+{
+}
+
+KinectFrameSource::~KinectFrameSource()
+{
+    if (m_pMultiSourceFrameReader && m_hFrameArrived)
+    {
+        m_pMultiSourceFrameReader->UnsubscribeMultiSourceFrameArrived(m_hFrameArrived);
+    }
+}
+
+HRESULT KinectFrameSource::Initialize(IKinectSensor* pKinectSensor, bool bBodyIndex)
+{
+    V_CHECK_HR(pKinectSensor != nullptr);
+
+    m_bBodyIndex = bBodyIndex;
+
+    // the sizes the sensor's sources describe, before any frame arrives
+    Microsoft::WRL::ComPtr<IDepthFrameSource> pDepthFrameSource;
+    V_RET(pKinectSensor->get_DepthFrameSource(&pDepthFrameSource));
+
+    Microsoft::WRL::ComPtr<IFrameDescription> pDepthFrameDescription;
+    V_RET(pDepthFrameSource->get_FrameDescription(&pDepthFrameDescription));
+
+    Microsoft::WRL::ComPtr<IColorFrameSource> pColorFrameSource;
+    V_RET(pKinectSensor->get_ColorFrameSource(&pColorFrameSource));
+
+    Microsoft::WRL::ComPtr<IFrameDescription> pColorFrameDescription;
+    V_RET(pColorFrameSource->get_FrameDescription(&pColorFrameDescription));
+
+    V_RET(pDepthFrameDescription->get_Width(&m_geometry.nDepthWidth));
+    V_RET(pDepthFrameDescription->get_Height(&m_geometry.nDepthHeight));
+    V_RET(pColorFrameDescription->get_Width(&m_geometry.nColorWidth));
+    V_RET(pColorFrameDescription->get_Height(&m_geometry.nColorHeight));
+
+    DWORD frameSourceTypes = FrameSourceTypes::FrameSourceTypes_Depth | FrameSourceTypes::FrameSourceTypes_Color;
+    if (bBodyIndex)
+    {
+        frameSourceTypes |= FrameSourceTypes::FrameSourceTypes_BodyIndex;
+    }
+
+    V_RET(pKinectSensor->OpenMultiSourceFrameReader(frameSourceTypes, &m_pMultiSourceFrameReader));
+
+    return m_pMultiSourceFrameReader->SubscribeMultiSourceFrameArrived(&m_hFrameArrived);
+}
+
+bool KinectFrameSource::WaitForFrame(std::chrono::milliseconds timeout)
+{
+    if (m_pArrivedFrame)
+    {
+        return true;
+    }
+
+    if (WaitForSingleObject(reinterpret_cast<HANDLE>(m_hFrameArrived), static_cast<DWORD>(timeout.count())) != WAIT_OBJECT_0)
+    {
+        return false;
+    }
+
+    Microsoft::WRL::ComPtr<IMultiSourceFrameArrivedEventArgs> pArgs;
+    Microsoft::WRL::ComPtr<IMultiSourceFrameReference> pFrameReference;
+    if (FAILED(m_pMultiSourceFrameReader->GetMultiSourceFrameArrivedEventData(m_hFrameArrived, &pArgs)) ||
+        FAILED(pArgs->get_FrameReference(&pFrameReference)) ||
+        FAILED(pFrameReference->AcquireFrame(&m_pArrivedFrame)))
+    {
+        m_pArrivedFrame.Reset();
+        return false;
+    }
+
+    return true;
+}
+
+HRESULT KinectFrameSource::AcquireFrame(PipelineFrame* pFrame)
+{
+    V_CHECK_HR(m_pMultiSourceFrameReader != nullptr && pFrame != nullptr);
+
+    // the frame the arrival event announced, or whatever is latest after a timeout
+    Microsoft::WRL::ComPtr<IMultiSourceFrame> pMultiSourceFrame;
+    pMultiSourceFrame.Swap(m_pArrivedFrame);
+    if (!pMultiSourceFrame)
+    {
+        V_RET(m_pMultiSourceFrameReader->AcquireLatestFrame(&pMultiSourceFrame));
+    }
+
+    // Get the depth frame data
+    Microsoft::WRL::ComPtr<IDepthFrameReference> pDepthFrameReference;
+    V_RET(pMultiSourceFrame->get_DepthFrameReference(&pDepthFrameReference));
+
+    Microsoft::WRL::ComPtr<IDepthFrame> pDepthFrame;
+    V_RET(pDepthFrameReference->AcquireFrame(&pDepthFrame));
+
+    int64_t nDepthTime = 0;
+    V_RET(pDepthFrame->get_RelativeTime(&nDepthTime));
+
+    Microsoft::WRL::ComPtr<IFrameDescription> pDepthFrameDescription;
+    V_RET(pDepthFrame->get_FrameDescription(&pDepthFrameDescription));
+
+    int nDepthWidth = 0;
+    V_RET(pDepthFrameDescription->get_Width(&nDepthWidth));
+
+    int nDepthHeight = 0;
+    V_RET(pDepthFrameDescription->get_Height(&nDepthHeight));
+
+    // Get the color frame data
+    Microsoft::WRL::ComPtr<IColorFrameReference> pColorFrameReference;
+    V_RET(pMultiSourceFrame->get_ColorFrameReference(&pColorFrameReference));
+
+    Microsoft::WRL::ComPtr<IColorFrame> pColorFrame;
+    V_RET(pColorFrameReference->AcquireFrame(&pColorFrame));
+
+    // get color frame data
+    Microsoft::WRL::ComPtr<IFrameDescription> pColorFrameDescription;
+    V_RET(pColorFrame->get_FrameDescription(&pColorFrameDescription));
+
+    int nColorWidth = 0;
+    V_RET(pColorFrameDescription->get_Width(&nColorWidth));
+
+    int nColorHeight = 0;
+    V_RET(pColorFrameDescription->get_Height(&nColorHeight));
+
+    ColorImageFormat imageFormat = ColorImageFormat_None;
+    V_RET(pColorFrame->get_RawColorImageFormat(&imageFormat));
+
+    // Copy everything into the pipeline frame, the SDK frames are released when we return
+    const ColorFormat colorFormat = (imageFormat == ColorImageFormat_Yuy2) ? ColorFormat_Yuy2 : ColorFormat_Bgra;
+    pFrame->Reserve(nDepthWidth, nDepthHeight, nColorWidth, nColorHeight, colorFormat);
+    pFrame->nRelativeTime = nDepthTime;
+
+    UINT nColorBufferSize = nColorWidth * nColorHeight * sizeof(RGBQUAD);
+    BYTE* pColorBuffer = pFrame->pColorStorage.get();
+    if (imageFormat == ColorImageFormat_Bgra)
+    {
+        V_RET(pColorFrame->CopyRawFrameDataToArray(nColorBufferSize, pColorBuffer));
+    }
+    else if (imageFormat == ColorImageFormat_Yuy2)
+    {
+        // Half the bytes of BGRA and no conversion pass, the compositor
+        // converts just the player pixels
+        UINT nRawBufferSize = 0;
+        BYTE* pRawBuffer = nullptr;
+        V_RET(pColorFrame->AccessRawUnderlyingBuffer(&nRawBufferSize, &pRawBuffer));
+
+        const UINT nYuy2BufferSize = nColorWidth * nColorHeight * 2;
+        V_CHECK_HR(pRawBuffer && nRawBufferSize >= nYuy2BufferSize);
+
+        memcpy(pColorBuffer, pRawBuffer, nYuy2BufferSize);
+    }
+    else
+    {
+        V_RET(pColorFrame->CopyConvertedFrameDataToArray(nColorBufferSize, pColorBuffer, ColorImageFormat_Bgra));
+    }
+
+    V_RET(pDepthFrame->CopyFrameDataToArray(nDepthWidth * nDepthHeight, pFrame->pDepthStorage.get()));
+
+    UINT nBodyIndexBufferSize = nDepthWidth * nDepthHeight;
+    if (!m_bBodyIndex)
+    {
+        // nobody tracked, so recordings of keyed sessions still replay
+        memset(pFrame->pBodyIndexStorage.get(), 0xff, nBodyIndexBufferSize);
+        return S_OK;
+    }
+
+    // Get the body index frame data
+    Microsoft::WRL::ComPtr<IBodyIndexFrameReference> pBodyIndexFrameReference;
+    V_RET(pMultiSourceFrame->get_BodyIndexFrameReference(&pBodyIndexFrameReference));
+
+    Microsoft::WRL::ComPtr<IBodyIndexFrame> pBodyIndexFrame;
+    V_RET(pBodyIndexFrameReference->AcquireFrame(&pBodyIndexFrame));
+
+    Microsoft::WRL::ComPtr<IFrameDescription> pBodyIndexFrameDescription;
+    V_RET(pBodyIndexFrame->get_FrameDescription(&pBodyIndexFrameDescription));
+
+    int nBodyIndexWidth = 0;
+    V_RET(pBodyIndexFrameDescription->get_Width(&nBodyIndexWidth));
+
+    int nBodyIndexHeight = 0;
+    V_RET(pBodyIndexFrameDescription->get_Height(&nBodyIndexHeight));
+
+    // the body index frame shares the depth geometry
+    V_CHECK_HR(nBodyIndexWidth == nDepthWidth && nBodyIndexHeight == nDepthHeight);
+
+    V_RET(pBodyIndexFrame->CopyFrameDataToArray(nBodyIndexBufferSize, pFrame->pBodyIndexStorage.get()));
+
+    return S_OK;
+}
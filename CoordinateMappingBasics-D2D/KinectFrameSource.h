@@ -0,0 +1,31 @@
+#pragma once
+
+#include "stdafx.h"
+#include "WindowsHelper.h"
+#include "FrameSource.h"
+
+// Depth, color and body index frames from an open sensor. Waits on the
+// reader's frame arrived event, so the acquisition thread sleeps between frames.
+class KinectFrameSource : public FrameSource
+{
+public:
+    KinectFrameSource();
+    ~KinectFrameSource();
+
+    // Without bBodyIndex the body index source is left closed, sparing the
+    // sensor's body tracking, and frames come with every pixel as no player
+    HRESULT Initialize(IKinectSensor* pKinectSensor, bool bBodyIndex = true);
+
+    bool WaitForFrame(std::chrono::milliseconds timeout) override;
+
+    // copies the frames into pFrame's storage, the SDK frames are released on return
+    HRESULT AcquireFrame(PipelineFrame* pFrame) override;
+
+private:
+    Microsoft::WRL::ComPtr<IMultiSourceFrameReader> m_pMultiSourceFrameReader;
+    WAITABLE_HANDLE m_hFrameArrived;
+    bool m_bBodyIndex;
+
+    // frame announced by the last successful wait, not acquired yet
+    Microsoft::WRL::ComPtr<IMultiSourceFrame> m_pArrivedFrame;
+};
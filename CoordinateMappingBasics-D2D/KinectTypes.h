@@ -0,0 +1,55 @@
+#pragma once
+
+// The frame processing code only needs a handful of Win32/Kinect SDK types.
+// On Windows they come from the SDK headers; elsewhere we provide layout
+// compatible definitions so the same code can run without a sensor attached.
+
+#ifdef _WIN32
+
+#include "stdafx.h"
+
+#else
+
+#include <cstdint>
+
+typedef uint8_t     BYTE;
+typedef uint16_t    WORD;
+typedef uint16_t    UINT16;
+typedef uint32_t    UINT;
+typedef uint32_t    DWORD;
+typedef int32_t     LONG;
+typedef int32_t     HRESULT;
+
+struct RGBQUAD
+{
+    BYTE rgbBlue;
+    BYTE rgbGreen;
+    BYTE rgbRed;
+    BYTE rgbReserved;
+};
+
+struct DepthSpacePoint
+{
+    float X;
+    float Y;
+};
+
+struct ColorSpacePoint
+{
+    float X;
+    float Y;
+};
+
+#define S_OK            ((HRESULT)0L)
+#define S_FALSE         ((HRESULT)1L)
+#define E_NOTIMPL       ((HRESULT)0x80004001L)
+#define E_FAIL          ((HRESULT)0x80004005L)
+#define E_PENDING       ((HRESULT)0x8000000AL)
+#define E_ACCESSDENIED  ((HRESULT)0x80070005L)
+#define E_OUTOFMEMORY   ((HRESULT)0x8007000EL)
+#define E_INVALIDARG    ((HRESULT)0x80070057L)
+
+#define SUCCEEDED(hr)   (((HRESULT)(hr)) >= 0)
+#define FAILED(hr)      (((HRESULT)(hr)) < 0)
+
+#endif
@@ -0,0 +1,140 @@
+#include "MappedFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() :
+    m_pData(nullptr),
+    m_nSize(0),
+#ifdef _WIN32
+    m_hFile(INVALID_HANDLE_VALUE),
+    m_hMapping(nullptr)
+#else
+    m_nFile(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+#ifdef _WIN32
+
+HRESULT MappedFile::Open(const char* pszPath)
+{
+    Close();
+
+    m_hFile = CreateFileA(pszPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    LARGE_INTEGER size = {0};
+    if (!GetFileSizeEx(m_hFile, &size) || size.QuadPart == 0)
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    m_hMapping = CreateFileMappingW(m_hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_hMapping)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Close();
+        return hr;
+    }
+
+    m_pData = static_cast<const BYTE*>(MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0));
+    if (!m_pData)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+        Close();
+        return hr;
+    }
+
+    m_nSize = static_cast<uint64_t>(size.QuadPart);
+    return S_OK;
+}
+
+void MappedFile::Close()
+{
+    if (m_pData)
+    {
+        UnmapViewOfFile(m_pData);
+        m_pData = nullptr;
+    }
+
+    if (m_hMapping)
+    {
+        CloseHandle(m_hMapping);
+        m_hMapping = nullptr;
+    }
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+    }
+
+    m_nSize = 0;
+}
+
+#else
+
+HRESULT MappedFile::Open(const char* pszPath)
+{
+    Close();
+
+    m_nFile = open(pszPath, O_RDONLY);
+    if (m_nFile < 0)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    struct stat info;
+    if (fstat(m_nFile, &info) != 0 || info.st_size == 0)
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    void* pData = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, m_nFile, 0);
+    if (pData == MAP_FAILED)
+    {
+        Close();
+        return E_OUTOFMEMORY;
+    }
+
+    // frames are read front to back during replay
+    madvise(pData, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+
+    m_pData = static_cast<const BYTE*>(pData);
+    m_nSize = static_cast<uint64_t>(info.st_size);
+    return S_OK;
+}
+
+void MappedFile::Close()
+{
+    if (m_pData)
+    {
+        munmap(const_cast<BYTE*>(m_pData), static_cast<size_t>(m_nSize));
+        m_pData = nullptr;
+    }
+
+    if (m_nFile >= 0)
+    {
+        close(m_nFile);
+        m_nFile = -1;
+    }
+
+    m_nSize = 0;
+}
+
+#endif
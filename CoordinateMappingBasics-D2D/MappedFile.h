@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "KinectTypes.h"
+
+// Read only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    HRESULT Open(const char* pszPath);
+    void Close();
+
+    const BYTE* GetData() const { return m_pData; }
+    uint64_t GetSize() const { return m_nSize; }
+
+private:
+    const BYTE* m_pData;
+    uint64_t m_nSize;
+
+#ifdef _WIN32
+    HANDLE m_hFile;
+    HANDLE m_hMapping;
+#else
+    int m_nFile;
+#endif
+};
@@ -0,0 +1,324 @@
+#include "MappingCache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include "WindowsHelper.h"
+
+namespace
+{
+    // A depth pixel splats over about three color pixels, its corners sit
+    // half of that beyond the pixel centers projected; the rest covers the
+    // lens distortion bending the tile edges between the corners.
+    const int cFootprintMargin = 8;
+
+    const int cCornersPerTile = 8;
+}
+
+MappingCache::MappingCache() :
+    m_pMapper(nullptr),
+    m_nDepthWidth(0),
+    m_nDepthHeight(0),
+    m_nColorWidth(0),
+    m_nColorHeight(0),
+    m_nTileSize(0),
+    m_nColumns(0),
+    m_nRows(0),
+    m_nTolerance(cDefaultTolerance),
+    m_nRefreshInterval(cDefaultRefreshInterval),
+    m_bValid(false),
+    m_nFramesSinceRefresh(0),
+    m_bFullMap(true),
+    m_nRemappedPixels(0),
+    m_fFullMapMilliseconds(0.0)
+{
+    m_stats = MappingCacheStats();
+}
+
+HRESULT MappingCache::Initialize(
+    ColorToDepthMapper* pMapper,
+    int nDepthWidth,
+    int nDepthHeight,
+    int nColorWidth,
+    int nColorHeight,
+    int nTileSize)
+{
+    V_CHECK_HR(pMapper && nDepthWidth > 0 && nDepthHeight > 0 && nColorWidth > 0 && nColorHeight > 0 && nTileSize > 0);
+
+    m_pMapper = pMapper;
+    m_nDepthWidth = nDepthWidth;
+    m_nDepthHeight = nDepthHeight;
+    m_nColorWidth = nColorWidth;
+    m_nColorHeight = nColorHeight;
+    m_nTileSize = nTileSize;
+    m_nColumns = (nDepthWidth + nTileSize - 1) / nTileSize;
+    m_nRows = (nDepthHeight + nTileSize - 1) / nTileSize;
+
+    m_reference.assign(size_t(nDepthWidth) * nDepthHeight, 0);
+
+    m_changedTiles.reserve(size_t(m_nColumns) * m_nRows);
+
+    const size_t nMaxCorners = size_t(cCornersPerTile) * m_nColumns * m_nRows;
+    m_cornerPoints.reserve(nMaxCorners);
+    m_cornerDepths.reserve(nMaxCorners);
+    m_cornerColorPoints.resize(nMaxCorners);
+
+    m_bValid = false;
+    m_nFramesSinceRefresh = 0;
+    m_fFullMapMilliseconds = 0.0;
+    m_stats = MappingCacheStats();
+
+    return S_OK;
+}
+
+double MappingCache::GetHitRate() const
+{
+    return m_stats.nColorPixels ? 1.0 - double(m_stats.nRemappedPixels) / m_stats.nColorPixels : 0.0;
+}
+
+bool MappingCache::CompareTile(const UINT16* pDepthBuffer, int nTile, UINT16* pnNearest, UINT16* pnFarthest) const
+{
+    const int nLeft = (nTile % m_nColumns) * m_nTileSize;
+    const int nTop = (nTile / m_nColumns) * m_nTileSize;
+    const int nRight = std::min(nLeft + m_nTileSize, m_nDepthWidth);
+    const int nBottom = std::min(nTop + m_nTileSize, m_nDepthHeight);
+
+    // the common case is an unchanged tile, so the range is only gathered
+    // once a pixel has moved; a change needs a pixel with depth in one of
+    // the frames, which keeps the range valid
+    bool bChanged = false;
+    for (int y = nTop; y < nBottom && !bChanged; ++y)
+    {
+        const UINT16* pRow = pDepthBuffer + y * m_nDepthWidth;
+        const UINT16* pReferenceRow = m_reference.data() + y * m_nDepthWidth;
+
+        for (int x = nLeft; x < nRight; ++x)
+        {
+            // 0 is no depth, appearing or vanishing counts as a change
+            const int nNew = pRow[x];
+            const int nOld = pReferenceRow[x];
+            bChanged |= (abs(nNew - nOld) > m_nTolerance) | ((nNew == 0) != (nOld == 0));
+        }
+    }
+
+    if (!bChanged)
+    {
+        return false;
+    }
+
+    UINT16 nNearest = 0xffff;
+    UINT16 nFarthest = 0;
+    for (int y = nTop; y < nBottom; ++y)
+    {
+        for (int x = nLeft; x < nRight; ++x)
+        {
+            const UINT16 depths[2] = {pDepthBuffer[y * m_nDepthWidth + x], m_reference[y * m_nDepthWidth + x]};
+            for (UINT16 depth : depths)
+            {
+                if (depth != 0)
+                {
+                    nNearest = std::min(nNearest, depth);
+                    nFarthest = std::max(nFarthest, depth);
+                }
+            }
+        }
+    }
+
+    *pnNearest = nNearest;
+    *pnFarthest = nFarthest;
+    return true;
+}
+
+void MappingCache::UpdateReference(const UINT16* pDepthBuffer, int nTile)
+{
+    const int nLeft = (nTile % m_nColumns) * m_nTileSize;
+    const int nTop = (nTile / m_nColumns) * m_nTileSize;
+    const int nRight = std::min(nLeft + m_nTileSize, m_nDepthWidth);
+    const int nBottom = std::min(nTop + m_nTileSize, m_nDepthHeight);
+
+    for (int y = nTop; y < nBottom; ++y)
+    {
+        std::copy(pDepthBuffer + y * m_nDepthWidth + nLeft, pDepthBuffer + y * m_nDepthWidth + nRight,
+            m_reference.begin() + y * m_nDepthWidth + nLeft);
+    }
+}
+
+HRESULT MappingCache::BeginFrame(const UINT16* pDepthBuffer, std::vector<PixelRect>* pRects)
+{
+    V_CHECK_HR(m_pMapper && pDepthBuffer && pRects);
+
+    pRects->clear();
+
+    bool bFullMap = !m_bValid || (m_nRefreshInterval > 0 && m_nFramesSinceRefresh >= m_nRefreshInterval);
+    m_changedTiles.clear();
+
+    if (!bFullMap)
+    {
+        m_cornerPoints.clear();
+        m_cornerDepths.clear();
+
+        const int nTiles = m_nColumns * m_nRows;
+        for (int nTile = 0; nTile < nTiles; ++nTile)
+        {
+            UINT16 nNearest = 0;
+            UINT16 nFarthest = 0;
+            if (!CompareTile(pDepthBuffer, nTile, &nNearest, &nFarthest))
+            {
+                continue;
+            }
+
+            m_changedTiles.push_back(nTile);
+
+            const int nLeft = (nTile % m_nColumns) * m_nTileSize;
+            const int nTop = (nTile / m_nColumns) * m_nTileSize;
+            const int nRight = std::min(nLeft + m_nTileSize, m_nDepthWidth) - 1;
+            const int nBottom = std::min(nTop + m_nTileSize, m_nDepthHeight) - 1;
+            const int corners[4][2] = {{nLeft, nTop}, {nRight, nTop}, {nLeft, nBottom}, {nRight, nBottom}};
+
+            // projections move monotonically with depth, the nearest and
+            // farthest depths bound every pixel in between
+            for (const int* pCorner : corners)
+            {
+                const DepthSpacePoint point = {static_cast<float>(pCorner[0]), static_cast<float>(pCorner[1])};
+                m_cornerPoints.push_back(point);
+                m_cornerPoints.push_back(point);
+                m_cornerDepths.push_back(nNearest);
+                m_cornerDepths.push_back(nFarthest);
+            }
+        }
+
+        m_stats.nTiles += nTiles;
+        m_stats.nChangedTiles += m_changedTiles.size();
+
+        if (!m_changedTiles.empty())
+        {
+            V_RET(m_pMapper->MapDepthPointsToColorSpace(
+                static_cast<UINT>(m_cornerPoints.size()),
+                m_cornerPoints.data(),
+                m_cornerDepths.data(),
+                m_cornerColorPoints.data()));
+        }
+
+        for (size_t i = 0; i < m_changedTiles.size() && !bFullMap; ++i)
+        {
+            const ColorSpacePoint* pCorners = &m_cornerColorPoints[i * cCornersPerTile];
+
+            float fLeft = pCorners[0].X;
+            float fRight = pCorners[0].X;
+            float fTop = pCorners[0].Y;
+            float fBottom = pCorners[0].Y;
+            for (int nCorner = 0; nCorner < cCornersPerTile; ++nCorner)
+            {
+                const ColorSpacePoint& p = pCorners[nCorner];
+
+                // -infinity for corners that do not project, NaN fails too
+                if (!(p.X > -m_nColorWidth && p.X < 2.0f * m_nColorWidth && p.Y > -m_nColorHeight && p.Y < 2.0f * m_nColorHeight))
+                {
+                    bFullMap = true;
+                    break;
+                }
+
+                fLeft = std::min(fLeft, p.X);
+                fRight = std::max(fRight, p.X);
+                fTop = std::min(fTop, p.Y);
+                fBottom = std::max(fBottom, p.Y);
+            }
+
+            PixelRect footprint =
+            {
+                static_cast<int>(floorf(fLeft)) - cFootprintMargin,
+                static_cast<int>(floorf(fTop)) - cFootprintMargin,
+                static_cast<int>(ceilf(fRight)) + cFootprintMargin + 1,
+                static_cast<int>(ceilf(fBottom)) + cFootprintMargin + 1,
+            };
+            footprint.Clip(m_nColorWidth, m_nColorHeight);
+
+            if (!footprint.IsEmpty())
+            {
+                pRects->push_back(footprint);
+            }
+        }
+
+        // overlapping footprints are merged, so no color pixel is mapped twice
+        bool bMerged = true;
+        while (bMerged && !bFullMap)
+        {
+            bMerged = false;
+            for (size_t i = 0; i < pRects->size() && !bMerged; ++i)
+            {
+                for (size_t j = i + 1; j < pRects->size(); ++j)
+                {
+                    if ((*pRects)[i].Intersects((*pRects)[j]))
+                    {
+                        (*pRects)[i].Union((*pRects)[j]);
+                        pRects->erase(pRects->begin() + j);
+                        bMerged = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        int nArea = 0;
+        for (const PixelRect& rect : *pRects)
+        {
+            nArea += rect.GetArea();
+        }
+
+        if (int64_t(nArea) * 100 > int64_t(cMaxRemappedPercent) * m_nColorWidth * m_nColorHeight)
+        {
+            bFullMap = true;
+        }
+
+        m_nRemappedPixels = nArea;
+    }
+
+    m_bFullMap = bFullMap;
+
+    if (bFullMap)
+    {
+        const PixelRect frame = {0, 0, m_nColorWidth, m_nColorHeight};
+        pRects->assign(1, frame);
+
+        std::copy(pDepthBuffer, pDepthBuffer + m_reference.size(), m_reference.begin());
+        m_nFramesSinceRefresh = 0;
+        m_nRemappedPixels = m_nColorWidth * m_nColorHeight;
+    }
+    else
+    {
+        for (int nTile : m_changedTiles)
+        {
+            UpdateReference(pDepthBuffer, nTile);
+        }
+        ++m_nFramesSinceRefresh;
+    }
+
+    return S_OK;
+}
+
+void MappingCache::EndFrame(double fMapMilliseconds, bool bSucceeded)
+{
+    if (!bSucceeded)
+    {
+        m_bValid = false;
+        return;
+    }
+
+    m_bValid = true;
+
+    ++m_stats.nFrames;
+    m_stats.nColorPixels += uint64_t(m_nColorWidth) * m_nColorHeight;
+    m_stats.nRemappedPixels += m_nRemappedPixels;
+    m_stats.fMapMilliseconds += fMapMilliseconds;
+
+    if (m_bFullMap)
+    {
+        ++m_stats.nFullMaps;
+        m_fFullMapMilliseconds = (m_stats.nFullMaps == 1) ?
+            fMapMilliseconds :
+            0.75 * m_fFullMapMilliseconds + 0.25 * fMapMilliseconds;
+    }
+    else
+    {
+        m_stats.fSavedMilliseconds += std::max(0.0, m_fFullMapMilliseconds - fMapMilliseconds);
+    }
+}
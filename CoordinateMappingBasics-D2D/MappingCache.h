@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "KinectTypes.h"
+#include "ColorToDepthMapper.h"
+#include "PixelRect.h"
+
+struct MappingCacheStats
+{
+    uint64_t nFrames;
+    // frames mapped in full, by the refresh interval or because too much changed
+    uint64_t nFullMaps;
+
+    // depth tiles compared, and those that moved beyond the tolerance
+    uint64_t nTiles;
+    uint64_t nChangedTiles;
+
+    // color pixels over all frames, and the ones mapped again rather than reused
+    uint64_t nColorPixels;
+    uint64_t nRemappedPixels;
+
+    double fMapMilliseconds;
+    // what mapping every frame in full would have cost more, estimated from
+    // the full maps
+    double fSavedMilliseconds;
+};
+
+// Reuses the color to depth mapping of a fixed camera between frames. The
+// depth frame is split into tiles, each compared against the depth it was
+// last mapped with; a tile moving by more than the tolerance anywhere gets
+// its color space footprint, at its old and its new depths, mapped again.
+// Everything else keeps last frame's mapping, which the tolerance lets
+// drift a little until the periodic full refresh.
+//
+// Per frame: BeginFrame, map the rectangles it returns, EndFrame.
+class MappingCache
+{
+public:
+    static const int cDefaultTileSize = 32;
+    static const UINT16 cDefaultTolerance = 8;
+    static const int cDefaultRefreshInterval = 30;
+
+    MappingCache();
+
+    // pMapper only projects the tile corners, it is not owned
+    HRESULT Initialize(
+        ColorToDepthMapper* pMapper,
+        int nDepthWidth,
+        int nDepthHeight,
+        int nColorWidth,
+        int nColorHeight,
+        int nTileSize = cDefaultTileSize);
+
+    // largest depth change (mm) a tile may see and still count as unchanged
+    UINT16 GetTolerance() const { return m_nTolerance; }
+    void SetTolerance(UINT16 nMillimeters) { m_nTolerance = nMillimeters; }
+
+    // frames between full maps, 0 never refreshes
+    int GetRefreshInterval() const { return m_nRefreshInterval; }
+    void SetRefreshInterval(int nFrames) { m_nRefreshInterval = nFrames; }
+
+    // the next frame maps in full, e.g. when the mapping buffer was written elsewhere
+    void Invalidate() { m_bValid = false; }
+
+    // Color rectangles of pDepthBuffer's frame to map again, non overlapping;
+    // empty when the whole mapping is reused, the whole frame on a full map.
+    // pDepthBuffer becomes the depth the changed tiles compare against.
+    HRESULT BeginFrame(const UINT16* pDepthBuffer, std::vector<PixelRect>* pRects);
+
+    // after mapping BeginFrame's rectangles, or with bSucceeded false to map
+    // in full next frame
+    void EndFrame(double fMapMilliseconds, bool bSucceeded);
+
+    MappingCacheStats GetStats() const { return m_stats; }
+    // share of color pixels reused over all frames
+    double GetHitRate() const;
+
+private:
+    // the mapped share of the frame above which one full map is cheaper
+    static const int cMaxRemappedPercent = 60;
+
+    ColorToDepthMapper* m_pMapper;
+    int m_nDepthWidth;
+    int m_nDepthHeight;
+    int m_nColorWidth;
+    int m_nColorHeight;
+    int m_nTileSize;
+    int m_nColumns;
+    int m_nRows;
+
+    UINT16 m_nTolerance;
+    int m_nRefreshInterval;
+
+    bool m_bValid;
+    int m_nFramesSinceRefresh;
+    bool m_bFullMap;
+    int m_nRemappedPixels;
+
+    // the depth each tile was last mapped with
+    std::vector<UINT16> m_reference;
+
+    std::vector<int> m_changedTiles;
+
+    // corners of the changed tiles at their nearest and farthest depths
+    std::vector<DepthSpacePoint> m_cornerPoints;
+    std::vector<UINT16> m_cornerDepths;
+    std::vector<ColorSpacePoint> m_cornerColorPoints;
+
+    // running average of the full maps, what a frame costs without the cache
+    double m_fFullMapMilliseconds;
+
+    MappingCacheStats m_stats;
+
+    // whether the tile moved beyond the tolerance, and the valid depth range
+    // of its old and new pixels together
+    bool CompareTile(const UINT16* pDepthBuffer, int nTile, UINT16* pnNearest, UINT16* pnFarthest) const;
+    void UpdateReference(const UINT16* pDepthBuffer, int nTile);
+};
@@ -0,0 +1,330 @@
+#include "MatteRefiner.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "ThreadPool.h"
+#include "WindowsHelper.h"
+
+namespace
+{
+    const BYTE cNoPlayer = 0xff;
+
+    struct Dilate
+    {
+        BYTE operator()(BYTE a, BYTE b) const { return std::max(a, b); }
+    };
+
+    struct Erode
+    {
+        BYTE operator()(BYTE a, BYTE b) const { return std::min(a, b); }
+    };
+
+    void MaskRow(const BYTE* pBodyIndexRow, BYTE* pMaskRow, int nWidth)
+    {
+        for (int x = 0; x < nWidth; ++x)
+        {
+            pMaskRow[x] = (pBodyIndexRow[x] != cNoPlayer) ? 0xff : 0;
+        }
+    }
+
+    // Op over the 2 * Radius + 1 pixels centered on each one of a row, the
+    // edge pixels repeated past the ends. The interior leaves out the clamps
+    // so the compiler can vectorize it.
+    template <int Radius, typename Op>
+    void FilterRow(const BYTE* pSource, BYTE* pTarget, int nWidth, Op op)
+    {
+        const int nInteriorBegin = std::min(Radius, nWidth);
+        const int nInteriorEnd = std::max(nWidth - Radius, nInteriorBegin);
+
+        auto clamped = [&](int x)
+        {
+            BYTE value = pSource[x];
+            for (int d = 1; d <= Radius; ++d)
+            {
+                value = op(op(value, pSource[std::max(x - d, 0)]), pSource[std::min(x + d, nWidth - 1)]);
+            }
+            return value;
+        };
+
+        for (int x = 0; x < nInteriorBegin; ++x)
+        {
+            pTarget[x] = clamped(x);
+        }
+
+        for (int x = nInteriorBegin; x < nInteriorEnd; ++x)
+        {
+            BYTE value = pSource[x];
+            for (int d = 1; d <= Radius; ++d)
+            {
+                value = op(op(value, pSource[x - d]), pSource[x + d]);
+            }
+            pTarget[x] = value;
+        }
+
+        for (int x = nInteriorEnd; x < nWidth; ++x)
+        {
+            pTarget[x] = clamped(x);
+        }
+    }
+
+    // The rows of a frame a vertical pass over row y reads, clamped to the frame
+    template <int Radius, typename Pixel>
+    void GetColumnRows(const Pixel* pSource, int nWidth, int nHeight, int y, const Pixel* (&rows)[2 * Radius + 1])
+    {
+        for (int d = -Radius; d <= Radius; ++d)
+        {
+            rows[d + Radius] = pSource + std::min(std::max(y + d, 0), nHeight - 1) * nWidth;
+        }
+    }
+
+    // FilterRow down the columns, row y of the result
+    template <int Radius, typename Op>
+    void FilterColumns(const BYTE* pSource, int nWidth, int nHeight, int y, BYTE* pTarget, Op op)
+    {
+        const BYTE* rows[2 * Radius + 1];
+        GetColumnRows<Radius>(pSource, nWidth, nHeight, y, rows);
+
+        for (int x = 0; x < nWidth; ++x)
+        {
+            BYTE value = rows[0][x];
+            for (int k = 1; k < 2 * Radius + 1; ++k)
+            {
+                value = op(value, rows[k][x]);
+            }
+            pTarget[x] = value;
+        }
+    }
+
+    // The tent's horizontal sums, at most 9 * 255
+    void BlurRow(const BYTE* pSource, UINT16* pTarget, int nWidth)
+    {
+        auto at = [&](int x) { return int(pSource[std::min(std::max(x, 0), nWidth - 1)]); };
+
+        const int nInteriorBegin = std::min(2, nWidth);
+        const int nInteriorEnd = std::max(nWidth - 2, nInteriorBegin);
+
+        for (int x = 0; x < nInteriorBegin; ++x)
+        {
+            pTarget[x] = static_cast<UINT16>(at(x - 2) + 2 * at(x - 1) + 3 * at(x) + 2 * at(x + 1) + at(x + 2));
+        }
+
+        for (int x = nInteriorBegin; x < nInteriorEnd; ++x)
+        {
+            pTarget[x] = static_cast<UINT16>(
+                pSource[x - 2] + 2 * pSource[x - 1] + 3 * pSource[x] + 2 * pSource[x + 1] + pSource[x + 2]);
+        }
+
+        for (int x = nInteriorEnd; x < nWidth; ++x)
+        {
+            pTarget[x] = static_cast<UINT16>(at(x - 2) + 2 * at(x - 1) + 3 * at(x) + 2 * at(x + 1) + at(x + 2));
+        }
+    }
+
+    // Row y of the blurred matte: the vertical sums of the horizontal ones
+    // reach 81 * 255, divided by the weights' 81 rounding to nearest, so a
+    // solid mask keeps 0 and 255 exactly. The division is a multiply and
+    // shift, exact for every sum up to 81 * 256 and a third of the time. The
+    // coverage is written alongside.
+    void BlurColumns(
+        const UINT16* pRowSums,
+        const BYTE* pBodyIndexRow,
+        int nWidth,
+        int nHeight,
+        int y,
+        BYTE* pAlphaRow,
+        BYTE* pCoverageRow)
+    {
+        const UINT16* rows[5];
+        GetColumnRows<2>(pRowSums, nWidth, nHeight, y, rows);
+
+        for (int x = 0; x < nWidth; ++x)
+        {
+            // 16 bit sums keep the vectorized loop at 16 bit lanes
+            const UINT16 nSum = static_cast<UINT16>(rows[0][x] + 2 * rows[1][x] + 3 * rows[2][x] + 2 * rows[3][x] + rows[4][x] + 40);
+            pAlphaRow[x] = static_cast<BYTE>((uint32_t(nSum) * 51782) >> 22);
+        }
+
+        for (int x = 0; x < nWidth; ++x)
+        {
+            const BYTE body = (pBodyIndexRow[x] != cNoPlayer) ? pBodyIndexRow[x] : 0;
+            pCoverageRow[x] = (pAlphaRow[x] != 0) ? body : cNoPlayer;
+        }
+    }
+}
+
+const char* GetMatteRefinementName(MatteRefinement refinement)
+{
+    switch (refinement)
+    {
+    case MatteRefinement_None:
+        return "none";
+    case MatteRefinement_Feather:
+        return "feather";
+    case MatteRefinement_Clean:
+        return "clean";
+    default:
+        return "unknown";
+    }
+}
+
+bool ParseMatteRefinement(const char* pszName, MatteRefinement* pRefinement)
+{
+    const MatteRefinement refinements[] = {MatteRefinement_None, MatteRefinement_Feather, MatteRefinement_Clean};
+    for (MatteRefinement refinement : refinements)
+    {
+        if (pszName && strcmp(pszName, GetMatteRefinementName(refinement)) == 0)
+        {
+            *pRefinement = refinement;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+MatteRefiner::MatteRefiner() :
+    m_nDepthWidth(0),
+    m_nDepthHeight(0)
+{
+}
+
+HRESULT MatteRefiner::Initialize(int nDepthWidth, int nDepthHeight)
+{
+    V_CHECK_HR(nDepthWidth > 0 && nDepthHeight > 0);
+
+    m_nDepthWidth = nDepthWidth;
+    m_nDepthHeight = nDepthHeight;
+
+    const size_t nDepthPixels = size_t(nDepthWidth) * nDepthHeight;
+    m_mask[0].assign(nDepthPixels, 0);
+    m_mask[1].assign(nDepthPixels, 0);
+    m_rowSums.assign(nDepthPixels, 0);
+    m_bandRows.clear();
+
+    return S_OK;
+}
+
+template <typename Pass>
+void MatteRefiner::RunBands(ThreadPool* pThreadPool, int nBands, const Pass& pass)
+{
+    nBands = std::max(1, std::min(nBands, m_nDepthHeight));
+    if (!pThreadPool)
+    {
+        nBands = 1;
+    }
+
+    // each band has a row of its own to hand from one filter to the next
+    const size_t nBandRows = size_t(nBands) * m_nDepthWidth;
+    if (m_bandRows.size() < nBandRows)
+    {
+        m_bandRows.resize(nBandRows);
+    }
+
+    auto runBand = [&](int band)
+    {
+        pass(
+            m_nDepthHeight * band / nBands,
+            m_nDepthHeight * (band + 1) / nBands,
+            m_bandRows.data() + size_t(band) * m_nDepthWidth);
+    };
+
+    if (nBands == 1)
+    {
+        runBand(0);
+        return;
+    }
+
+    pThreadPool->ParallelFor(nBands, runBand);
+}
+
+void MatteRefiner::Refine(
+    MatteRefinement refinement,
+    const BYTE* pBodyIndexBuffer,
+    ThreadPool* pThreadPool,
+    int nBands,
+    BYTE* pAlphaMatte,
+    BYTE* pCoverage)
+{
+    const int nWidth = m_nDepthWidth;
+    const int nHeight = m_nDepthHeight;
+    BYTE* pMask0 = m_mask[0].data();
+    BYTE* pMask1 = m_mask[1].data();
+    UINT16* pRowSums = m_rowSums.data();
+
+    if (refinement == MatteRefinement_None)
+    {
+        RunBands(pThreadPool, nBands, [&](int nBeginRow, int nEndRow, BYTE*)
+        {
+            const size_t nBegin = size_t(nBeginRow) * nWidth;
+            const size_t nCount = size_t(nEndRow - nBeginRow) * nWidth;
+            MaskRow(pBodyIndexBuffer + nBegin, pAlphaMatte + nBegin, static_cast<int>(nCount));
+            memcpy(pCoverage + nBegin, pBodyIndexBuffer + nBegin, nCount);
+        });
+        return;
+    }
+
+    // Each pass finishes the previous one's vertical filter on its rows and
+    // runs the next horizontal one on the result, which only needs that row
+    if (refinement == MatteRefinement_Clean)
+    {
+        // closing: dilate, erode
+        RunBands(pThreadPool, nBands, [&](int nBeginRow, int nEndRow, BYTE* pRow)
+        {
+            for (int y = nBeginRow; y < nEndRow; ++y)
+            {
+                MaskRow(pBodyIndexBuffer + y * nWidth, pRow, nWidth);
+                FilterRow<1>(pRow, pMask0 + y * nWidth, nWidth, Dilate());
+            }
+        });
+
+        // the closing's erosion and the opening's, one over twice the radius
+        RunBands(pThreadPool, nBands, [&](int nBeginRow, int nEndRow, BYTE* pRow)
+        {
+            for (int y = nBeginRow; y < nEndRow; ++y)
+            {
+                FilterColumns<1>(pMask0, nWidth, nHeight, y, pRow, Dilate());
+                FilterRow<2>(pRow, pMask1 + y * nWidth, nWidth, Erode());
+            }
+        });
+
+        // opening: the dilation
+        RunBands(pThreadPool, nBands, [&](int nBeginRow, int nEndRow, BYTE* pRow)
+        {
+            for (int y = nBeginRow; y < nEndRow; ++y)
+            {
+                FilterColumns<2>(pMask1, nWidth, nHeight, y, pRow, Erode());
+                FilterRow<1>(pRow, pMask0 + y * nWidth, nWidth, Dilate());
+            }
+        });
+
+        RunBands(pThreadPool, nBands, [&](int nBeginRow, int nEndRow, BYTE* pRow)
+        {
+            for (int y = nBeginRow; y < nEndRow; ++y)
+            {
+                FilterColumns<1>(pMask0, nWidth, nHeight, y, pRow, Dilate());
+                BlurRow(pRow, pRowSums + y * nWidth, nWidth);
+            }
+        });
+    }
+    else
+    {
+        RunBands(pThreadPool, nBands, [&](int nBeginRow, int nEndRow, BYTE* pRow)
+        {
+            for (int y = nBeginRow; y < nEndRow; ++y)
+            {
+                MaskRow(pBodyIndexBuffer + y * nWidth, pRow, nWidth);
+                BlurRow(pRow, pRowSums + y * nWidth, nWidth);
+            }
+        });
+    }
+
+    RunBands(pThreadPool, nBands, [&](int nBeginRow, int nEndRow, BYTE*)
+    {
+        for (int y = nBeginRow; y < nEndRow; ++y)
+        {
+            BlurColumns(
+                pRowSums, pBodyIndexBuffer + y * nWidth, nWidth, nHeight, y,
+                pAlphaMatte + y * nWidth, pCoverage + y * nWidth);
+        }
+    });
+}
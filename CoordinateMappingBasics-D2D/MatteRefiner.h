@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include "KinectTypes.h"
+
+class ThreadPool;
+
+// How the player mask's edge is refined before compositing. The sensor's
+// body index has a hard, noisy edge that steps by a whole depth pixel, about
+// three color pixels at the distances players stand at.
+enum MatteRefinement
+{
+    // the body index as it is, composited with hard edges
+    MatteRefinement_None = 0,
+    // the mask blurred into an alpha ramp across the edge
+    MatteRefinement_Feather,
+    // a closing fills pinholes and notches, an opening removes specks and
+    // slivers, then the feather's blur
+    MatteRefinement_Clean,
+};
+
+const char* GetMatteRefinementName(MatteRefinement refinement);
+
+// Matches a name from GetMatteRefinementName, false for anything else
+bool ParseMatteRefinement(const char* pszName, MatteRefinement* pRefinement);
+
+// Turns a body index frame into an 8 bit alpha matte in depth space for
+// CompositeFrameMatte. The morphology runs on 3x3 squares, closing then
+// opening; the blur is a 5x5 tent, weights 1 2 3 2 1 along each axis. Both
+// are separable and clamp at the frame's edges, so every pass reads the row
+// or the few rows around it, and the frame is split into row bands for the
+// thread pool between passes.
+class MatteRefiner
+{
+public:
+    MatteRefiner();
+
+    HRESULT Initialize(int nDepthWidth, int nDepthHeight);
+
+    // Refines the frame's body index into pAlphaMatte, one byte per depth
+    // pixel. pCoverage receives a body index frame of the pixels the matte
+    // shows anything of: the pixel's body where it had one, the first body
+    // where the refinement grew the mask, no player where alpha is 0; it is
+    // what region and tile tracking should look at. MatteRefinement_None
+    // gives alpha 255 on the players and a copy of the body index.
+    void Refine(
+        MatteRefinement refinement,
+        const BYTE* pBodyIndexBuffer,
+        ThreadPool* pThreadPool,
+        int nBands,
+        BYTE* pAlphaMatte,
+        BYTE* pCoverage);
+
+private:
+    int m_nDepthWidth;
+    int m_nDepthHeight;
+
+    // ping pong frames between the passes, the blur's horizontal sums and a
+    // row per band for the vertical pass feeding the next horizontal one
+    std::vector<BYTE> m_mask[2];
+    std::vector<UINT16> m_rowSums;
+    std::vector<BYTE> m_bandRows;
+
+    template <typename Pass>
+    void RunBands(ThreadPool* pThreadPool, int nBands, const Pass& pass);
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <algorithm>
+
+// Integer pixel rectangle, right and bottom exclusive
+struct PixelRect
+{
+    int nLeft;
+    int nTop;
+    int nRight;
+    int nBottom;
+
+    bool IsEmpty() const { return nRight <= nLeft || nBottom <= nTop; }
+    int GetWidth() const { return nRight - nLeft; }
+    int GetHeight() const { return nBottom - nTop; }
+    int GetArea() const { return IsEmpty() ? 0 : GetWidth() * GetHeight(); }
+
+    bool ContainsRow(int y) const { return y >= nTop && y < nBottom; }
+
+    bool Intersects(const PixelRect& other) const
+    {
+        return nLeft < other.nRight && other.nLeft < nRight && nTop < other.nBottom && other.nTop < nBottom;
+    }
+
+    void Union(const PixelRect& other)
+    {
+        nLeft = std::min(nLeft, other.nLeft);
+        nTop = std::min(nTop, other.nTop);
+        nRight = std::max(nRight, other.nRight);
+        nBottom = std::max(nBottom, other.nBottom);
+    }
+
+    void Clip(int nWidth, int nHeight)
+    {
+        nLeft = std::max(nLeft, 0);
+        nTop = std::max(nTop, 0);
+        nRight = std::min(nRight, nWidth);
+        nBottom = std::min(nBottom, nHeight);
+    }
+};
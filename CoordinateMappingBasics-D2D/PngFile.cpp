@@ -0,0 +1,243 @@
+#include "PngFile.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include "Deflate.h"
+#include "ThreadPool.h"
+
+namespace
+{
+    const BYTE cSignature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+
+    // ~370KB of filtered data per strip at 1920 wide, enough for deflate to
+    // find its matches and plenty of strips for the pool
+    const int cStripRows = 64;
+
+    const int cBytesPerPixel = 3;
+
+    // zlib header: deflate with a 32K window, fastest level, no dictionary
+    const BYTE cZlibHeader[2] = {0x78, 0x01};
+
+    enum RowFilter
+    {
+        RowFilter_None = 0,
+        RowFilter_Sub = 1,
+        RowFilter_Up = 2,
+        RowFilter_Paeth = 4,
+    };
+
+    const RowFilter cRowFilters[] = {RowFilter_None, RowFilter_Sub, RowFilter_Up, RowFilter_Paeth};
+    const int cRowFilterCount = sizeof(cRowFilters) / sizeof(cRowFilters[0]);
+
+    void Put32BigEndian(BYTE* p, uint32_t nValue)
+    {
+        p[0] = static_cast<BYTE>(nValue >> 24);
+        p[1] = static_cast<BYTE>(nValue >> 16);
+        p[2] = static_cast<BYTE>(nValue >> 8);
+        p[3] = static_cast<BYTE>(nValue);
+    }
+
+    void ToRgb(const RGBQUAD* pRow, int nWidth, BYTE* pRgb)
+    {
+        for (int x = 0; x < nWidth; ++x)
+        {
+            pRgb[0] = pRow[x].rgbRed;
+            pRgb[1] = pRow[x].rgbGreen;
+            pRgb[2] = pRow[x].rgbBlue;
+            pRgb += cBytesPerPixel;
+        }
+    }
+
+    BYTE PaethPredictor(int nLeft, int nAbove, int nAboveLeft)
+    {
+        const int nEstimate = nLeft + nAbove - nAboveLeft;
+        const int nLeftDistance = abs(nEstimate - nLeft);
+        const int nAboveDistance = abs(nEstimate - nAbove);
+        const int nAboveLeftDistance = abs(nEstimate - nAboveLeft);
+
+        if (nLeftDistance <= nAboveDistance && nLeftDistance <= nAboveLeftDistance)
+        {
+            return static_cast<BYTE>(nLeft);
+        }
+
+        return static_cast<BYTE>((nAboveDistance <= nAboveLeftDistance) ? nAbove : nAboveLeft);
+    }
+
+    // Tries each filter on the row and keeps the one whose output has the
+    // smallest sum of absolute values as signed bytes, the usual heuristic.
+    // pCandidate holds nRowBytes scratch bytes, pOutput receives the filter
+    // type byte and the filtered row.
+    void FilterRow(const BYTE* pRow, const BYTE* pAbove, int nRowBytes, BYTE* pCandidate, BYTE* pOutput)
+    {
+        uint64_t nBestCost = UINT64_MAX;
+
+        for (RowFilter filter : cRowFilters)
+        {
+            uint64_t nCost = 0;
+            for (int i = 0; i < nRowBytes; ++i)
+            {
+                const int nLeft = (i >= cBytesPerPixel) ? pRow[i - cBytesPerPixel] : 0;
+                const int nAboveLeft = (i >= cBytesPerPixel) ? pAbove[i - cBytesPerPixel] : 0;
+
+                BYTE nPrediction = 0;
+                switch (filter)
+                {
+                case RowFilter_Sub:
+                    nPrediction = static_cast<BYTE>(nLeft);
+                    break;
+                case RowFilter_Up:
+                    nPrediction = pAbove[i];
+                    break;
+                case RowFilter_Paeth:
+                    nPrediction = PaethPredictor(nLeft, pAbove[i], nAboveLeft);
+                    break;
+                default:
+                    break;
+                }
+
+                pCandidate[i] = static_cast<BYTE>(pRow[i] - nPrediction);
+                nCost += abs(static_cast<signed char>(pCandidate[i]));
+            }
+
+            if (nCost < nBestCost)
+            {
+                nBestCost = nCost;
+                pOutput[0] = static_cast<BYTE>(filter);
+                memcpy(pOutput + 1, pCandidate, nRowBytes);
+            }
+        }
+    }
+
+    // Chunks are built in place: length and type first, the CRC over type and
+    // data once the data is in
+    size_t BeginChunk(std::vector<BYTE>* pOutput, const char* pszType)
+    {
+        const size_t nStart = pOutput->size();
+        pOutput->resize(nStart + 4);
+        pOutput->insert(pOutput->end(), pszType, pszType + 4);
+        return nStart;
+    }
+
+    void EndChunk(std::vector<BYTE>* pOutput, size_t nStart)
+    {
+        const size_t nDataSize = pOutput->size() - nStart - 8;
+        Put32BigEndian(pOutput->data() + nStart, static_cast<uint32_t>(nDataSize));
+
+        const uint32_t nCrc = UpdateCrc32(0, pOutput->data() + nStart + 4, nDataSize + 4);
+        pOutput->resize(pOutput->size() + 4);
+        Put32BigEndian(pOutput->data() + pOutput->size() - 4, nCrc);
+    }
+
+    struct PngStrip
+    {
+        // a complete IDAT chunk
+        std::vector<BYTE> chunk;
+        uint32_t nAdler;
+        size_t nFilteredSize;
+    };
+}
+
+HRESULT EncodePng(
+    const RGBQUAD* pPixels,
+    int nWidth,
+    int nHeight,
+    ThreadPool* pThreadPool,
+    std::vector<BYTE>* pOutput)
+{
+    if (!pPixels || !pOutput || nWidth <= 0 || nHeight <= 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    const int nRowBytes = nWidth * cBytesPerPixel;
+    const int nStripCount = (nHeight + cStripRows - 1) / cStripRows;
+    std::vector<PngStrip> strips(nStripCount);
+
+    auto encodeStrip = [&](int nStrip)
+    {
+        const int nBegin = nStrip * cStripRows;
+        const int nEnd = std::min(nHeight, nBegin + cStripRows);
+
+        std::vector<BYTE> filtered(size_t(nEnd - nBegin) * (1 + nRowBytes));
+        std::vector<BYTE> scratch(3 * size_t(nRowBytes));
+        BYTE* pAbove = scratch.data();
+        BYTE* pRow = pAbove + nRowBytes;
+        BYTE* pCandidate = pRow + nRowBytes;
+
+        // filters look at the row above, which may belong to the previous strip
+        if (nBegin > 0)
+        {
+            ToRgb(pPixels + size_t(nBegin - 1) * nWidth, nWidth, pAbove);
+        }
+        else
+        {
+            memset(pAbove, 0, nRowBytes);
+        }
+
+        for (int y = nBegin; y < nEnd; ++y)
+        {
+            ToRgb(pPixels + size_t(y) * nWidth, nWidth, pRow);
+            FilterRow(pRow, pAbove, nRowBytes, pCandidate, &filtered[size_t(y - nBegin) * (1 + nRowBytes)]);
+            std::swap(pAbove, pRow);
+        }
+
+        PngStrip& strip = strips[nStrip];
+        strip.nAdler = UpdateAdler32(1, filtered.data(), filtered.size());
+        strip.nFilteredSize = filtered.size();
+
+        const size_t nChunk = BeginChunk(&strip.chunk, "IDAT");
+        if (nStrip == 0)
+        {
+            strip.chunk.insert(strip.chunk.end(), cZlibHeader, cZlibHeader + sizeof(cZlibHeader));
+        }
+
+        DeflateCompress(filtered.data(), filtered.size(), nStrip == nStripCount - 1, &strip.chunk);
+        EndChunk(&strip.chunk, nChunk);
+    };
+
+    if (pThreadPool)
+    {
+        pThreadPool->ParallelFor(nStripCount, encodeStrip);
+    }
+    else
+    {
+        for (int i = 0; i < nStripCount; ++i)
+        {
+            encodeStrip(i);
+        }
+    }
+
+    pOutput->assign(cSignature, cSignature + sizeof(cSignature));
+
+    // 8 bits per channel RGB, no interlacing
+    size_t nChunk = BeginChunk(pOutput, "IHDR");
+    BYTE header[13] = {0};
+    Put32BigEndian(header, static_cast<uint32_t>(nWidth));
+    Put32BigEndian(header + 4, static_cast<uint32_t>(nHeight));
+    header[8] = 8;
+    header[9] = 2;
+    pOutput->insert(pOutput->end(), header, header + sizeof(header));
+    EndChunk(pOutput, nChunk);
+
+    uint32_t nAdler = strips[0].nAdler;
+    for (int i = 1; i < nStripCount; ++i)
+    {
+        nAdler = CombineAdler32(nAdler, strips[i].nAdler, strips[i].nFilteredSize);
+    }
+
+    for (const PngStrip& strip : strips)
+    {
+        pOutput->insert(pOutput->end(), strip.chunk.begin(), strip.chunk.end());
+    }
+
+    // the zlib checksum closes the stream in a chunk of its own
+    nChunk = BeginChunk(pOutput, "IDAT");
+    pOutput->resize(pOutput->size() + 4);
+    Put32BigEndian(pOutput->data() + pOutput->size() - 4, nAdler);
+    EndChunk(pOutput, nChunk);
+
+    nChunk = BeginChunk(pOutput, "IEND");
+    EndChunk(pOutput, nChunk);
+
+    return S_OK;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include "KinectTypes.h"
+
+class ThreadPool;
+
+// 24bpp PNG files. The image is cut into strips of rows that are filtered
+// and deflated independently across pThreadPool (null runs them on the
+// calling thread), then stitched into one zlib stream, one IDAT chunk per
+// strip. Strips cost a little ratio since matches cannot reach back across
+// them.
+HRESULT EncodePng(
+    const RGBQUAD* pPixels,
+    int nWidth,
+    int nHeight,
+    ThreadPool* pThreadPool,
+    std::vector<BYTE>* pOutput);
@@ -0,0 +1,131 @@
+#include "QoiFile.h"
+#include <cstring>
+
+namespace
+{
+    const BYTE cOpIndex = 0x00;
+    const BYTE cOpDiff = 0x40;
+    const BYTE cOpLuma = 0x80;
+    const BYTE cOpRun = 0xc0;
+    const BYTE cOpRgb = 0xfe;
+
+    const int cHeaderSize = 14;
+    const int cMaxRun = 62;
+    const BYTE cEndMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+    // every pixel is opaque, so alpha (255 * 11) is a constant in the hash
+    int GetIndexPosition(const RGBQUAD& pixel)
+    {
+        return (pixel.rgbRed * 3 + pixel.rgbGreen * 5 + pixel.rgbBlue * 7 + 255 * 11) % 64;
+    }
+
+    bool SameColor(const RGBQUAD& left, const RGBQUAD& right)
+    {
+        return left.rgbRed == right.rgbRed && left.rgbGreen == right.rgbGreen && left.rgbBlue == right.rgbBlue;
+    }
+
+    void Put32BigEndian(BYTE* p, uint32_t nValue)
+    {
+        p[0] = static_cast<BYTE>(nValue >> 24);
+        p[1] = static_cast<BYTE>(nValue >> 16);
+        p[2] = static_cast<BYTE>(nValue >> 8);
+        p[3] = static_cast<BYTE>(nValue);
+    }
+}
+
+HRESULT EncodeQoi(
+    const RGBQUAD* pPixels,
+    int nWidth,
+    int nHeight,
+    std::vector<BYTE>* pOutput)
+{
+    if (!pPixels || !pOutput || nWidth <= 0 || nHeight <= 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    const size_t nPixels = size_t(nWidth) * nHeight;
+
+    // worst case is an RGB op per pixel
+    pOutput->resize(cHeaderSize + nPixels * 4 + sizeof(cEndMarker));
+    BYTE* pStart = pOutput->data();
+    BYTE* p = pStart;
+
+    memcpy(p, "qoif", 4);
+    Put32BigEndian(p + 4, static_cast<uint32_t>(nWidth));
+    Put32BigEndian(p + 8, static_cast<uint32_t>(nHeight));
+    p[12] = 3;
+    p[13] = 0;
+    p += cHeaderSize;
+
+    // entries start out transparent black, which no opaque pixel can match
+    RGBQUAD index[64];
+    memset(index, 0, sizeof(index));
+
+    RGBQUAD previous = {0, 0, 0, 0xff};
+    int nRun = 0;
+
+    for (size_t i = 0; i < nPixels; ++i)
+    {
+        const RGBQUAD& pixel = pPixels[i];
+
+        if (SameColor(pixel, previous))
+        {
+            ++nRun;
+            if (nRun == cMaxRun || i + 1 == nPixels)
+            {
+                *p++ = static_cast<BYTE>(cOpRun | (nRun - 1));
+                nRun = 0;
+            }
+            continue;
+        }
+
+        if (nRun)
+        {
+            *p++ = static_cast<BYTE>(cOpRun | (nRun - 1));
+            nRun = 0;
+        }
+
+        const int nIndex = GetIndexPosition(pixel);
+        if (index[nIndex].rgbReserved && SameColor(index[nIndex], pixel))
+        {
+            *p++ = static_cast<BYTE>(cOpIndex | nIndex);
+        }
+        else
+        {
+            index[nIndex] = pixel;
+            index[nIndex].rgbReserved = 0xff;
+
+            const int nRed = static_cast<signed char>(pixel.rgbRed - previous.rgbRed);
+            const int nGreen = static_cast<signed char>(pixel.rgbGreen - previous.rgbGreen);
+            const int nBlue = static_cast<signed char>(pixel.rgbBlue - previous.rgbBlue);
+            const int nRedGreen = nRed - nGreen;
+            const int nBlueGreen = nBlue - nGreen;
+
+            if (nRed >= -2 && nRed <= 1 && nGreen >= -2 && nGreen <= 1 && nBlue >= -2 && nBlue <= 1)
+            {
+                *p++ = static_cast<BYTE>(cOpDiff | ((nRed + 2) << 4) | ((nGreen + 2) << 2) | (nBlue + 2));
+            }
+            else if (nGreen >= -32 && nGreen <= 31 && nRedGreen >= -8 && nRedGreen <= 7 && nBlueGreen >= -8 && nBlueGreen <= 7)
+            {
+                *p++ = static_cast<BYTE>(cOpLuma | (nGreen + 32));
+                *p++ = static_cast<BYTE>(((nRedGreen + 8) << 4) | (nBlueGreen + 8));
+            }
+            else
+            {
+                *p++ = cOpRgb;
+                *p++ = pixel.rgbRed;
+                *p++ = pixel.rgbGreen;
+                *p++ = pixel.rgbBlue;
+            }
+        }
+
+        previous = pixel;
+    }
+
+    memcpy(p, cEndMarker, sizeof(cEndMarker));
+    p += sizeof(cEndMarker);
+
+    pOutput->resize(p - pStart);
+    return S_OK;
+}
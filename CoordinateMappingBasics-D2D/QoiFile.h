@@ -0,0 +1,13 @@
+#pragma once
+
+#include <vector>
+#include "KinectTypes.h"
+
+// "Quite OK Image" files (qoiformat.org): lossless, a single pass over the
+// pixels with no entropy coder, several times faster than PNG at a somewhat
+// larger size. Written with 3 channels since the X byte carries nothing.
+HRESULT EncodeQoi(
+    const RGBQUAD* pPixels,
+    int nWidth,
+    int nHeight,
+    std::vector<BYTE>* pOutput);
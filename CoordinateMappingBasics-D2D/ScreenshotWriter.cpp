@@ -0,0 +1,182 @@
+#include "ScreenshotWriter.h"
+#include <cstdio>
+#include <cstring>
+#include "BitmapFile.h"
+#include "WindowsHelper.h"
+
+ScreenshotWriter::ScreenshotWriter() :
+    m_nWidth(0),
+    m_nHeight(0),
+    m_format(ImageFormat_Bmp),
+    m_bBusy(false),
+    m_bStop(false),
+    m_nWritten(0),
+    m_nRefused(0)
+{
+}
+
+ScreenshotWriter::~ScreenshotWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_bStop = true;
+    }
+    m_wake.notify_one();
+
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+HRESULT ScreenshotWriter::Initialize(
+    int nWidth,
+    int nHeight,
+    ImageFormat format,
+    int nEncoderThreads,
+    int nBufferCount)
+{
+    V_CHECK_HR(nWidth > 0 && nHeight > 0 && nBufferCount > 0);
+    V_CHECK_HR(!m_thread.joinable());
+
+    m_nWidth = nWidth;
+    m_nHeight = nHeight;
+    m_format = format;
+
+    if (format == ImageFormat_Png)
+    {
+        m_pEncoderPool = std::make_unique<ThreadPool>(nEncoderThreads);
+    }
+
+    // everything is allocated up front, taking a screenshot allocates nothing
+    for (int i = 0; i < nBufferCount; ++i)
+    {
+        m_buffers.push_back(std::make_unique<RGBQUAD[]>(size_t(nWidth) * nHeight));
+        m_freeBuffers.push_back(i);
+    }
+
+    // room for a BMP, the compressed formats are far smaller
+    m_encoded.reserve(GetBitmapFileSize(nWidth, nHeight));
+    m_thread = std::thread(&ScreenshotWriter::WriterMain, this);
+
+    return S_OK;
+}
+
+HRESULT ScreenshotWriter::Submit(const RGBQUAD* pPixels, const std::string& path, const WriteCallback& done)
+{
+    V_CHECK_HR(pPixels && m_thread.joinable());
+
+    int nBuffer = -1;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_freeBuffers.empty())
+        {
+            ++m_nRefused;
+            return E_PENDING;
+        }
+
+        nBuffer = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+    }
+
+    // the copy is the only part of a screenshot the calling thread pays for
+    RGBQUAD* pCopy = m_buffers[nBuffer].get();
+    memcpy(pCopy, pPixels, size_t(m_nWidth) * m_nHeight * sizeof(RGBQUAD));
+
+    WriteJob job = {pCopy, nBuffer, path, done};
+    return Enqueue(std::move(job));
+}
+
+HRESULT ScreenshotWriter::SubmitBorrowed(const RGBQUAD* pPixels, const std::string& path, const WriteCallback& done)
+{
+    V_CHECK_HR(pPixels && m_thread.joinable());
+
+    WriteJob job = {pPixels, -1, path, done};
+    return Enqueue(std::move(job));
+}
+
+HRESULT ScreenshotWriter::Enqueue(WriteJob&& job)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_jobs.push_back(std::move(job));
+    }
+    m_wake.notify_one();
+
+    return S_OK;
+}
+
+void ScreenshotWriter::Flush()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_idle.wait(lock, [this] { return m_jobs.empty() && !m_bBusy; });
+}
+
+int ScreenshotWriter::GetFreeBufferCount() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return static_cast<int>(m_freeBuffers.size());
+}
+
+void ScreenshotWriter::WriterMain()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    for (;;)
+    {
+        m_wake.wait(lock, [this] { return m_bStop || !m_jobs.empty(); });
+
+        // drain the queue before stopping, nobody's screenshot gets lost
+        if (m_jobs.empty())
+        {
+            break;
+        }
+
+        WriteJob job = std::move(m_jobs.front());
+        m_jobs.pop_front();
+        m_bBusy = true;
+
+        lock.unlock();
+
+        HRESULT hr = SaveJob(job);
+        if (SUCCEEDED(hr))
+        {
+            ++m_nWritten;
+        }
+
+        // borrowed pixels may be reused from inside the callback
+        if (job.done)
+        {
+            job.done(hr, job.path);
+        }
+
+        lock.lock();
+
+        if (job.nBuffer >= 0)
+        {
+            m_freeBuffers.push_back(job.nBuffer);
+        }
+
+        m_bBusy = false;
+        if (m_jobs.empty())
+        {
+            m_idle.notify_all();
+        }
+    }
+}
+
+HRESULT ScreenshotWriter::SaveJob(const WriteJob& job)
+{
+    V_RET(EncodeImage(m_format, job.pPixels, m_nWidth, m_nHeight, m_pEncoderPool.get(), &m_encoded));
+
+    FILE* pFile = fopen(job.path.c_str(), "wb");
+    if (!pFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    const bool bWritten = fwrite(m_encoded.data(), 1, m_encoded.size(), pFile) == m_encoded.size();
+    const bool bClosed = fclose(pFile) == 0;
+
+    return (bWritten && bClosed) ? S_OK : E_FAIL;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "KinectTypes.h"
+#include "ImageEncoder.h"
+#include "ThreadPool.h"
+
+// Encodes frames to BMP, QOI or PNG and writes them on a background thread,
+// so saving an image never stalls the thread that produced it. Submit copies the frame
+// into one of a few preallocated buffers; when all of them are still waiting
+// for the disk the frame is refused instead of waiting.
+class ScreenshotWriter
+{
+public:
+    // enough for a screenshot to be queued while the previous one is written
+    static const int cDefaultBufferCount = 2;
+
+    // run on the writer thread once a file is written or has failed
+    typedef std::function<void(HRESULT hr, const std::string& path)> WriteCallback;
+
+    ScreenshotWriter();
+    // writes whatever is still queued, then stops the thread
+    ~ScreenshotWriter();
+
+    ScreenshotWriter(const ScreenshotWriter&) = delete;
+    ScreenshotWriter& operator=(const ScreenshotWriter&) = delete;
+
+    // PNG strips are deflated on a pool of nEncoderThreads of the writer's own
+    // (0 is one per hardware thread), so they never queue behind compositing
+    HRESULT Initialize(
+        int nWidth,
+        int nHeight,
+        ImageFormat format = ImageFormat_Bmp,
+        int nEncoderThreads = 0,
+        int nBufferCount = cDefaultBufferCount);
+
+    ImageFormat GetFormat() const { return m_format; }
+
+    // Copies pPixels and queues them for writing to path. Returns E_PENDING
+    // when every buffer is in use.
+    HRESULT Submit(const RGBQUAD* pPixels, const std::string& path, const WriteCallback& done);
+
+    // Queues pixels without copying them. The caller keeps them unchanged
+    // until done has run.
+    HRESULT SubmitBorrowed(const RGBQUAD* pPixels, const std::string& path, const WriteCallback& done);
+
+    // blocks until everything queued so far is written
+    void Flush();
+
+    int GetFreeBufferCount() const;
+    uint64_t GetWrittenCount() const { return m_nWritten; }
+    uint64_t GetRefusedCount() const { return m_nRefused; }
+
+private:
+    struct WriteJob
+    {
+        const RGBQUAD* pPixels;
+        // index of the pooled buffer holding the pixels, -1 when borrowed
+        int nBuffer;
+        std::string path;
+        WriteCallback done;
+    };
+
+    int m_nWidth;
+    int m_nHeight;
+    ImageFormat m_format;
+    std::unique_ptr<ThreadPool> m_pEncoderPool;
+
+    std::vector<std::unique_ptr<RGBQUAD[]>> m_buffers;
+    std::vector<int> m_freeBuffers;
+
+    // reused for every file
+    std::vector<BYTE> m_encoded;
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    std::deque<WriteJob> m_jobs;
+    bool m_bBusy;
+    bool m_bStop;
+    std::thread m_thread;
+
+    std::atomic<uint64_t> m_nWritten;
+    std::atomic<uint64_t> m_nRefused;
+
+    HRESULT Enqueue(WriteJob&& job);
+    void WriterMain();
+    HRESULT SaveJob(const WriteJob& job);
+};
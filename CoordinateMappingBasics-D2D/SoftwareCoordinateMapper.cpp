@@ -0,0 +1,875 @@
+#include "SoftwareCoordinateMapper.h"
+#include "CompositeKernel.h"
+#include "WindowsHelper.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+namespace
+{
+    const float cNegativeInfinity = -std::numeric_limits<float>::infinity();
+    const UINT16 cFarthest = 0xffff;
+
+    // fixed point iterations are plenty for the small distortion of the Kinect lenses
+    const int cUndistortIterations = 20;
+
+    // splats are grown slightly so rounding between neighbours never leaves cracks
+    const float cSplatOverlap = 0.1f;
+
+    // What SplatRegions writes into either kind of map. SetRow is called for
+    // every color row of a splat, Write for every pixel that wins the z-test.
+    template <typename DepthMap>
+    class MapWriter;
+
+    template <>
+    class MapWriter<DepthSpacePoint>
+    {
+    public:
+        MapWriter(int /*nDepthWidth*/, int /*nDepthHeight*/) : m_fDepthY(0.0f) {}
+
+        static DepthSpacePoint GetInvalid()
+        {
+            const DepthSpacePoint invalid = {cNegativeInfinity, cNegativeInfinity};
+            return invalid;
+        }
+
+        void SetRow(float fDepthY) { m_fDepthY = fDepthY; }
+
+        void Write(DepthSpacePoint* pPoint, float fDepthX) const
+        {
+            pPoint->X = fDepthX;
+            pPoint->Y = m_fDepthY;
+        }
+
+    private:
+        float m_fDepthY;
+    };
+
+    // GetDepthIndex split into its row and column halves, so the row is only
+    // rounded once per splat row
+    template <>
+    class MapWriter<UINT>
+    {
+    public:
+        MapWriter(int nDepthWidth, int nDepthHeight) :
+            m_fWidth(static_cast<float>(nDepthWidth)),
+            m_fHeight(static_cast<float>(nDepthHeight)),
+            m_nWidth(nDepthWidth),
+            m_bRowValid(false),
+            m_nRowIndex(0)
+        {
+        }
+
+        static UINT GetInvalid() { return cInvalidDepthIndex; }
+
+        void SetRow(float fDepthY)
+        {
+            const float fY = fDepthY + 0.5f;
+            m_bRowValid = fY > -1.0f && fY < m_fHeight;
+            m_nRowIndex = m_bRowValid ? UINT(static_cast<int>(fY) * m_nWidth) : 0;
+        }
+
+        void Write(UINT* pIndex, float fDepthX) const
+        {
+            const float fX = fDepthX + 0.5f;
+            *pIndex = (m_bRowValid && fX > -1.0f && fX < m_fWidth) ? m_nRowIndex + UINT(static_cast<int>(fX)) : cInvalidDepthIndex;
+        }
+
+    private:
+        float m_fWidth;
+        float m_fHeight;
+        int m_nWidth;
+        bool m_bRowValid;
+        UINT m_nRowIndex;
+    };
+
+    // The color pixels [nLeft, nRight) x [nTop, nBottom) a projected depth
+    // pixel covers, unclipped, and what it writes there
+    struct Splat
+    {
+        int nLeft;
+        int nRight;
+        int nTop;
+        int nBottom;
+        UINT16 z;
+        float fInvSizeX;
+        float fInvSizeY;
+    };
+
+    // u, v and zc as ProjectDepthPixel returns them, pSplatScale the pixel's
+    // entry of m_pSplatScales
+    inline void GetSplat(UINT16 depthValue, float u, float v, float zc, const float* pSplatScale, Splat* pSplat)
+    {
+        // size of one depth pixel in color pixels at this distance
+        const float fScale = depthValue * 0.001f / zc;
+        const float fSizeX = pSplatScale[0] * fScale;
+        const float fSizeY = pSplatScale[1] * fScale;
+        const float fHalfX = 0.5f * fSizeX + cSplatOverlap;
+        const float fHalfY = 0.5f * fSizeY + cSplatOverlap;
+
+        pSplat->nLeft = static_cast<int>(ceilf(u - fHalfX));
+        pSplat->nRight = static_cast<int>(floorf(u + fHalfX)) + 1;
+        pSplat->nTop = static_cast<int>(ceilf(v - fHalfY));
+        pSplat->nBottom = static_cast<int>(floorf(v + fHalfY)) + 1;
+
+        pSplat->z = static_cast<UINT16>(std::min(zc * 1000.0f, 65534.0f));
+        pSplat->fInvSizeX = 1.0f / fSizeX;
+        pSplat->fInvSizeY = 1.0f / fSizeY;
+    }
+
+    // Writes the clipped part of a splat wherever it wins the z-test.
+    // pDepthMap and pZBuffer start at color row nMapTop.
+    template <typename DepthMap>
+    inline void WriteSplat(
+        const Splat& splat,
+        int depthX,
+        int depthY,
+        float u,
+        float v,
+        const PixelRect& clip,
+        int nColorWidth,
+        int nMapTop,
+        MapWriter<DepthMap>& writer,
+        DepthMap* pDepthMap,
+        UINT16* pZBuffer)
+    {
+        for (int colorY = clip.nTop; colorY < clip.nBottom; ++colorY)
+        {
+            writer.SetRow(depthY + (colorY - v) * splat.fInvSizeY);
+            const int nRow = (colorY - nMapTop) * nColorWidth;
+
+            for (int colorX = clip.nLeft; colorX < clip.nRight; ++colorX)
+            {
+                const int nColorIndex = nRow + colorX;
+                if (splat.z < pZBuffer[nColorIndex])
+                {
+                    pZBuffer[nColorIndex] = splat.z;
+                    writer.Write(pDepthMap + nColorIndex, depthX + (colorX - u) * splat.fInvSizeX);
+                }
+            }
+        }
+    }
+
+    bool ReadValues(const char* pszValues, float* pValues, int nCount)
+    {
+        for (int i = 0; i < nCount; ++i)
+        {
+            char* pszEnd = nullptr;
+            pValues[i] = strtof(pszValues, &pszEnd);
+            if (pszEnd == pszValues)
+            {
+                return false;
+            }
+            pszValues = pszEnd;
+        }
+
+        return true;
+    }
+
+    bool ReadIntrinsic(const char* pszKey, const char* pszValues, const char* pszCamera, SensorIntrinsics* pIntrinsics, int* pFound)
+    {
+        const size_t nPrefix = strlen(pszCamera);
+        if (strncmp(pszKey, pszCamera, nPrefix) != 0 || pszKey[nPrefix] != '.')
+        {
+            return true;
+        }
+
+        const char* pszField = pszKey + nPrefix + 1;
+        float values[3] = {0};
+
+        if (strcmp(pszField, "size") == 0)
+        {
+            if (!ReadValues(pszValues, values, 2))
+            {
+                return false;
+            }
+            pIntrinsics->nWidth = static_cast<int>(values[0]);
+            pIntrinsics->nHeight = static_cast<int>(values[1]);
+            *pFound |= 1;
+        }
+        else if (strcmp(pszField, "focal") == 0)
+        {
+            if (!ReadValues(pszValues, values, 2))
+            {
+                return false;
+            }
+            pIntrinsics->fFocalLengthX = values[0];
+            pIntrinsics->fFocalLengthY = values[1];
+            *pFound |= 2;
+        }
+        else if (strcmp(pszField, "principal") == 0)
+        {
+            if (!ReadValues(pszValues, values, 2))
+            {
+                return false;
+            }
+            pIntrinsics->fPrincipalPointX = values[0];
+            pIntrinsics->fPrincipalPointY = values[1];
+            *pFound |= 4;
+        }
+        else if (strcmp(pszField, "radial") == 0)
+        {
+            if (!ReadValues(pszValues, values, 3))
+            {
+                return false;
+            }
+            pIntrinsics->fRadialK2 = values[0];
+            pIntrinsics->fRadialK4 = values[1];
+            pIntrinsics->fRadialK6 = values[2];
+        }
+
+        return true;
+    }
+
+    inline bool IsValid(const DepthSpacePoint& p)
+    {
+        return p.X != cNegativeInfinity && p.Y != cNegativeInfinity;
+    }
+}
+
+HRESULT LoadSensorCalibration(const char* pszPath, SensorCalibration* pCalibration)
+{
+    if (!pszPath || !pCalibration)
+    {
+        return E_INVALIDARG;
+    }
+
+    FILE* pFile = fopen(pszPath, "r");
+    if (!pFile)
+    {
+        return E_ACCESSDENIED;
+    }
+
+    SensorCalibration calibration;
+    memset(&calibration, 0, sizeof(calibration));
+
+    int nDepthFound = 0;
+    int nColorFound = 0;
+    bool bRotation = false;
+    bool bTranslation = false;
+    bool bParsed = true;
+
+    char szLine[512];
+    while (bParsed && fgets(szLine, sizeof(szLine), pFile))
+    {
+        char szKey[64];
+        int nKeyLength = 0;
+        if (szLine[0] == '#' || sscanf(szLine, "%63s%n", szKey, &nKeyLength) != 1)
+        {
+            continue;
+        }
+
+        const char* pszValues = szLine + nKeyLength;
+
+        if (strcmp(szKey, "rotation") == 0)
+        {
+            bParsed = bRotation = ReadValues(pszValues, calibration.rotation, 9);
+        }
+        else if (strcmp(szKey, "translation") == 0)
+        {
+            bParsed = bTranslation = ReadValues(pszValues, calibration.translation, 3);
+        }
+        else
+        {
+            bParsed = ReadIntrinsic(szKey, pszValues, "depth", &calibration.depth, &nDepthFound) &&
+                ReadIntrinsic(szKey, pszValues, "color", &calibration.color, &nColorFound);
+        }
+    }
+
+    fclose(pFile);
+
+    // size, focal length and principal point are required, distortion defaults to none
+    V_CHECK_HR(bParsed && bRotation && bTranslation && nDepthFound == 7 && nColorFound == 7);
+
+    *pCalibration = calibration;
+    return S_OK;
+}
+
+SensorIntrinsics ScaleSensorIntrinsics(const SensorIntrinsics& intrinsics, int nWidth, int nHeight)
+{
+    const float fScaleX = float(nWidth) / intrinsics.nWidth;
+    const float fScaleY = float(nHeight) / intrinsics.nHeight;
+
+    // pixel centers sit at integer coordinates, so the principal point
+    // scales about the image's corner half a pixel off
+    SensorIntrinsics scaled = intrinsics;
+    scaled.nWidth = nWidth;
+    scaled.nHeight = nHeight;
+    scaled.fFocalLengthX = intrinsics.fFocalLengthX * fScaleX;
+    scaled.fFocalLengthY = intrinsics.fFocalLengthY * fScaleY;
+    scaled.fPrincipalPointX = (intrinsics.fPrincipalPointX + 0.5f) * fScaleX - 0.5f;
+    scaled.fPrincipalPointY = (intrinsics.fPrincipalPointY + 0.5f) * fScaleY - 0.5f;
+    return scaled;
+}
+
+SensorCalibration ScaleSensorCalibration(
+    const SensorCalibration& calibration,
+    int nDepthWidth,
+    int nDepthHeight,
+    int nColorWidth,
+    int nColorHeight)
+{
+    SensorCalibration scaled = calibration;
+    scaled.depth = ScaleSensorIntrinsics(calibration.depth, nDepthWidth, nDepthHeight);
+    scaled.color = ScaleSensorIntrinsics(calibration.color, nColorWidth, nColorHeight);
+    return scaled;
+}
+
+void CompareDepthSpaceMappings(
+    const DepthSpacePoint* pReference,
+    const DepthSpacePoint* pMapping,
+    UINT nCount,
+    MappingError* pError)
+{
+    memset(pError, 0, sizeof(*pError));
+
+    double fTotalError = 0.0;
+    for (UINT i = 0; i < nCount; ++i)
+    {
+        const bool bReferenceValid = IsValid(pReference[i]);
+        const bool bMappingValid = IsValid(pMapping[i]);
+
+        if (bReferenceValid != bMappingValid)
+        {
+            ++pError->nValidityMismatch;
+            continue;
+        }
+
+        if (!bReferenceValid)
+        {
+            continue;
+        }
+
+        ++pError->nBothValid;
+
+        const float dx = pReference[i].X - pMapping[i].X;
+        const float dy = pReference[i].Y - pMapping[i].Y;
+        const float fError = sqrtf(dx * dx + dy * dy);
+        fTotalError += fError;
+        pError->fMaxError = std::max(pError->fMaxError, fError);
+
+        if (static_cast<int>(pReference[i].X + 0.5f) != static_cast<int>(pMapping[i].X + 0.5f) ||
+            static_cast<int>(pReference[i].Y + 0.5f) != static_cast<int>(pMapping[i].Y + 0.5f))
+        {
+            ++pError->nPixelMismatch;
+        }
+    }
+
+    if (pError->nBothValid)
+    {
+        pError->fMeanError = static_cast<float>(fTotalError / pError->nBothValid);
+    }
+}
+
+namespace
+{
+    const char cReferenceMappingMagic[4] = {'M', 'A', 'P', 'R'};
+
+    struct ReferenceMappingHeader
+    {
+        char magic[4];
+        int32_t nDepthWidth;
+        int32_t nDepthHeight;
+        int32_t nColorWidth;
+        int32_t nColorHeight;
+    };
+}
+
+HRESULT SaveReferenceMapping(const char* pszPath, const ReferenceMapping& mapping)
+{
+    V_CHECK_HR(pszPath && mapping.nDepthWidth > 0 && mapping.nDepthHeight > 0 && mapping.nColorWidth > 0 && mapping.nColorHeight > 0);
+    V_CHECK_HR(mapping.depth.size() == size_t(mapping.nDepthWidth) * mapping.nDepthHeight);
+    V_CHECK_HR(mapping.points.size() == size_t(mapping.nColorWidth) * mapping.nColorHeight);
+
+    ReferenceMappingHeader header;
+    memcpy(header.magic, cReferenceMappingMagic, sizeof(header.magic));
+    header.nDepthWidth = mapping.nDepthWidth;
+    header.nDepthHeight = mapping.nDepthHeight;
+    header.nColorWidth = mapping.nColorWidth;
+    header.nColorHeight = mapping.nColorHeight;
+
+    FILE* pFile = fopen(pszPath, "wb");
+    if (!pFile)
+    {
+        return E_FAIL;
+    }
+
+    bool bWritten = fwrite(&header, sizeof(header), 1, pFile) == 1;
+    bWritten = bWritten && fwrite(mapping.depth.data(), sizeof(UINT16), mapping.depth.size(), pFile) == mapping.depth.size();
+    bWritten = bWritten && fwrite(mapping.points.data(), sizeof(DepthSpacePoint), mapping.points.size(), pFile) == mapping.points.size();
+    const bool bClosed = fclose(pFile) == 0;
+
+    return (bWritten && bClosed) ? S_OK : E_FAIL;
+}
+
+HRESULT LoadReferenceMapping(const char* pszPath, ReferenceMapping* pMapping)
+{
+    V_CHECK_HR(pszPath && pMapping);
+
+    FILE* pFile = fopen(pszPath, "rb");
+    if (!pFile)
+    {
+        return E_FAIL;
+    }
+
+    // the sizes bound the reads below, a few thousand pixels on a side is
+    // already far beyond any sensor
+    const int32_t nMaxSize = 16384;
+    ReferenceMappingHeader header;
+    bool bRead = fread(&header, sizeof(header), 1, pFile) == 1 &&
+        memcmp(header.magic, cReferenceMappingMagic, sizeof(header.magic)) == 0 &&
+        header.nDepthWidth > 0 && header.nDepthWidth <= nMaxSize && header.nDepthHeight > 0 && header.nDepthHeight <= nMaxSize &&
+        header.nColorWidth > 0 && header.nColorWidth <= nMaxSize && header.nColorHeight > 0 && header.nColorHeight <= nMaxSize;
+
+    if (bRead)
+    {
+        pMapping->nDepthWidth = header.nDepthWidth;
+        pMapping->nDepthHeight = header.nDepthHeight;
+        pMapping->nColorWidth = header.nColorWidth;
+        pMapping->nColorHeight = header.nColorHeight;
+        pMapping->depth.resize(size_t(header.nDepthWidth) * header.nDepthHeight);
+        pMapping->points.resize(size_t(header.nColorWidth) * header.nColorHeight);
+
+        bRead = fread(pMapping->depth.data(), sizeof(UINT16), pMapping->depth.size(), pFile) == pMapping->depth.size() &&
+            fread(pMapping->points.data(), sizeof(DepthSpacePoint), pMapping->points.size(), pFile) == pMapping->points.size();
+    }
+
+    fclose(pFile);
+    return bRead ? S_OK : E_FAIL;
+}
+
+SoftwareCoordinateMapper::SoftwareCoordinateMapper() :
+    m_pRowBlockDepth(nullptr),
+    m_nRowBlockRows(0)
+{
+    memset(&m_referenceCalibration, 0, sizeof(m_referenceCalibration));
+    memset(&m_calibration, 0, sizeof(m_calibration));
+}
+
+HRESULT SoftwareCoordinateMapper::Initialize(const SensorCalibration& calibration)
+{
+    V_RET(BuildTables(calibration));
+
+    m_referenceCalibration = calibration;
+    return S_OK;
+}
+
+HRESULT SoftwareCoordinateMapper::SetFrameGeometry(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight)
+{
+    V_CHECK_HR(m_pColorRays && nDepthWidth > 0 && nDepthHeight > 0 && nColorWidth > 0 && nColorHeight > 0);
+
+    if (m_calibration.depth.nWidth == nDepthWidth && m_calibration.depth.nHeight == nDepthHeight &&
+        m_calibration.color.nWidth == nColorWidth && m_calibration.color.nHeight == nColorHeight)
+    {
+        return S_OK;
+    }
+
+    return BuildTables(ScaleSensorCalibration(m_referenceCalibration, nDepthWidth, nDepthHeight, nColorWidth, nColorHeight));
+}
+
+HRESULT SoftwareCoordinateMapper::BuildTables(const SensorCalibration& calibration)
+{
+    const SensorIntrinsics& depth = calibration.depth;
+    const SensorIntrinsics& color = calibration.color;
+
+    if (depth.nWidth <= 0 || depth.nHeight <= 0 || color.nWidth <= 0 || color.nHeight <= 0 ||
+        depth.fFocalLengthX <= 0 || depth.fFocalLengthY <= 0 ||
+        color.fFocalLengthX <= 0 || color.fFocalLengthY <= 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_calibration = calibration;
+
+    const int nDepthCount = depth.nWidth * depth.nHeight;
+    m_pUnprojection = std::make_unique<float[]>(nDepthCount * 2);
+    m_pColorRays = std::make_unique<float[]>(nDepthCount * 3);
+    m_pSplatScales.reset();
+    m_pZBuffer.reset();
+    m_pRowBlockDepth = nullptr;
+
+    const float* R = calibration.rotation;
+
+    for (int y = 0; y < depth.nHeight; ++y)
+    {
+        for (int x = 0; x < depth.nWidth; ++x)
+        {
+            const float xd = (x - depth.fPrincipalPointX) / depth.fFocalLengthX;
+            const float yd = (y - depth.fPrincipalPointY) / depth.fFocalLengthY;
+
+            // invert the radial distortion
+            float xu = xd;
+            float yu = yd;
+            for (int nIteration = 0; nIteration < cUndistortIterations; ++nIteration)
+            {
+                const float r2 = xu * xu + yu * yu;
+                const float f = 1.0f + r2 * (depth.fRadialK2 + r2 * (depth.fRadialK4 + r2 * depth.fRadialK6));
+                xu = xd / f;
+                yu = yd / f;
+            }
+
+            const int i = x + y * depth.nWidth;
+            m_pUnprojection[2 * i + 0] = xu;
+            m_pUnprojection[2 * i + 1] = yu;
+
+            m_pColorRays[3 * i + 0] = R[0] * xu + R[1] * yu + R[2];
+            m_pColorRays[3 * i + 1] = R[3] * xu + R[4] * yu + R[5];
+            m_pColorRays[3 * i + 2] = R[6] * xu + R[7] * yu + R[8];
+        }
+    }
+
+    // The spacing of the rays around each pixel rather than 1 / focal
+    // length: the depth lens's distortion widens the pixels toward the
+    // corners by far more than the splats' overlap covers
+    m_pSplatScales = std::make_unique<float[]>(nDepthCount * 2);
+    for (int y = 0; y < depth.nHeight; ++y)
+    {
+        const int nUp = std::max(y - 1, 0);
+        const int nDown = std::min(y + 1, depth.nHeight - 1);
+
+        for (int x = 0; x < depth.nWidth; ++x)
+        {
+            const int nLeft = std::max(x - 1, 0);
+            const int nRight = std::min(x + 1, depth.nWidth - 1);
+            const float* pLeft = &m_pUnprojection[2 * (nLeft + y * depth.nWidth)];
+            const float* pRight = &m_pUnprojection[2 * (nRight + y * depth.nWidth)];
+            const float* pUp = &m_pUnprojection[2 * (x + nUp * depth.nWidth)];
+            const float* pDown = &m_pUnprojection[2 * (x + nDown * depth.nWidth)];
+
+            const int i = x + y * depth.nWidth;
+            m_pSplatScales[2 * i + 0] = color.fFocalLengthX * (pRight[0] - pLeft[0]) / std::max(nRight - nLeft, 1);
+            m_pSplatScales[2 * i + 1] = color.fFocalLengthY * (pDown[1] - pUp[1]) / std::max(nDown - nUp, 1);
+        }
+    }
+
+    return S_OK;
+}
+
+bool SoftwareCoordinateMapper::ProjectDepthPixel(int nDepthIndex, UINT16 depth, float* pColorX, float* pColorY, float* pColorZ) const
+{
+    if (depth == 0)
+    {
+        return false;
+    }
+
+    const float z = depth * 0.001f;
+    const float* pRay = m_pColorRays.get() + 3 * nDepthIndex;
+    const float* T = m_calibration.translation;
+
+    const float X = pRay[0] * z + T[0];
+    const float Y = pRay[1] * z + T[1];
+    const float Z = pRay[2] * z + T[2];
+
+    if (Z <= 0.0f)
+    {
+        return false;
+    }
+
+    const SensorIntrinsics& color = m_calibration.color;
+    const float xn = X / Z;
+    const float yn = Y / Z;
+    const float r2 = xn * xn + yn * yn;
+    const float f = 1.0f + r2 * (color.fRadialK2 + r2 * (color.fRadialK4 + r2 * color.fRadialK6));
+
+    *pColorX = color.fFocalLengthX * xn * f + color.fPrincipalPointX;
+    *pColorY = color.fFocalLengthY * yn * f + color.fPrincipalPointY;
+    *pColorZ = Z;
+
+    return true;
+}
+
+HRESULT SoftwareCoordinateMapper::MapColorFrameToDepthSpace(
+    UINT nDepthPointCount,
+    const UINT16* pDepthFrameData,
+    UINT nColorPointCount,
+    DepthSpacePoint* pDepthSpacePoints)
+{
+    const PixelRect frame = {0, 0, m_calibration.color.nWidth, m_calibration.color.nHeight};
+
+    return MapColorRegionsToDepthSpace(nDepthPointCount, pDepthFrameData, nColorPointCount, pDepthSpacePoints, &frame, 1);
+}
+
+HRESULT SoftwareCoordinateMapper::MapColorRegionsToDepthSpace(
+    UINT nDepthPointCount,
+    const UINT16* pDepthFrameData,
+    UINT nColorPointCount,
+    DepthSpacePoint* pDepthSpacePoints,
+    const PixelRect* pRects,
+    int nRectCount)
+{
+    return SplatRegions(nDepthPointCount, pDepthFrameData, nColorPointCount, pDepthSpacePoints, pRects, nRectCount);
+}
+
+HRESULT SoftwareCoordinateMapper::MapColorRegionsToDepthIndices(
+    UINT nDepthPointCount,
+    const UINT16* pDepthFrameData,
+    UINT nColorPointCount,
+    UINT* pDepthIndices,
+    const PixelRect* pRects,
+    int nRectCount)
+{
+    return SplatRegions(nDepthPointCount, pDepthFrameData, nColorPointCount, pDepthIndices, pRects, nRectCount);
+}
+
+template <typename DepthMap>
+HRESULT SoftwareCoordinateMapper::SplatRegions(
+    UINT nDepthPointCount,
+    const UINT16* pDepthFrameData,
+    UINT nColorPointCount,
+    DepthMap* pDepthMap,
+    const PixelRect* pRects,
+    int nRectCount)
+{
+    const SensorIntrinsics& depth = m_calibration.depth;
+    const SensorIntrinsics& color = m_calibration.color;
+
+    if (!m_pColorRays || !pDepthFrameData || !pDepthMap || (nRectCount > 0 && !pRects) ||
+        nDepthPointCount != UINT(depth.nWidth * depth.nHeight) ||
+        nColorPointCount != UINT(color.nWidth * color.nHeight))
+    {
+        return E_INVALIDARG;
+    }
+
+    if (!m_pZBuffer)
+    {
+        m_pZBuffer.reset(new UINT16[color.nWidth * color.nHeight]);
+    }
+
+    MapWriter<DepthMap> writer(depth.nWidth, depth.nHeight);
+    const DepthMap invalid = MapWriter<DepthMap>::GetInvalid();
+
+    for (int nRect = 0; nRect < nRectCount; ++nRect)
+    {
+        PixelRect rect = pRects[nRect];
+        rect.Clip(color.nWidth, color.nHeight);
+
+        for (int y = rect.nTop; y < rect.nBottom; ++y)
+        {
+            const int nRow = y * color.nWidth;
+            std::fill(pDepthMap + nRow + rect.nLeft, pDepthMap + nRow + rect.nRight, invalid);
+            std::fill(m_pZBuffer.get() + nRow + rect.nLeft, m_pZBuffer.get() + nRow + rect.nRight, cFarthest);
+        }
+    }
+
+    for (int depthY = 0; depthY < depth.nHeight; ++depthY)
+    {
+        for (int depthX = 0; depthX < depth.nWidth; ++depthX)
+        {
+            const int nDepthIndex = depthX + depthY * depth.nWidth;
+            const UINT16 depthValue = pDepthFrameData[nDepthIndex];
+
+            float u = 0, v = 0, zc = 0;
+            if (!ProjectDepthPixel(nDepthIndex, depthValue, &u, &v, &zc))
+            {
+                continue;
+            }
+
+            Splat splat;
+            GetSplat(depthValue, u, v, zc, &m_pSplatScales[2 * nDepthIndex], &splat);
+
+            for (int nRect = 0; nRect < nRectCount; ++nRect)
+            {
+                const PixelRect& rect = pRects[nRect];
+                const PixelRect clip =
+                {
+                    std::max(std::max(splat.nLeft, rect.nLeft), 0),
+                    std::max(std::max(splat.nTop, rect.nTop), 0),
+                    std::min(std::min(splat.nRight, rect.nRight), color.nWidth),
+                    std::min(std::min(splat.nBottom, rect.nBottom), color.nHeight),
+                };
+
+                WriteSplat(splat, depthX, depthY, u, v, clip, color.nWidth, 0, writer, pDepthMap, m_pZBuffer.get());
+            }
+        }
+    }
+
+    return S_OK;
+}
+
+HRESULT SoftwareCoordinateMapper::PrepareColorRowBlocks(
+    UINT nDepthPointCount,
+    const UINT16* pDepthFrameData,
+    int nBlockRows)
+{
+    const SensorIntrinsics& depth = m_calibration.depth;
+    const SensorIntrinsics& color = m_calibration.color;
+
+    if (!m_pColorRays || !pDepthFrameData || nBlockRows <= 0 || nDepthPointCount != UINT(depth.nWidth * depth.nHeight))
+    {
+        return E_INVALIDARG;
+    }
+
+    const int nBlocks = (color.nHeight + nBlockRows - 1) / nBlockRows;
+
+    m_pRowBlockDepth = pDepthFrameData;
+    m_nRowBlockRows = nBlockRows;
+    m_rowBlockProjections.resize(size_t(3) * nDepthPointCount);
+    m_rowBlockSpans.resize(size_t(2) * nDepthPointCount);
+    m_rowBlockStarts.assign(nBlocks + 1, 0);
+
+    // project everything once, noting the blocks each splat reaches into and
+    // counting the pixels each block gets; a zero z marks the depth pixels
+    // that project nowhere, an empty span the ones that miss the frame
+    for (UINT i = 0; i < nDepthPointCount; ++i)
+    {
+        float* pProjection = &m_rowBlockProjections[3 * i];
+        UINT16* pSpan = &m_rowBlockSpans[2 * i];
+        pSpan[0] = 1;
+        pSpan[1] = 0;
+
+        if (!ProjectDepthPixel(static_cast<int>(i), pDepthFrameData[i], &pProjection[0], &pProjection[1], &pProjection[2]))
+        {
+            pProjection[2] = 0.0f;
+            continue;
+        }
+
+        Splat splat;
+        GetSplat(pDepthFrameData[i], pProjection[0], pProjection[1], pProjection[2], &m_pSplatScales[2 * i], &splat);
+
+        const int nTop = std::max(splat.nTop, 0);
+        const int nBottom = std::min(splat.nBottom, color.nHeight);
+        if (nTop >= nBottom || splat.nLeft >= color.nWidth || splat.nRight <= 0)
+        {
+            continue;
+        }
+
+        pSpan[0] = static_cast<UINT16>(nTop / nBlockRows);
+        pSpan[1] = static_cast<UINT16>((nBottom - 1) / nBlockRows);
+        for (int nBlock = pSpan[0]; nBlock <= pSpan[1]; ++nBlock)
+        {
+            ++m_rowBlockStarts[nBlock + 1];
+        }
+    }
+
+    for (int nBlock = 0; nBlock < nBlocks; ++nBlock)
+    {
+        m_rowBlockStarts[nBlock + 1] += m_rowBlockStarts[nBlock];
+    }
+
+    // then list them, in raster order so the z-test breaks ties the way the
+    // whole frame splat does
+    m_rowBlockCursors.assign(m_rowBlockStarts.begin(), m_rowBlockStarts.end() - 1);
+    m_rowBlockPixels.resize(m_rowBlockStarts[nBlocks]);
+
+    for (UINT i = 0; i < nDepthPointCount; ++i)
+    {
+        const UINT16* pSpan = &m_rowBlockSpans[2 * i];
+        for (int nBlock = pSpan[0]; nBlock <= pSpan[1]; ++nBlock)
+        {
+            m_rowBlockPixels[m_rowBlockCursors[nBlock]++] = i;
+        }
+    }
+
+    return S_OK;
+}
+
+HRESULT SoftwareCoordinateMapper::MapColorRowBlockToDepthIndices(
+    int nBlock,
+    UINT* pDepthIndices,
+    UINT16* pZBuffer) const
+{
+    const SensorIntrinsics& depth = m_calibration.depth;
+    const SensorIntrinsics& color = m_calibration.color;
+
+    if (!m_pRowBlockDepth || !pDepthIndices || !pZBuffer || nBlock < 0 || nBlock + 1 >= int(m_rowBlockStarts.size()))
+    {
+        return E_INVALIDARG;
+    }
+
+    const int nTop = nBlock * m_nRowBlockRows;
+    const int nBottom = std::min(nTop + m_nRowBlockRows, color.nHeight);
+    const size_t nPixels = size_t(nBottom - nTop) * color.nWidth;
+
+    std::fill(pDepthIndices, pDepthIndices + nPixels, cInvalidDepthIndex);
+    std::fill(pZBuffer, pZBuffer + nPixels, cFarthest);
+
+    MapWriter<UINT> writer(depth.nWidth, depth.nHeight);
+
+    for (UINT k = m_rowBlockStarts[nBlock]; k < m_rowBlockStarts[nBlock + 1]; ++k)
+    {
+        const UINT i = m_rowBlockPixels[k];
+        const float* pProjection = &m_rowBlockProjections[3 * i];
+        const float u = pProjection[0];
+        const float v = pProjection[1];
+
+        Splat splat;
+        GetSplat(m_pRowBlockDepth[i], u, v, pProjection[2], &m_pSplatScales[2 * i], &splat);
+
+        const PixelRect clip =
+        {
+            std::max(splat.nLeft, 0),
+            std::max(splat.nTop, nTop),
+            std::min(splat.nRight, color.nWidth),
+            std::min(splat.nBottom, nBottom),
+        };
+
+        WriteSplat(splat, static_cast<int>(i % depth.nWidth), static_cast<int>(i / depth.nWidth), u, v, clip,
+            color.nWidth, nTop, writer, pDepthIndices, pZBuffer);
+    }
+
+    return S_OK;
+}
+
+HRESULT SoftwareCoordinateMapper::MapDepthPointsToColorSpace(
+    UINT nPointCount,
+    const DepthSpacePoint* pDepthPoints,
+    const UINT16* pDepths,
+    ColorSpacePoint* pColorPoints)
+{
+    const SensorIntrinsics& depth = m_calibration.depth;
+
+    if (!m_pColorRays || (nPointCount > 0 && (!pDepthPoints || !pDepths || !pColorPoints)))
+    {
+        return E_INVALIDARG;
+    }
+
+    for (UINT i = 0; i < nPointCount; ++i)
+    {
+        // also rejects -infinity and NaN
+        const float fX = pDepthPoints[i].X + 0.5f;
+        const float fY = pDepthPoints[i].Y + 0.5f;
+        const bool bInside = fX >= 0.0f && fX < depth.nWidth && fY >= 0.0f && fY < depth.nHeight;
+
+        float zc = 0;
+        ColorSpacePoint& p = pColorPoints[i];
+        if (!bInside || !ProjectDepthPixel(static_cast<int>(fX) + static_cast<int>(fY) * depth.nWidth, pDepths[i], &p.X, &p.Y, &zc))
+        {
+            p.X = cNegativeInfinity;
+            p.Y = cNegativeInfinity;
+        }
+    }
+
+    return S_OK;
+}
+
+HRESULT SoftwareCoordinateMapper::MapDepthFrameToColorSpace(
+    UINT nDepthPointCount,
+    const UINT16* pDepthFrameData,
+    UINT nColorPointCount,
+    ColorSpacePoint* pColorSpacePoints)
+{
+    const SensorIntrinsics& depth = m_calibration.depth;
+
+    if (!m_pColorRays || !pDepthFrameData || !pColorSpacePoints ||
+        nDepthPointCount != UINT(depth.nWidth * depth.nHeight) ||
+        nColorPointCount != nDepthPointCount)
+    {
+        return E_INVALIDARG;
+    }
+
+    for (UINT i = 0; i < nDepthPointCount; ++i)
+    {
+        float zc = 0;
+        ColorSpacePoint& p = pColorSpacePoints[i];
+        if (!ProjectDepthPixel(static_cast<int>(i), pDepthFrameData[i], &p.X, &p.Y, &zc))
+        {
+            p.X = cNegativeInfinity;
+            p.Y = cNegativeInfinity;
+        }
+    }
+
+    return S_OK;
+}
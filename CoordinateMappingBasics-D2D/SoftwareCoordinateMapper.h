@@ -0,0 +1,205 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "ColorToDepthMapper.h"
+
+// Pinhole model with Brown radial distortion (k2, k4, k6), same terms the SDK
+// reports through ICoordinateMapper::GetDepthCameraIntrinsics.
+struct SensorIntrinsics
+{
+    int nWidth;
+    int nHeight;
+    float fFocalLengthX;
+    float fFocalLengthY;
+    float fPrincipalPointX;
+    float fPrincipalPointY;
+    float fRadialK2;
+    float fRadialK4;
+    float fRadialK6;
+};
+
+struct SensorCalibration
+{
+    SensorIntrinsics depth;
+    SensorIntrinsics color;
+
+    // depth camera to color camera, row major rotation, translation in meters
+    float rotation[9];
+    float translation[3];
+};
+
+// Reads a calibration file made of "key value..." lines:
+//   depth.size 512 424          color.size 1920 1080
+//   depth.focal fx fy           color.focal fx fy
+//   depth.principal cx cy       color.principal cx cy
+//   depth.radial k2 k4 k6       color.radial k2 k4 k6
+//   rotation r00 r01 ... r22    translation tx ty tz
+// Lines starting with # are ignored.
+HRESULT LoadSensorCalibration(const char* pszPath, SensorCalibration* pCalibration);
+
+// The same cameras delivering frames of another size, e.g. a sensor mode
+// with binned or unbinned pixels: focal lengths and principal points scale
+// with the image, the distortion (at unit depth) and the extrinsics do not.
+SensorIntrinsics ScaleSensorIntrinsics(const SensorIntrinsics& intrinsics, int nWidth, int nHeight);
+SensorCalibration ScaleSensorCalibration(
+    const SensorCalibration& calibration,
+    int nDepthWidth,
+    int nDepthHeight,
+    int nColorWidth,
+    int nColorHeight);
+
+struct MappingError
+{
+    // color pixels where both mappings are valid
+    UINT nBothValid;
+    // color pixels valid in exactly one of the mappings
+    UINT nValidityMismatch;
+    // both valid but rounding to a different depth pixel
+    UINT nPixelMismatch;
+    float fMeanError;
+    float fMaxError;
+};
+
+// Compares a mapping against a reference (e.g. a saved SDK mapping), errors in depth pixels.
+void CompareDepthSpaceMappings(
+    const DepthSpacePoint* pReference,
+    const DepthSpacePoint* pMapping,
+    UINT nCount,
+    MappingError* pError);
+
+// A depth frame and the color to depth mapping of it, e.g. what the SDK's
+// MapColorFrameToDepthSpace returned, kept to check the software mapper against
+struct ReferenceMapping
+{
+    int nDepthWidth;
+    int nDepthHeight;
+    int nColorWidth;
+    int nColorHeight;
+    std::vector<UINT16> depth;
+    std::vector<DepthSpacePoint> points;
+};
+
+// A small header of the four sizes, then the depth frame and the points as they are in memory
+HRESULT SaveReferenceMapping(const char* pszPath, const ReferenceMapping& mapping);
+HRESULT LoadReferenceMapping(const char* pszPath, ReferenceMapping* pMapping);
+
+// Color to depth mapping computed from a calibration instead of the SDK, so it
+// runs off device. Everything that only depends on the calibration is folded
+// into per depth pixel tables up front. Each frame the depth pixels are
+// projected into color space and splatted over the color pixels they cover,
+// with a z-buffer keeping the nearest surface. That touches the 217k depth
+// pixels rather than searching from the 2M color pixels.
+class SoftwareCoordinateMapper : public ColorToDepthMapper
+{
+public:
+    SoftwareCoordinateMapper();
+
+    HRESULT Initialize(const SensorCalibration& calibration);
+
+    // Rebuilds the tables for the calibration Initialize was given scaled to
+    // the new frame sizes, nothing when they are the current ones
+    HRESULT SetFrameGeometry(int nDepthWidth, int nDepthHeight, int nColorWidth, int nColorHeight) override;
+
+    HRESULT MapColorFrameToDepthSpace(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        UINT nColorPointCount,
+        DepthSpacePoint* pDepthSpacePoints) override;
+
+    // Every depth pixel is still projected so occluders outside the regions
+    // keep winning the z-buffer, only the clearing and splatting is clipped.
+    HRESULT MapColorRegionsToDepthSpace(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        UINT nColorPointCount,
+        DepthSpacePoint* pDepthSpacePoints,
+        const PixelRect* pRects,
+        int nRectCount) override;
+
+    // The splat of MapColorRegionsToDepthSpace, rounding each point to its
+    // depth pixel as it is written
+    HRESULT MapColorRegionsToDepthIndices(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        UINT nColorPointCount,
+        UINT* pDepthIndices,
+        const PixelRect* pRects,
+        int nRectCount) override;
+
+    // Projects the depth frame once, keeping color space position and depth per
+    // depth pixel (12 bytes each) and the depth pixels of every row block in
+    // raster order, so a block splats exactly what the whole frame splat
+    // writes there.
+    HRESULT PrepareColorRowBlocks(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        int nBlockRows) override;
+
+    HRESULT MapColorRowBlockToDepthIndices(
+        int nBlock,
+        UINT* pDepthIndices,
+        UINT16* pZBuffer) const override;
+
+    // Points are snapped to the nearest depth pixel, the tables only hold rays
+    // for pixel centers.
+    HRESULT MapDepthPointsToColorSpace(
+        UINT nPointCount,
+        const DepthSpacePoint* pDepthPoints,
+        const UINT16* pDepths,
+        ColorSpacePoint* pColorPoints) override;
+
+    HRESULT MapDepthFrameToColorSpace(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        UINT nColorPointCount,
+        ColorSpacePoint* pColorSpacePoints) override;
+
+    // Undistorted x/y at unit depth per depth pixel, like GetDepthFrameToCameraSpaceTable
+    const float* GetDepthFrameToCameraSpaceTable() const { return m_pUnprojection.get(); }
+
+    const SensorCalibration& GetCalibration() const { return m_calibration; }
+
+private:
+    // as given to Initialize, and scaled to the current frame sizes
+    SensorCalibration m_referenceCalibration;
+    SensorCalibration m_calibration;
+
+    // (x, y) at unit depth per depth pixel
+    std::unique_ptr<float[]> m_pUnprojection;
+
+    // the unprojected ray rotated into color camera space, 3 floats per depth pixel
+    std::unique_ptr<float[]> m_pColorRays;
+
+    // nearest depth (mm) seen so far per color pixel, allocated by the first
+    // whole frame splat so row block mapping never touches it
+    std::unique_ptr<UINT16[]> m_pZBuffer;
+
+    // PrepareColorRowBlocks' frame: color x, y and z per depth pixel, the
+    // blocks [first, last] its splat reaches, and per block the range of
+    // m_rowBlockPixels listing the depth pixels it gets
+    const UINT16* m_pRowBlockDepth;
+    int m_nRowBlockRows;
+    std::vector<float> m_rowBlockProjections;
+    std::vector<UINT16> m_rowBlockSpans;
+    std::vector<UINT> m_rowBlockStarts;
+    std::vector<UINT> m_rowBlockCursors;
+    std::vector<UINT> m_rowBlockPixels;
+
+    // color pixels per depth pixel at equal depth in both cameras, x and y
+    // per depth pixel
+    std::unique_ptr<float[]> m_pSplatScales;
+
+    template <typename DepthMap>
+    HRESULT SplatRegions(
+        UINT nDepthPointCount,
+        const UINT16* pDepthFrameData,
+        UINT nColorPointCount,
+        DepthMap* pDepthMap,
+        const PixelRect* pRects,
+        int nRectCount);
+
+    HRESULT BuildTables(const SensorCalibration& calibration);
+
+    bool ProjectDepthPixel(int nDepthIndex, UINT16 depth, float* pColorX, float* pColorY, float* pColorZ) const;
+};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free ring with a single producer and a single consumer. The
+// producer may also pop, which is how it drops the oldest entry when the
+// consumer falls behind; pops therefore claim entries with a CAS on the tail.
+// Entries are small handles (e.g. frame slot indices), not the frames.
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t nCapacity) :
+        m_nCapacity(nCapacity),
+        m_pItems(new std::atomic<T>[nCapacity]),
+        m_nHead(0),
+        m_nTail(0)
+    {
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    size_t GetCapacity() const { return m_nCapacity; }
+
+    size_t GetSize() const
+    {
+        return static_cast<size_t>(m_nHead.load(std::memory_order_acquire) - m_nTail.load(std::memory_order_acquire));
+    }
+
+    // producer only
+    bool TryPush(T item)
+    {
+        const uint64_t nHead = m_nHead.load(std::memory_order_relaxed);
+        if (nHead - m_nTail.load(std::memory_order_acquire) >= m_nCapacity)
+        {
+            return false;
+        }
+
+        m_pItems[nHead % m_nCapacity].store(item, std::memory_order_relaxed);
+        m_nHead.store(nHead + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer, or the producer dropping the oldest entry
+    bool TryPop(T* pItem)
+    {
+        uint64_t nTail = m_nTail.load(std::memory_order_acquire);
+        for (;;)
+        {
+            if (nTail == m_nHead.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            T item = m_pItems[nTail % m_nCapacity].load(std::memory_order_relaxed);
+            if (m_nTail.compare_exchange_weak(nTail, nTail + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+            {
+                *pItem = item;
+                return true;
+            }
+        }
+    }
+
+private:
+    const size_t m_nCapacity;
+    std::unique_ptr<std::atomic<T>[]> m_pItems;
+
+    // keep the producer and consumer indices on separate cache lines
+    char m_headPadding[64];
+    std::atomic<uint64_t> m_nHead;
+    char m_tailPadding[64];
+    std::atomic<uint64_t> m_nTail;
+};
+
+// Lock-free triple buffer: the writer always has a back buffer to fill, the
+// reader always gets the most recently published one and a publish never
+// waits for the reader. Unread buffers are overwritten (drop oldest).
+class TripleBuffer
+{
+public:
+    TripleBuffer() :
+        m_nBack(0),
+        m_nMiddle(1),
+        m_nFront(2)
+    {
+    }
+
+    // writer side
+    int GetBackIndex() const { return m_nBack; }
+
+    // returns false when the previously published buffer was never read
+    bool Publish()
+    {
+        const int nPrevious = m_nMiddle.exchange(m_nBack | cFresh, std::memory_order_acq_rel);
+        m_nBack = nPrevious & cIndexMask;
+        return (nPrevious & cFresh) == 0;
+    }
+
+    // reader side, returns false when nothing new was published
+    bool AcquireLatest()
+    {
+        if ((m_nMiddle.load(std::memory_order_acquire) & cFresh) == 0)
+        {
+            return false;
+        }
+
+        m_nFront = m_nMiddle.exchange(m_nFront, std::memory_order_acq_rel) & cIndexMask;
+        return true;
+    }
+
+    int GetFrontIndex() const { return m_nFront; }
+
+    bool HasFresh() const { return (m_nMiddle.load(std::memory_order_acquire) & cFresh) != 0; }
+
+private:
+    static const int cIndexMask = 3;
+    static const int cFresh = 4;
+
+    int m_nBack;
+    char m_padding[64];
+    std::atomic<int> m_nMiddle;
+    int m_nFront;
+};
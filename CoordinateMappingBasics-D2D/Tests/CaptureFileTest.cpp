@@ -0,0 +1,374 @@
+// Records small captures, plays them back without a sensor and checks every
+// frame comes back as written, then damages them: truncated files, header
+// sizes of zero or beyond the file, index entries and frame sections
+// pointing outside the mapping, and random bytes over the header and index.
+// A damaged capture has to fail to open or fail GetFrame, never hand out
+// buffers reaching past the end of the file.
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "CaptureFile.h"
+#include "TestCheck.h"
+
+namespace
+{
+    const char* const cCapturePath = "CaptureFileTest.kcap";
+    const char* const cDamagedPath = "CaptureFileTest.damaged.kcap";
+
+    const int cDepthWidth = 10;
+    const int cDepthHeight = 7;
+    const int cColorWidth = 16;
+    const int cColorHeight = 9;
+    const UINT cFrameCount = 5;
+
+    // 1/30 s in RelativeTime's 100 ns ticks
+    const int64_t cFrameTicks = 333333;
+
+    struct Random
+    {
+        uint32_t nState;
+
+        uint32_t Next()
+        {
+            nState = nState * 1664525 + 1013904223;
+            return nState >> 8;
+        }
+    };
+
+    // the frame's pixels are derived from its number, so playback can be
+    // checked without keeping what was recorded
+    BYTE GetFrameByte(UINT nFrame, int nSection, size_t i)
+    {
+        return static_cast<BYTE>(nFrame * 31 + nSection * 7 + i * 3);
+    }
+
+    size_t GetColorBytes(CaptureColorFormat colorFormat)
+    {
+        return size_t(cColorWidth) * cColorHeight * GetCaptureColorBytesPerPixel(colorFormat);
+    }
+
+    void WriteCapture(CaptureColorFormat colorFormat)
+    {
+        const size_t nDepthPixels = size_t(cDepthWidth) * cDepthHeight;
+        std::vector<UINT16> depth(nDepthPixels);
+        std::vector<BYTE> color(GetColorBytes(colorFormat));
+        std::vector<BYTE> bodyIndex(nDepthPixels);
+
+        CaptureWriter writer;
+        TEST_CHECK(SUCCEEDED(writer.Open(cCapturePath, cDepthWidth, cDepthHeight, cColorWidth, cColorHeight, colorFormat)));
+
+        for (UINT nFrame = 0; nFrame < cFrameCount; ++nFrame)
+        {
+            for (size_t i = 0; i < nDepthPixels; ++i)
+            {
+                depth[i] = static_cast<UINT16>(GetFrameByte(nFrame, 0, i) * 16);
+                bodyIndex[i] = GetFrameByte(nFrame, 2, i);
+            }
+            for (size_t i = 0; i < color.size(); ++i)
+            {
+                color[i] = GetFrameByte(nFrame, 1, i);
+            }
+
+            TEST_CHECK(SUCCEEDED(writer.WriteFrame(nFrame * cFrameTicks, depth.data(), color.data(), bodyIndex.data())));
+        }
+
+        TEST_CHECK(writer.GetFrameCount() == cFrameCount);
+        TEST_CHECK(SUCCEEDED(writer.Close()));
+    }
+
+    bool IsFrame(const CaptureFrame& frame, UINT nFrame, CaptureColorFormat colorFormat)
+    {
+        bool bSame = frame.nRelativeTime == nFrame * cFrameTicks;
+
+        const size_t nDepthPixels = size_t(cDepthWidth) * cDepthHeight;
+        for (size_t i = 0; i < nDepthPixels; ++i)
+        {
+            bSame = bSame && frame.pDepthBuffer[i] == GetFrameByte(nFrame, 0, i) * 16;
+            bSame = bSame && frame.pBodyIndexBuffer[i] == GetFrameByte(nFrame, 2, i);
+        }
+        for (size_t i = 0; i < GetColorBytes(colorFormat); ++i)
+        {
+            bSame = bSame && frame.pColorBuffer[i] == GetFrameByte(nFrame, 1, i);
+        }
+
+        return bSame;
+    }
+
+    void TestPlayback(CaptureColorFormat colorFormat)
+    {
+        WriteCapture(colorFormat);
+
+        CaptureReader reader;
+        TEST_CHECK(SUCCEEDED(reader.Open(cCapturePath)));
+        TEST_CHECK(reader.GetFrameCount() == cFrameCount);
+        TEST_CHECK(reader.GetHeader().nColorFormat == UINT(colorFormat));
+
+        for (UINT nFrame = 0; nFrame < cFrameCount; ++nFrame)
+        {
+            CaptureFrame frame;
+            TEST_CHECK(SUCCEEDED(reader.GetFrame(nFrame, &frame)) && IsFrame(frame, nFrame, colorFormat));
+            TEST_CHECK(reinterpret_cast<uintptr_t>(frame.pColorBuffer) % cCaptureAlignment == 0);
+        }
+
+        CaptureFrame frame;
+        TEST_CHECK(reader.GetFrame(cFrameCount, &frame) == E_INVALIDARG);
+        TEST_CHECK(reader.FindFrame(2 * cFrameTicks - 1) == 2);
+        TEST_CHECK(reader.FindFrame(cFrameCount * cFrameTicks) == cFrameCount);
+        reader.Close();
+
+        // the replay source hands every frame out once, then ends or loops
+        for (int nLoop = 0; nLoop < 2; ++nLoop)
+        {
+            ReplayFrameSource source;
+            TEST_CHECK(SUCCEEDED(source.Open(cCapturePath, ReplayPacing_AsFastAsPossible, nLoop != 0)));
+
+            for (UINT nFrame = 0; nFrame < 2 * cFrameCount; ++nFrame)
+            {
+                PipelineFrame pipelineFrame;
+                const HRESULT hr = source.AcquireFrame(&pipelineFrame);
+                if (!nLoop && nFrame >= cFrameCount)
+                {
+                    TEST_CHECK(hr == S_FALSE);
+                    continue;
+                }
+
+                TEST_CHECK(hr == S_OK);
+                TEST_CHECK(pipelineFrame.nColorWidth == cColorWidth && pipelineFrame.nDepthHeight == cDepthHeight);
+                TEST_CHECK(pipelineFrame.colorFormat == ((colorFormat == CaptureColorFormat_Yuy2) ? ColorFormat_Yuy2 : ColorFormat_Bgra));
+
+                const CaptureFrame played = {pipelineFrame.nRelativeTime, pipelineFrame.pDepthBuffer,
+                    pipelineFrame.pColorBuffer, pipelineFrame.pBodyIndexBuffer};
+                TEST_CHECK(IsFrame(played, nFrame % cFrameCount, colorFormat));
+            }
+        }
+    }
+
+    std::vector<BYTE> ReadFile(const char* pszPath)
+    {
+        std::vector<BYTE> data;
+        FILE* pFile = fopen(pszPath, "rb");
+        if (pFile)
+        {
+            BYTE buffer[4096];
+            size_t nRead = 0;
+            while ((nRead = fread(buffer, 1, sizeof(buffer), pFile)) > 0)
+            {
+                data.insert(data.end(), buffer, buffer + nRead);
+            }
+            fclose(pFile);
+        }
+        return data;
+    }
+
+    void WriteFile(const char* pszPath, const std::vector<BYTE>& data)
+    {
+        FILE* pFile = fopen(pszPath, "wb");
+        TEST_CHECK(pFile && fwrite(data.data(), 1, data.size(), pFile) == data.size());
+        if (pFile)
+        {
+            fclose(pFile);
+        }
+    }
+
+    // Opens a damaged file and reads every frame it hands out, byte for
+    // byte, all of which has to lie inside the file. Returns how many did.
+    UINT ReadDamaged(const std::vector<BYTE>& data)
+    {
+        WriteFile(cDamagedPath, data);
+
+        CaptureReader reader;
+        if (FAILED(reader.Open(cDamagedPath)))
+        {
+            return 0;
+        }
+
+        const CaptureFileHeader& header = reader.GetHeader();
+        const size_t nDepthPixels = size_t(header.nDepthWidth) * header.nDepthHeight;
+        const size_t nColorBytes = size_t(header.nColorWidth) * header.nColorHeight * GetCaptureColorBytesPerPixel(header.nColorFormat);
+
+        UINT nRead = 0;
+        for (UINT nFrame = 0; nFrame < reader.GetFrameCount(); ++nFrame)
+        {
+            CaptureFrame frame;
+            if (FAILED(reader.GetFrame(nFrame, &frame)))
+            {
+                continue;
+            }
+
+            // Where the file's own index and frame header put the sections,
+            // which have to be inside the file and hold its bytes there
+            CaptureIndexEntry entry;
+            CaptureFrameHeader frameHeader;
+            memcpy(&entry, &data[static_cast<size_t>(header.nIndexOffset) + nFrame * sizeof(entry)], sizeof(entry));
+            if (entry.nOffset > data.size() || sizeof(frameHeader) > data.size() - entry.nOffset)
+            {
+                TEST_CHECK(!"frame header outside the file");
+                continue;
+            }
+            memcpy(&frameHeader, &data[static_cast<size_t>(entry.nOffset)], sizeof(frameHeader));
+
+            auto inside = [&](const void* pSection, uint64_t nSectionOffset, size_t nBytes)
+            {
+                const uint64_t nBegin = entry.nOffset + nSectionOffset;
+                return nBegin <= data.size() && nBytes <= data.size() - nBegin &&
+                    memcmp(pSection, &data[static_cast<size_t>(nBegin)], nBytes) == 0;
+            };
+
+            TEST_CHECK(inside(frame.pDepthBuffer, frameHeader.nDepthOffset, nDepthPixels * sizeof(UINT16)));
+            TEST_CHECK(inside(frame.pColorBuffer, frameHeader.nColorOffset, nColorBytes));
+            TEST_CHECK(inside(frame.pBodyIndexBuffer, frameHeader.nBodyIndexOffset, nDepthPixels));
+            ++nRead;
+        }
+
+        return nRead;
+    }
+
+    template <typename T>
+    void Poke(std::vector<BYTE>& data, size_t nOffset, T value)
+    {
+        memcpy(&data[nOffset], &value, sizeof(value));
+    }
+
+    void TestDamage()
+    {
+        WriteCapture(CaptureColorFormat_Bgra);
+        const std::vector<BYTE> original = ReadFile(cCapturePath);
+        TEST_CHECK(!original.empty());
+        TEST_CHECK(ReadDamaged(original) == cFrameCount);
+
+        CaptureFileHeader header;
+        memcpy(&header, original.data(), sizeof(header));
+
+        // cut anywhere, the file either fails to open or at most drops frames
+        for (size_t nSize = 0; nSize < original.size(); nSize += 61)
+        {
+            const std::vector<BYTE> truncated(original.begin(), original.begin() + nSize);
+            TEST_CHECK(ReadDamaged(truncated) == 0);
+        }
+
+        // sizes of zero, negative or beyond the file
+        const size_t nDepthWidthOffset = offsetof(CaptureFileHeader, nDepthWidth);
+        const size_t nColorHeightOffset = offsetof(CaptureFileHeader, nColorHeight);
+        const size_t nColorFormatOffset = offsetof(CaptureFileHeader, nColorFormat);
+        const size_t nFrameCountOffset = offsetof(CaptureFileHeader, nFrameCount);
+        const size_t nFrameSizeOffset = offsetof(CaptureFileHeader, nFrameSize);
+
+        std::vector<BYTE> data = original;
+        Poke(data, nDepthWidthOffset, 0);
+        TEST_CHECK(ReadDamaged(data) == 0);
+
+        data = original;
+        Poke(data, nColorHeightOffset, -cColorHeight);
+        TEST_CHECK(ReadDamaged(data) == 0);
+
+        data = original;
+        Poke(data, nColorFormatOffset, 7u);
+        TEST_CHECK(ReadDamaged(data) == 0);
+
+        data = original;
+        Poke(data, nFrameCountOffset, 0x40000000u);
+        TEST_CHECK(ReadDamaged(data) == 0);
+
+        data = original;
+        Poke(data, nFrameSizeOffset, uint64_t(0));
+        TEST_CHECK(ReadDamaged(data) == 0);
+
+        // a frame count and frame size whose product wraps around to the
+        // index offset the header holds
+        data = original;
+        Poke(data, nFrameCountOffset, 2u);
+        Poke(data, nFrameSizeOffset, (uint64_t(1) << 63) + header.nFrameSize * cFrameCount / 2);
+        TEST_CHECK(ReadDamaged(data) == 0);
+
+        // a larger depth frame than was written, which no longer fits
+        // between the section offsets the frames hold
+        data = original;
+        Poke(data, nDepthWidthOffset, 4 * cDepthWidth);
+        TEST_CHECK(ReadDamaged(data) == 0);
+
+        // index entries past the end of the file and wrapping around
+        const size_t nIndexOffset = static_cast<size_t>(header.nIndexOffset);
+        const size_t nEntryOffset = nIndexOffset + sizeof(CaptureIndexEntry) + offsetof(CaptureIndexEntry, nOffset);
+
+        data = original;
+        Poke(data, nEntryOffset, uint64_t(original.size()));
+        TEST_CHECK(ReadDamaged(data) == cFrameCount - 1);
+
+        data = original;
+        Poke(data, nEntryOffset, ~uint64_t(cCaptureAlignment - 1));
+        TEST_CHECK(ReadDamaged(data) == cFrameCount - 1);
+
+        data = original;
+        Poke(data, nEntryOffset, uint64_t(header.nIndexOffset - cCaptureAlignment));
+        TEST_CHECK(ReadDamaged(data) == cFrameCount - 1);
+
+        // frame sections outside the frame, or wrapping around
+        CaptureIndexEntry entry;
+        memcpy(&entry, &original[nIndexOffset], sizeof(entry));
+        const size_t nFrameOffset = static_cast<size_t>(entry.nOffset);
+
+        const size_t sectionOffsets[3] =
+        {
+            offsetof(CaptureFrameHeader, nDepthOffset),
+            offsetof(CaptureFrameHeader, nColorOffset),
+            offsetof(CaptureFrameHeader, nBodyIndexOffset),
+        };
+        for (size_t nSectionOffset : sectionOffsets)
+        {
+            data = original;
+            Poke(data, nFrameOffset + nSectionOffset, uint64_t(header.nFrameSize));
+            TEST_CHECK(ReadDamaged(data) == cFrameCount - 1);
+
+            data = original;
+            Poke(data, nFrameOffset + nSectionOffset, ~uint64_t(cCaptureAlignment - 1));
+            TEST_CHECK(ReadDamaged(data) == cFrameCount - 1);
+
+            // over the frame header
+            data = original;
+            Poke(data, nFrameOffset + nSectionOffset, uint64_t(0));
+            TEST_CHECK(ReadDamaged(data) == cFrameCount - 1);
+        }
+
+        // random bytes over the header, the first frame's header and the
+        // index; whatever opens has been read in full by ReadDamaged
+        Random random = {7};
+        for (int nRun = 0; nRun < 2000; ++nRun)
+        {
+            data = original;
+            const int nChanges = 1 + random.Next() % 4;
+            for (int nChange = 0; nChange < nChanges; ++nChange)
+            {
+                const uint32_t nWhere = random.Next() % 3;
+                size_t nOffset = 0;
+                if (nWhere == 0)
+                {
+                    nOffset = random.Next() % sizeof(CaptureFileHeader);
+                }
+                else if (nWhere == 1)
+                {
+                    nOffset = nFrameOffset + random.Next() % sizeof(CaptureFrameHeader);
+                }
+                else
+                {
+                    nOffset = nIndexOffset + random.Next() % (data.size() - nIndexOffset);
+                }
+                data[nOffset] = static_cast<BYTE>(random.Next());
+            }
+
+            ReadDamaged(data);
+        }
+
+        remove(cDamagedPath);
+    }
+}
+
+int main()
+{
+    TestPlayback(CaptureColorFormat_Bgra);
+    TestPlayback(CaptureColorFormat_Yuy2);
+    TestDamage();
+
+    remove(cCapturePath);
+    return TestResult();
+}
@@ -0,0 +1,275 @@
+// Holds every vector kernel the CPU runs to the scalar one, byte for byte, on
+// randomized frames: the composite in both color formats and both depth map
+// representations, with hard edges and with an alpha matte, the YUY2
+// conversion, the upscale and the depth keying. Frames come in the Kinect's
+// depth size, which runs the scalar kernels compiled for it, and in sizes
+// that run the generic ones, one of them too odd for the AVX2 gathers.
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "CompositeKernel.h"
+#include "TestCheck.h"
+
+namespace
+{
+    struct Random
+    {
+        uint32_t nState;
+
+        uint32_t Next()
+        {
+            nState = nState * 1664525 + 1013904223;
+            return nState >> 8;
+        }
+
+        int Below(int nLimit) { return static_cast<int>(Next() % uint32_t(nLimit)); }
+        BYTE Byte() { return static_cast<BYTE>(Next()); }
+    };
+
+    struct FrameSize
+    {
+        int nDepthWidth;
+        int nDepthHeight;
+        int nColorWidth;
+        int nColorHeight;
+    };
+
+    // in range, on the rounding edges, out of range, -infinity and NaN
+    float RandomCoordinate(Random& random, int nSize)
+    {
+        switch (random.Below(8))
+        {
+        case 0:
+            return -std::numeric_limits<float>::infinity();
+        case 1:
+            return std::numeric_limits<float>::quiet_NaN();
+        case 2:
+            return (random.Below(2) == 0) ? -0.5f : nSize - 0.5f;
+        case 3:
+            return static_cast<float>(random.Below(4 * nSize)) - 2.0f * nSize;
+        default:
+            return static_cast<float>(random.Below(nSize * 64)) / 64.0f - 0.25f;
+        }
+    }
+
+    // mostly no player, as in a real frame, and every body
+    BYTE RandomBodyIndex(Random& random)
+    {
+        return (random.Below(3) == 0) ? static_cast<BYTE>(random.Below(6)) : 0xff;
+    }
+
+    bool SamePixels(const std::vector<RGBQUAD>& a, const std::vector<RGBQUAD>& b)
+    {
+        return a.size() == b.size() && memcmp(a.data(), b.data(), a.size() * sizeof(RGBQUAD)) == 0;
+    }
+
+    void TestComposite(CompositeKernelType kernel, const FrameSize& size, Random& random)
+    {
+        const int nDepthPixels = size.nDepthWidth * size.nDepthHeight;
+        const int nColorPixels = size.nColorWidth * size.nColorHeight;
+
+        std::vector<DepthSpacePoint> points(nColorPixels);
+        std::vector<UINT> indices(nColorPixels);
+        for (int i = 0; i < nColorPixels; ++i)
+        {
+            points[i].X = RandomCoordinate(random, size.nDepthWidth);
+            points[i].Y = RandomCoordinate(random, size.nDepthHeight);
+            indices[i] = GetDepthIndex(points[i], size.nDepthWidth, size.nDepthHeight);
+        }
+
+        std::vector<BYTE> bodyIndex(nDepthPixels);
+        std::vector<BYTE> alphaMatte(nDepthPixels);
+        for (int i = 0; i < nDepthPixels; ++i)
+        {
+            bodyIndex[i] = RandomBodyIndex(random);
+            alphaMatte[i] = (random.Below(2) == 0) ? 0 : random.Byte();
+        }
+
+        std::vector<RGBQUAD> color(nColorPixels);
+        std::vector<RGBQUAD> background(nColorPixels);
+        std::vector<BYTE> yuy2(size_t(nColorPixels) * 2);
+        for (int i = 0; i < nColorPixels; ++i)
+        {
+            const RGBQUAD pixel = {random.Byte(), random.Byte(), random.Byte(), random.Byte()};
+            const RGBQUAD backgroundPixel = {random.Byte(), random.Byte(), random.Byte(), 0xff};
+            color[i] = pixel;
+            background[i] = backgroundPixel;
+        }
+        for (BYTE& value : yuy2)
+        {
+            value = random.Byte();
+        }
+
+        // the whole frame, and a range starting and ending on odd pixels for
+        // the scalar lead-ins and tails
+        const int ranges[2][2] = {{0, nColorPixels}, {1, nColorPixels - 3}};
+        for (const auto& range : ranges)
+        {
+            std::vector<RGBQUAD> expected(nColorPixels);
+            std::vector<RGBQUAD> actual(nColorPixels);
+
+            auto check = [&](auto composite)
+            {
+                expected = background;
+                actual = background;
+                composite(CompositeKernel_Scalar, expected.data());
+                composite(kernel, actual.data());
+                return SamePixels(expected, actual);
+            };
+
+            TEST_CHECK(check([&](CompositeKernelType k, RGBQUAD* pOutput)
+            {
+                CompositeFrame(k, points.data(), bodyIndex.data(), size.nDepthWidth, size.nDepthHeight,
+                    color.data(), background.data(), pOutput, range[0], range[1]);
+            }));
+            TEST_CHECK(check([&](CompositeKernelType k, RGBQUAD* pOutput)
+            {
+                CompositeFrame(k, indices.data(), bodyIndex.data(), size.nDepthWidth, size.nDepthHeight,
+                    color.data(), background.data(), pOutput, range[0], range[1]);
+            }));
+            TEST_CHECK(check([&](CompositeKernelType k, RGBQUAD* pOutput)
+            {
+                CompositeFrameYuy2(k, points.data(), bodyIndex.data(), size.nDepthWidth, size.nDepthHeight,
+                    yuy2.data(), background.data(), pOutput, range[0], range[1]);
+            }));
+            TEST_CHECK(check([&](CompositeKernelType k, RGBQUAD* pOutput)
+            {
+                CompositeFrameYuy2(k, indices.data(), bodyIndex.data(), size.nDepthWidth, size.nDepthHeight,
+                    yuy2.data(), background.data(), pOutput, range[0], range[1]);
+            }));
+            TEST_CHECK(check([&](CompositeKernelType k, RGBQUAD* pOutput)
+            {
+                CompositeFrameMatte(k, points.data(), alphaMatte.data(), size.nDepthWidth, size.nDepthHeight,
+                    color.data(), background.data(), pOutput, range[0], range[1]);
+            }));
+            TEST_CHECK(check([&](CompositeKernelType k, RGBQUAD* pOutput)
+            {
+                CompositeFrameMatte(k, indices.data(), alphaMatte.data(), size.nDepthWidth, size.nDepthHeight,
+                    color.data(), background.data(), pOutput, range[0], range[1]);
+            }));
+            TEST_CHECK(check([&](CompositeKernelType k, RGBQUAD* pOutput)
+            {
+                CompositeFrameMatteYuy2(k, points.data(), alphaMatte.data(), size.nDepthWidth, size.nDepthHeight,
+                    yuy2.data(), background.data(), pOutput, range[0], range[1]);
+            }));
+            TEST_CHECK(check([&](CompositeKernelType k, RGBQUAD* pOutput)
+            {
+                CompositeFrameMatteYuy2(k, indices.data(), alphaMatte.data(), size.nDepthWidth, size.nDepthHeight,
+                    yuy2.data(), background.data(), pOutput, range[0], range[1]);
+            }));
+            TEST_CHECK(check([&](CompositeKernelType k, RGBQUAD* pOutput)
+            {
+                ConvertYuy2ToBgra(k, yuy2.data(), pOutput, range[0], range[1]);
+            }));
+        }
+
+        // points and indices must composite alike too
+        std::vector<RGBQUAD> fromPoints(nColorPixels);
+        std::vector<RGBQUAD> fromIndices(nColorPixels);
+        CompositeFrame(kernel, points.data(), bodyIndex.data(), size.nDepthWidth, size.nDepthHeight,
+            color.data(), background.data(), fromPoints.data(), 0, nColorPixels);
+        CompositeFrame(kernel, indices.data(), bodyIndex.data(), size.nDepthWidth, size.nDepthHeight,
+            color.data(), background.data(), fromIndices.data(), 0, nColorPixels);
+        TEST_CHECK(SamePixels(fromPoints, fromIndices));
+    }
+
+    void TestUpscale(CompositeKernelType kernel, const FrameSize& size, Random& random)
+    {
+        const int nSourcePixels = size.nDepthWidth * size.nDepthHeight;
+        const int nOutputPixels = size.nColorWidth * size.nColorHeight;
+
+        // premultiplied: no channel above alpha
+        std::vector<RGBQUAD> source(nSourcePixels);
+        for (RGBQUAD& pixel : source)
+        {
+            const BYTE alpha = (random.Below(2) == 0) ? 0 : random.Byte();
+            pixel.rgbReserved = alpha;
+            pixel.rgbBlue = static_cast<BYTE>(random.Below(alpha + 1));
+            pixel.rgbGreen = static_cast<BYTE>(random.Below(alpha + 1));
+            pixel.rgbRed = static_cast<BYTE>(random.Below(alpha + 1));
+        }
+
+        std::vector<RGBQUAD> background(nOutputPixels);
+        for (RGBQUAD& pixel : background)
+        {
+            const RGBQUAD backgroundPixel = {random.Byte(), random.Byte(), random.Byte(), 0xff};
+            pixel = backgroundPixel;
+        }
+
+        std::vector<RGBQUAD> expected(nOutputPixels);
+        std::vector<RGBQUAD> actual(nOutputPixels);
+        UpscaleComposite(CompositeKernel_Scalar, source.data(), size.nDepthWidth, size.nDepthHeight,
+            background.data(), expected.data(), size.nColorWidth, size.nColorHeight, 0, size.nColorHeight);
+        UpscaleComposite(kernel, source.data(), size.nDepthWidth, size.nDepthHeight,
+            background.data(), actual.data(), size.nColorWidth, size.nColorHeight, 0, size.nColorHeight);
+        TEST_CHECK(SamePixels(expected, actual));
+    }
+
+    void TestKeyDepthRange(CompositeKernelType kernel, const FrameSize& size, Random& random)
+    {
+        const int nDepthPixels = size.nDepthWidth * size.nDepthHeight;
+
+        // every depth, no depth included, and a background close to it
+        std::vector<UINT16> depth(nDepthPixels);
+        std::vector<UINT16> background(nDepthPixels);
+        for (int i = 0; i < nDepthPixels; ++i)
+        {
+            depth[i] = (random.Below(7) == 0) ? 0 : static_cast<UINT16>(random.Next());
+            background[i] = (random.Below(5) == 0) ? 0 : static_cast<UINT16>(depth[i] + random.Below(256) - 64);
+        }
+
+        const UINT16 ranges[][2] = {{0, 0xffff}, {500, 4500}, {1, 1}};
+        for (const auto& range : ranges)
+        {
+            for (int nBackground = 0; nBackground < 2; ++nBackground)
+            {
+                const UINT16* pBackground = nBackground ? background.data() : nullptr;
+                std::vector<BYTE> expected(nDepthPixels, 0x55);
+                std::vector<BYTE> actual(nDepthPixels, 0x55);
+
+                KeyDepthRange(CompositeKernel_Scalar, depth.data(), pBackground, range[0], range[1], 100,
+                    expected.data(), 1, nDepthPixels - 1);
+                KeyDepthRange(kernel, depth.data(), pBackground, range[0], range[1], 100,
+                    actual.data(), 1, nDepthPixels - 1);
+                TEST_CHECK(expected == actual);
+            }
+        }
+    }
+}
+
+int main()
+{
+    const FrameSize sizes[] =
+    {
+        // the Kinect v2, whose depth size has kernels of its own
+        {512, 424, 640, 360},
+        // generic, a whole number of dwords of body index
+        {64, 50, 200, 113},
+        // generic, the AVX2 gathers left to the SSE4.1 and scalar paths
+        {63, 45, 101, 77},
+    };
+
+    const CompositeKernelType kernels[] = {CompositeKernel_Scalar, CompositeKernel_Sse41, CompositeKernel_Avx2};
+    for (CompositeKernelType kernel : kernels)
+    {
+        if (!IsCompositeKernelSupported(kernel))
+        {
+            printf("%s: not supported here, skipped\n", GetCompositeKernelName(kernel));
+            continue;
+        }
+
+        Random random = {1};
+        for (const FrameSize& size : sizes)
+        {
+            TestComposite(kernel, size, random);
+            TestUpscale(kernel, size, random);
+            TestKeyDepthRange(kernel, size, random);
+        }
+
+        printf("%s: checked\n", GetCompositeKernelName(kernel));
+    }
+
+    return TestResult();
+}
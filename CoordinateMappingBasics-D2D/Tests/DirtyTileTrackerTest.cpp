@@ -0,0 +1,242 @@
+// Runs the tile tracker the way the compositor and presenter do: frames
+// written into rotating buffers, and uploads of only the rectangles changed
+// since the frame last uploaded. Checks that the rectangles cover exactly
+// the changed tiles, that after Invalidate the next frame is uploaded whole
+// although no tile's signature changed, that a presenter carries on across
+// a change of frame size, and that the presenter may ask for rectangles
+// while the tiles are laid out again on another thread.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "DirtyTileTracker.h"
+#include "TestCheck.h"
+
+namespace
+{
+    // 4 x 3 tiles, the last column and row clipped
+    const int cWidth = 200;
+    const int cHeight = 130;
+    const int cTileSize = 64;
+
+    // One frame into pBuffer, returning the tiles it redrew
+    std::vector<int> WriteFrame(DirtyTileTracker& tracker, const std::vector<uint64_t>& signatures, const void* pBuffer)
+    {
+        tracker.BeginFrame();
+        for (int i = 0; i < tracker.GetTileCount(); ++i)
+        {
+            tracker.UpdateTile(i, signatures[i]);
+        }
+
+        std::vector<int> tiles;
+        tracker.GetTilesToRedraw(pBuffer, &tiles);
+        tracker.MarkWritten(pBuffer);
+        return tiles;
+    }
+
+    int GetCoveredArea(const std::vector<PixelRect>& rects)
+    {
+        int nArea = 0;
+        for (const PixelRect& rect : rects)
+        {
+            nArea += rect.GetArea();
+        }
+        return nArea;
+    }
+
+    bool IsWholeFrame(const std::vector<PixelRect>& rects, int nWidth, int nHeight)
+    {
+        return rects.size() == 1 &&
+            rects[0].nLeft == 0 && rects[0].nTop == 0 && rects[0].nRight == nWidth && rects[0].nBottom == nHeight;
+    }
+
+    void TestChangedRects()
+    {
+        DirtyTileTracker tracker;
+        TEST_CHECK(FAILED(tracker.Initialize(0, cHeight, cTileSize)));
+        TEST_CHECK(SUCCEEDED(tracker.Initialize(cWidth, cHeight, cTileSize)));
+        TEST_CHECK(tracker.GetColumnCount() == 4 && tracker.GetRowCount() == 3);
+
+        const PixelRect lastTile = tracker.GetTileRect(tracker.GetTileCount() - 1);
+        TEST_CHECK(lastTile.nLeft == 192 && lastTile.nTop == 128 && lastTile.nRight == cWidth && lastTile.nBottom == cHeight);
+
+        int buffers[2];
+        std::vector<uint64_t> signatures(tracker.GetTileCount(), 1);
+        std::vector<PixelRect> rects;
+        int64_t nUploadedFrame = 0;
+
+        // the first frame: every tile drawn and uploaded
+        TEST_CHECK(WriteFrame(tracker, signatures, &buffers[0]).size() == size_t(tracker.GetTileCount()));
+        tracker.GetChangedRects(&buffers[0], nUploadedFrame, &rects, &nUploadedFrame);
+        TEST_CHECK(IsWholeFrame(rects, cWidth, cHeight));
+        TEST_CHECK(nUploadedFrame == 1);
+
+        // one tile changed: a buffer not seen yet is drawn whole, but only
+        // that tile is uploaded
+        signatures[5] = 2;
+        TEST_CHECK(WriteFrame(tracker, signatures, &buffers[1]).size() == size_t(tracker.GetTileCount()));
+        tracker.GetChangedRects(&buffers[1], nUploadedFrame, &rects, &nUploadedFrame);
+        const PixelRect tile5 = tracker.GetTileRect(5);
+        TEST_CHECK(rects.size() == 1 && rects[0].nLeft == tile5.nLeft && rects[0].nBottom == tile5.nBottom);
+        TEST_CHECK(nUploadedFrame == 2);
+
+        // the first buffer catches up on both frames, the two tiles side by
+        // side changed since the upload go up as one rectangle
+        signatures[6] = 2;
+        signatures[7] = 2;
+        const std::vector<int> redrawn = WriteFrame(tracker, signatures, &buffers[0]);
+        TEST_CHECK(redrawn.size() == 3 && redrawn[0] == 5 && redrawn[2] == 7);
+        tracker.GetChangedRects(&buffers[0], nUploadedFrame, &rects, &nUploadedFrame);
+        TEST_CHECK(rects.size() == 1 && rects[0].nLeft == tracker.GetTileRect(6).nLeft && rects[0].nRight == cWidth);
+
+        // nothing changed: nothing drawn or uploaded
+        TEST_CHECK(WriteFrame(tracker, signatures, &buffers[1]).size() == 2);
+        TEST_CHECK(WriteFrame(tracker, signatures, &buffers[0]).empty());
+        tracker.GetChangedRects(&buffers[0], nUploadedFrame, &rects, &nUploadedFrame);
+        TEST_CHECK(rects.empty());
+    }
+
+    void TestInvalidate()
+    {
+        DirtyTileTracker tracker;
+        TEST_CHECK(SUCCEEDED(tracker.Initialize(cWidth, cHeight, cTileSize)));
+
+        int buffers[3];
+        const std::vector<uint64_t> signatures(tracker.GetTileCount(), 7);
+        std::vector<PixelRect> rects;
+        int64_t nUploadedFrame = 0;
+
+        for (int nFrame = 0; nFrame < 6; ++nFrame)
+        {
+            WriteFrame(tracker, signatures, &buffers[nFrame % 3]);
+            tracker.GetChangedRects(&buffers[nFrame % 3], nUploadedFrame, &rects, &nUploadedFrame);
+        }
+        TEST_CHECK(rects.empty());
+
+        // the background changed under unchanged tiles: the next frame is
+        // drawn and uploaded whole, into the buffer the presenter last had
+        // as well as into the others
+        for (int nBuffer = 0; nBuffer < 3; ++nBuffer)
+        {
+            tracker.Invalidate();
+            TEST_CHECK(WriteFrame(tracker, signatures, &buffers[nBuffer]).size() == size_t(tracker.GetTileCount()));
+            tracker.GetChangedRects(&buffers[nBuffer], nUploadedFrame, &rects, &nUploadedFrame);
+            TEST_CHECK(GetCoveredArea(rects) == cWidth * cHeight);
+        }
+
+        // and once only, the frames after it upload nothing again
+        WriteFrame(tracker, signatures, &buffers[0]);
+        WriteFrame(tracker, signatures, &buffers[1]);
+        tracker.GetChangedRects(&buffers[1], nUploadedFrame, &rects, &nUploadedFrame);
+        TEST_CHECK(rects.empty());
+    }
+
+    void TestReinitialize()
+    {
+        DirtyTileTracker tracker;
+        TEST_CHECK(SUCCEEDED(tracker.Initialize(cWidth, cHeight, cTileSize)));
+
+        int buffer = 0;
+        std::vector<PixelRect> rects;
+        int64_t nUploadedFrame = 0;
+        for (int nFrame = 0; nFrame < 10; ++nFrame)
+        {
+            WriteFrame(tracker, std::vector<uint64_t>(tracker.GetTileCount(), 3), &buffer);
+            tracker.GetChangedRects(&buffer, nUploadedFrame, &rects, &nUploadedFrame);
+        }
+        TEST_CHECK(nUploadedFrame == 10);
+
+        // frames of another size: the presenter's frame number still counts,
+        // and the first frame of the new size is uploaded whole
+        const int nWidth = 100;
+        const int nHeight = 300;
+        TEST_CHECK(SUCCEEDED(tracker.Initialize(nWidth, nHeight, cTileSize)));
+        WriteFrame(tracker, std::vector<uint64_t>(tracker.GetTileCount(), 3), &buffer);
+        tracker.GetChangedRects(&buffer, nUploadedFrame, &rects, &nUploadedFrame);
+        TEST_CHECK(nUploadedFrame == 11);
+        TEST_CHECK(GetCoveredArea(rects) == nWidth * nHeight);
+        for (const PixelRect& rect : rects)
+        {
+            TEST_CHECK(rect.nRight <= nWidth && rect.nBottom <= nHeight);
+        }
+    }
+
+    // The presenter asks for rectangles while the processing thread keeps
+    // switching frame sizes and the UI invalidates
+    void TestConcurrentInitialize()
+    {
+        const int sizes[2][2] = {{cWidth, cHeight}, {96, 300}};
+        const int nMaxWidth = std::max(sizes[0][0], sizes[1][0]);
+        const int nMaxHeight = std::max(sizes[0][1], sizes[1][1]);
+
+        DirtyTileTracker tracker;
+        TEST_CHECK(SUCCEEDED(tracker.Initialize(sizes[0][0], sizes[0][1], cTileSize)));
+
+        int buffers[3];
+        std::atomic<bool> bDone(false);
+        std::atomic<int> nOutside(0);
+        int nPresented = 0;
+
+        std::thread presenter([&]
+        {
+            std::vector<PixelRect> rects;
+            int64_t nUploadedFrame = 0;
+            while (!bDone)
+            {
+                tracker.GetChangedRects(&buffers[nPresented % 3], nUploadedFrame, &rects, &nUploadedFrame);
+                for (const PixelRect& rect : rects)
+                {
+                    if (rect.IsEmpty() || rect.nLeft < 0 || rect.nTop < 0 || rect.nRight > nMaxWidth || rect.nBottom > nMaxHeight)
+                    {
+                        ++nOutside;
+                    }
+                }
+
+                if (++nPresented % 16 == 0)
+                {
+                    tracker.Invalidate();
+                }
+                std::this_thread::yield();
+            }
+        });
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int nFrame = 0;
+        while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(300))
+        {
+            if (nFrame % 8 == 0)
+            {
+                const int* pSize = sizes[(nFrame / 8) % 2];
+                TEST_CHECK(SUCCEEDED(tracker.Initialize(pSize[0], pSize[1], cTileSize)));
+            }
+
+            std::vector<uint64_t> signatures(tracker.GetTileCount());
+            for (size_t i = 0; i < signatures.size(); ++i)
+            {
+                signatures[i] = (i + nFrame / 3) % 5;
+            }
+            WriteFrame(tracker, signatures, &buffers[nFrame % 3]);
+            ++nFrame;
+            std::this_thread::yield();
+        }
+
+        bDone = true;
+        presenter.join();
+
+        printf("%d frames written, %d presented, %d rects outside the frame\n", nFrame, nPresented, nOutside.load());
+        TEST_CHECK(nPresented > 0);
+        TEST_CHECK(nOutside == 0);
+    }
+}
+
+int main()
+{
+    TestChangedRects();
+    TestInvalidate();
+    TestReinitialize();
+    TestConcurrentInitialize();
+
+    return TestResult();
+}
@@ -0,0 +1,137 @@
+// Checks how the pipeline's waits wake up: a FrameEvent wakes a waiter as
+// soon as another thread sets it, a Set nobody waited for yet is kept for
+// the next Wait, several Sets wake it once, and an unset event times out
+// after the timeout rather than before or much later. The timer driven
+// source sleeps until its next frame is due, times out when that is past
+// the timeout, and hands a late reader the latest frame, counting the rest
+// as skipped. Timing limits are loose enough for a loaded machine.
+
+#include <chrono>
+#include <thread>
+#include "FrameEvent.h"
+#include "TimerFrameSource.h"
+#include "TestCheck.h"
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+    typedef std::chrono::milliseconds Milliseconds;
+
+    // how much later than asked for a thread may run on a busy machine
+    const Milliseconds cSlack(150);
+
+    Milliseconds GetElapsed(Clock::time_point start)
+    {
+        return std::chrono::duration_cast<Milliseconds>(Clock::now() - start);
+    }
+
+    void TestFrameEvent()
+    {
+        FrameEvent event;
+
+        // nothing set: the whole timeout passes
+        Clock::time_point start = Clock::now();
+        TEST_CHECK(!event.Wait(Milliseconds(30)));
+        TEST_CHECK(GetElapsed(start) >= Milliseconds(29) && GetElapsed(start) < Milliseconds(30) + cSlack);
+        TEST_CHECK(event.GetWakeLatency().nWakes == 0);
+
+        // set before anybody waits: the next wait returns at once and takes
+        // the signal with it
+        event.Set();
+        start = Clock::now();
+        TEST_CHECK(event.Wait(Milliseconds(1000)));
+        TEST_CHECK(GetElapsed(start) < cSlack);
+        TEST_CHECK(!event.Wait(Milliseconds(10)));
+        TEST_CHECK(event.GetWakeLatency().nWakes == 1);
+
+        // several sets before a wait wake it once
+        event.Set();
+        event.Set();
+        event.Set();
+        TEST_CHECK(event.Wait(Milliseconds(1000)));
+        TEST_CHECK(!event.Wait(Milliseconds(10)));
+        TEST_CHECK(event.GetWakeLatency().nWakes == 2);
+
+        // set from another thread while waiting: woken then, not at the timeout
+        for (int nRound = 0; nRound < 5; ++nRound)
+        {
+            start = Clock::now();
+            std::thread setter([&]
+            {
+                std::this_thread::sleep_for(Milliseconds(20));
+                event.Set();
+            });
+
+            TEST_CHECK(event.Wait(Milliseconds(2000)));
+            const Milliseconds elapsed = GetElapsed(start);
+            TEST_CHECK(elapsed >= Milliseconds(19) && elapsed < Milliseconds(20) + cSlack);
+            setter.join();
+        }
+
+        const WakeLatencyStats stats = event.GetWakeLatency();
+        TEST_CHECK(stats.nWakes == 7);
+        TEST_CHECK(stats.nMaxMicroseconds >= 0 && stats.nMaxMicroseconds < std::chrono::duration_cast<std::chrono::microseconds>(cSlack).count());
+        printf("FrameEvent: %llu wakes, %.0f us on average, %lld us at most\n",
+            (unsigned long long)stats.nWakes, stats.GetAverageMicroseconds(), (long long)stats.nMaxMicroseconds);
+    }
+
+    void TestTimerFrameSource()
+    {
+        TimerFrameSource source;
+        TEST_CHECK(source.Initialize(0, 4, 8, 8, Milliseconds(20)) == E_INVALIDARG);
+        TEST_CHECK(source.Initialize(4, 4, 8, 8, Milliseconds(0)) == E_INVALIDARG);
+
+        const Milliseconds period(40);
+        const Clock::time_point initialized = Clock::now();
+        TEST_CHECK(SUCCEEDED(source.Initialize(8, 6, 16, 12, period)));
+        TEST_CHECK(source.GetGeometry() == MakeFrameGeometry(8, 6, 16, 12));
+
+        // the first frame is a period away: a shorter wait times out after
+        // its own timeout, and the frame is not there yet
+        PipelineFrame frame;
+        Clock::time_point start = Clock::now();
+        TEST_CHECK(!source.WaitForFrame(Milliseconds(5)));
+        TEST_CHECK(GetElapsed(start) >= Milliseconds(4) && GetElapsed(start) < Milliseconds(5) + cSlack);
+        TEST_CHECK(source.AcquireFrame(&frame) == E_PENDING || GetElapsed(initialized) >= period);
+
+        // a longer wait wakes when the frame is due
+        TEST_CHECK(source.WaitForFrame(Milliseconds(1000)));
+        TEST_CHECK(GetElapsed(initialized) >= period - Milliseconds(1) && GetElapsed(initialized) < period + cSlack);
+        TEST_CHECK(source.AcquireFrame(&frame) == S_OK);
+        TEST_CHECK(frame.nRelativeTime == 0);
+        TEST_CHECK(frame.GetGeometry() == MakeFrameGeometry(8, 6, 16, 12));
+        TEST_CHECK(frame.pDepthBuffer && frame.pColorBuffer && frame.pBodyIndexBuffer && frame.colorFormat == ColorFormat_Bgra);
+
+        // and again a period later, one period of RelativeTime further
+        TEST_CHECK(source.WaitForFrame(Milliseconds(1000)));
+        TEST_CHECK(source.AcquireFrame(&frame) == S_OK);
+        const int64_t nPeriodTicks = std::chrono::duration_cast<std::chrono::microseconds>(period).count() * 10;
+        TEST_CHECK(frame.nRelativeTime == nPeriodTicks);
+        TEST_CHECK(source.GetSkippedFrameCount() == 0);
+
+        // a reader three and a half periods late gets the latest frame, the
+        // wait returning at once as nothing is left to wait for
+        std::this_thread::sleep_for(period * 7 / 2);
+        start = Clock::now();
+        TEST_CHECK(source.WaitForFrame(Milliseconds(1000)));
+        TEST_CHECK(GetElapsed(start) < cSlack);
+        TEST_CHECK(source.AcquireFrame(&frame) == S_OK);
+
+        const uint64_t nSkipped = source.GetSkippedFrameCount();
+        TEST_CHECK(nSkipped >= 2);
+        TEST_CHECK(frame.nRelativeTime == int64_t(2 + nSkipped) * nPeriodTicks);
+
+        const WakeLatencyStats stats = source.GetWakeLatency();
+        TEST_CHECK(stats.nWakes == 2);
+        printf("TimerFrameSource: %llu wakes, %.0f us on average, %llu frames skipped\n",
+            (unsigned long long)stats.nWakes, stats.GetAverageMicroseconds(), (unsigned long long)nSkipped);
+    }
+}
+
+int main()
+{
+    TestFrameEvent();
+    TestTimerFrameSource();
+
+    return TestResult();
+}
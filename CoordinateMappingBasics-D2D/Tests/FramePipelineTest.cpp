@@ -0,0 +1,212 @@
+// Runs the pipeline headless on a source far faster than the processing
+// stage, presented far slower still, so both hand-offs keep dropping the
+// oldest frame. Checks that what is presented stays recent, that the slow
+// presenter does not hold processing back to its own rate, that no slot is
+// handed to the source while the processing stage still reads it, and that
+// every acquired frame is accounted for, processed or dropped, with the
+// pipeline still acquiring at the end rather than stalled on lost slots.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "FramePipeline.h"
+#include "TestCheck.h"
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const int cDepthWidth = 8;
+    const int cDepthHeight = 6;
+    const int cColorWidth = 16;
+    const int cColorHeight = 12;
+
+    const std::chrono::milliseconds cRunTime(1500);
+
+    // A presented frame may have waited in the queue, been processed and
+    // waited for the presenter, each a few frames long; without dropping
+    // the oldest it would trail further behind every frame
+    const std::chrono::milliseconds cMaxPresentLatency(100);
+
+    // RelativeTime is in 100 ns ticks
+    int64_t GetTicks(Clock::time_point time)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count() * 10;
+    }
+
+    // How long each stage takes for a frame
+    struct StageTimes
+    {
+        std::chrono::microseconds source;
+        std::chrono::microseconds process;
+        std::chrono::microseconds present;
+    };
+
+    // Frames every period, stamped with when they were acquired and numbered
+    // in their own storage
+    class CountingFrameSource : public FrameSource
+    {
+    public:
+        explicit CountingFrameSource(std::chrono::microseconds period) :
+            m_period(period),
+            m_nextFrameTime(Clock::now()),
+            m_nFrames(0)
+        {
+            m_geometry = MakeFrameGeometry(cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+        }
+
+        bool WaitForFrame(std::chrono::milliseconds timeout) override
+        {
+            const Clock::time_point now = Clock::now();
+            if (m_nextFrameTime > now + timeout)
+            {
+                std::this_thread::sleep_for(timeout);
+                return false;
+            }
+
+            std::this_thread::sleep_until(m_nextFrameTime);
+            return true;
+        }
+
+        HRESULT AcquireFrame(PipelineFrame* pFrame) override
+        {
+            if (Clock::now() < m_nextFrameTime)
+            {
+                return E_PENDING;
+            }
+
+            m_nextFrameTime = Clock::now() + m_period;
+
+            pFrame->Reserve(cDepthWidth, cDepthHeight, cColorWidth, cColorHeight);
+            pFrame->nRelativeTime = GetTicks(Clock::now());
+            pFrame->pDepthStorage.get()[0] = static_cast<UINT16>(m_nFrames);
+            pFrame->pColorStorage.get()[0] = static_cast<BYTE>(m_nFrames);
+
+            ++m_nFrames;
+            return S_OK;
+        }
+
+        uint64_t GetFrameCount() const { return m_nFrames; }
+
+    private:
+        std::chrono::microseconds m_period;
+        Clock::time_point m_nextFrameTime;
+        std::atomic<uint64_t> m_nFrames;
+    };
+
+    void TestDropOldest(FramePipeline& pipeline, const StageTimes& times)
+    {
+        CountingFrameSource source(times.source);
+        const FramePipelineStats before = pipeline.GetStats();
+
+        // the source renumbering a slot the processing stage holds would
+        // show up as its two tags disagreeing afterwards
+        std::atomic<int> nTorn(0);
+        FramePipelineCallbacks callbacks;
+        callbacks.process = [&](const PipelineFrame& frame, RGBQUAD* pOutput)
+        {
+            const UINT16 nTag = frame.pDepthBuffer[0];
+            if (times.process.count())
+            {
+                std::this_thread::sleep_for(times.process);
+            }
+            if (frame.pDepthBuffer[0] != nTag || frame.pColorBuffer[0] != static_cast<BYTE>(nTag))
+            {
+                ++nTorn;
+            }
+
+            pOutput[0].rgbBlue = static_cast<BYTE>(nTag);
+            pOutput[0].rgbGreen = static_cast<BYTE>(nTag >> 8);
+        };
+
+        TEST_CHECK(SUCCEEDED(pipeline.Start(&source, callbacks, cColorWidth, cColorHeight)));
+
+        const Clock::time_point start = Clock::now();
+        const Clock::time_point lateStart = start + cRunTime * 2 / 3;
+        uint64_t nLateStartFrames = 0;
+        int nPresented = 0;
+        int64_t nMaxLatency = 0;
+
+        while (Clock::now() - start < cRunTime)
+        {
+            if (!pipeline.GetPresentEvent().Wait(std::chrono::milliseconds(100)))
+            {
+                continue;
+            }
+
+            if (times.present.count())
+            {
+                std::this_thread::sleep_for(times.present);
+            }
+
+            pipeline.PresentLatest([&](const RGBQUAD*, int64_t nRelativeTime)
+            {
+                nMaxLatency = std::max(nMaxLatency, GetTicks(Clock::now()) - nRelativeTime);
+                ++nPresented;
+            });
+
+            if (!nLateStartFrames && Clock::now() >= lateStart)
+            {
+                nLateStartFrames = source.GetFrameCount();
+            }
+        }
+
+        const uint64_t nLateFrames = source.GetFrameCount() - nLateStartFrames;
+        pipeline.Stop();
+
+        FramePipelineStats stats = pipeline.GetStats();
+        stats.nAcquired -= before.nAcquired;
+        stats.nProcessed -= before.nProcessed;
+        stats.nDroppedBeforeProcessing -= before.nDroppedBeforeProcessing;
+        stats.nDroppedBeforePresent -= before.nDroppedBeforePresent;
+        printf("acquired %llu, processed %llu, presented %d, dropped %llu before processing and %llu before present, max latency %.1f ms\n",
+            (unsigned long long)stats.nAcquired, (unsigned long long)stats.nProcessed, nPresented,
+            (unsigned long long)stats.nDroppedBeforeProcessing, (unsigned long long)stats.nDroppedBeforePresent,
+            nMaxLatency / 10000.0);
+
+        TEST_CHECK(nTorn == 0);
+        TEST_CHECK(nPresented > 0);
+        TEST_CHECK(stats.nDroppedBeforeProcessing > 0);
+        TEST_CHECK(nMaxLatency <= std::chrono::duration_cast<std::chrono::microseconds>(cMaxPresentLatency).count() * 10);
+
+        // still acquiring in the last third of the run
+        TEST_CHECK(nLateFrames > 0);
+
+        // processing keeps its own pace however slow the presenter: a
+        // processing stage waiting on the presenter would manage one frame
+        // per present, a sixth of this
+        if (times.process.count())
+        {
+            const int64_t nProcessPeriods = cRunTime / times.process;
+            printf("processed %llu of the %lld frames the processing time allows\n",
+                (unsigned long long)stats.nProcessed, (long long)nProcessPeriods);
+            TEST_CHECK(stats.nProcessed >= uint64_t(nProcessPeriods * 8 / 10));
+        }
+
+        // only the frames still queued are neither processed nor dropped
+        TEST_CHECK(stats.nAcquired == stats.nProcessed + stats.nDroppedBeforeProcessing + stats.nProcessQueueDepth);
+    }
+}
+
+int main()
+{
+    // a source far faster than the processing stage and a presenter slower
+    // still, then every stage as fast as it goes, so the acquisition thread
+    // drops and the processing thread frees slots as often as they can;
+    // each run on the slots the one before left behind
+    const StageTimes times[] =
+    {
+        {std::chrono::microseconds(1000), std::chrono::milliseconds(4), std::chrono::milliseconds(25)},
+        {std::chrono::microseconds(0), std::chrono::microseconds(0), std::chrono::microseconds(0)},
+        {std::chrono::microseconds(1000), std::chrono::milliseconds(4), std::chrono::milliseconds(25)},
+    };
+
+    FramePipeline pipeline;
+    for (const StageTimes& stageTimes : times)
+    {
+        TestDropOldest(pipeline, stageTimes);
+    }
+
+    return TestResult();
+}
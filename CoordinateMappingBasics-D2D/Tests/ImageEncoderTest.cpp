@@ -0,0 +1,785 @@
+// Reads back what the image encoders write, with decoders of its own: QOI
+// files of odd sizes decode to the pixels encoded, using every kind of op,
+// and PNG files pass their chunk CRCs and zlib header, inflate to the
+// filtered rows of the pixels encoded and end in the Adler-32 of the stream,
+// the same bytes whether the strips are deflated on a thread pool or not.
+// The deflater's own output, appended pieces included, inflates back to its
+// input, and the checksums match known values, CombineAdler32 matching the
+// checksum of both buffers back to back.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "Deflate.h"
+#include "ImageEncoder.h"
+#include "PngFile.h"
+#include "QoiFile.h"
+#include "ThreadPool.h"
+#include "TestCheck.h"
+
+namespace
+{
+    uint32_t NextRandom(uint32_t& nState)
+    {
+        nState = nState * 1664525 + 1013904223;
+        return nState >> 8;
+    }
+
+    uint32_t ReadBigEndian(const BYTE* pData)
+    {
+        return (uint32_t(pData[0]) << 24) | (uint32_t(pData[1]) << 16) | (uint32_t(pData[2]) << 8) | pData[3];
+    }
+
+    // Stretches of repeated pixels (longer than a QOI run can hold), small
+    // and larger steps from the previous pixel, a few recurring colors and
+    // noise, so every QOI op and PNG filter gets its turn
+    std::vector<RGBQUAD> MakePicture(int nWidth, int nHeight, uint32_t nSeed)
+    {
+        const RGBQUAD palette[4] = {{10, 200, 30, 0}, {250, 250, 250, 0}, {0, 0, 0, 0}, {90, 60, 180, 0}};
+
+        std::vector<RGBQUAD> pixels(size_t(nWidth) * nHeight);
+        RGBQUAD previous = {0, 0, 0, 0};
+        uint32_t nState = nSeed;
+        size_t i = 0;
+        while (i < pixels.size())
+        {
+            const uint32_t nMode = NextRandom(nState) % 5;
+            const size_t nLength = (nMode == 0) ? 1 + NextRandom(nState) % 150 : 1 + NextRandom(nState) % 12;
+            for (size_t n = 0; n < nLength && i < pixels.size(); ++n, ++i)
+            {
+                RGBQUAD pixel = previous;
+                if (nMode == 1)
+                {
+                    pixel.rgbRed = BYTE(pixel.rgbRed + NextRandom(nState) % 4 - 2);
+                    pixel.rgbGreen = BYTE(pixel.rgbGreen + NextRandom(nState) % 4 - 2);
+                    pixel.rgbBlue = BYTE(pixel.rgbBlue + NextRandom(nState) % 4 - 2);
+                }
+                else if (nMode == 2)
+                {
+                    const int nStep = int(NextRandom(nState) % 41) - 20;
+                    pixel.rgbGreen = BYTE(pixel.rgbGreen + nStep);
+                    pixel.rgbRed = BYTE(pixel.rgbRed + nStep + int(NextRandom(nState) % 9) - 4);
+                    pixel.rgbBlue = BYTE(pixel.rgbBlue + nStep + int(NextRandom(nState) % 9) - 4);
+                }
+                else if (nMode == 3)
+                {
+                    pixel = palette[NextRandom(nState) % 4];
+                }
+                else if (nMode == 4)
+                {
+                    const uint32_t nValue = NextRandom(nState);
+                    pixel.rgbRed = BYTE(nValue);
+                    pixel.rgbGreen = BYTE(nValue >> 8);
+                    pixel.rgbBlue = BYTE(nValue >> 16);
+                }
+
+                // the X byte is not stored, whatever is in it
+                pixel.rgbReserved = BYTE(NextRandom(nState));
+                pixels[i] = pixel;
+                previous = pixel;
+            }
+        }
+        return pixels;
+    }
+
+    bool SameColors(const std::vector<RGBQUAD>& a, const std::vector<RGBQUAD>& b)
+    {
+        if (a.size() != b.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (a[i].rgbRed != b[i].rgbRed || a[i].rgbGreen != b[i].rgbGreen || a[i].rgbBlue != b[i].rgbBlue)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //
+    // Inflate (RFC 1951), after the canonical decoder in zlib's puff.c
+    //
+
+    struct BitReader
+    {
+        const BYTE* pData;
+        size_t nSize;
+        size_t nBit;
+        bool bOverrun;
+
+        // nCount bits, the first one read the lowest
+        uint32_t Read(int nCount)
+        {
+            uint32_t nValue = 0;
+            for (int i = 0; i < nCount; ++i)
+            {
+                if ((nBit >> 3) >= nSize)
+                {
+                    bOverrun = true;
+                    return 0;
+                }
+                nValue |= uint32_t((pData[nBit >> 3] >> (nBit & 7)) & 1) << i;
+                ++nBit;
+            }
+            return nValue;
+        }
+    };
+
+    struct HuffmanTable
+    {
+        int counts[16];
+        std::vector<int> symbols;
+    };
+
+    // Canonical codes from their lengths, false when over-subscribed
+    bool BuildTable(const int* pLengths, int nCount, HuffmanTable* pTable)
+    {
+        memset(pTable->counts, 0, sizeof(pTable->counts));
+        for (int i = 0; i < nCount; ++i)
+        {
+            ++pTable->counts[pLengths[i]];
+        }
+
+        int nLeft = 1;
+        for (int nLength = 1; nLength < 16; ++nLength)
+        {
+            nLeft = (nLeft << 1) - pTable->counts[nLength];
+            if (nLeft < 0)
+            {
+                return false;
+            }
+        }
+
+        int offsets[16] = {};
+        for (int nLength = 1; nLength < 15; ++nLength)
+        {
+            offsets[nLength + 1] = offsets[nLength] + pTable->counts[nLength];
+        }
+
+        pTable->symbols.assign(nCount, 0);
+        for (int i = 0; i < nCount; ++i)
+        {
+            if (pLengths[i])
+            {
+                pTable->symbols[offsets[pLengths[i]]++] = i;
+            }
+        }
+        return true;
+    }
+
+    int DecodeSymbol(BitReader& reader, const HuffmanTable& table)
+    {
+        int nCode = 0;
+        int nFirst = 0;
+        int nIndex = 0;
+        for (int nLength = 1; nLength < 16; ++nLength)
+        {
+            nCode |= int(reader.Read(1));
+            const int nCount = table.counts[nLength];
+            if (nCode - nCount < nFirst)
+            {
+                return table.symbols[nIndex + (nCode - nFirst)];
+            }
+            nIndex += nCount;
+            nFirst = (nFirst + nCount) << 1;
+            nCode <<= 1;
+        }
+        return -1;
+    }
+
+    bool InflateCodes(BitReader& reader, const HuffmanTable& literals, const HuffmanTable& distances, std::vector<BYTE>* pOutput)
+    {
+        static const int lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const int lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const int distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+            1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+        static const int distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+        while (!reader.bOverrun)
+        {
+            int nSymbol = DecodeSymbol(reader, literals);
+            if (nSymbol < 0)
+            {
+                return false;
+            }
+            if (nSymbol < 256)
+            {
+                pOutput->push_back(BYTE(nSymbol));
+                continue;
+            }
+            if (nSymbol == 256)
+            {
+                return true;
+            }
+
+            nSymbol -= 257;
+            if (nSymbol >= 29)
+            {
+                return false;
+            }
+            const int nLength = lengthBase[nSymbol] + int(reader.Read(lengthExtra[nSymbol]));
+
+            nSymbol = DecodeSymbol(reader, distances);
+            if (nSymbol < 0 || nSymbol >= 30)
+            {
+                return false;
+            }
+            const size_t nDistance = size_t(distanceBase[nSymbol]) + reader.Read(distanceExtra[nSymbol]);
+            if (nDistance > pOutput->size())
+            {
+                return false;
+            }
+            for (int i = 0; i < nLength; ++i)
+            {
+                pOutput->push_back((*pOutput)[pOutput->size() - nDistance]);
+            }
+        }
+        return false;
+    }
+
+    bool InflateDynamicTables(BitReader& reader, HuffmanTable* pLiterals, HuffmanTable* pDistances)
+    {
+        static const int order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+        const int nLiteralCount = int(reader.Read(5)) + 257;
+        const int nDistanceCount = int(reader.Read(5)) + 1;
+        const int nCodeLengthCount = int(reader.Read(4)) + 4;
+        if (nLiteralCount > 286 || nDistanceCount > 30)
+        {
+            return false;
+        }
+
+        int lengths[286 + 30] = {};
+        for (int i = 0; i < nCodeLengthCount; ++i)
+        {
+            lengths[order[i]] = int(reader.Read(3));
+        }
+        HuffmanTable codeLengths;
+        if (!BuildTable(lengths, 19, &codeLengths))
+        {
+            return false;
+        }
+
+        int n = 0;
+        while (n < nLiteralCount + nDistanceCount)
+        {
+            const int nSymbol = DecodeSymbol(reader, codeLengths);
+            if (nSymbol < 0 || reader.bOverrun)
+            {
+                return false;
+            }
+            if (nSymbol < 16)
+            {
+                lengths[n++] = nSymbol;
+                continue;
+            }
+
+            int nRepeated = 0;
+            int nRepeat = 0;
+            if (nSymbol == 16)
+            {
+                if (n == 0)
+                {
+                    return false;
+                }
+                nRepeated = lengths[n - 1];
+                nRepeat = 3 + int(reader.Read(2));
+            }
+            else if (nSymbol == 17)
+            {
+                nRepeat = 3 + int(reader.Read(3));
+            }
+            else
+            {
+                nRepeat = 11 + int(reader.Read(7));
+            }
+            if (n + nRepeat > nLiteralCount + nDistanceCount)
+            {
+                return false;
+            }
+            while (nRepeat--)
+            {
+                lengths[n++] = nRepeated;
+            }
+        }
+
+        // a block without an end code could never finish
+        return lengths[256] != 0 &&
+            BuildTable(lengths, nLiteralCount, pLiterals) &&
+            BuildTable(lengths + nLiteralCount, nDistanceCount, pDistances);
+    }
+
+    // Inflates a raw deflate stream up to its final block, pConsumed getting
+    // the bytes it took
+    bool Inflate(const BYTE* pData, size_t nSize, std::vector<BYTE>* pOutput, size_t* pConsumed)
+    {
+        BitReader reader = {pData, nSize, 0, false};
+        bool bFinal = false;
+        while (!bFinal)
+        {
+            bFinal = reader.Read(1) != 0;
+            const uint32_t nType = reader.Read(2);
+            if (nType == 0)
+            {
+                reader.nBit = (reader.nBit + 7) & ~size_t(7);
+                const uint32_t nLength = reader.Read(16);
+                if (nLength != (~reader.Read(16) & 0xffff))
+                {
+                    return false;
+                }
+                for (uint32_t i = 0; i < nLength && !reader.bOverrun; ++i)
+                {
+                    pOutput->push_back(BYTE(reader.Read(8)));
+                }
+            }
+            else if (nType == 1)
+            {
+                int lengths[288 + 30];
+                for (int i = 0; i < 288; ++i)
+                {
+                    lengths[i] = (i < 144) ? 8 : (i < 256) ? 9 : (i < 280) ? 7 : 8;
+                }
+                for (int i = 288; i < 288 + 30; ++i)
+                {
+                    lengths[i] = 5;
+                }
+
+                HuffmanTable literals;
+                HuffmanTable distances;
+                if (!BuildTable(lengths, 288, &literals) || !BuildTable(lengths + 288, 30, &distances) ||
+                    !InflateCodes(reader, literals, distances, pOutput))
+                {
+                    return false;
+                }
+            }
+            else if (nType == 2)
+            {
+                HuffmanTable literals;
+                HuffmanTable distances;
+                if (!InflateDynamicTables(reader, &literals, &distances) ||
+                    !InflateCodes(reader, literals, distances, pOutput))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                return false;
+            }
+
+            if (reader.bOverrun)
+            {
+                return false;
+            }
+        }
+
+        *pConsumed = (reader.nBit + 7) >> 3;
+        return true;
+    }
+
+    //
+    // Decoders
+    //
+
+    // opCounts gets how often each op was used: RGB, INDEX, DIFF, LUMA, RUN
+    bool DecodeQoi(const std::vector<BYTE>& file, int* pWidth, int* pHeight, std::vector<RGBQUAD>* pPixels, int opCounts[5])
+    {
+        const BYTE endMarker[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+        if (file.size() < 14 + sizeof(endMarker) || memcmp(file.data(), "qoif", 4) != 0 || file[12] != 3 || file[13] != 0)
+        {
+            return false;
+        }
+        *pWidth = int(ReadBigEndian(&file[4]));
+        *pHeight = int(ReadBigEndian(&file[8]));
+
+        RGBQUAD index[64] = {};
+        RGBQUAD pixel = {0, 0, 0, 255};
+        pPixels->assign(size_t(*pWidth) * *pHeight, pixel);
+
+        size_t nPosition = 14;
+        const size_t nEnd = file.size() - sizeof(endMarker);
+        size_t i = 0;
+        while (i < pPixels->size())
+        {
+            if (nPosition >= nEnd)
+            {
+                return false;
+            }
+
+            const BYTE nOp = file[nPosition++];
+            size_t nRun = 1;
+            if (nOp == 0xfe)
+            {
+                if (nPosition + 3 > nEnd)
+                {
+                    return false;
+                }
+                pixel.rgbRed = file[nPosition];
+                pixel.rgbGreen = file[nPosition + 1];
+                pixel.rgbBlue = file[nPosition + 2];
+                nPosition += 3;
+                ++opCounts[0];
+            }
+            else if ((nOp & 0xc0) == 0x00)
+            {
+                pixel = index[nOp];
+                ++opCounts[1];
+            }
+            else if ((nOp & 0xc0) == 0x40)
+            {
+                pixel.rgbRed = BYTE(pixel.rgbRed + ((nOp >> 4) & 3) - 2);
+                pixel.rgbGreen = BYTE(pixel.rgbGreen + ((nOp >> 2) & 3) - 2);
+                pixel.rgbBlue = BYTE(pixel.rgbBlue + (nOp & 3) - 2);
+                ++opCounts[2];
+            }
+            else if ((nOp & 0xc0) == 0x80)
+            {
+                if (nPosition >= nEnd)
+                {
+                    return false;
+                }
+                const BYTE nSecond = file[nPosition++];
+                const int nGreen = (nOp & 0x3f) - 32;
+                pixel.rgbRed = BYTE(pixel.rgbRed + nGreen + ((nSecond >> 4) & 0x0f) - 8);
+                pixel.rgbGreen = BYTE(pixel.rgbGreen + nGreen);
+                pixel.rgbBlue = BYTE(pixel.rgbBlue + nGreen + (nSecond & 0x0f) - 8);
+                ++opCounts[3];
+            }
+            else if (nOp != 0xff)
+            {
+                nRun = (nOp & 0x3f) + 1;
+                ++opCounts[4];
+            }
+            else
+            {
+                // RGBA is never written for 3 channels
+                return false;
+            }
+
+            if (i + nRun > pPixels->size())
+            {
+                return false;
+            }
+            while (nRun--)
+            {
+                (*pPixels)[i++] = pixel;
+            }
+            index[(pixel.rgbRed * 3 + pixel.rgbGreen * 5 + pixel.rgbBlue * 7 + pixel.rgbReserved * 11) % 64] = pixel;
+        }
+
+        return nPosition == nEnd && memcmp(&file[nEnd], endMarker, sizeof(endMarker)) == 0;
+    }
+
+    int GetPaethPredictor(int a, int b, int c)
+    {
+        const int p = a + b - c;
+        const int pa = p > a ? p - a : a - p;
+        const int pb = p > b ? p - b : b - p;
+        const int pc = p > c ? p - c : c - p;
+        return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+    }
+
+    // Checks every chunk's CRC and the zlib stream around the image data;
+    // pIdatCount gets the number of IDAT chunks and filterCounts how often
+    // each row filter was used
+    bool DecodePng(const std::vector<BYTE>& file, int* pWidth, int* pHeight, std::vector<RGBQUAD>* pPixels, int* pIdatCount, int filterCounts[5])
+    {
+        const BYTE signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+        if (file.size() < sizeof(signature) || memcmp(file.data(), signature, sizeof(signature)) != 0)
+        {
+            return false;
+        }
+
+        std::vector<BYTE> stream;
+        bool bHeader = false;
+        bool bEnd = false;
+        *pIdatCount = 0;
+        size_t nPosition = sizeof(signature);
+        while (!bEnd)
+        {
+            if (nPosition + 12 > file.size())
+            {
+                return false;
+            }
+            const uint32_t nLength = ReadBigEndian(&file[nPosition]);
+            if (nLength > file.size() - nPosition - 12)
+            {
+                return false;
+            }
+            const BYTE* pType = &file[nPosition + 4];
+            const BYTE* pData = pType + 4;
+            if (UpdateCrc32(0, pType, nLength + 4) != ReadBigEndian(pData + nLength))
+            {
+                return false;
+            }
+
+            if (memcmp(pType, "IHDR", 4) == 0)
+            {
+                // 8 bit RGB, deflate, adaptive filters, not interlaced
+                const BYTE format[5] = {8, 2, 0, 0, 0};
+                if (nLength != 13 || memcmp(pData + 8, format, sizeof(format)) != 0)
+                {
+                    return false;
+                }
+                *pWidth = int(ReadBigEndian(pData));
+                *pHeight = int(ReadBigEndian(pData + 4));
+                bHeader = true;
+            }
+            else if (memcmp(pType, "IDAT", 4) == 0)
+            {
+                stream.insert(stream.end(), pData, pData + nLength);
+                ++*pIdatCount;
+            }
+            else if (memcmp(pType, "IEND", 4) == 0)
+            {
+                bEnd = true;
+            }
+            nPosition += 12 + nLength;
+        }
+        if (!bHeader || nPosition != file.size())
+        {
+            return false;
+        }
+
+        // deflate with a 32K window, no preset dictionary
+        if (stream.size() < 6 || stream[0] != 0x78 || (stream[0] * 256 + stream[1]) % 31 != 0 || (stream[1] & 0x20))
+        {
+            return false;
+        }
+
+        std::vector<BYTE> rows;
+        size_t nConsumed = 0;
+        if (!Inflate(stream.data() + 2, stream.size() - 2, &rows, &nConsumed) || 2 + nConsumed + 4 != stream.size() ||
+            UpdateAdler32(1, rows.data(), rows.size()) != ReadBigEndian(&stream[2 + nConsumed]))
+        {
+            return false;
+        }
+
+        const size_t nStride = 1 + size_t(*pWidth) * 3;
+        if (rows.size() != nStride * *pHeight)
+        {
+            return false;
+        }
+
+        std::vector<BYTE> above(nStride, 0);
+        pPixels->resize(size_t(*pWidth) * *pHeight);
+        for (int y = 0; y < *pHeight; ++y)
+        {
+            BYTE* pRow = &rows[y * nStride];
+            if (pRow[0] > 4)
+            {
+                return false;
+            }
+            ++filterCounts[pRow[0]];
+
+            for (size_t i = 1; i < nStride; ++i)
+            {
+                const int nLeft = (i > 3) ? pRow[i - 3] : 0;
+                const int nUpperLeft = (i > 3) ? above[i - 3] : 0;
+                int nPredicted = 0;
+                switch (pRow[0])
+                {
+                case 0: nPredicted = 0; break;
+                case 1: nPredicted = nLeft; break;
+                case 2: nPredicted = above[i]; break;
+                case 3: nPredicted = (nLeft + above[i]) / 2; break;
+                default: nPredicted = GetPaethPredictor(nLeft, above[i], nUpperLeft); break;
+                }
+                pRow[i] = BYTE(pRow[i] + nPredicted);
+            }
+
+            for (int x = 0; x < *pWidth; ++x)
+            {
+                RGBQUAD& pixel = (*pPixels)[size_t(y) * *pWidth + x];
+                pixel.rgbRed = pRow[1 + x * 3];
+                pixel.rgbGreen = pRow[2 + x * 3];
+                pixel.rgbBlue = pRow[3 + x * 3];
+                pixel.rgbReserved = 0;
+            }
+            memcpy(above.data(), pRow, nStride);
+        }
+        return true;
+    }
+
+    //
+    // Tests
+    //
+
+    void TestChecksums()
+    {
+        const BYTE* pWikipedia = reinterpret_cast<const BYTE*>("Wikipedia");
+        const BYTE* pDigits = reinterpret_cast<const BYTE*>("123456789");
+        const BYTE* pFox = reinterpret_cast<const BYTE*>("The quick brown fox jumps over the lazy dog");
+
+        TEST_CHECK(UpdateAdler32(1, pDigits, 0) == 1);
+        TEST_CHECK(UpdateAdler32(1, pWikipedia, 9) == 0x11e60398);
+        TEST_CHECK(UpdateAdler32(1, pDigits, 9) == 0x091e01de);
+        TEST_CHECK(UpdateAdler32(1, pFox, 43) == 0x5bdc0fda);
+
+        TEST_CHECK(UpdateCrc32(0, pDigits, 0) == 0);
+        TEST_CHECK(UpdateCrc32(0, pDigits, 9) == 0xcbf43926);
+        TEST_CHECK(UpdateCrc32(0, pFox, 43) == 0x414fa339);
+        TEST_CHECK(UpdateCrc32(0, reinterpret_cast<const BYTE*>("IEND"), 4) == 0xae426082);
+
+        // long enough for the sums to be reduced on the way
+        std::vector<BYTE> data(100000);
+        for (size_t i = 0; i < data.size(); ++i)
+        {
+            data[i] = BYTE(i * i + 7 * i);
+        }
+        const uint32_t nAdler = UpdateAdler32(1, data.data(), data.size());
+        TEST_CHECK(nAdler == 0x4e65d490);
+        TEST_CHECK(UpdateCrc32(0, data.data(), data.size()) == 0x6b6de2de);
+
+        // in pieces, updating or combining, around the Adler-32 modulus
+        const size_t splits[] = {0, 1, 5552, 65521, 65522, 99999, 100000};
+        for (size_t nSplit : splits)
+        {
+            const size_t nSecondSize = data.size() - nSplit;
+            const uint32_t nFirst = UpdateAdler32(1, data.data(), nSplit);
+            const uint32_t nSecond = UpdateAdler32(1, data.data() + nSplit, nSecondSize);
+            TEST_CHECK(UpdateAdler32(nFirst, data.data() + nSplit, nSecondSize) == nAdler);
+            TEST_CHECK(CombineAdler32(nFirst, nSecond, nSecondSize) == nAdler);
+            TEST_CHECK(UpdateCrc32(UpdateCrc32(0, data.data(), nSplit), data.data() + nSplit, nSecondSize) == 0x6b6de2de);
+        }
+    }
+
+    bool RoundTrips(const std::vector<BYTE>& data)
+    {
+        std::vector<BYTE> compressed;
+        DeflateCompress(data.data(), data.size(), true, &compressed);
+
+        std::vector<BYTE> inflated;
+        size_t nConsumed = 0;
+        return Inflate(compressed.data(), compressed.size(), &inflated, &nConsumed) &&
+            nConsumed == compressed.size() && inflated == data;
+    }
+
+    void TestDeflate()
+    {
+        uint32_t nState = 7;
+
+        TEST_CHECK(RoundTrips(std::vector<BYTE>()));
+        TEST_CHECK(RoundTrips(std::vector<BYTE>(1, 'a')));
+
+        // matches longer than the longest deflate has
+        TEST_CHECK(RoundTrips(std::vector<BYTE>(1000, 0)));
+
+        std::vector<BYTE> noise(70000);
+        for (BYTE& value : noise)
+        {
+            value = BYTE(NextRandom(nState));
+        }
+        TEST_CHECK(RoundTrips(noise));
+
+        // a block repeated with changes, matches near and across the whole
+        // window
+        std::vector<BYTE> repeated;
+        for (int nCopy = 0; nCopy < 200; ++nCopy)
+        {
+            repeated.insert(repeated.end(), noise.begin(), noise.begin() + 1000);
+            repeated[NextRandom(nState) % repeated.size()] ^= 0x55;
+        }
+        TEST_CHECK(RoundTrips(repeated));
+
+        // compressed apart and appended, only the last piece final
+        std::vector<BYTE> compressed;
+        const size_t splits[] = {0, 30000, 30000, 150000, repeated.size()};
+        for (int i = 0; i < 4; ++i)
+        {
+            DeflateCompress(repeated.data() + splits[i], splits[i + 1] - splits[i], i == 3, &compressed);
+        }
+        std::vector<BYTE> inflated;
+        size_t nConsumed = 0;
+        TEST_CHECK(Inflate(compressed.data(), compressed.size(), &inflated, &nConsumed));
+        TEST_CHECK(nConsumed == compressed.size() && inflated == repeated);
+    }
+
+    void TestQoi()
+    {
+        const int sizes[][2] = {{1, 1}, {7, 5}, {33, 17}, {1, 129}, {203, 61}};
+        int opCounts[5] = {};
+        for (const int* pSize : sizes)
+        {
+            const std::vector<RGBQUAD> pixels = MakePicture(pSize[0], pSize[1], uint32_t(pSize[0] * 1000 + pSize[1]));
+
+            std::vector<BYTE> file;
+            TEST_CHECK(SUCCEEDED(EncodeQoi(pixels.data(), pSize[0], pSize[1], &file)));
+
+            int nWidth = 0;
+            int nHeight = 0;
+            std::vector<RGBQUAD> decoded;
+            TEST_CHECK(DecodeQoi(file, &nWidth, &nHeight, &decoded, opCounts));
+            TEST_CHECK(nWidth == pSize[0] && nHeight == pSize[1]);
+            TEST_CHECK(SameColors(decoded, pixels));
+        }
+
+        printf("QOI ops: %d rgb, %d index, %d diff, %d luma, %d run\n",
+            opCounts[0], opCounts[1], opCounts[2], opCounts[3], opCounts[4]);
+        for (int nCount : opCounts)
+        {
+            TEST_CHECK(nCount > 0);
+        }
+
+        std::vector<BYTE> file;
+        TEST_CHECK(FAILED(EncodeQoi(nullptr, 4, 4, &file)));
+        TEST_CHECK(FAILED(EncodeQoi(MakePicture(4, 4, 1).data(), 0, 4, &file)));
+    }
+
+    void TestPng()
+    {
+        ThreadPool threadPool(4);
+
+        // one strip, and several with the last one short
+        const int sizes[][2] = {{1, 1}, {7, 5}, {131, 150}, {1, 200}};
+        int filterCounts[5] = {};
+        for (const int* pSize : sizes)
+        {
+            const std::vector<RGBQUAD> pixels = MakePicture(pSize[0], pSize[1], uint32_t(pSize[0] * 1000 + pSize[1]));
+
+            std::vector<BYTE> file;
+            TEST_CHECK(SUCCEEDED(EncodePng(pixels.data(), pSize[0], pSize[1], nullptr, &file)));
+
+            int nWidth = 0;
+            int nHeight = 0;
+            int nIdatCount = 0;
+            std::vector<RGBQUAD> decoded;
+            TEST_CHECK(DecodePng(file, &nWidth, &nHeight, &decoded, &nIdatCount, filterCounts));
+            TEST_CHECK(nWidth == pSize[0] && nHeight == pSize[1]);
+            TEST_CHECK(SameColors(decoded, pixels));
+
+            // a chunk per strip of 64 rows, and the trailer's
+            TEST_CHECK(nIdatCount == (pSize[1] + 63) / 64 + 1);
+
+            std::vector<BYTE> pooledFile;
+            TEST_CHECK(SUCCEEDED(EncodePng(pixels.data(), pSize[0], pSize[1], &threadPool, &pooledFile)));
+            TEST_CHECK(pooledFile == file);
+
+            // and through the format's entry point
+            std::vector<BYTE> encoded;
+            TEST_CHECK(SUCCEEDED(EncodeImage(ImageFormat_Png, pixels.data(), pSize[0], pSize[1], &threadPool, &encoded)));
+            TEST_CHECK(encoded == file);
+        }
+
+        // all but Average, which the encoder does not try
+        printf("PNG filters: %d none, %d sub, %d up, %d average, %d paeth\n",
+            filterCounts[0], filterCounts[1], filterCounts[2], filterCounts[3], filterCounts[4]);
+        TEST_CHECK(filterCounts[0] > 0 && filterCounts[1] > 0 && filterCounts[2] > 0 && filterCounts[4] > 0);
+
+        std::vector<BYTE> file;
+        TEST_CHECK(FAILED(EncodePng(nullptr, 4, 4, nullptr, &file)));
+        TEST_CHECK(FAILED(EncodePng(MakePicture(4, 4, 1).data(), 4, -1, nullptr, &file)));
+    }
+}
+
+int main()
+{
+    TestChecksums();
+    TestDeflate();
+    TestQoi();
+    TestPng();
+
+    return TestResult();
+}
@@ -0,0 +1,265 @@
+// Holds the software mapper's color to depth mapping to a reference within
+// the error the splatting is expected to add.
+//
+// Without arguments the references are worked out in closed form: for a
+// typical Kinect v2 calibration, with the color camera slightly rotated, the
+// depth frames of a flat and of a slanted wall, and for every color pixel the
+// point where its ray meets the wall, projected into the depth camera.
+//
+// Given a calibration file and a mapping the app saved with -savemapping
+// while running on the SDK mapper, it checks the software mapper against
+// the SDK's MapColorFrameToDepthSpace output for that frame instead:
+//   SoftwareMapperTest sensor.calibration sdk.mapping
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vector>
+#include "SoftwareCoordinateMapper.h"
+#include "TestCheck.h"
+
+namespace
+{
+    // Mean distance from the reference, in depth pixels. The shares of the
+    // color pixels both map that round to another depth pixel, and of all
+    // color pixels only one of them maps: cracks between the splats show up
+    // in the last one.
+    const float cMaxMeanError = 0.25f;
+    const float cMaxPixelMismatch = 0.10f;
+    const float cMaxValidityMismatch = 0.005f;
+
+    SensorCalibration GetTestCalibration()
+    {
+        SensorCalibration calibration;
+        memset(&calibration, 0, sizeof(calibration));
+
+        calibration.depth.nWidth = 512;
+        calibration.depth.nHeight = 424;
+        calibration.depth.fFocalLengthX = 365.5f;
+        calibration.depth.fFocalLengthY = 365.5f;
+        calibration.depth.fPrincipalPointX = 257.0f;
+        calibration.depth.fPrincipalPointY = 207.0f;
+        calibration.depth.fRadialK2 = 0.09f;
+        calibration.depth.fRadialK4 = -0.27f;
+        calibration.depth.fRadialK6 = 0.09f;
+
+        calibration.color.nWidth = 1920;
+        calibration.color.nHeight = 1080;
+        calibration.color.fFocalLengthX = 1081.4f;
+        calibration.color.fFocalLengthY = 1081.4f;
+        calibration.color.fPrincipalPointX = 959.5f;
+        calibration.color.fPrincipalPointY = 539.5f;
+        calibration.color.fRadialK2 = 0.02f;
+        calibration.color.fRadialK4 = -0.01f;
+
+        // a degree about y
+        const float fAngle = 0.01745f;
+        calibration.rotation[0] = cosf(fAngle);
+        calibration.rotation[2] = sinf(fAngle);
+        calibration.rotation[4] = 1.0f;
+        calibration.rotation[6] = -sinf(fAngle);
+        calibration.rotation[8] = cosf(fAngle);
+        calibration.translation[0] = -0.052f;
+        calibration.translation[1] = 0.002f;
+
+        return calibration;
+    }
+
+    // The undistorted direction at unit depth of a pixel
+    void Unproject(const SensorIntrinsics& camera, double x, double y, double* pX, double* pY)
+    {
+        const double xd = (x - camera.fPrincipalPointX) / camera.fFocalLengthX;
+        const double yd = (y - camera.fPrincipalPointY) / camera.fFocalLengthY;
+
+        // Newton's method on the radius, the distortion only scales it
+        const double rd = sqrt(xd * xd + yd * yd);
+        double r = rd;
+        for (int nIteration = 0; nIteration < 20; ++nIteration)
+        {
+            const double r2 = r * r;
+            const double f = r * (1.0 + r2 * (camera.fRadialK2 + r2 * (camera.fRadialK4 + r2 * camera.fRadialK6))) - rd;
+            const double df = 1.0 + r2 * (3.0 * camera.fRadialK2 + r2 * (5.0 * camera.fRadialK4 + r2 * 7.0 * camera.fRadialK6));
+            r -= f / df;
+        }
+
+        const double fScale = (rd > 0.0) ? r / rd : 1.0;
+        *pX = xd * fScale;
+        *pY = yd * fScale;
+    }
+
+    // The wall Z = fDistance + fSlope * X in depth camera space, meters
+    struct Wall
+    {
+        double fDistance;
+        double fSlope;
+    };
+
+    std::vector<UINT16> RenderDepth(const SensorCalibration& calibration, const Wall& wall)
+    {
+        const SensorIntrinsics& depth = calibration.depth;
+        std::vector<UINT16> frame(size_t(depth.nWidth) * depth.nHeight);
+
+        for (int y = 0; y < depth.nHeight; ++y)
+        {
+            for (int x = 0; x < depth.nWidth; ++x)
+            {
+                double xu = 0.0;
+                double yu = 0.0;
+                Unproject(depth, x, y, &xu, &yu);
+
+                const double z = wall.fDistance / (1.0 - wall.fSlope * xu);
+                frame[x + y * depth.nWidth] = static_cast<UINT16>(lround(z * 1000.0));
+            }
+        }
+
+        return frame;
+    }
+
+    // Where each color pixel's ray meets the wall, in depth pixels, or
+    // -infinity when that is outside the depth frame
+    std::vector<DepthSpacePoint> MapWall(const SensorCalibration& calibration, const Wall& wall)
+    {
+        const SensorIntrinsics& depth = calibration.depth;
+        const SensorIntrinsics& color = calibration.color;
+        const float* R = calibration.rotation;
+        const float* T = calibration.translation;
+
+        // a point in color space p is R^T (p - T) in depth space
+        const double tx = R[0] * T[0] + R[3] * T[1] + R[6] * T[2];
+        const double ty = R[1] * T[0] + R[4] * T[1] + R[7] * T[2];
+        const double tz = R[2] * T[0] + R[5] * T[1] + R[8] * T[2];
+
+        const float fInvalid = -std::numeric_limits<float>::infinity();
+        std::vector<DepthSpacePoint> points(size_t(color.nWidth) * color.nHeight);
+
+        for (int v = 0; v < color.nHeight; ++v)
+        {
+            for (int u = 0; u < color.nWidth; ++u)
+            {
+                DepthSpacePoint& point = points[u + v * color.nWidth];
+                point.X = fInvalid;
+                point.Y = fInvalid;
+
+                double xc = 0.0;
+                double yc = 0.0;
+                Unproject(color, u, v, &xc, &yc);
+
+                // the ray s * (xc, yc, 1) in depth space is s * d - t
+                const double dx = R[0] * xc + R[3] * yc + R[6];
+                const double dy = R[1] * xc + R[4] * yc + R[7];
+                const double dz = R[2] * xc + R[5] * yc + R[8];
+
+                const double fDenominator = dz - wall.fSlope * dx;
+                if (fDenominator <= 0.0)
+                {
+                    continue;
+                }
+
+                const double s = (wall.fDistance + tz - wall.fSlope * tx) / fDenominator;
+                const double X = s * dx - tx;
+                const double Y = s * dy - ty;
+                const double Z = s * dz - tz;
+
+                const double xn = X / Z;
+                const double yn = Y / Z;
+                const double r2 = xn * xn + yn * yn;
+                const double f = 1.0 + r2 * (depth.fRadialK2 + r2 * (depth.fRadialK4 + r2 * depth.fRadialK6));
+                const double x = depth.fFocalLengthX * xn * f + depth.fPrincipalPointX;
+                const double y = depth.fFocalLengthY * yn * f + depth.fPrincipalPointY;
+
+                if (x >= -0.5 && x < depth.nWidth - 0.5 && y >= -0.5 && y < depth.nHeight - 0.5)
+                {
+                    point.X = static_cast<float>(x);
+                    point.Y = static_cast<float>(y);
+                }
+            }
+        }
+
+        return points;
+    }
+
+    void CheckMapping(const char* pszName, const SensorCalibration& calibration, const ReferenceMapping& reference)
+    {
+        SoftwareCoordinateMapper mapper;
+        TEST_CHECK(SUCCEEDED(mapper.Initialize(calibration)));
+        TEST_CHECK(SUCCEEDED(mapper.SetFrameGeometry(
+            reference.nDepthWidth, reference.nDepthHeight, reference.nColorWidth, reference.nColorHeight)));
+
+        std::vector<DepthSpacePoint> points(reference.points.size());
+        TEST_CHECK(SUCCEEDED(mapper.MapColorFrameToDepthSpace(
+            static_cast<UINT>(reference.depth.size()),
+            reference.depth.data(),
+            static_cast<UINT>(points.size()),
+            points.data())));
+
+        MappingError error;
+        CompareDepthSpaceMappings(reference.points.data(), points.data(), static_cast<UINT>(points.size()), &error);
+
+        const float fPixelMismatch = error.nBothValid ? float(error.nPixelMismatch) / error.nBothValid : 1.0f;
+        const float fValidityMismatch = float(error.nValidityMismatch) / points.size();
+        printf("%s: %u mapped, mean error %.3f max %.3f, pixel mismatch %.2f%%, validity mismatch %.2f%%\n",
+            pszName, error.nBothValid, error.fMeanError, error.fMaxError, 100.0f * fPixelMismatch, 100.0f * fValidityMismatch);
+
+        // a mapping that maps nothing would pass everything below
+        TEST_CHECK(error.nBothValid > points.size() / 4);
+        TEST_CHECK(error.fMeanError < cMaxMeanError);
+        TEST_CHECK(fPixelMismatch < cMaxPixelMismatch);
+        TEST_CHECK(fValidityMismatch < cMaxValidityMismatch);
+    }
+
+    ReferenceMapping GetWallMapping(const SensorCalibration& calibration, const Wall& wall)
+    {
+        ReferenceMapping reference;
+        reference.nDepthWidth = calibration.depth.nWidth;
+        reference.nDepthHeight = calibration.depth.nHeight;
+        reference.nColorWidth = calibration.color.nWidth;
+        reference.nColorHeight = calibration.color.nHeight;
+        reference.depth = RenderDepth(calibration, wall);
+        reference.points = MapWall(calibration, wall);
+        return reference;
+    }
+
+    void TestAnalyticReferences()
+    {
+        const SensorCalibration calibration = GetTestCalibration();
+
+        const Wall flat = {2.5, 0.0};
+        CheckMapping("flat wall", calibration, GetWallMapping(calibration, flat));
+
+        const Wall slanted = {1.8, 0.4};
+        CheckMapping("slanted wall", calibration, GetWallMapping(calibration, slanted));
+
+        // the references round trip through the file the app saves
+        const char* pszPath = "SoftwareMapperTest.mapping";
+        const ReferenceMapping saved = GetWallMapping(calibration, flat);
+        ReferenceMapping loaded;
+        TEST_CHECK(SUCCEEDED(SaveReferenceMapping(pszPath, saved)));
+        TEST_CHECK(SUCCEEDED(LoadReferenceMapping(pszPath, &loaded)));
+        TEST_CHECK(loaded.nDepthWidth == saved.nDepthWidth && loaded.nColorHeight == saved.nColorHeight);
+        TEST_CHECK(loaded.depth == saved.depth);
+        TEST_CHECK(loaded.points.size() == saved.points.size() &&
+            memcmp(loaded.points.data(), saved.points.data(), saved.points.size() * sizeof(DepthSpacePoint)) == 0);
+        remove(pszPath);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 3)
+    {
+        SensorCalibration calibration;
+        ReferenceMapping reference;
+        if (FAILED(LoadSensorCalibration(argv[1], &calibration)) || FAILED(LoadReferenceMapping(argv[2], &reference)))
+        {
+            fprintf(stderr, "cannot read %s or %s\n", argv[1], argv[2]);
+            return 1;
+        }
+
+        CheckMapping(argv[2], calibration, reference);
+        return TestResult();
+    }
+
+    TestAnalyticReferences();
+    return TestResult();
+}
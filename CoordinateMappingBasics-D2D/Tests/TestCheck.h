@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdio>
+
+// The few checks the test executables need. A failed check prints where it
+// failed and is counted; main returns TestResult() so CTest sees failures.
+inline int& TestFailureCount()
+{
+    static int nFailures = 0;
+    return nFailures;
+}
+
+#define TEST_CHECK(__bool__) \
+    do { if (!(__bool__)) { ++TestFailureCount(); fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #__bool__); } } while (0)
+
+// 0 when every check passed, else 1
+inline int TestResult()
+{
+    if (TestFailureCount() != 0)
+    {
+        fprintf(stderr, "%d checks failed\n", TestFailureCount());
+        return 1;
+    }
+
+    printf("all checks passed\n");
+    return 0;
+}
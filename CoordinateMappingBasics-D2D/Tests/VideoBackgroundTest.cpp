@@ -0,0 +1,211 @@
+// Plays a small Y4M video through the background's decoder thread and ring,
+// asking for every frame in turn for three times the length of the video:
+// each frame must arrive decoded and scaled as DecodeFrame decodes it, the
+// ring of three slots wrapping around many times and the video looping
+// back to its first frame at the end of the file, and the frame handed out
+// must stay intact while the decoder keeps filling the other slots. Then a
+// jump ahead, which the decoder catches up on by skipping, and a replay
+// clock going back, which the video plays on through. Files the reader
+// cannot play are turned away.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "VideoBackground.h"
+#include "TestCheck.h"
+
+namespace
+{
+    const int cSourceWidth = 8;
+    const int cSourceHeight = 6;
+    const int cFrameCount = 5;
+    const int cFramesPerSecond = 10;
+
+    // scaled up on the way, like a background of another size
+    const int cWidth = 12;
+    const int cHeight = 10;
+    const int cRingSize = 3;
+
+    // RelativeTime is in 100ns ticks, halfway into a frame
+    int64_t GetFrameTime(int64_t nFrame)
+    {
+        return nFrame * 10000000 / cFramesPerSecond + 10000000 / cFramesPerSecond / 2;
+    }
+
+    // Y varies across every frame and from frame to frame, the chroma from
+    // frame to frame
+    bool WriteY4m(const char* pszPath, const char* pszColorSpace, bool bTruncatedFrame)
+    {
+        FILE* pFile = fopen(pszPath, "wb");
+        if (!pFile)
+        {
+            return false;
+        }
+
+        bool bWritten = fprintf(pFile, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C%s\n",
+            cSourceWidth, cSourceHeight, cFramesPerSecond, pszColorSpace) > 0;
+
+        const int nChromaPixels = (cSourceWidth / 2) * ((cSourceHeight + 1) / 2);
+        std::vector<BYTE> planes(size_t(cSourceWidth) * cSourceHeight + 2 * nChromaPixels);
+        for (int nFrame = 0; nFrame < cFrameCount + (bTruncatedFrame ? 1 : 0); ++nFrame)
+        {
+            for (int y = 0; y < cSourceHeight; ++y)
+            {
+                for (int x = 0; x < cSourceWidth; ++x)
+                {
+                    planes[x + y * cSourceWidth] = static_cast<BYTE>(16 + 40 * nFrame + 3 * x + 2 * y);
+                }
+            }
+
+            BYTE* pChroma = planes.data() + cSourceWidth * cSourceHeight;
+            for (int i = 0; i < nChromaPixels; ++i)
+            {
+                pChroma[i] = static_cast<BYTE>(100 + 10 * nFrame);
+                pChroma[nChromaPixels + i] = static_cast<BYTE>(150 - 10 * nFrame);
+            }
+
+            // the last frame cut short, as when a copy was interrupted
+            const bool bTruncated = (nFrame == cFrameCount);
+            const size_t nBytes = bTruncated ? planes.size() / 2 : planes.size();
+            bWritten = bWritten && fputs("FRAME\n", pFile) >= 0 && fwrite(planes.data(), 1, nBytes, pFile) == nBytes;
+        }
+
+        const bool bClosed = fclose(pFile) == 0;
+        return bWritten && bClosed;
+    }
+
+    // Polls until the decoder has frame nFrame ready for its time, null when
+    // it does not arrive or a later one does
+    const RGBQUAD* WaitForFrame(VideoBackground& video, int64_t nTime, int64_t nFrame)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (std::chrono::steady_clock::now() < deadline)
+        {
+            int64_t nHeldFrame = -1;
+            const RGBQUAD* pPixels = video.GetFrame(nTime, &nHeldFrame);
+            if (pPixels && nHeldFrame == nFrame)
+            {
+                return pPixels;
+            }
+            if (nHeldFrame > nFrame)
+            {
+                return nullptr;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        return nullptr;
+    }
+
+    bool SamePixels(const RGBQUAD* pA, const RGBQUAD* pB)
+    {
+        return memcmp(pA, pB, size_t(cWidth) * cHeight * sizeof(RGBQUAD)) == 0;
+    }
+
+    void TestPlayback(const char* pszPath)
+    {
+        VideoBackground video;
+        TEST_CHECK(SUCCEEDED(video.Open(pszPath, cWidth, cHeight, 30.0, cRingSize)));
+        TEST_CHECK(video.IsOpen());
+        TEST_CHECK(video.GetFrameCount() == cFrameCount);
+        TEST_CHECK(video.GetFramesPerSecond() == cFramesPerSecond);
+
+        // every frame of the file as the decoder thread should produce it,
+        // all of them different
+        std::vector<std::vector<RGBQUAD>> expected(cFrameCount, std::vector<RGBQUAD>(size_t(cWidth) * cHeight));
+        for (int i = 0; i < cFrameCount; ++i)
+        {
+            TEST_CHECK(SUCCEEDED(video.DecodeFrame(i, expected[i].data())));
+            TEST_CHECK(i == 0 || !SamePixels(expected[i].data(), expected[i - 1].data()));
+        }
+        TEST_CHECK(FAILED(video.DecodeFrame(cFrameCount, expected[0].data())));
+
+        // the first call starts the video's clock
+        int64_t nHeldFrame = -1;
+        video.GetFrame(0, &nHeldFrame);
+
+        int nWrong = 0;
+        int nOverwritten = 0;
+        const int64_t nPlayed = 3 * cFrameCount;
+        for (int64_t nFrame = 0; nFrame < nPlayed; ++nFrame)
+        {
+            const RGBQUAD* pPixels = WaitForFrame(video, GetFrameTime(nFrame), nFrame);
+            const std::vector<RGBQUAD>& frame = expected[nFrame % cFrameCount];
+            if (!pPixels || !SamePixels(pPixels, frame.data()))
+            {
+                ++nWrong;
+                continue;
+            }
+
+            // the decoder fills the other slots meanwhile, never this one
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            if (!SamePixels(pPixels, frame.data()))
+            {
+                ++nOverwritten;
+            }
+        }
+        TEST_CHECK(nWrong == 0);
+        TEST_CHECK(nOverwritten == 0);
+
+        VideoBackgroundStats stats = video.GetStats();
+        TEST_CHECK(stats.nDecoded >= uint64_t(nPlayed));
+        TEST_CHECK(stats.nSkipped == 0);
+
+        // far ahead: the frames in between are skipped, not decoded
+        const int64_t nJump = nPlayed + 40;
+        const RGBQUAD* pPixels = WaitForFrame(video, GetFrameTime(nJump), nJump);
+        TEST_CHECK(pPixels && SamePixels(pPixels, expected[nJump % cFrameCount].data()));
+        stats = video.GetStats();
+        TEST_CHECK(stats.nSkipped > 0);
+        TEST_CHECK(stats.nDecoded < uint64_t(nJump));
+
+        // a replay starting over: the video goes on from where it was
+        pPixels = video.GetFrame(GetFrameTime(0), &nHeldFrame);
+        TEST_CHECK(nHeldFrame == nJump);
+        pPixels = WaitForFrame(video, GetFrameTime(1), nJump + 1);
+        TEST_CHECK(pPixels && SamePixels(pPixels, expected[(nJump + 1) % cFrameCount].data()));
+
+        stats = video.GetStats();
+        printf("%llu requests, %llu missed, %llu decoded, %llu skipped, %.3f ms per decode\n",
+            (unsigned long long)stats.nRequests, (unsigned long long)stats.nMisses,
+            (unsigned long long)stats.nDecoded, (unsigned long long)stats.nSkipped,
+            stats.nDecoded ? stats.fDecodeMilliseconds / stats.nDecoded : 0.0);
+
+        video.Close();
+        TEST_CHECK(!video.IsOpen());
+    }
+
+    void TestRejected(const char* pszPath)
+    {
+        VideoBackground video;
+        TEST_CHECK(FAILED(video.Open(pszPath, cWidth, cHeight, 30.0, 1)));
+
+        // 4:4:4 is not read
+        TEST_CHECK(WriteY4m(pszPath, "444", false));
+        TEST_CHECK(video.Open(pszPath, cWidth, cHeight) == E_NOTIMPL);
+        TEST_CHECK(!video.IsOpen());
+
+        // nor is something that only has the extension
+        FILE* pFile = fopen(pszPath, "wb");
+        TEST_CHECK(pFile && fputs("not a video\n", pFile) >= 0 && fclose(pFile) == 0);
+        TEST_CHECK(FAILED(video.Open(pszPath, cWidth, cHeight)));
+        TEST_CHECK(!video.IsOpen());
+    }
+}
+
+int main()
+{
+    const char* pszPath = "VideoBackgroundTest.y4m";
+
+    // the frame cut short at the end of the file is not played
+    TEST_CHECK(WriteY4m(pszPath, "420jpeg", true));
+    TestPlayback(pszPath);
+    TestRejected(pszPath);
+
+    remove(pszPath);
+    return TestResult();
+}
@@ -0,0 +1,189 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace
+{
+    const int cCacheLineSize = 64;
+}
+
+ThreadPool::ThreadPool(int nThreadCount) :
+    m_nGeneration(0),
+    m_bStop(false),
+    m_pTask(nullptr),
+    m_nRemaining(0)
+{
+    if (nThreadCount <= 0)
+    {
+        nThreadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+
+    for (int i = 0; i < nThreadCount; ++i)
+    {
+        m_queues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    // queue 0 belongs to whichever thread calls ParallelFor
+    for (int i = 1; i < nThreadCount; ++i)
+    {
+        m_workers.emplace_back(&ThreadPool::WorkerMain, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeLock);
+        m_bStop = true;
+    }
+    m_wake.notify_all();
+
+    for (std::thread& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::ParallelFor(int nTaskCount, const std::function<void(int)>& task)
+{
+    if (nTaskCount <= 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> jobLock(m_jobLock);
+
+    if (m_workers.empty() || nTaskCount == 1)
+    {
+        for (int i = 0; i < nTaskCount; ++i)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    m_pTask = &task;
+    m_nRemaining.store(nTaskCount);
+
+    // hand each worker a contiguous run of tasks, so neighbouring bands stay on
+    // one core unless somebody runs out of work and steals them
+    const int nQueues = GetThreadCount();
+    for (int q = 0; q < nQueues; ++q)
+    {
+        const int nBegin = static_cast<int>(int64_t(nTaskCount) * q / nQueues);
+        const int nEnd = static_cast<int>(int64_t(nTaskCount) * (q + 1) / nQueues);
+
+        std::lock_guard<std::mutex> lock(m_queues[q]->lock);
+        for (int i = nBegin; i < nEnd; ++i)
+        {
+            m_queues[q]->tasks.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_wakeLock);
+        ++m_nGeneration;
+    }
+    m_wake.notify_all();
+
+    RunTasks(0);
+
+    std::unique_lock<std::mutex> lock(m_wakeLock);
+    m_done.wait(lock, [this] { return m_nRemaining.load() == 0; });
+    m_pTask = nullptr;
+}
+
+void ThreadPool::WorkerMain(int nWorker)
+{
+    uint64_t nSeenGeneration = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_wakeLock);
+            m_wake.wait(lock, [&] { return m_bStop || m_nGeneration != nSeenGeneration; });
+
+            if (m_bStop)
+            {
+                return;
+            }
+
+            nSeenGeneration = m_nGeneration;
+        }
+
+        RunTasks(nWorker);
+    }
+}
+
+bool ThreadPool::TryGetTask(int nWorker, int* pTask)
+{
+    // own queue first, from the front
+    {
+        WorkQueue& own = *m_queues[nWorker];
+        std::lock_guard<std::mutex> lock(own.lock);
+        if (!own.tasks.empty())
+        {
+            *pTask = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+
+    // then steal from the back of everybody else's
+    const int nQueues = GetThreadCount();
+    for (int i = 1; i < nQueues; ++i)
+    {
+        WorkQueue& victim = *m_queues[(nWorker + i) % nQueues];
+        std::lock_guard<std::mutex> lock(victim.lock);
+        if (!victim.tasks.empty())
+        {
+            *pTask = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::RunTasks(int nWorker)
+{
+    int nTask = 0;
+    while (TryGetTask(nWorker, &nTask))
+    {
+        (*m_pTask)(nTask);
+
+        if (m_nRemaining.fetch_sub(1) == 1)
+        {
+            std::lock_guard<std::mutex> lock(m_wakeLock);
+            m_done.notify_all();
+        }
+    }
+}
+
+void SplitCacheAlignedBands(
+    const void* pBase,
+    int nElementSize,
+    int nCount,
+    int nGranularity,
+    int nBands,
+    int* pBoundaries)
+{
+    const uintptr_t base = reinterpret_cast<uintptr_t>(pBase);
+    const int nUnits = (nCount + nGranularity - 1) / nGranularity;
+
+    pBoundaries[0] = 0;
+    for (int band = 1; band < nBands; ++band)
+    {
+        int nIndex = static_cast<int>(int64_t(nUnits) * band / nBands) * nGranularity;
+
+        // move forward until the element starts a new cache line
+        while (nIndex < nCount && ((base + uintptr_t(nIndex) * nElementSize) % cCacheLineSize) != 0)
+        {
+            ++nIndex;
+        }
+
+        pBoundaries[band] = std::max(pBoundaries[band - 1], std::min(nIndex, nCount));
+    }
+    pBoundaries[nBands] = nCount;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker pool for data parallel frame work. Each worker owns a queue
+// of task indices; idle workers steal from the back of the other queues so
+// uneven tasks (e.g. bands with more player pixels) still balance out.
+class ThreadPool
+{
+public:
+    // nThreadCount includes the calling thread, 0 means one per hardware thread
+    explicit ThreadPool(int nThreadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int GetThreadCount() const { return static_cast<int>(m_queues.size()); }
+
+    // Runs task(i) for every i in [0, nTaskCount) and returns once all of them
+    // have finished. The calling thread works on tasks too.
+    void ParallelFor(int nTaskCount, const std::function<void(int)>& task);
+
+private:
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<int> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::vector<std::thread> m_workers;
+
+    // serializes ParallelFor callers
+    std::mutex m_jobLock;
+
+    std::mutex m_wakeLock;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    uint64_t m_nGeneration;
+    bool m_bStop;
+
+    const std::function<void(int)>* m_pTask;
+    std::atomic<int> m_nRemaining;
+
+    void WorkerMain(int nWorker);
+    bool TryGetTask(int nWorker, int* pTask);
+    void RunTasks(int nWorker);
+};
+
+// Splits nCount elements of nElementSize bytes starting at pBase into nBands
+// contiguous ranges. Range boundaries are multiples of nGranularity elements
+// (e.g. a row) nudged forward onto a cache line, so no two bands write the
+// same line. pBoundaries receives nBands + 1 entries.
+void SplitCacheAlignedBands(
+    const void* pBase,
+    int nElementSize,
+    int nCount,
+    int nGranularity,
+    int nBands,
+    int* pBoundaries);
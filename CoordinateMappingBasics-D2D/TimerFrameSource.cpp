@@ -0,0 +1,140 @@
+#include "TimerFrameSource.h"
+#include <thread>
+
+namespace
+{
+    // RelativeTime is in 100ns ticks
+    const int64_t cTicksPerMicrosecond = 10;
+
+    // body index value of pixels that are not part of a player
+    const BYTE cNoPlayer = 0xff;
+}
+
+TimerFrameSource::TimerFrameSource() :
+    m_nDepthWidth(0),
+    m_nDepthHeight(0),
+    m_nColorWidth(0),
+    m_nColorHeight(0),
+    m_period(0),
+    m_nNextFrame(0),
+    m_nSkippedFrames(0)
+{
+}
+
+HRESULT TimerFrameSource::Initialize(
+    int nDepthWidth,
+    int nDepthHeight,
+    int nColorWidth,
+    int nColorHeight,
+    std::chrono::microseconds period)
+{
+    if (nDepthWidth <= 0 || nDepthHeight <= 0 || nColorWidth <= 0 || nColorHeight <= 0 || period.count() <= 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    m_nDepthWidth = nDepthWidth;
+    m_nDepthHeight = nDepthHeight;
+    m_nColorWidth = nColorWidth;
+    m_nColorHeight = nColorHeight;
+    m_period = period;
+    m_geometry = MakeFrameGeometry(nDepthWidth, nDepthHeight, nColorWidth, nColorHeight);
+
+    m_pDepth.reset(new UINT16[nDepthWidth * nDepthHeight]);
+    m_pBodyIndex.reset(new BYTE[nDepthWidth * nDepthHeight]);
+    m_pColor.reset(new RGBQUAD[nColorWidth * nColorHeight]);
+
+    // an upright ellipse at 1.5m in front of a wall receding from 2m to 4m
+    const float fCenterX = nDepthWidth * 0.5f;
+    const float fCenterY = nDepthHeight * 0.55f;
+    const float fRadiusX = nDepthWidth * 0.15f;
+    const float fRadiusY = nDepthHeight * 0.4f;
+
+    for (int y = 0; y < nDepthHeight; ++y)
+    {
+        for (int x = 0; x < nDepthWidth; ++x)
+        {
+            const float dx = (x - fCenterX) / fRadiusX;
+            const float dy = (y - fCenterY) / fRadiusY;
+            const bool bPlayer = (dx * dx + dy * dy) <= 1.0f;
+
+            const int i = y * nDepthWidth + x;
+            m_pDepth[i] = bPlayer ? 1500 : static_cast<UINT16>(2000 + (2000 * x) / nDepthWidth);
+            m_pBodyIndex[i] = bPlayer ? 0 : cNoPlayer;
+        }
+    }
+
+    for (int y = 0; y < nColorHeight; ++y)
+    {
+        for (int x = 0; x < nColorWidth; ++x)
+        {
+            RGBQUAD& pixel = m_pColor[y * nColorWidth + x];
+            pixel.rgbRed = static_cast<BYTE>((255 * x) / nColorWidth);
+            pixel.rgbGreen = static_cast<BYTE>((255 * y) / nColorHeight);
+            pixel.rgbBlue = 128;
+            pixel.rgbReserved = 0xff;
+        }
+    }
+
+    m_nNextFrame = 0;
+    m_nSkippedFrames = 0;
+    m_nextFrameTime = std::chrono::steady_clock::now() + m_period;
+
+    return S_OK;
+}
+
+bool TimerFrameSource::WaitForFrame(std::chrono::milliseconds timeout)
+{
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= m_nextFrameTime)
+    {
+        // already due, nothing was waited for
+        return true;
+    }
+
+    const auto wakeTime = now + timeout;
+    if (wakeTime < m_nextFrameTime)
+    {
+        std::this_thread::sleep_until(wakeTime);
+        return false;
+    }
+
+    std::this_thread::sleep_until(m_nextFrameTime);
+    m_wakeLatency.Record(m_nextFrameTime);
+
+    return true;
+}
+
+HRESULT TimerFrameSource::AcquireFrame(PipelineFrame* pFrame)
+{
+    if (!m_pDepth || !pFrame)
+    {
+        return E_FAIL;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now < m_nextFrameTime)
+    {
+        return E_PENDING;
+    }
+
+    // like the sensor, a late reader gets the latest frame and misses the rest
+    const int64_t nMissed = (now - m_nextFrameTime) / m_period;
+    m_nSkippedFrames += nMissed;
+    m_nNextFrame += nMissed;
+    m_nextFrameTime += m_period * (nMissed + 1);
+
+    pFrame->nRelativeTime = m_nNextFrame * m_period.count() * cTicksPerMicrosecond;
+    pFrame->nDepthWidth = m_nDepthWidth;
+    pFrame->nDepthHeight = m_nDepthHeight;
+    pFrame->nColorWidth = m_nColorWidth;
+    pFrame->nColorHeight = m_nColorHeight;
+    pFrame->pDepthBuffer = m_pDepth.get();
+    pFrame->pColorBuffer = reinterpret_cast<const BYTE*>(m_pColor.get());
+    pFrame->colorFormat = ColorFormat_Bgra;
+    pFrame->pBodyIndexBuffer = m_pBodyIndex.get();
+
+    ++m_nNextFrame;
+
+    return S_OK;
+}
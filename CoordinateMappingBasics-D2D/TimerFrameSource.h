@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include "FrameSource.h"
+
+// Synthetic frames released on a fixed clock: a person shaped blob in front of
+// a depth ramp. Runs the pipeline without a sensor and lets the wait logic be
+// checked on any platform. Any frame sizes and period go, so it doubles as a
+// load generator for sensors with more pixels or frames than the Kinect.
+class TimerFrameSource : public FrameSource
+{
+public:
+    TimerFrameSource();
+
+    HRESULT Initialize(
+        int nDepthWidth,
+        int nDepthHeight,
+        int nColorWidth,
+        int nColorHeight,
+        std::chrono::microseconds period);
+
+    bool WaitForFrame(std::chrono::milliseconds timeout) override;
+    HRESULT AcquireFrame(PipelineFrame* pFrame) override;
+
+    // ticks that passed without anybody acquiring them
+    uint64_t GetSkippedFrameCount() const { return m_nSkippedFrames; }
+
+private:
+    int m_nDepthWidth;
+    int m_nDepthHeight;
+    int m_nColorWidth;
+    int m_nColorHeight;
+
+    std::chrono::microseconds m_period;
+    std::chrono::steady_clock::time_point m_nextFrameTime;
+    int64_t m_nNextFrame;
+    uint64_t m_nSkippedFrames;
+
+    // every frame shows the same content, handed out without copying
+    std::unique_ptr<UINT16[]> m_pDepth;
+    std::unique_ptr<RGBQUAD[]> m_pColor;
+    std::unique_ptr<BYTE[]> m_pBodyIndex;
+};
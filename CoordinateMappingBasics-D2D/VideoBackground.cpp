@@ -0,0 +1,411 @@
+#include "VideoBackground.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "BitmapFile.h"
+#include "CompositeKernel.h"
+#include "WindowsHelper.h"
+
+namespace
+{
+    // RelativeTime is in 100ns ticks
+    const double cTicksPerSecond = 1e7;
+
+    bool HasExtension(const char* pszPath, const char* pszExtension)
+    {
+        const size_t nLength = strlen(pszPath);
+        const size_t nExtensionLength = strlen(pszExtension);
+        if (nLength < nExtensionLength)
+        {
+            return false;
+        }
+
+        for (size_t i = 0; i < nExtensionLength; ++i)
+        {
+            if (tolower(static_cast<unsigned char>(pszPath[nLength - nExtensionLength + i])) != pszExtension[i])
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+}
+
+VideoBackground::VideoBackground() :
+    m_bY4m(false),
+    m_nWidth(0),
+    m_nHeight(0),
+    m_nSourceWidth(0),
+    m_nSourceHeight(0),
+    m_fFramesPerSecond(0),
+    m_bStop(false),
+    m_nWantedFrame(0),
+    m_nNextDecode(0),
+    m_nHeldFrame(-1),
+    m_nHeldSlot(-1),
+    m_bTimeStarted(false),
+    m_nStartTime(0),
+    m_nLastTime(0),
+    m_stats()
+{
+}
+
+VideoBackground::~VideoBackground()
+{
+    Close();
+}
+
+HRESULT VideoBackground::Open(const char* pszPath, int nWidth, int nHeight, double fRawFramesPerSecond, int nRingSize)
+{
+    // the caller holds one slot while the decoder fills another
+    V_CHECK_HR(pszPath && nWidth > 0 && nHeight > 0 && fRawFramesPerSecond > 0 && nRingSize >= 2);
+
+    Close();
+
+    m_nWidth = nWidth;
+    m_nHeight = nHeight;
+    V_RET(m_file.Open(pszPath));
+
+    m_bY4m = HasExtension(pszPath, ".y4m");
+    if (m_bY4m)
+    {
+        HRESULT hr = ParseY4m();
+        if (FAILED(hr))
+        {
+            Close();
+            return hr;
+        }
+    }
+    else
+    {
+        const uint64_t nFrameBytes = uint64_t(nWidth) * nHeight * sizeof(RGBQUAD);
+        for (uint64_t nOffset = 0; nOffset + nFrameBytes <= m_file.GetSize(); nOffset += nFrameBytes)
+        {
+            m_frameOffsets.push_back(nOffset);
+        }
+
+        m_nSourceWidth = nWidth;
+        m_nSourceHeight = nHeight;
+        m_fFramesPerSecond = fRawFramesPerSecond;
+    }
+
+    if (m_frameOffsets.empty())
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    // everything the decoder writes is allocated up front
+    m_slots.resize(nRingSize);
+    for (Slot& slot : m_slots)
+    {
+        slot.pPixels = std::make_unique<RGBQUAD[]>(size_t(nWidth) * nHeight);
+        slot.nFrame = -1;
+    }
+
+    m_bStop = false;
+    m_nWantedFrame = 0;
+    m_nNextDecode = 0;
+    m_nHeldFrame = -1;
+    m_nHeldSlot = -1;
+    m_bTimeStarted = false;
+    m_stats = VideoBackgroundStats();
+    m_thread = std::thread(&VideoBackground::DecoderMain, this);
+
+    return S_OK;
+}
+
+void VideoBackground::Close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_bStop = true;
+    }
+    m_wake.notify_one();
+
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+
+    m_slots.clear();
+    m_frameOffsets.clear();
+    m_file.Close();
+}
+
+HRESULT VideoBackground::ParseY4m()
+{
+    const char* pData = reinterpret_cast<const char*>(m_file.GetData());
+    const size_t nSize = static_cast<size_t>(m_file.GetSize());
+
+    const char cSignature[] = "YUV4MPEG2 ";
+    const size_t nSignatureLength = sizeof(cSignature) - 1;
+    V_CHECK_HR(nSize > nSignatureLength && memcmp(pData, cSignature, nSignatureLength) == 0);
+
+    const char* pHeaderEnd = static_cast<const char*>(memchr(pData, '\n', nSize));
+    V_CHECK_HR(pHeaderEnd);
+
+    // W<width> H<height> F<num>:<den> C<colorspace>, the other parameters
+    // don't change the pixels
+    int nFrameRateNumerator = 30;
+    int nFrameRateDenominator = 1;
+    std::string header(pData + nSignatureLength, pHeaderEnd);
+    size_t nPosition = 0;
+    while (nPosition < header.size())
+    {
+        size_t nEnd = header.find(' ', nPosition);
+        if (nEnd == std::string::npos)
+        {
+            nEnd = header.size();
+        }
+
+        const std::string token = header.substr(nPosition, nEnd - nPosition);
+        if (!token.empty())
+        {
+            switch (token[0])
+            {
+            case 'W':
+                m_nSourceWidth = atoi(token.c_str() + 1);
+                break;
+            case 'H':
+                m_nSourceHeight = atoi(token.c_str() + 1);
+                break;
+            case 'F':
+                if (sscanf(token.c_str() + 1, "%d:%d", &nFrameRateNumerator, &nFrameRateDenominator) != 2)
+                {
+                    return E_FAIL;
+                }
+                break;
+            case 'C':
+                // 420jpeg, 420paldv, 420mpeg2 and 420 differ only in chroma siting
+                if (token.compare(1, 3, "420") != 0)
+                {
+                    return E_NOTIMPL;
+                }
+                break;
+            }
+        }
+
+        nPosition = nEnd + 1;
+    }
+
+    // pairs of pixels are repacked to YUY2
+    V_CHECK_HR(m_nSourceWidth > 0 && m_nSourceHeight > 0 && m_nSourceWidth % 2 == 0);
+    V_CHECK_HR(nFrameRateNumerator > 0 && nFrameRateDenominator > 0);
+    m_fFramesPerSecond = double(nFrameRateNumerator) / nFrameRateDenominator;
+
+    const uint64_t nFrameBytes = uint64_t(m_nSourceWidth) * m_nSourceHeight +
+        2 * uint64_t(m_nSourceWidth / 2) * ((m_nSourceHeight + 1) / 2);
+
+    // every frame is FRAME, optional parameters and a newline, then the planes
+    const char cFrameTag[] = "FRAME";
+    const size_t nFrameTagLength = sizeof(cFrameTag) - 1;
+    size_t nOffset = pHeaderEnd + 1 - pData;
+    while (nOffset + nFrameTagLength < nSize && memcmp(pData + nOffset, cFrameTag, nFrameTagLength) == 0)
+    {
+        const char* pLineEnd = static_cast<const char*>(memchr(pData + nOffset, '\n', nSize - nOffset));
+        if (!pLineEnd)
+        {
+            break;
+        }
+
+        const size_t nPixels = pLineEnd + 1 - pData;
+        if (nPixels + nFrameBytes > nSize)
+        {
+            break;
+        }
+
+        m_frameOffsets.push_back(nPixels);
+        nOffset = nPixels + static_cast<size_t>(nFrameBytes);
+    }
+
+    return S_OK;
+}
+
+const RGBQUAD* VideoBackground::GetFrame(int64_t nRelativeTime, int64_t* pnFrame)
+{
+    if (!m_bTimeStarted)
+    {
+        m_bTimeStarted = true;
+        m_nStartTime = nRelativeTime;
+        m_nLastTime = nRelativeTime;
+    }
+
+    // a replay starting over moves the clock back, the video keeps going
+    if (nRelativeTime < m_nLastTime)
+    {
+        m_nStartTime -= m_nLastTime - nRelativeTime;
+    }
+    m_nLastTime = nRelativeTime;
+
+    const int64_t nWanted = static_cast<int64_t>((nRelativeTime - m_nStartTime) * m_fFramesPerSecond / cTicksPerSecond);
+
+    const RGBQUAD* pPixels = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_nWantedFrame = std::max(m_nWantedFrame, nWanted);
+
+        int nBest = -1;
+        for (int i = 0; i < static_cast<int>(m_slots.size()); ++i)
+        {
+            const int64_t nFrame = m_slots[i].nFrame;
+            if (nFrame >= 0 && nFrame <= nWanted && (nBest < 0 || nFrame > m_slots[nBest].nFrame))
+            {
+                nBest = i;
+            }
+        }
+
+        ++m_stats.nRequests;
+        if (nBest < 0 || m_slots[nBest].nFrame != nWanted)
+        {
+            ++m_stats.nMisses;
+        }
+
+        // the held frame is released, the decoder may now reuse its slot
+        if (nBest >= 0 && m_slots[nBest].nFrame > m_nHeldFrame)
+        {
+            m_nHeldFrame = m_slots[nBest].nFrame;
+            m_nHeldSlot = nBest;
+        }
+
+        if (m_nHeldSlot >= 0)
+        {
+            pPixels = m_slots[m_nHeldSlot].pPixels.get();
+        }
+
+        if (pnFrame)
+        {
+            *pnFrame = m_nHeldFrame;
+        }
+    }
+    m_wake.notify_one();
+
+    return pPixels;
+}
+
+HRESULT VideoBackground::DecodeFrame(int nFrame, RGBQUAD* pPixels) const
+{
+    std::unique_ptr<RGBQUAD[]> pSourcePixels(new RGBQUAD[size_t(m_nSourceWidth) * m_nSourceHeight]);
+    std::vector<BYTE> yuy2Row(size_t(m_nSourceWidth) * 2);
+    return DecodeFrame(nFrame, pPixels, pSourcePixels.get(), yuy2Row.data());
+}
+
+HRESULT VideoBackground::DecodeFrame(int nFrame, RGBQUAD* pPixels, RGBQUAD* pSourcePixels, BYTE* pYuy2Row) const
+{
+    V_CHECK_HR(pPixels && nFrame >= 0 && nFrame < GetFrameCount());
+
+    const BYTE* pFrame = m_file.GetData() + m_frameOffsets[nFrame];
+    if (!m_bY4m)
+    {
+        memcpy(pPixels, pFrame, size_t(m_nWidth) * m_nHeight * sizeof(RGBQUAD));
+        return S_OK;
+    }
+
+    const bool bScaled = (m_nSourceWidth != m_nWidth || m_nSourceHeight != m_nHeight);
+    RGBQUAD* pDecoded = bScaled ? pSourcePixels : pPixels;
+
+    // Each row and its chroma row are repacked to YUY2 and converted with the
+    // compositor's YUY2 kernels
+    const int nChromaWidth = m_nSourceWidth / 2;
+    const BYTE* pU = pFrame + size_t(m_nSourceWidth) * m_nSourceHeight;
+    const BYTE* pV = pU + size_t(nChromaWidth) * ((m_nSourceHeight + 1) / 2);
+    const CompositeKernelType kernel = GetBestCompositeKernel();
+
+    for (int y = 0; y < m_nSourceHeight; ++y)
+    {
+        const BYTE* pYRow = pFrame + size_t(y) * m_nSourceWidth;
+        const BYTE* pURow = pU + size_t(y / 2) * nChromaWidth;
+        const BYTE* pVRow = pV + size_t(y / 2) * nChromaWidth;
+
+        for (int x = 0; x < nChromaWidth; ++x)
+        {
+            pYuy2Row[4 * x + 0] = pYRow[2 * x];
+            pYuy2Row[4 * x + 1] = pURow[x];
+            pYuy2Row[4 * x + 2] = pYRow[2 * x + 1];
+            pYuy2Row[4 * x + 3] = pVRow[x];
+        }
+
+        ConvertYuy2ToBgra(kernel, pYuy2Row, pDecoded + size_t(y) * m_nSourceWidth, 0, m_nSourceWidth);
+    }
+
+    if (bScaled)
+    {
+        ScaleImage(pSourcePixels, m_nSourceWidth, m_nSourceHeight, pPixels, m_nWidth, m_nHeight);
+    }
+
+    return S_OK;
+}
+
+VideoBackgroundStats VideoBackground::GetStats() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_stats;
+}
+
+void VideoBackground::DecoderMain()
+{
+    std::unique_ptr<RGBQUAD[]> pSourcePixels(new RGBQUAD[size_t(m_nSourceWidth) * m_nSourceHeight]);
+    std::vector<BYTE> yuy2Row(size_t(m_nSourceWidth) * 2);
+
+    for (;;)
+    {
+        int nSlot = -1;
+        int64_t nFrame = 0;
+        {
+            std::unique_lock<std::mutex> lock(m_lock);
+            for (;;)
+            {
+                if (m_bStop)
+                {
+                    return;
+                }
+
+                // empty slots and frames older than the held one can be reused
+                for (int i = 0; i < static_cast<int>(m_slots.size()); ++i)
+                {
+                    if (i != m_nHeldSlot && m_slots[i].nFrame <= m_nHeldFrame &&
+                        (nSlot < 0 || m_slots[i].nFrame < m_slots[nSlot].nFrame))
+                    {
+                        nSlot = i;
+                    }
+                }
+
+                if (nSlot >= 0)
+                {
+                    break;
+                }
+
+                m_wake.wait(lock);
+            }
+
+            // frames the caller is already past are not worth decoding
+            if (m_nNextDecode < m_nWantedFrame)
+            {
+                m_stats.nSkipped += m_nWantedFrame - m_nNextDecode;
+                m_nNextDecode = m_nWantedFrame;
+            }
+
+            nFrame = m_nNextDecode++;
+            m_slots[nSlot].nFrame = -1;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const HRESULT hr = DecodeFrame(static_cast<int>(nFrame % GetFrameCount()), m_slots[nSlot].pPixels.get(), pSourcePixels.get(), yuy2Row.data());
+        const double fMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (SUCCEEDED(hr))
+            {
+                m_slots[nSlot].nFrame = nFrame;
+                ++m_stats.nDecoded;
+                m_stats.fDecodeMilliseconds += fMilliseconds;
+            }
+        }
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "KinectTypes.h"
+#include "MappedFile.h"
+
+struct VideoBackgroundStats
+{
+    // GetFrame calls, and those that found no decoded frame for their time
+    // and got an older frame or none
+    uint64_t nRequests;
+    uint64_t nMisses;
+
+    // frames decoded into the ring, and frames the decoder skipped to catch up
+    uint64_t nDecoded;
+    uint64_t nSkipped;
+
+    double fDecodeMilliseconds;
+};
+
+// A looping video as the background. A decoder thread converts frames ahead
+// into a small ring of preallocated buffers at the output size, so the frame
+// thread never decodes. Reads
+//
+//   .y4m   YUV4MPEG2 4:2:0 of even width, any size (scaled), its own frame rate
+//   other  headerless BGRA frames at the output size, at the given frame rate
+class VideoBackground
+{
+public:
+    VideoBackground();
+    // stops the decoder
+    ~VideoBackground();
+
+    VideoBackground(const VideoBackground&) = delete;
+    VideoBackground& operator=(const VideoBackground&) = delete;
+
+    HRESULT Open(const char* pszPath, int nWidth, int nHeight, double fRawFramesPerSecond = 30.0, int nRingSize = 4);
+    void Close();
+
+    bool IsOpen() const { return m_thread.joinable(); }
+    int GetFrameCount() const { return static_cast<int>(m_frameOffsets.size()); }
+    double GetFramesPerSecond() const { return m_fFramesPerSecond; }
+
+    // The video frame showing at nRelativeTime (100ns ticks, counted from the
+    // first call, the video looping), or the latest decoded one before it.
+    // Null until the first frame is decoded. The pixels stay valid until the
+    // next call; *pnFrame gets the position in the unlooped stream, so the
+    // caller can tell whether the content changed.
+    const RGBQUAD* GetFrame(int64_t nRelativeTime, int64_t* pnFrame);
+
+    // Decodes frame nFrame (of GetFrameCount) into nWidth x nHeight pixels
+    // on the calling thread, allocating scratch space every call
+    HRESULT DecodeFrame(int nFrame, RGBQUAD* pPixels) const;
+
+    VideoBackgroundStats GetStats() const;
+
+private:
+    struct Slot
+    {
+        std::unique_ptr<RGBQUAD[]> pPixels;
+        // frame of the unlooped stream it holds, -1 while empty or being written
+        int64_t nFrame;
+    };
+
+    HRESULT ParseY4m();
+
+    // pSourcePixels holds a source sized frame when it is scaled, pYuy2Row a
+    // YUY2 source row
+    HRESULT DecodeFrame(int nFrame, RGBQUAD* pPixels, RGBQUAD* pSourcePixels, BYTE* pYuy2Row) const;
+
+    void DecoderMain();
+
+    MappedFile m_file;
+    bool m_bY4m;
+    int m_nWidth;
+    int m_nHeight;
+    int m_nSourceWidth;
+    int m_nSourceHeight;
+    double m_fFramesPerSecond;
+    // where the pixels of every frame start in the file
+    std::vector<uint64_t> m_frameOffsets;
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::vector<Slot> m_slots;
+    bool m_bStop;
+    std::thread m_thread;
+
+    // the frame the caller wants now, the next one to decode and the one the
+    // caller holds, which is never overwritten
+    int64_t m_nWantedFrame;
+    int64_t m_nNextDecode;
+    int64_t m_nHeldFrame;
+    int m_nHeldSlot;
+
+    bool m_bTimeStarted;
+    int64_t m_nStartTime;
+    int64_t m_nLastTime;
+
+    VideoBackgroundStats m_stats;
+};
@@ -1,15 +1,17 @@
 #pragma once
 
+#ifdef _WIN32
 #include <wrl/client.h>
+#endif
 
 #define V(__hr__) \
     if (FAILED(__hr__)) { return; }
 
 #define V_RET(__hr__) \
-    if (FAILED(__hr__)) { return __hr__; }
+    { HRESULT __hrRet__ = (__hr__); if (FAILED(__hrRet__)) { return __hrRet__; } }
 
 #define V_CHECK(__bool__) \
     if (!(__bool__)) { return; }
 
 #define V_CHECK_HR(__bool__) \
-    if (!(__bool__)) { return E_FAIL; }
\ No newline at end of file
+    if (!(__bool__)) { return E_FAIL; }
@@ -13,6 +13,8 @@
 #define IDC_VIDEOVIEW                   1000
 #define IDC_STATUS                      1001
 #define IDC_BUTTON_SCREENSHOT           1002
+#define IDC_BUTTON_SAVEREPLAY           1003
+#define IDC_BUTTON_NEXTBACKGROUND       1004
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
@@ -20,7 +22,7 @@
 #define _APS_NO_MFC                     1
 #define _APS_NEXT_RESOURCE_VALUE        101
 #define _APS_NEXT_COMMAND_VALUE         32771
-#define _APS_NEXT_CONTROL_VALUE         1003
+#define _APS_NEXT_CONTROL_VALUE         1005
 #define _APS_NEXT_SYMED_VALUE           102
 #endif
 #endif
@@ -12,6 +12,10 @@
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
 #endif
 
+#ifndef NOMINMAX
+#define NOMINMAX                        // Keep std::min / std::max usable
+#endif
+
 // Windows Header Files
 #include <windows.h>
 